@@ -4,10 +4,28 @@
 #include <iomanip>
 #include <ctime>
 #include <csignal>
+#include <cstdio>
 #include <atomic>
+#include <memory>
+#include <sys/stat.h>
 #include "DeckLinkAPI.h"
+#include "app_options.h"
 #include "callbacks.h"
+#include "clip_playout.h"
 #include "decklink_utils.h"
+#include "denoise.h"
+#include "failover.h"
+#include "frame_bus.h"
+#include "frame_scheduler.h"
+#include "frame_verify.h"
+#include "ingest_playout.h"
+#include "lut3d.h"
+#include "multiviewer.h"
+#include "overlay.h"
+#include "perf_counters.h"
+#include "scopes.h"
+#include "stats.h"
+#include "v210.h"
 
 std::atomic<bool> g_stopFlag{false};
 
@@ -16,7 +34,61 @@ void signalHandler(int signum) {
     g_stopFlag = true;
 }
 
-int main() {
+static int64_t fileModifiedNs(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return -1;
+    return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+// The control file holds "STRENGTH [SPATIAL]", both 0 to 1.
+static bool readDenoiseControl(const std::string& path, float& strength, float& spatial) {
+    FILE* file = std::fopen(path.c_str(), "r");
+    if (!file) return false;
+    float values[2] = {0.0f, 0.0f};
+    int count = std::fscanf(file, "%f %f", &values[0], &values[1]);
+    std::fclose(file);
+    if (count < 1) return false;
+    strength = values[0];
+    spatial = count > 1 ? values[1] : 0.0f;
+    return true;
+}
+
+static std::shared_ptr<const OverlayGraphic> loadOverlayGraphic(const AppOptions& options, int width, int height) {
+    std::vector<uint8_t> rgba;
+    int graphicWidth, graphicHeight;
+    if (!readPamRgba(options.overlayPath, rgba, graphicWidth, graphicHeight)) {
+        std::cerr << "Cannot read overlay " << options.overlayPath << " (expected PAM, MAXVAL 255, DEPTH 3 or 4)" << std::endl;
+        return nullptr;
+    }
+    LumaKey key;
+    key.clip = options.lumaKeyClip;
+    key.gain = options.lumaKeyGain;
+    return OverlayGraphic::fromRgba(rgba.data(), graphicWidth, graphicHeight, false, options.overlayX, options.overlayY,
+                                    width, height, bmdFormat10BitYUV, options.lumaKey ? &key : nullptr);
+}
+
+int main(int argc, char* argv[]) {
+    AppOptions options;
+    if (!parseAppOptions(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    // Before any stage or callback is created: they set up their counters at construction.
+    setPerfCountersEnabled(options.perfCounters);
+
+    if (!options.ingestAddress.empty()) {
+        std::signal(SIGINT, signalHandler);
+        return runUdpIngest(options, g_stopFlag);
+    }
+    if (!options.playoutPlaylist.empty()) {
+        std::signal(SIGINT, signalHandler);
+        return runClipPlayout(options, g_stopFlag);
+    }
+    if (!options.multiviewerInputs.empty()) {
+        std::signal(SIGINT, signalHandler);
+        return runMultiviewer(options, g_stopFlag);
+    }
+
     IDeckLink* inputDevice = findDeckLinkDevice("DeckLink Duo", 3);
     IDeckLink* outputDevice = findDeckLinkDevice("DeckLink Duo", 0);
 
@@ -27,9 +99,10 @@ int main() {
         return 1;
     }
 
-    // Set profiles
-    if (!setDeviceProfile(inputDevice, bmdProfileTwoSubDevicesHalfDuplex) ||
-        !setDeviceProfile(outputDevice, bmdProfileTwoSubDevicesHalfDuplex)) {
+    // Set profiles; a failover backup input needs a third sub-device
+    BMDProfileID profile = options.failoverBackup >= 0 ? bmdProfileFourSubDevicesHalfDuplex : bmdProfileTwoSubDevicesHalfDuplex;
+    if (!setDeviceProfile(inputDevice, profile) ||
+        !setDeviceProfile(outputDevice, profile)) {
         std::cerr << "Failed to set device profiles" << std::endl;
         inputDevice->Release();
         outputDevice->Release();
@@ -76,6 +149,140 @@ int main() {
     InputCallback* inputCb = new InputCallback(output, timeScale);
     input->SetCallback(inputCb);
 
+    // One pinned worker pool runs every per-frame stage; declared first so it outlives them.
+    std::unique_ptr<FrameScheduler> scheduler;
+    if (options.denoise || !options.lutPath.empty() || !options.lutTransform.empty() || !options.overlayPath.empty() ||
+        !options.scopesName.empty() || !options.busName.empty() || !options.verifyLog.empty()) {
+        scheduler.reset(new FrameScheduler(options.workers, options.workerCpus));
+        inputCb->setScheduler(scheduler.get());
+        std::cout << "Frame processing on " << scheduler->workers() << " workers" << std::endl;
+    }
+
+    std::unique_ptr<Denoiser> denoiser;
+    int64_t denoiseModifiedNs = -1;
+    if (options.denoise) {
+        float strength = options.denoiseStrength;
+        float spatial = options.denoiseSpatial;
+        if (!options.denoiseControlPath.empty()) {
+            denoiseModifiedNs = fileModifiedNs(options.denoiseControlPath);
+            readDenoiseControl(options.denoiseControlPath, strength, spatial);
+        }
+        denoiser.reset(new Denoiser(*scheduler));
+        denoiser->setStrength(strength, spatial);
+        inputCb->setDenoiser(denoiser.get());
+        std::cout << "Denoise: strength " << denoiser->strength() << ", spatial " << denoiser->spatial() << std::endl;
+    }
+
+    std::unique_ptr<LutStage> lutStage;
+    if (!options.lutPath.empty() || !options.lutTransform.empty()) {
+        std::shared_ptr<const Lut3D> lut;
+        ColorTransform transform;
+        CubeLut cube;
+        if (!options.lutTransform.empty() && parseColorTransform(options.lutTransform, transform)) {
+            lut = Lut3D::fromCube(generateCubeLut(transform), inputMatrix(transform), outputMatrix(transform));
+        } else if (!options.lutPath.empty() && loadCubeFile(options.lutPath, cube)) {
+            lut = Lut3D::fromCube(cube, YCbCrMatrix::Rec709, YCbCrMatrix::Rec709);
+        }
+        if (lut) {
+            lutStage.reset(new LutStage(*scheduler));
+            lutStage->setLut(lut);
+            inputCb->setLutStage(lutStage.get());
+            std::cout << "3D LUT: " << (options.lutTransform.empty() ? options.lutPath : options.lutTransform) << std::endl;
+        } else {
+            std::cerr << "No usable 3D LUT, continuing without colour transform" << std::endl;
+        }
+    }
+
+    std::unique_ptr<Overlay> overlay;
+    int64_t overlayModifiedNs = -1;
+    if (!options.overlayPath.empty()) {
+        overlay.reset(new Overlay(*scheduler));
+        overlayModifiedNs = fileModifiedNs(options.overlayPath);
+        overlay->setGraphic(loadOverlayGraphic(options, frameWidth, frameHeight));
+        inputCb->setOverlay(overlay.get());
+    }
+
+    std::unique_ptr<Scopes> scopes;
+    if (!options.scopesName.empty()) {
+        scopes.reset(new Scopes(*scheduler, options.scopesName, options.scopesRate, options.scopesLineStep,
+                                options.scopesImages));
+        if (scopes->open()) {
+            inputCb->setScopes(scopes.get());
+            std::cout << "Scopes: " << options.scopesRate << " Hz, every " << options.scopesLineStep << " line(s)"
+                      << (options.scopesImages ? ", with images" : "") << std::endl;
+        } else {
+            std::cerr << "Continuing without scopes" << std::endl;
+            scopes.reset();
+        }
+    }
+
+    std::unique_ptr<FrameBus> frameBus;
+    if (!options.busName.empty()) {
+        frameBus.reset(new FrameBus(*scheduler, options.busName, options.busSlots));
+        if (frameBus->open(static_cast<size_t>(v210RowBytes(frameWidth)) * frameHeight)) {
+            inputCb->setFrameBus(frameBus.get());
+        } else {
+            std::cerr << "Continuing without frame bus" << std::endl;
+            frameBus.reset();
+        }
+    }
+
+    std::unique_ptr<FrameVerifier> verifier;
+    if (!options.verifyLog.empty()) {
+        verifier.reset(new FrameVerifier(*scheduler, options.verifyLog));
+        if (verifier->open()) {
+            inputCb->setVerifier(verifier.get());
+        } else {
+            std::cerr << "Continuing without verification" << std::endl;
+            verifier.reset();
+        }
+    }
+
+    IDeckLink* backupDevice = nullptr;
+    IDeckLinkInput* backupInput = nullptr;
+    MultiviewerInput* backupCb = nullptr;
+    std::unique_ptr<Failover> failover;
+    if (!options.failoverMode.empty()) {
+        FailoverMode mode;
+        if (parseFailoverMode(options.failoverMode, mode)) {
+            failover.reset(new Failover(output, scheduler.get(), frameWidth, frameHeight, timeScale, mode,
+                                        options.failoverRestoreFrames));
+            if (options.failoverBackup >= 0) {
+                backupDevice = findDeckLinkDevice("DeckLink Duo", options.failoverBackup);
+                if (backupDevice && backupDevice->QueryInterface(IID_IDeckLinkInput, reinterpret_cast<void**>(&backupInput)) == S_OK) {
+                    backupCb = new MultiviewerInput(backupInput, "failover.backup");
+                    backupInput->SetCallback(backupCb);
+                    failover->setBackup(backupCb);
+                } else {
+                    std::cerr << "Failover backup sub-device " << options.failoverBackup << " not available" << std::endl;
+                }
+            }
+            if (mode == FailoverMode::Backup && !backupCb) {
+                std::cerr << "No failover backup input, freezing the last good frame instead" << std::endl;
+            }
+            if (!options.failoverSlatePath.empty()) {
+                std::vector<uint8_t> rgba;
+                int slateWidth, slateHeight;
+                if (readPamRgba(options.failoverSlatePath, rgba, slateWidth, slateHeight)) {
+                    std::shared_ptr<const OverlayGraphic> graphic = OverlayGraphic::fromRgba(
+                        rgba.data(), slateWidth, slateHeight, false, (frameWidth - slateWidth) / 2,
+                        (frameHeight - slateHeight) / 2, frameWidth, frameHeight, bmdFormat10BitYUV);
+                    std::vector<uint8_t> slate(static_cast<size_t>(v210RowBytes(frameWidth)) * frameHeight);
+                    renderOverBlack(graphic.get(), slate.data(), v210RowBytes(frameWidth), frameWidth, frameHeight,
+                                    bmdFormat10BitYUV);
+                    failover->setSlate(std::move(slate));
+                } else {
+                    std::cerr << "Cannot read slate " << options.failoverSlatePath << ", using black" << std::endl;
+                }
+            }
+            inputCb->setFailover(failover.get());
+            std::cout << "Failover: " << options.failoverMode << ", restore after " << options.failoverRestoreFrames
+                      << " good frames" << std::endl;
+        } else {
+            std::cerr << "Unknown --failover mode " << options.failoverMode << ", continuing without failover" << std::endl;
+        }
+    }
+
     HRESULT hr = input->EnableVideoInput(selectedMode, bmdFormat10BitYUV, bmdVideoInputFlagDefault);
     if (hr != S_OK) {
         std::cerr << "Failed to enable video input" << std::endl;
@@ -100,6 +307,10 @@ int main() {
         goto cleanup;
     }
 
+    if (backupInput && (backupInput->EnableVideoInput(selectedMode, bmdFormat10BitYUV, bmdVideoInputFlagDefault) != S_OK ||
+                        backupInput->StartStreams() != S_OK)) {
+        std::cerr << "Failed to start failover backup input" << std::endl;
+    }
     input->StartStreams();
     output->StartScheduledPlayback(0, timeScale, 1.0);
 
@@ -107,11 +318,42 @@ int main() {
 
     while (!g_stopFlag.load()) {
         std::this_thread::sleep_for(std::chrono::seconds(1));
+        if (scheduler) scheduler->updateUtilization();
+        if (frameBus) frameBus->updateConsumers();
+        if (denoiser) {
+            if (!options.denoiseControlPath.empty() && fileModifiedNs(options.denoiseControlPath) != denoiseModifiedNs) {
+                denoiseModifiedNs = fileModifiedNs(options.denoiseControlPath);
+                float strength, spatial;
+                if (readDenoiseControl(options.denoiseControlPath, strength, spatial)) {
+                    denoiser->setStrength(strength, spatial);
+                }
+            }
+            std::cout << "Denoise: strength " << std::setprecision(2) << denoiser->strength() << ", spatial "
+                      << denoiser->spatial() << ", " << statsValue("denoise.cpu_us").load() << " us CPU, "
+                      << statsValue("denoise.wall_us").load() << " us wall per frame, "
+                      << statsValue("denoise.moving_pct").load() << "% moving" << std::endl;
+        }
+        // Graphics are converted here and swapped in; the capture thread never waits on a reload.
+        if (overlay && fileModifiedNs(options.overlayPath) != overlayModifiedNs) {
+            overlayModifiedNs = fileModifiedNs(options.overlayPath);
+            std::shared_ptr<const OverlayGraphic> graphic = loadOverlayGraphic(options, frameWidth, frameHeight);
+            if (graphic) {
+                overlay->setGraphic(graphic);
+                std::cout << "Overlay reloaded: " << options.overlayPath << std::endl;
+            }
+        }
     }
 
 cleanup:
     input->StopStreams();
+    // Frames still in the pipeline are scheduled before playback stops.
+    if (scheduler) scheduler->drain();
     output->StopScheduledPlayback(0, nullptr, timeScale);
+    if (backupInput) {
+        backupInput->StopStreams();
+        backupInput->DisableVideoInput();
+        backupInput->SetCallback(nullptr);
+    }
     input->DisableVideoInput();
     input->DisableAudioInput();
     output->DisableVideoOutput();
@@ -128,8 +370,40 @@ cleanup:
     std::cout << "Metrics:" << std::endl;
     std::cout << "Total frames: " << inputCb->getFrameCount() << std::endl;
     std::cout << "Dropped frames: " << inputCb->getDropCount() << std::endl;
+    std::cout << "No-signal frames: " << inputCb->getNoSignalCount() << std::endl;
+    std::cout << "Dropped (pipeline busy): " << inputCb->getBusyCount() << std::endl;
     std::cout << "Average FPS: " << std::fixed << std::setprecision(2) << averageFps << std::endl;
     std::cout << "Total audio samples: " << inputCb->getAudioSampleCount() << std::endl;
+    if (options.perfCounters) {
+        StatsRegistry::instance().print(std::cout, "capture.");
+        StatsRegistry::instance().print(std::cout, "perf.");
+    }
+    if (denoiser) {
+        StatsRegistry::instance().print(std::cout, "denoise.");
+    }
+    if (lutStage) {
+        StatsRegistry::instance().print(std::cout, "lut.");
+    }
+    if (overlay) {
+        StatsRegistry::instance().print(std::cout, "overlay.");
+    }
+    if (failover) {
+        StatsRegistry::instance().print(std::cout, "failover.");
+    }
+    if (scopes) {
+        StatsRegistry::instance().print(std::cout, "scopes.");
+    }
+    if (frameBus) {
+        frameBus->updateConsumers();
+        StatsRegistry::instance().print(std::cout, "bus.");
+    }
+    if (verifier) {
+        StatsRegistry::instance().print(std::cout, "verify.");
+    }
+    if (scheduler) {
+        scheduler->updateUtilization();
+        StatsRegistry::instance().print(std::cout, "sched.");
+    }
 
     int hours = static_cast<int>(totalSeconds) / 3600;
     int minutes = (static_cast<int>(totalSeconds) % 3600) / 60;
@@ -141,6 +415,11 @@ cleanup:
     input->SetCallback(nullptr);
     output->SetScheduledFrameCompletionCallback(nullptr);
 
+    // Held freeze and backup frames go back before the inputs are released.
+    failover.reset();
+    if (backupCb) backupCb->Release();
+    if (backupInput) backupInput->Release();
+    if (backupDevice) backupDevice->Release();
     input->Release();
     output->Release();
     inputDevice->Release();
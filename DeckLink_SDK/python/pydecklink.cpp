@@ -0,0 +1,550 @@
+// Python bindings for CaptureEngine.
+//
+// Frames reach Python as pydecklink.Frame objects implementing the buffer
+// protocol directly over the DeckLink capture buffer, so numpy.asarray(frame)
+// or memoryview(frame) is a writable view with no copy. The callback runs on
+// the engine's delivery thread, which only takes the GIL for the duration of
+// the call; capture, queueing and output scheduling all run without it.
+// Returning the frame from the callback (or calling frame.schedule()) hands
+// the same buffer back to the output by reference.
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include "capture_engine.h"
+#include "stats.h"
+
+namespace {
+
+struct PixelFormatName {
+    const char* name;
+    BMDPixelFormat format;
+};
+
+const PixelFormatName kPixelFormats[] = {
+    {"v210", bmdFormat10BitYUV},
+    {"uyvy", bmdFormat8BitYUV},
+    {"bgra", bmdFormat8BitBGRA},
+};
+
+const char* pixelFormatName(BMDPixelFormat format) {
+    for (const auto& entry : kPixelFormats) {
+        if (entry.format == format) return entry.name;
+    }
+    return "unknown";
+}
+
+struct EngineObject {
+    PyObject_HEAD
+    CaptureEngine* engine;
+    PyObject* callback;
+    // start() takes a reference to the engine and stopEngine() drops it, so
+    // the object outlives the delivery thread even if Python drops its own.
+    bool holdsSelf;
+    std::atomic<int64_t>* frames;
+    std::atomic<int64_t>* callbackUs;
+    std::atomic<int64_t>* callbackMaxUs;
+    std::atomic<int64_t>* gilWaitUs;
+    std::atomic<int64_t>* overheadUs;
+    std::atomic<int64_t>* overheadMaxUs;
+    std::atomic<int64_t>* overruns;
+    std::atomic<int64_t>* errors;
+};
+
+struct FrameObject {
+    PyObject_HEAD
+    EngineObject* engine;
+    CapturedFrame* frame;
+    int64_t deliveredNs;
+    Py_ssize_t exports;
+    bool scheduled;
+    Py_ssize_t shape[3];
+    Py_ssize_t strides[3];
+};
+
+PyTypeObject* FrameType = nullptr;
+PyTypeObject* EngineType = nullptr;
+
+void updateMax(std::atomic<int64_t>* value, int64_t sample) {
+    if (sample > value->load()) *value = sample;
+}
+
+// ---------------------------------------------------------------- Frame
+
+bool frameUsable(FrameObject* self) {
+    if (!self->frame) {
+        PyErr_SetString(PyExc_ValueError, "frame has been released");
+        return false;
+    }
+    return true;
+}
+
+void Frame_dealloc(FrameObject* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    delete self->frame;
+    Py_XDECREF(self->engine);
+    type->tp_free(reinterpret_cast<PyObject*>(self));
+    Py_DECREF(type);
+}
+
+int Frame_getbuffer(FrameObject* self, Py_buffer* view, int flags) {
+    if (!self->frame || !self->frame->bytes()) {
+        PyErr_SetString(PyExc_BufferError, "frame has no mapped pixel memory");
+        return -1;
+    }
+    CapturedFrame* frame = self->frame;
+    Py_ssize_t rowBytes = frame->rowBytes();
+    Py_ssize_t height = frame->height();
+
+    // Typed views only when the consumer asks for a format; otherwise plain bytes.
+    const char* format = "B";
+    Py_ssize_t itemSize = 1;
+    int ndim = 2;
+    self->shape[0] = height;
+    self->shape[1] = rowBytes;
+    self->strides[0] = rowBytes;
+    self->strides[1] = 1;
+    if (flags & PyBUF_FORMAT) {
+        if (frame->pixelFormat() == bmdFormat10BitYUV) {
+            // One v210 word per element: 3 packed 10-bit components each.
+            format = "I";
+            itemSize = 4;
+            self->shape[1] = rowBytes / 4;
+            self->strides[1] = 4;
+        } else if (frame->pixelFormat() == bmdFormat8BitBGRA) {
+            ndim = 3;
+            self->shape[1] = frame->width();
+            self->shape[2] = 4;
+            self->strides[1] = 4;
+            self->strides[2] = 1;
+        }
+    }
+
+    view->obj = reinterpret_cast<PyObject*>(self);
+    Py_INCREF(self);
+    view->buf = frame->bytes();
+    view->len = rowBytes * height;
+    view->readonly = 0;
+    view->itemsize = itemSize;
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(format) : nullptr;
+    view->ndim = (flags & PyBUF_ND) ? ndim : 1;
+    view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? self->strides : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+    self->exports++;
+    return 0;
+}
+
+void Frame_releasebuffer(FrameObject* self, Py_buffer*) {
+    self->exports--;
+}
+
+bool scheduleFrame(FrameObject* self) {
+    if (self->scheduled) return true;
+    bool scheduled;
+    Py_BEGIN_ALLOW_THREADS
+    scheduled = self->engine->engine->schedule(*self->frame);
+    Py_END_ALLOW_THREADS
+    self->scheduled = scheduled;
+    return scheduled;
+}
+
+PyObject* Frame_schedule(FrameObject* self, PyObject*) {
+    if (!frameUsable(self)) return nullptr;
+    return PyBool_FromLong(scheduleFrame(self));
+}
+
+PyObject* Frame_release(FrameObject* self, PyObject*) {
+    if (self->exports > 0) {
+        PyErr_SetString(PyExc_BufferError, "frame still has exported buffer views");
+        return nullptr;
+    }
+    delete self->frame;
+    self->frame = nullptr;
+    Py_RETURN_NONE;
+}
+
+PyObject* Frame_enter(FrameObject* self, PyObject*) {
+    Py_INCREF(self);
+    return reinterpret_cast<PyObject*>(self);
+}
+
+PyObject* Frame_exit(FrameObject* self, PyObject*) {
+    return Frame_release(self, nullptr);
+}
+
+#define FRAME_GETTER(name, expr)                              \
+    PyObject* Frame_get_##name(FrameObject* self, void*) {    \
+        if (!frameUsable(self)) return nullptr;               \
+        CapturedFrame* frame = self->frame;                   \
+        (void)frame;                                          \
+        return expr;                                          \
+    }
+
+FRAME_GETTER(width, PyLong_FromLong(frame->width()))
+FRAME_GETTER(height, PyLong_FromLong(frame->height()))
+FRAME_GETTER(row_bytes, PyLong_FromLong(frame->rowBytes()))
+FRAME_GETTER(pixel_format, PyUnicode_FromString(pixelFormatName(frame->pixelFormat())))
+FRAME_GETTER(stream_time, PyLong_FromLongLong(frame->streamTime()))
+FRAME_GETTER(duration, PyLong_FromLongLong(frame->duration()))
+FRAME_GETTER(sequence, PyLong_FromUnsignedLongLong(frame->sequence()))
+FRAME_GETTER(has_signal, PyBool_FromLong(frame->hasSignal()))
+FRAME_GETTER(latency_us, PyLong_FromLongLong((self->deliveredNs - frame->arrivalNs()) / 1000))
+
+PyObject* Frame_get_scheduled(FrameObject* self, void*) {
+    return PyBool_FromLong(self->scheduled);
+}
+
+PyGetSetDef Frame_getset[] = {
+    {"width", reinterpret_cast<getter>(Frame_get_width), nullptr, "Width in pixels.", nullptr},
+    {"height", reinterpret_cast<getter>(Frame_get_height), nullptr, "Height in rows.", nullptr},
+    {"row_bytes", reinterpret_cast<getter>(Frame_get_row_bytes), nullptr, "Bytes per row.", nullptr},
+    {"pixel_format", reinterpret_cast<getter>(Frame_get_pixel_format), nullptr, "'v210', 'uyvy' or 'bgra'.", nullptr},
+    {"stream_time", reinterpret_cast<getter>(Frame_get_stream_time), nullptr, "Capture time in engine time scale units.", nullptr},
+    {"duration", reinterpret_cast<getter>(Frame_get_duration), nullptr, "Frame duration in engine time scale units.", nullptr},
+    {"sequence", reinterpret_cast<getter>(Frame_get_sequence), nullptr, "Capture sequence number.", nullptr},
+    {"has_signal", reinterpret_cast<getter>(Frame_get_has_signal), nullptr, "False when the input has no source.", nullptr},
+    {"latency_us", reinterpret_cast<getter>(Frame_get_latency_us), nullptr, "Arrival to callback delay.", nullptr},
+    {"scheduled", reinterpret_cast<getter>(Frame_get_scheduled), nullptr, "True once handed to the output.", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+PyMethodDef Frame_methods[] = {
+    {"schedule", reinterpret_cast<PyCFunction>(Frame_schedule), METH_NOARGS,
+     "Schedule this buffer for output at its capture time, by reference. Returns False if the output refused it."},
+    {"release", reinterpret_cast<PyCFunction>(Frame_release), METH_NOARGS,
+     "Return the capture buffer to the driver now instead of when the object is collected."},
+    {"__enter__", reinterpret_cast<PyCFunction>(Frame_enter), METH_NOARGS, nullptr},
+    {"__exit__", reinterpret_cast<PyCFunction>(Frame_exit), METH_VARARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyType_Slot Frame_slots[] = {
+    {Py_tp_dealloc, reinterpret_cast<void*>(Frame_dealloc)},
+    {Py_tp_doc, const_cast<char*>("A captured frame; supports the buffer protocol over the capture memory.")},
+    {Py_tp_methods, Frame_methods},
+    {Py_tp_getset, Frame_getset},
+    {Py_bf_getbuffer, reinterpret_cast<void*>(Frame_getbuffer)},
+    {Py_bf_releasebuffer, reinterpret_cast<void*>(Frame_releasebuffer)},
+    {0, nullptr},
+};
+
+PyType_Spec Frame_spec = {
+    "pydecklink.Frame", sizeof(FrameObject), 0, Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, Frame_slots,
+};
+
+// ---------------------------------------------------------------- Engine
+
+// Runs on the delivery thread with the GIL released.
+void deliverFrame(EngineObject* self, std::unique_ptr<CapturedFrame> captured) {
+    int64_t startNs = monotonicNowNs();
+    PyGILState_STATE gil = PyGILState_Ensure();
+    int64_t lockedNs = monotonicNowNs();
+
+    FrameObject* frame = PyObject_New(FrameObject, FrameType);
+    int64_t callNs = 0;
+    if (frame) {
+        Py_INCREF(self);
+        frame->engine = self;
+        frame->frame = captured.release();
+        frame->deliveredNs = lockedNs;
+        frame->exports = 0;
+        frame->scheduled = false;
+
+        int64_t callStartNs = monotonicNowNs();
+        PyObject* result = PyObject_CallFunctionObjArgs(self->callback, reinterpret_cast<PyObject*>(frame), nullptr);
+        callNs = monotonicNowNs() - callStartNs;
+        if (!result) {
+            (*self->errors)++;
+            PyErr_WriteUnraisable(self->callback);
+        } else if (result == reinterpret_cast<PyObject*>(frame) && frame->frame) {
+            scheduleFrame(frame);
+        }
+        Py_XDECREF(result);
+        Py_DECREF(frame);
+    } else {
+        (*self->errors)++;
+        PyErr_WriteUnraisable(self->callback);
+    }
+    int64_t endNs = monotonicNowNs();
+    PyGILState_Release(gil);
+
+    // Overhead is everything the binding adds around the user's own code.
+    int64_t overheadUs = (endNs - startNs - callNs) / 1000;
+    (*self->frames)++;
+    *self->callbackUs = callNs / 1000;
+    updateMax(self->callbackMaxUs, callNs / 1000);
+    *self->gilWaitUs = (lockedNs - startNs) / 1000;
+    *self->overheadUs = overheadUs;
+    updateMax(self->overheadMaxUs, overheadUs);
+    // Set by start() before the delivery thread was created.
+    int64_t frameDurationNs = self->engine->frameDuration() * 1000000000 / self->engine->timeScale();
+    if (endNs - startNs > frameDurationNs) (*self->overruns)++;
+}
+
+int Engine_init(EngineObject* self, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"callback", "input", "output", "mode", "pixel_format", "audio",
+                                     "queue_depth", "model", nullptr};
+    PyObject* callback = nullptr;
+    long long input = 3;
+    long long output = 0;
+    const char* mode = "1080i5994";
+    const char* pixelFormat = "v210";
+    int audio = 1;
+    int queueDepth = 2;
+    const char* model = "DeckLink Duo";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|LLsspis", const_cast<char**>(keywords), &callback, &input,
+                                     &output, &mode, &pixelFormat, &audio, &queueDepth, &model)) {
+        return -1;
+    }
+    if (!PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable");
+        return -1;
+    }
+    if (self->engine) {
+        PyErr_SetString(PyExc_RuntimeError, "engine is already initialised");
+        return -1;
+    }
+
+    CaptureEngine::Config config;
+    config.inputIndex = input;
+    config.outputIndex = output;
+    config.model = model;
+    config.audio = audio != 0;
+    config.queueDepth = queueDepth;
+    if (!parseDisplayMode(mode, config.mode)) {
+        PyErr_Format(PyExc_ValueError, "unknown display mode '%s'", mode);
+        return -1;
+    }
+    bool formatFound = false;
+    for (const auto& entry : kPixelFormats) {
+        if (pixelFormat == std::string(entry.name)) {
+            config.pixelFormat = entry.format;
+            formatFound = true;
+        }
+    }
+    if (!formatFound) {
+        PyErr_Format(PyExc_ValueError, "unknown pixel format '%s' (v210, uyvy, bgra)", pixelFormat);
+        return -1;
+    }
+
+    Py_INCREF(callback);
+    self->callback = callback;
+    self->engine = new CaptureEngine(config);
+    self->frames = &statsValue("python.frames");
+    self->callbackUs = &statsValue("python.callback_us");
+    self->callbackMaxUs = &statsValue("python.callback_max_us");
+    self->gilWaitUs = &statsValue("python.gil_wait_us");
+    self->overheadUs = &statsValue("python.overhead_us");
+    self->overheadMaxUs = &statsValue("python.overhead_max_us");
+    self->overruns = &statsValue("python.overruns");
+    self->errors = &statsValue("python.errors");
+    return 0;
+}
+
+bool engineUsable(EngineObject* self) {
+    if (!self->engine) {
+        PyErr_SetString(PyExc_RuntimeError, "engine is not initialised");
+        return false;
+    }
+    return true;
+}
+
+void stopEngine(EngineObject* self) {
+    // The delivery thread needs the GIL to finish its last callback.
+    Py_BEGIN_ALLOW_THREADS
+    self->engine->stop();
+    Py_END_ALLOW_THREADS
+    if (self->holdsSelf) {
+        self->holdsSelf = false;
+        Py_DECREF(self);
+    }
+}
+
+// Never runs while capturing: a started engine holds a reference to itself.
+void Engine_dealloc(EngineObject* self) {
+    PyTypeObject* type = Py_TYPE(self);
+    if (self->engine) self->engine->Release();
+    Py_XDECREF(self->callback);
+    type->tp_free(reinterpret_cast<PyObject*>(self));
+    Py_DECREF(type);
+}
+
+PyObject* Engine_start(EngineObject* self, PyObject*) {
+    if (!engineUsable(self)) return nullptr;
+    if (self->engine->running()) {
+        PyErr_SetString(PyExc_RuntimeError, "engine is already running");
+        return nullptr;
+    }
+    // Taken before the delivery thread exists, which may call back before start() returns.
+    Py_INCREF(self);
+    self->holdsSelf = true;
+    bool started;
+    Py_BEGIN_ALLOW_THREADS
+    started = self->engine->start([self](std::unique_ptr<CapturedFrame> frame) { deliverFrame(self, std::move(frame)); });
+    Py_END_ALLOW_THREADS
+    if (!started) {
+        self->holdsSelf = false;
+        Py_DECREF(self);
+        PyErr_SetString(PyExc_RuntimeError, "could not start capture (see stderr)");
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+PyObject* Engine_stop(EngineObject* self, PyObject*) {
+    if (!engineUsable(self)) return nullptr;
+    if (self->engine->onDeliveryThread()) {
+        PyErr_SetString(PyExc_RuntimeError, "stop() cannot be called from the frame callback");
+        return nullptr;
+    }
+    stopEngine(self);
+    Py_RETURN_NONE;
+}
+
+// Sleeps without holding the GIL, waking to let Ctrl-C through. Returns
+// False on timeout, True if the engine was stopped from another thread.
+PyObject* Engine_wait(EngineObject* self, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"timeout", nullptr};
+    PyObject* timeoutObject = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", const_cast<char**>(keywords), &timeoutObject)) {
+        return nullptr;
+    }
+    if (!engineUsable(self)) return nullptr;
+    double timeout = -1.0;
+    if (timeoutObject != Py_None) {
+        timeout = PyFloat_AsDouble(timeoutObject);
+        if (timeout == -1.0 && PyErr_Occurred()) return nullptr;
+    }
+    int64_t deadlineNs = timeout < 0 ? INT64_MAX : monotonicNowNs() + static_cast<int64_t>(timeout * 1e9);
+    while (self->engine->running()) {
+        if (monotonicNowNs() >= deadlineNs) Py_RETURN_FALSE;
+        Py_BEGIN_ALLOW_THREADS
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        Py_END_ALLOW_THREADS
+        if (PyErr_CheckSignals() < 0) return nullptr;
+    }
+    Py_RETURN_TRUE;
+}
+
+PyObject* Engine_enter(EngineObject* self, PyObject*) {
+    PyObject* started = Engine_start(self, nullptr);
+    if (!started) return nullptr;
+    Py_DECREF(started);
+    Py_INCREF(self);
+    return reinterpret_cast<PyObject*>(self);
+}
+
+PyObject* Engine_exit(EngineObject* self, PyObject*) {
+    if (!engineUsable(self)) return nullptr;
+    stopEngine(self);
+    Py_RETURN_FALSE;
+}
+
+PyObject* Engine_get_running(EngineObject* self, void*) {
+    return PyBool_FromLong(self->engine && self->engine->running());
+}
+
+PyObject* Engine_get_frame_rate(EngineObject* self, void*) {
+    if (!engineUsable(self)) return nullptr;
+    if (self->engine->frameDuration() == 0) Py_RETURN_NONE;
+    return PyFloat_FromDouble(static_cast<double>(self->engine->timeScale()) / self->engine->frameDuration());
+}
+
+PyObject* Engine_get_time_scale(EngineObject* self, void*) {
+    if (!engineUsable(self)) return nullptr;
+    return PyLong_FromLongLong(self->engine->timeScale());
+}
+
+PyGetSetDef Engine_getset[] = {
+    {"running", reinterpret_cast<getter>(Engine_get_running), nullptr, "True while capturing.", nullptr},
+    {"frame_rate", reinterpret_cast<getter>(Engine_get_frame_rate), nullptr, "Frames per second once started.", nullptr},
+    {"time_scale", reinterpret_cast<getter>(Engine_get_time_scale), nullptr, "Ticks per second of stream_time.", nullptr},
+    {nullptr, nullptr, nullptr, nullptr, nullptr},
+};
+
+PyMethodDef Engine_methods[] = {
+    {"start", reinterpret_cast<PyCFunction>(Engine_start), METH_NOARGS, "Open the sub-devices and start capture and playback."},
+    {"stop", reinterpret_cast<PyCFunction>(Engine_stop), METH_NOARGS, "Stop capture and playback; waits for the running callback."},
+    {"wait", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(Engine_wait)), METH_VARARGS | METH_KEYWORDS,
+     "wait(timeout=None): sleep with the GIL released until stopped or timed out."},
+    {"__enter__", reinterpret_cast<PyCFunction>(Engine_enter), METH_NOARGS, nullptr},
+    {"__exit__", reinterpret_cast<PyCFunction>(Engine_exit), METH_VARARGS, nullptr},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyType_Slot Engine_slots[] = {
+    {Py_tp_dealloc, reinterpret_cast<void*>(Engine_dealloc)},
+    {Py_tp_doc, const_cast<char*>("Engine(callback, input=3, output=0, mode='1080i5994', pixel_format='v210', "
+                                  "audio=True, queue_depth=2, model='DeckLink Duo')")},
+    {Py_tp_methods, Engine_methods},
+    {Py_tp_getset, Engine_getset},
+    {Py_tp_init, reinterpret_cast<void*>(Engine_init)},
+    {Py_tp_new, reinterpret_cast<void*>(PyType_GenericNew)},
+    {0, nullptr},
+};
+
+PyType_Spec Engine_spec = {
+    "pydecklink.Engine", sizeof(EngineObject), 0, Py_TPFLAGS_DEFAULT, Engine_slots,
+};
+
+// ---------------------------------------------------------------- module
+
+PyObject* module_stats(PyObject*, PyObject* args, PyObject* kwargs) {
+    static const char* keywords[] = {"prefix", nullptr};
+    const char* prefix = "";
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|s", const_cast<char**>(keywords), &prefix)) {
+        return nullptr;
+    }
+    std::string filter(prefix);
+    PyObject* result = PyDict_New();
+    if (!result) return nullptr;
+    for (const auto& entry : StatsRegistry::instance().snapshot()) {
+        if (entry.first.compare(0, filter.size(), filter) != 0) continue;
+        PyObject* value = PyLong_FromLongLong(entry.second);
+        if (!value || PyDict_SetItemString(result, entry.first.c_str(), value) < 0) {
+            Py_XDECREF(value);
+            Py_DECREF(result);
+            return nullptr;
+        }
+        Py_DECREF(value);
+    }
+    return result;
+}
+
+PyMethodDef module_methods[] = {
+    {"stats", reinterpret_cast<PyCFunction>(reinterpret_cast<void (*)()>(module_stats)), METH_VARARGS | METH_KEYWORDS,
+     "stats(prefix=''): engine.* and python.* counters as a dict."},
+    {nullptr, nullptr, 0, nullptr},
+};
+
+PyModuleDef module_def = {
+    PyModuleDef_HEAD_INIT,
+    "pydecklink",
+    "Zero-copy DeckLink capture/playout for Python.",
+    -1,
+    module_methods,
+    nullptr,
+    nullptr,
+    nullptr,
+    nullptr,
+};
+
+} // namespace
+
+PyMODINIT_FUNC PyInit_pydecklink(void) {
+    FrameType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&Frame_spec));
+    EngineType = reinterpret_cast<PyTypeObject*>(PyType_FromSpec(&Engine_spec));
+    if (!FrameType || !EngineType) return nullptr;
+    PyObject* module = PyModule_Create(&module_def);
+    if (!module) return nullptr;
+    if (PyModule_AddType(module, FrameType) < 0 || PyModule_AddType(module, EngineType) < 0) {
+        Py_DECREF(module);
+        return nullptr;
+    }
+    return module;
+}
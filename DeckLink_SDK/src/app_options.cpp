@@ -0,0 +1,185 @@
+#include "app_options.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+bool parseHostPort(const std::string& value, std::string& host, uint16_t& port) {
+    size_t colon = value.rfind(':');
+    if (colon == std::string::npos || colon == 0) return false;
+    int parsed = std::atoi(value.c_str() + colon + 1);
+    if (parsed <= 0 || parsed > 65535) return false;
+    host = value.substr(0, colon);
+    port = static_cast<uint16_t>(parsed);
+    return true;
+}
+
+bool parsePair(const char* value, float& first, float& second) {
+    const char* comma = std::strchr(value, ',');
+    if (!comma) return false;
+    first = static_cast<float>(std::atof(value));
+    second = static_cast<float>(std::atof(comma + 1));
+    return true;
+}
+}
+
+bool parseAppOptions(int argc, char* argv[], AppOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (std::strcmp(arg, "--udp-ingest") == 0 && hasValue) {
+            if (!parseHostPort(argv[++i], options.ingestAddress, options.ingestPort)) {
+                std::cerr << "Invalid --udp-ingest address: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(arg, "--ingest-latency") == 0 && hasValue) {
+            options.ingestLatencyMs = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--ingest-max-jitter") == 0 && hasValue) {
+            options.ingestMaxJitterMs = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--ts-analyze") == 0) {
+            options.analyzeIngest = true;
+        } else if (std::strcmp(arg, "--overlay") == 0 && hasValue) {
+            options.overlayPath = argv[++i];
+        } else if (std::strcmp(arg, "--overlay-pos") == 0 && hasValue) {
+            float x, y;
+            if (!parsePair(argv[++i], x, y)) {
+                std::cerr << "Invalid --overlay-pos: " << argv[i] << std::endl;
+                return false;
+            }
+            options.overlayX = static_cast<int>(x);
+            options.overlayY = static_cast<int>(y);
+        } else if (std::strcmp(arg, "--luma-key") == 0 && hasValue) {
+            if (!parsePair(argv[++i], options.lumaKeyClip, options.lumaKeyGain)) {
+                std::cerr << "Invalid --luma-key: " << argv[i] << std::endl;
+                return false;
+            }
+            options.lumaKey = true;
+        } else if (std::strcmp(arg, "--lut") == 0 && hasValue) {
+            options.lutPath = argv[++i];
+        } else if (std::strcmp(arg, "--lut-transform") == 0 && hasValue) {
+            options.lutTransform = argv[++i];
+        } else if (std::strcmp(arg, "--denoise") == 0 && hasValue) {
+            const char* value = argv[++i];
+            options.denoiseStrength = static_cast<float>(std::atof(value));
+            const char* comma = std::strchr(value, ',');
+            options.denoiseSpatial = comma ? static_cast<float>(std::atof(comma + 1)) : 0.0f;
+            if (options.denoiseStrength < 0.0f || options.denoiseStrength > 1.0f || options.denoiseSpatial < 0.0f ||
+                options.denoiseSpatial > 1.0f) {
+                std::cerr << "Invalid --denoise (strengths are 0 to 1): " << value << std::endl;
+                return false;
+            }
+            options.denoise = true;
+        } else if (std::strcmp(arg, "--denoise-control") == 0 && hasValue) {
+            options.denoiseControlPath = argv[++i];
+            options.denoise = true;
+        } else if (std::strcmp(arg, "--workers") == 0 && hasValue) {
+            options.workers = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--worker-cpus") == 0 && hasValue) {
+            options.workerCpus.clear();
+            for (const char* item = argv[++i]; *item; item++) {
+                options.workerCpus.push_back(std::atoi(item));
+                item = std::strchr(item, ',');
+                if (!item) break;
+            }
+        } else if (std::strcmp(arg, "--failover") == 0 && hasValue) {
+            options.failoverMode = argv[++i];
+        } else if (std::strcmp(arg, "--failover-backup") == 0 && hasValue) {
+            options.failoverBackup = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--failover-slate") == 0 && hasValue) {
+            options.failoverSlatePath = argv[++i];
+        } else if (std::strcmp(arg, "--failover-restore") == 0 && hasValue) {
+            options.failoverRestoreFrames = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--scopes") == 0 && hasValue) {
+            options.scopesName = argv[++i];
+        } else if (std::strcmp(arg, "--scopes-rate") == 0 && hasValue) {
+            options.scopesRate = std::atof(argv[++i]);
+        } else if (std::strcmp(arg, "--scopes-lines") == 0 && hasValue) {
+            options.scopesLineStep = std::atoi(argv[++i]);
+            if (options.scopesLineStep < 1) {
+                std::cerr << "Invalid --scopes-lines: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(arg, "--scopes-images") == 0) {
+            options.scopesImages = true;
+        } else if (std::strcmp(arg, "--bus") == 0 && hasValue) {
+            options.busName = argv[++i];
+        } else if (std::strcmp(arg, "--bus-slots") == 0 && hasValue) {
+            options.busSlots = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--verify") == 0 && hasValue) {
+            options.verifyLog = argv[++i];
+        } else if (std::strcmp(arg, "--perf-counters") == 0) {
+            options.perfCounters = true;
+        } else if (std::strcmp(arg, "--multiviewer") == 0 && hasValue) {
+            options.multiviewerInputs.clear();
+            for (const char* item = argv[++i]; *item; item++) {
+                options.multiviewerInputs.push_back(std::atoi(item));
+                item = std::strchr(item, ',');
+                if (!item) break;
+            }
+        } else if (std::strcmp(arg, "--mv-output") == 0 && hasValue) {
+            options.multiviewerOutput = std::atoi(argv[++i]);
+        } else if (std::strcmp(arg, "--mv-layout") == 0 && hasValue) {
+            if (std::sscanf(argv[++i], "%dx%d", &options.multiviewerColumns, &options.multiviewerRows) != 2 ||
+                options.multiviewerColumns <= 0 || options.multiviewerRows <= 0) {
+                std::cerr << "Invalid --mv-layout (expected COLSxROWS): " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(arg, "--playout") == 0 && hasValue) {
+            options.playoutPlaylist = argv[++i];
+        } else if (std::strcmp(arg, "--playout-loop") == 0) {
+            options.playoutLoop = true;
+        } else if (std::strcmp(arg, "--playout-prefetch") == 0 && hasValue) {
+            options.playoutPrefetchFrames = std::atoi(argv[++i]);
+            if (options.playoutPrefetchFrames < 1) {
+                std::cerr << "Invalid --playout-prefetch: " << argv[i] << std::endl;
+                return false;
+            }
+        } else if (std::strcmp(arg, "--no-output") == 0) {
+            options.noOutput = true;
+        } else {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]" << std::endl
+              << "  (no options)              SDI passthrough, DeckLink Duo input 3 -> output 0" << std::endl
+              << "  --udp-ingest ADDR:PORT    receive MPEG-TS over UDP and play it out on output 0" << std::endl
+              << "  --ingest-latency MS       playout delay added on top of the jitter buffer (default 200)" << std::endl
+              << "  --ingest-max-jitter MS    upper bound for the jitter buffer depth (default 100)" << std::endl
+              << "  --ts-analyze              run TR 101 290 priority 1/2 checks on the ingest stream" << std::endl
+              << "  --overlay FILE.pam        composite a graphic onto the passthrough video (reloaded on change)" << std::endl
+              << "  --overlay-pos X,Y         top-left position of the graphic (default 0,0)" << std::endl
+              << "  --luma-key CLIP,GAIN      key the graphic on its luma instead of its alpha channel" << std::endl
+              << "  --lut FILE.cube           apply a 3D LUT to the passthrough video" << std::endl
+              << "  --lut-transform NAME      built-in LUT: 709-to-2020, 2020-to-709, 709-to-pq, pq-to-709," << std::endl
+              << "                            709-to-hlg, hlg-to-709" << std::endl
+              << "  --denoise S[,SPATIAL]     temporal noise reduction, strength 0-1 (plus optional spatial 0-1)" << std::endl
+              << "  --denoise-control FILE    re-read \"STRENGTH [SPATIAL]\" from FILE when it changes" << std::endl
+              << "  --workers N               frame-processing worker threads (default: half the cores)" << std::endl
+              << "  --worker-cpus CPU,CPU,... cores to pin the workers to (default: from core 1 upwards)" << std::endl
+              << "  --failover MODE           on input loss show backup, freeze or slate (falls back in that order)" << std::endl
+              << "  --failover-backup N       input sub-device used by --failover backup" << std::endl
+              << "  --failover-slate FILE.pam slate shown by --failover slate (default black)" << std::endl
+              << "  --failover-restore N      good frames required before switching back (default 25)" << std::endl
+              << "  --scopes NAME             publish waveform, vectorscope and histograms to /dev/shm/NAME" << std::endl
+              << "  --scopes-rate HZ          scope updates per second (default 10)" << std::endl
+              << "  --scopes-lines N          analyse every Nth line, 1 for full frames (default 4)" << std::endl
+              << "  --scopes-images           also publish rendered 8-bit scope images" << std::endl
+              << "  --bus NAME                share captured frames with other processes (see Frame-Bus-Reader)" << std::endl
+              << "  --bus-slots N             frames held in the bus ring, 3 to 32 (default 8)" << std::endl
+              << "  --verify LOG              checksum each frame at capture and before output, log to LOG" << std::endl
+              << "  --perf-counters           count cycles, instructions, LLC and dTLB misses per stage and thread" << std::endl
+              << "  --multiviewer IN,IN,...   mosaic of the given input sub-devices, e.g. 1,2,3" << std::endl
+              << "  --mv-output N             output sub-device for the multiviewer (default 0)" << std::endl
+              << "  --mv-layout COLSxROWS     multiviewer grid (default: smallest square that fits)" << std::endl
+              << "  --playout PLAYLIST        play raw v210+PCM clips from a playlist out on output 0" << std::endl
+              << "  --playout-loop            start the playlist again after the last entry" << std::endl
+              << "  --playout-prefetch N      frames read ahead of the playhead (default 30)" << std::endl
+              << "  --no-output               do not open a DeckLink output (stats only)" << std::endl;
+}
@@ -0,0 +1,68 @@
+#ifndef APP_OPTIONS_H
+#define APP_OPTIONS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct AppOptions {
+    // UDP/MPEG-TS ingest (--udp-ingest ADDR:PORT) instead of SDI passthrough
+    std::string ingestAddress;
+    uint16_t ingestPort = 0;
+    int ingestLatencyMs = 200;
+    int ingestMaxJitterMs = 100;
+    // Run the TR 101 290 analyzer on the ingested transport stream
+    bool analyzeIngest = false;
+    // Graphics overlay on the passthrough path (--overlay FILE.pam), reloaded when the file changes
+    std::string overlayPath;
+    int overlayX = 0;
+    int overlayY = 0;
+    // Luma key instead of the image alpha (--luma-key CLIP,GAIN)
+    bool lumaKey = false;
+    float lumaKeyClip = 0.0f;
+    float lumaKeyGain = 1.0f;
+    // 3D LUT on the passthrough path: a .cube file (BT.709 Y'CbCr in and out) or a built-in transform
+    std::string lutPath;
+    std::string lutTransform;
+    // Motion-adaptive temporal noise reduction (--denoise STRENGTH[,SPATIAL]), strengths re-read from denoiseControlPath on change
+    bool denoise = false;
+    float denoiseStrength = 0.5f;
+    float denoiseSpatial = 0.0f;
+    std::string denoiseControlPath;
+    // Frame-processing worker pool shared by the per-frame stages, pinned to workerCpus when given
+    int workers = 0;
+    std::vector<int> workerCpus;
+    // Failover on input loss (--failover backup|freeze|slate), back to the input after failoverRestoreFrames good frames
+    std::string failoverMode;
+    int failoverBackup = -1;
+    std::string failoverSlatePath;
+    int failoverRestoreFrames = 25;
+    // Waveform/vectorscope/histogram scopes published to shared memory (--scopes NAME)
+    std::string scopesName;
+    double scopesRate = 10.0;
+    int scopesLineStep = 4;
+    bool scopesImages = false;
+    // Shared-memory frame bus for consumer processes (--bus NAME)
+    std::string busName;
+    int busSlots = 8;
+    // Checksum every passthrough frame at capture and before output, one line per frame in verifyLog
+    std::string verifyLog;
+    // Multiviewer mosaic (--multiviewer 1,2,3) of input sub-devices onto one output sub-device
+    std::vector<int> multiviewerInputs;
+    int multiviewerOutput = 0;
+    int multiviewerColumns = 0;
+    int multiviewerRows = 0;
+    // Clip playout from a playlist of raw v210+PCM clips (--playout PLAYLIST) instead of SDI passthrough
+    std::string playoutPlaylist;
+    bool playoutLoop = false;
+    int playoutPrefetchFrames = 30;
+    // Hardware performance counters per stage and per thread (--perf-counters)
+    bool perfCounters = false;
+    // Run without a DeckLink output, e.g. against a local UDP sender
+    bool noOutput = false;
+};
+
+bool parseAppOptions(int argc, char* argv[], AppOptions& options);
+void printUsage(const char* program);
+
+#endif // APP_OPTIONS_H
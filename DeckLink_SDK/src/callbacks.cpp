@@ -3,6 +3,7 @@
 #include <cstring> // for memcmp
 #include <iomanip> // for std::fixed
 #include "decklink_utils.h" // for IID constants
+#include "stats.h"
 
 OutputCallback::~OutputCallback() {}
 
@@ -45,6 +46,7 @@ HRESULT OutputCallback::ScheduledPlaybackHasStopped() {
 InputCallback::InputCallback(IDeckLinkOutput* output, BMDTimeScale timeScale) 
     : m_output(output), m_timeScale(timeScale) {
     startTime = lastPrintTime = std::chrono::steady_clock::now();
+    if (perfCountersEnabled()) m_perf.reset(new PerfTotals("capture"));
 }
 
 InputCallback::~InputCallback() {}
@@ -80,12 +82,31 @@ HRESULT InputCallback::VideoInputFormatChanged(BMDVideoInputFormatChangedEvents
 }
 
 HRESULT InputCallback::VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket) {
+    PerfScope perf(m_perf.get());
     if (videoFrame) {
+        int64_t arrivalNs = monotonicNowNs();
         frameCount++;
-        videoFrame->AddRef();
+        if (videoFrame->GetFlags() & bmdFrameHasNoInputSource) {
+            noSignalCount++;
+        }
         BMDTimeValue streamTime, duration;
         videoFrame->GetStreamTime(&streamTime, &duration, m_timeScale);
-        m_output->ScheduleVideoFrame(videoFrame, streamTime, duration, m_timeScale);
+        if (!m_failover || m_failover->process(videoFrame, streamTime, duration, arrivalNs)) {
+            std::shared_ptr<FrameVerifier::Record> verify;
+            if (m_verifier) {
+                verify = m_verifier->begin(frameCount - 1, streamTime, duration);
+                if (audioPacket) {
+                    void* samples;
+                    audioPacket->GetBytes(&samples);
+                    m_verifier->addAudio(*verify, samples, static_cast<uint32_t>(audioPacket->GetSampleFrameCount()));
+                }
+            }
+            videoFrame->AddRef();
+            if (!submitProcessing(videoFrame, streamTime, duration, arrivalNs, verify)) {
+                if (verify) m_verifier->skipped();
+                m_output->ScheduleVideoFrame(videoFrame, streamTime, duration, m_timeScale);
+            }
+        }
     } else {
         dropCount++;
     }
@@ -110,4 +131,65 @@ HRESULT InputCallback::VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFra
     }
 
     return S_OK;
-}
\ No newline at end of file
+}
+
+bool InputCallback::submitProcessing(IDeckLinkVideoInputFrame* videoFrame, BMDTimeValue streamTime, BMDTimeValue duration,
+                                     int64_t arrivalNs, std::shared_ptr<FrameVerifier::Record> verify) {
+    if (!m_scheduler || (!m_denoiser && !m_lut && !m_overlay && !m_scopes && !m_bus && !verify) ||
+        videoFrame->GetPixelFormat() != bmdFormat10BitYUV) {
+        return false;
+    }
+    std::shared_ptr<ScopedFrameAccess> access(new ScopedFrameAccess(videoFrame, bmdBufferAccessReadAndWrite));
+    if (!*access) {
+        return false;
+    }
+    uint8_t* bytes = static_cast<uint8_t*>(access->bytes());
+    long rowBytes = videoFrame->GetRowBytes();
+    int width = static_cast<int>(videoFrame->GetWidth());
+    int height = static_cast<int>(videoFrame->GetHeight());
+
+    // Returning here lets the next frame's stages start while this one is still being processed.
+    // Never wait inside the SDK callback: if the pipeline or the denoiser is still busy with
+    // earlier frames, this one is dropped. Nothing is scheduled for its slot, so the output
+    // repeats the last processed frame rather than airing an unprocessed one in between.
+    FrameScheduler::Job* job = m_denoiser && m_denoiser->busy() ? nullptr : m_scheduler->tryNewJob();
+    if (!job) {
+        busyCount++;
+        if (verify) m_verifier->skipped();
+        access.reset();
+        videoFrame->Release();
+        return true;
+    }
+    BMDPixelFormat format = videoFrame->GetPixelFormat();
+    // The capture checksum must see the frame before anything writes to it.
+    int captured = verify ? m_verifier->scheduleCapture(*job, *verify, bytes, rowBytes, width, height, format) : -1;
+    int denoise = m_denoiser ? m_denoiser->schedule(*job, bytes, rowBytes, width, height, format, {captured}) : -1;
+    int lut = m_lut ? m_lut->schedule(*job, bytes, rowBytes, width, height, {denoise, captured}) : -1;
+    int overlay = m_overlay ? m_overlay->schedule(*job, bytes, rowBytes, width, height, format, {lut, denoise, captured}) : -1;
+    int last = overlay >= 0 ? overlay : lut >= 0 ? lut : denoise;
+    if (m_scopes) {
+        m_scopes->schedule(*job, bytes, rowBytes, width, height, format, {last});
+    }
+    int busSlot = m_bus ? m_bus->schedule(*job, bytes, rowBytes, width, height, format, {last}) : -1;
+    if (verify) {
+        m_verifier->scheduleOutput(*job, *verify, bytes, rowBytes, width, height, format, {last, captured});
+    }
+    IDeckLinkOutput* output = m_output;
+    BMDTimeScale timeScale = m_timeScale;
+    FrameBus* bus = m_bus;
+    FrameVerifier* verifier = m_verifier;
+    bool modified = last >= 0;
+    BMDFrameFlags flags = videoFrame->GetFlags();
+    job->onComplete([output, videoFrame, access, streamTime, duration, timeScale, bus, busSlot, flags, arrivalNs,
+                     verifier, verify, modified]() mutable {
+        if (busSlot >= 0) bus->publish(busSlot, streamTime, duration, timeScale, arrivalNs, flags);
+        if (verify) {
+            verifier->finish(*verify, modified);
+            verify.reset();
+        }
+        access.reset();
+        output->ScheduleVideoFrame(videoFrame, streamTime, duration, timeScale);
+    });
+    m_scheduler->submit(job);
+    return true;
+}
@@ -3,7 +3,17 @@
 
 #include <atomic>
 #include <chrono>
+#include <memory>
 #include "DeckLinkAPI.h"
+#include "denoise.h"
+#include "failover.h"
+#include "frame_bus.h"
+#include "frame_scheduler.h"
+#include "frame_verify.h"
+#include "lut3d.h"
+#include "overlay.h"
+#include "perf_counters.h"
+#include "scopes.h"
 
 class OutputCallback : public IDeckLinkVideoOutputCallback {
 private:
@@ -24,15 +34,30 @@ private:
     std::atomic<ULONG> refCount{1};
     IDeckLinkOutput* m_output;
     BMDTimeScale m_timeScale;
+    FrameScheduler* m_scheduler = nullptr;
+    Denoiser* m_denoiser = nullptr;
+    LutStage* m_lut = nullptr;
+    Overlay* m_overlay = nullptr;
+    Scopes* m_scopes = nullptr;
+    FrameBus* m_bus = nullptr;
+    Failover* m_failover = nullptr;
+    FrameVerifier* m_verifier = nullptr;
+    // Hardware counters of the capture callback (capture.*), when enabled before construction.
+    std::unique_ptr<PerfTotals> m_perf;
 
     std::atomic<uint64_t> frameCount{0};
     std::atomic<uint64_t> dropCount{0};
+    std::atomic<uint64_t> noSignalCount{0};
+    std::atomic<uint64_t> busyCount{0};
     std::atomic<uint64_t> audioSampleCount{0};
 
     std::chrono::steady_clock::time_point startTime;
     std::chrono::steady_clock::time_point lastPrintTime;
     uint64_t lastFrameCount = 0;
 
+    bool submitProcessing(IDeckLinkVideoInputFrame* videoFrame, BMDTimeValue streamTime, BMDTimeValue duration,
+                          int64_t arrivalNs, std::shared_ptr<FrameVerifier::Record> verify);
+
 public:
     InputCallback(IDeckLinkOutput* output, BMDTimeScale timeScale);
     virtual ~InputCallback();
@@ -43,8 +68,26 @@ public:
     virtual HRESULT VideoInputFormatChanged(BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode* mode, BMDDetectedVideoInputFormatFlags flags) override;
     virtual HRESULT VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket) override;
 
+    // Optional stages run on each captured frame before it is scheduled: noise reduction, colour, then graphics.
+    // They run as one scheduler job; the frame is scheduled for output when the job completes.
+    void setScheduler(FrameScheduler* scheduler) { m_scheduler = scheduler; }
+    void setDenoiser(Denoiser* denoiser) { m_denoiser = denoiser; }
+    void setLutStage(LutStage* lut) { m_lut = lut; }
+    void setOverlay(Overlay* overlay) { m_overlay = overlay; }
+    // Reads the finished picture, after colour and graphics.
+    void setScopes(Scopes* scopes) { m_scopes = scopes; }
+    // Publishes the finished picture to consumer processes, in capture order.
+    void setFrameBus(FrameBus* bus) { m_bus = bus; }
+    // Checked first: frames without signal are replaced before any stage sees them.
+    void setFailover(Failover* failover) { m_failover = failover; }
+    // Checksums the picture at capture and again before it is scheduled; needs the scheduler.
+    void setVerifier(FrameVerifier* verifier) { m_verifier = verifier; }
+
     uint64_t getFrameCount() const { return frameCount.load(); }
     uint64_t getDropCount() const { return dropCount.load(); }
+    uint64_t getNoSignalCount() const { return noSignalCount.load(); }
+    // Frames dropped because the scheduler already had maxInFlight jobs running or the denoiser was busy.
+    uint64_t getBusyCount() const { return busyCount.load(); }
     uint64_t getAudioSampleCount() const { return audioSampleCount.load(); }
     std::chrono::steady_clock::time_point getStartTime() const { return startTime; }
 };
@@ -0,0 +1,249 @@
+#include "capture_engine.h"
+#include <cstring>
+#include <iostream>
+#include "stats.h"
+
+CapturedFrame::CapturedFrame(IDeckLinkVideoInputFrame* frame, BMDTimeValue streamTime, BMDTimeValue duration,
+                             int64_t arrivalNs, uint64_t sequence)
+    : m_frame(frame), m_streamTime(streamTime), m_duration(duration), m_arrivalNs(arrivalNs), m_sequence(sequence) {
+    m_frame->AddRef();
+    m_access.reset(new ScopedFrameAccess(m_frame, bmdBufferAccessReadAndWrite));
+    if (!*m_access) m_access.reset();
+}
+
+CapturedFrame::~CapturedFrame() {
+    // EndAccess before the last reference goes, or the driver may recycle a mapped buffer.
+    m_access.reset();
+    m_frame->Release();
+}
+
+CaptureEngine::CaptureEngine(const Config& config)
+    : m_config(config),
+      m_framesCaptured(statsValue(config.statsPrefix + ".frames_captured")),
+      m_framesDelivered(statsValue(config.statsPrefix + ".frames_delivered")),
+      m_queueDrops(statsValue(config.statsPrefix + ".queue_drops")),
+      m_noSignal(statsValue(config.statsPrefix + ".no_signal")),
+      m_framesScheduled(statsValue(config.statsPrefix + ".frames_scheduled")),
+      m_framesLate(statsValue(config.statsPrefix + ".frames_late")),
+      m_framesDropped(statsValue(config.statsPrefix + ".frames_dropped")),
+      m_queueLatencyUs(statsValue(config.statsPrefix + ".queue_latency_us")),
+      m_queueLatencyMaxUs(statsValue(config.statsPrefix + ".queue_latency_max_us")) {
+    if (m_config.queueDepth < 1) m_config.queueDepth = 1;
+}
+
+CaptureEngine::~CaptureEngine() {
+    stop();
+}
+
+bool CaptureEngine::open() {
+    m_inputDevice = findDeckLinkDevice(m_config.model, m_config.inputIndex);
+    m_outputDevice = findDeckLinkDevice(m_config.model, m_config.outputIndex);
+    if (!m_inputDevice || !m_outputDevice) {
+        std::cerr << "Could not find required sub-devices on " << m_config.model << std::endl;
+        return false;
+    }
+    if (!setDeviceProfile(m_inputDevice, bmdProfileTwoSubDevicesHalfDuplex) ||
+        !setDeviceProfile(m_outputDevice, bmdProfileTwoSubDevicesHalfDuplex)) {
+        std::cerr << "Failed to set device profiles" << std::endl;
+        return false;
+    }
+    if (m_inputDevice->QueryInterface(IID_IDeckLinkInput, reinterpret_cast<void**>(&m_input)) != S_OK ||
+        m_outputDevice->QueryInterface(IID_IDeckLinkOutput, reinterpret_cast<void**>(&m_output)) != S_OK) {
+        std::cerr << "Sub-devices do not support capture/playback" << std::endl;
+        return false;
+    }
+
+    IDeckLinkDisplayMode* displayMode = nullptr;
+    m_input->GetDisplayMode(m_config.mode, &displayMode);
+    if (!displayMode) {
+        std::cerr << "Unsupported display mode" << std::endl;
+        return false;
+    }
+    m_width = displayMode->GetWidth();
+    m_height = displayMode->GetHeight();
+    displayMode->GetFrameRate(&m_frameDuration, &m_timeScale);
+    displayMode->Release();
+
+    m_output->SetScheduledFrameCompletionCallback(this);
+    m_input->SetCallback(this);
+    if (m_input->EnableVideoInput(m_config.mode, m_config.pixelFormat, bmdVideoInputFlagDefault) != S_OK) {
+        std::cerr << "Failed to enable video input" << std::endl;
+        return false;
+    }
+    if (m_output->EnableVideoOutput(m_config.mode, bmdVideoOutputFlagDefault) != S_OK) {
+        std::cerr << "Failed to enable video output" << std::endl;
+        return false;
+    }
+    if (m_config.audio &&
+        (m_input->EnableAudioInput(bmdAudioSampleRate48kHz, bmdAudioSampleType16bitInteger, 2) != S_OK ||
+         m_output->EnableAudioOutput(bmdAudioSampleRate48kHz, bmdAudioSampleType16bitInteger, 2,
+                                     bmdAudioOutputStreamContinuous) != S_OK)) {
+        std::cerr << "Failed to enable audio, continuing video only" << std::endl;
+        m_config.audio = false;
+    }
+    return true;
+}
+
+void CaptureEngine::close() {
+    if (m_input) {
+        m_input->DisableVideoInput();
+        if (m_config.audio) m_input->DisableAudioInput();
+        m_input->SetCallback(nullptr);
+        m_input->Release();
+        m_input = nullptr;
+    }
+    if (m_output) {
+        m_output->DisableVideoOutput();
+        if (m_config.audio) m_output->DisableAudioOutput();
+        m_output->SetScheduledFrameCompletionCallback(nullptr);
+        m_output->Release();
+        m_output = nullptr;
+    }
+    if (m_inputDevice) m_inputDevice->Release();
+    if (m_outputDevice) m_outputDevice->Release();
+    m_inputDevice = m_outputDevice = nullptr;
+}
+
+bool CaptureEngine::start(Consumer consumer) {
+    if (m_running.load()) return false;
+    if (!open()) {
+        close();
+        return false;
+    }
+    m_consumer = std::move(consumer);
+    m_stopping = false;
+    m_running = true;
+    m_delivery = std::thread(&CaptureEngine::deliveryLoop, this);
+    m_output->StartScheduledPlayback(0, m_timeScale, 1.0);
+    if (m_input->StartStreams() != S_OK) {
+        std::cerr << "Failed to start capture" << std::endl;
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void CaptureEngine::stop() {
+    if (!m_running.exchange(false)) return;
+    m_input->StopStreams();
+    {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        m_stopping = true;
+        m_queue.clear();
+    }
+    m_queueReady.notify_all();
+    if (m_delivery.joinable()) m_delivery.join();
+    m_consumer = nullptr;
+    m_output->StopScheduledPlayback(0, nullptr, m_timeScale);
+    close();
+}
+
+bool CaptureEngine::schedule(const CapturedFrame& frame) {
+    if (!m_running.load() || !m_output) return false;
+    // Scheduling takes its own reference; ScheduledFrameCompleted drops it.
+    IDeckLinkVideoInputFrame* videoFrame = frame.frame();
+    videoFrame->AddRef();
+    if (m_output->ScheduleVideoFrame(videoFrame, frame.streamTime(), frame.duration(), m_timeScale) != S_OK) {
+        videoFrame->Release();
+        return false;
+    }
+    m_framesScheduled++;
+    return true;
+}
+
+void CaptureEngine::deliveryLoop() {
+    while (true) {
+        std::unique_ptr<CapturedFrame> frame;
+        {
+            std::unique_lock<std::mutex> lock(m_queueMutex);
+            m_queueReady.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+            if (m_stopping) break;
+            frame = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        int64_t waitUs = (monotonicNowNs() - frame->arrivalNs()) / 1000;
+        m_queueLatencyUs = waitUs;
+        if (waitUs > m_queueLatencyMaxUs.load()) m_queueLatencyMaxUs = waitUs;
+        m_framesDelivered++;
+        m_consumer(std::move(frame));
+    }
+}
+
+HRESULT CaptureEngine::QueryInterface(REFIID iid, LPVOID *ppv) {
+    if (!ppv) return E_INVALIDARG;
+    *ppv = nullptr;
+    if (memcmp(&iid, &kIID_IDeckLinkInputCallback, sizeof(REFIID)) == 0 ||
+        memcmp(&iid, &kIID_IUnknown, sizeof(REFIID)) == 0) {
+        *ppv = static_cast<IDeckLinkInputCallback*>(this);
+        AddRef();
+        return S_OK;
+    }
+    if (memcmp(&iid, &kIID_IDeckLinkVideoOutputCallback, sizeof(REFIID)) == 0) {
+        *ppv = static_cast<IDeckLinkVideoOutputCallback*>(this);
+        AddRef();
+        return S_OK;
+    }
+    return E_NOINTERFACE;
+}
+
+ULONG CaptureEngine::AddRef() {
+    return ++refCount;
+}
+
+ULONG CaptureEngine::Release() {
+    ULONG newRef = --refCount;
+    if (newRef == 0) {
+        delete this;
+        return 0;
+    }
+    return newRef;
+}
+
+HRESULT CaptureEngine::VideoInputFormatChanged(BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode* mode, BMDDetectedVideoInputFormatFlags flags) {
+    std::cout << "Video format changed" << std::endl;
+    return S_OK;
+}
+
+HRESULT CaptureEngine::VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket) {
+    if (videoFrame) {
+        m_framesCaptured++;
+        if (videoFrame->GetFlags() & bmdFrameHasNoInputSource) m_noSignal++;
+        BMDTimeValue streamTime, duration;
+        videoFrame->GetStreamTime(&streamTime, &duration, m_timeScale);
+        // The frame is mapped here so the consumer thread only ever sees ready memory.
+        std::unique_ptr<CapturedFrame> frame(new CapturedFrame(videoFrame, streamTime, duration, monotonicNowNs(), m_sequence++));
+        std::unique_ptr<CapturedFrame> dropped;
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            if (!m_stopping) {
+                if (static_cast<int>(m_queue.size()) >= m_config.queueDepth) {
+                    dropped = std::move(m_queue.front());
+                    m_queue.pop_front();
+                    m_queueDrops++;
+                }
+                m_queue.push_back(std::move(frame));
+            }
+        }
+        m_queueReady.notify_one();
+    }
+
+    if (audioPacket && m_config.audio) {
+        void* buffer;
+        audioPacket->GetBytes(&buffer);
+        BMDTimeValue packetTime;
+        audioPacket->GetPacketTime(&packetTime, m_timeScale);
+        m_output->ScheduleAudioSamples(buffer, audioPacket->GetSampleFrameCount(), packetTime, m_timeScale, nullptr);
+    }
+    return S_OK;
+}
+
+HRESULT CaptureEngine::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result) {
+    if (result == bmdOutputFrameDisplayedLate) m_framesLate++;
+    if (result == bmdOutputFrameDropped) m_framesDropped++;
+    if (completedFrame) completedFrame->Release();
+    return S_OK;
+}
+
+HRESULT CaptureEngine::ScheduledPlaybackHasStopped() {
+    return S_OK;
+}
@@ -0,0 +1,134 @@
+#ifndef CAPTURE_ENGINE_H
+#define CAPTURE_ENGINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "DeckLinkAPI.h"
+#include "decklink_utils.h"
+
+// A captured frame with its pixel memory mapped read/write. It holds a
+// reference on the DeckLink frame, so the bytes stay valid (and are not
+// recycled by the driver) until the object is destroyed.
+class CapturedFrame {
+private:
+    IDeckLinkVideoInputFrame* m_frame;
+    std::unique_ptr<ScopedFrameAccess> m_access;
+    BMDTimeValue m_streamTime;
+    BMDTimeValue m_duration;
+    int64_t m_arrivalNs;
+    uint64_t m_sequence;
+
+public:
+    CapturedFrame(IDeckLinkVideoInputFrame* frame, BMDTimeValue streamTime, BMDTimeValue duration,
+                  int64_t arrivalNs, uint64_t sequence);
+    ~CapturedFrame();
+    CapturedFrame(const CapturedFrame&) = delete;
+    CapturedFrame& operator=(const CapturedFrame&) = delete;
+
+    uint8_t* bytes() const { return m_access ? static_cast<uint8_t*>(m_access->bytes()) : nullptr; }
+    long rowBytes() const { return m_frame->GetRowBytes(); }
+    int width() const { return static_cast<int>(m_frame->GetWidth()); }
+    int height() const { return static_cast<int>(m_frame->GetHeight()); }
+    BMDPixelFormat pixelFormat() const { return m_frame->GetPixelFormat(); }
+    bool hasSignal() const { return (m_frame->GetFlags() & bmdFrameHasNoInputSource) == 0; }
+    BMDTimeValue streamTime() const { return m_streamTime; }
+    BMDTimeValue duration() const { return m_duration; }
+    int64_t arrivalNs() const { return m_arrivalNs; }
+    uint64_t sequence() const { return m_sequence; }
+    IDeckLinkVideoInputFrame* frame() const { return m_frame; }
+};
+
+// Capture/output engine for embedding (the Python module): frames from one
+// sub-device are handed to a consumer on a native delivery thread and may be
+// scheduled back out on another sub-device. Audio is passed straight through
+// on the capture thread.
+//
+// The delivery queue is bounded; when the consumer falls behind the oldest
+// undelivered frame is dropped, so the driver's capture pool is never exhausted.
+class CaptureEngine : public IDeckLinkInputCallback, public IDeckLinkVideoOutputCallback {
+public:
+    struct Config {
+        int64_t inputIndex = 3;
+        int64_t outputIndex = 0;
+        std::string model = "DeckLink Duo";
+        BMDDisplayMode mode = bmdModeHD1080i5994;
+        BMDPixelFormat pixelFormat = bmdFormat10BitYUV;
+        bool audio = true;
+        int queueDepth = 2;
+        std::string statsPrefix = "engine";
+    };
+    using Consumer = std::function<void(std::unique_ptr<CapturedFrame>)>;
+
+    explicit CaptureEngine(const Config& config);
+    virtual ~CaptureEngine();
+
+    // Opens both sub-devices and starts streaming; the consumer runs on the delivery thread.
+    bool start(Consumer consumer);
+    // Stops capture, drains the delivery thread and waits for output to finish. Safe to call twice.
+    void stop();
+    bool running() const { return m_running.load(); }
+    // stop() joins the delivery thread, so the consumer must not call it.
+    bool onDeliveryThread() const { return std::this_thread::get_id() == m_delivery.get_id(); }
+
+    // Schedules the frame's own buffer for output at its capture time; no
+    // pixels are copied. The driver holds a reference until the frame has been played.
+    bool schedule(const CapturedFrame& frame);
+
+    BMDTimeScale timeScale() const { return m_timeScale; }
+    BMDTimeValue frameDuration() const { return m_frameDuration; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    virtual HRESULT QueryInterface(REFIID iid, LPVOID *ppv) override;
+    virtual ULONG AddRef() override;
+    virtual ULONG Release() override;
+    virtual HRESULT VideoInputFormatChanged(BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode* mode, BMDDetectedVideoInputFormatFlags flags) override;
+    virtual HRESULT VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket) override;
+    virtual HRESULT ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result) override;
+    virtual HRESULT ScheduledPlaybackHasStopped() override;
+
+private:
+    std::atomic<ULONG> refCount{1};
+    Config m_config;
+    Consumer m_consumer;
+
+    IDeckLink* m_inputDevice = nullptr;
+    IDeckLink* m_outputDevice = nullptr;
+    IDeckLinkInput* m_input = nullptr;
+    IDeckLinkOutput* m_output = nullptr;
+    BMDTimeValue m_frameDuration = 0;
+    BMDTimeScale m_timeScale = 0;
+    int m_width = 0;
+    int m_height = 0;
+
+    std::atomic<bool> m_running{false};
+    std::thread m_delivery;
+    std::mutex m_queueMutex;
+    std::condition_variable m_queueReady;
+    std::deque<std::unique_ptr<CapturedFrame>> m_queue;
+    bool m_stopping = false;
+    uint64_t m_sequence = 0;
+
+    std::atomic<int64_t>& m_framesCaptured;
+    std::atomic<int64_t>& m_framesDelivered;
+    std::atomic<int64_t>& m_queueDrops;
+    std::atomic<int64_t>& m_noSignal;
+    std::atomic<int64_t>& m_framesScheduled;
+    std::atomic<int64_t>& m_framesLate;
+    std::atomic<int64_t>& m_framesDropped;
+    std::atomic<int64_t>& m_queueLatencyUs;
+    std::atomic<int64_t>& m_queueLatencyMaxUs;
+
+    bool open();
+    void close();
+    void deliveryLoop();
+};
+
+#endif // CAPTURE_ENGINE_H
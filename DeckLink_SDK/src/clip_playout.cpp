@@ -0,0 +1,525 @@
+#include "clip_playout.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "decklink_utils.h"
+#include "stats.h"
+#include "v210.h"
+
+namespace {
+constexpr int kAudioChannels = 2;
+constexpr int64_t kAudioRate = 48000;
+
+const size_t kPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+// Frame number or HH:MM:SS:FF (non-drop at the nominal rate).
+bool parseFramePoint(const std::string& text, int nominalFps, int64_t& frame) {
+    int hours, minutes, seconds, frames;
+    char extra;
+    if (std::sscanf(text.c_str(), "%d:%d:%d:%d%c", &hours, &minutes, &seconds, &frames, &extra) == 4) {
+        frame = ((static_cast<int64_t>(hours) * 60 + minutes) * 60 + seconds) * nominalFps + frames;
+        return true;
+    }
+    char* end = nullptr;
+    long long value = std::strtoll(text.c_str(), &end, 10);
+    if (end == text.c_str() || *end != '\0' || value < 0) return false;
+    frame = value;
+    return true;
+}
+
+const void* mapFile(const std::string& path, size_t& bytes) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    void* mapped = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        bytes = static_cast<size_t>(info.st_size);
+        mapped = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    return mapped == MAP_FAILED ? nullptr : mapped;
+}
+
+// Page-aligned range covering [bytes, bytes + length).
+void pageRange(const uint8_t* bytes, size_t length, uint8_t*& begin, size_t& span) {
+    uintptr_t first = reinterpret_cast<uintptr_t>(bytes) & ~(kPageSize - 1);
+    uintptr_t last = reinterpret_cast<uintptr_t>(bytes) + length;
+    begin = reinterpret_cast<uint8_t*>(first);
+    span = last - first;
+}
+}
+
+bool loadPlaylist(const std::string& path, BMDTimeValue frameDuration, BMDTimeScale timeScale,
+                  std::vector<PlaylistEntry>& entries) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open playlist " << path << std::endl;
+        return false;
+    }
+    std::string directory;
+    size_t slash = path.rfind('/');
+    if (slash != std::string::npos) directory = path.substr(0, slash + 1);
+    int nominalFps = static_cast<int>(std::lround(static_cast<double>(timeScale) / frameDuration));
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.resize(hash);
+        std::istringstream fields(line);
+        std::string clip, in, out;
+        if (!(fields >> clip)) continue;
+        fields >> in >> out;
+
+        PlaylistEntry entry;
+        entry.path = clip[0] == '/' ? clip : directory + clip;
+        if ((!in.empty() && !parseFramePoint(in, nominalFps, entry.in)) ||
+            (!out.empty() && !parseFramePoint(out, nominalFps, entry.out))) {
+            std::cerr << path << ":" << lineNumber << ": invalid in/out point" << std::endl;
+            return false;
+        }
+        entries.push_back(entry);
+    }
+    return !entries.empty();
+}
+
+ClipPlayout::Clip::~Clip() {
+    if (video) munmap(const_cast<uint8_t*>(video), videoBytes);
+    if (audio) munmap(const_cast<int16_t*>(audio), audioBytes);
+}
+
+ClipPlayout::ClipPlayout(IDeckLinkOutput* output, int width, int height, BMDTimeValue frameDuration,
+                         BMDTimeScale timeScale, int prefetchFrames, bool loop)
+    : m_output(output), m_width(width), m_height(height), m_rowBytes(v210RowBytes(width)),
+      m_frameBytes(static_cast<size_t>(v210RowBytes(width)) * height), m_frameDuration(frameDuration),
+      m_timeScale(timeScale), m_prefetchFrames(prefetchFrames), m_loop(loop),
+      m_framesScheduled(statsValue("playout.frames_scheduled")),
+      m_framesLate(statsValue("playout.frames_late")),
+      m_framesDropped(statsValue("playout.frames_dropped")),
+      m_framesSkipped(statsValue("playout.frames_skipped")),
+      m_prefetchMisses(statsValue("playout.prefetch_misses")),
+      m_copyUs(statsValue("playout.copy_us")),
+      m_copyMaxUs(statsValue("playout.copy_max_us")),
+      m_slackUs(statsValue("playout.schedule_slack_us")),
+      m_minSlackUs(statsValue("playout.min_slack_us")),
+      m_entriesStarted(statsValue("playout.entries_started")),
+      m_audioPadded(statsValue("playout.audio_padded_samples")),
+      m_audioDropped(statsValue("playout.audio_samples_dropped")),
+      m_playErrors(statsValue("playout.play_errors")) {
+    m_residency.resize((m_frameBytes + kPageSize - 1) / kPageSize + 1);
+}
+
+ClipPlayout::~ClipPlayout() {
+    stop();
+    for (int i = 0; i < kPoolSize; i++) {
+        if (m_pool[i]) m_pool[i]->Release();
+    }
+}
+
+std::shared_ptr<ClipPlayout::Clip> ClipPlayout::mapClip(const std::string& path) {
+    auto found = m_clips.find(path);
+    if (found != m_clips.end()) return found->second;
+
+    std::shared_ptr<Clip> clip(new Clip());
+    clip->path = path;
+    clip->video = static_cast<const uint8_t*>(mapFile(path, clip->videoBytes));
+    if (!clip->video) {
+        std::cerr << "Cannot map clip " << path << std::endl;
+        return nullptr;
+    }
+    clip->frames = static_cast<int64_t>(clip->videoBytes / m_frameBytes);
+    if (clip->videoBytes % m_frameBytes != 0) {
+        std::cerr << "Clip " << path << " is not a whole number of " << m_width << "x" << m_height
+                  << " v210 frames, ignoring the trailing bytes" << std::endl;
+    }
+    std::string audioPath = path.substr(0, path.rfind('.')) + ".pcm";
+    clip->audio = static_cast<const int16_t*>(mapFile(audioPath, clip->audioBytes));
+    if (clip->audio) {
+        clip->audioSamples = static_cast<int64_t>(clip->audioBytes / (kAudioChannels * sizeof(int16_t)));
+    }
+    // Access is explicit through the prefetch window; keep the kernel's own readahead out of the way.
+    madvise(const_cast<uint8_t*>(clip->video), clip->videoBytes, MADV_RANDOM);
+    m_clips[path] = clip;
+    return clip;
+}
+
+bool ClipPlayout::load(const std::vector<PlaylistEntry>& playlist) {
+    for (const PlaylistEntry& item : playlist) {
+        std::shared_ptr<Clip> clip = mapClip(item.path);
+        if (!clip) continue;
+        int64_t out = item.out < 0 ? clip->frames : std::min(item.out, clip->frames);
+        if (item.in >= out) {
+            std::cerr << "Skipping " << item.path << ": in point " << item.in << " is not before out point "
+                      << out << " (" << clip->frames << " frames)" << std::endl;
+            continue;
+        }
+        m_entries.push_back({clip, item.in, out});
+        std::cout << "Playlist " << m_entries.size() << ": " << item.path << " [" << item.in << ", " << out << ")"
+                  << (clip->audio ? " with audio" : "") << std::endl;
+    }
+    return !m_entries.empty();
+}
+
+bool ClipPlayout::step(Cursor& cursor) const {
+    if (++cursor.frame < m_entries[cursor.entry].out) return true;
+    if (++cursor.entry == m_entries.size()) {
+        if (!m_loop) return false;
+        cursor.entry = 0;
+    }
+    cursor.frame = m_entries[cursor.entry].in;
+    return true;
+}
+
+bool ClipPlayout::start() {
+    if (m_entries.empty()) return false;
+
+    for (int i = 0; i < kPoolSize; i++) {
+        if (m_output->CreateVideoFrame(m_width, m_height, static_cast<int32_t>(m_rowBytes), bmdFormat10BitYUV,
+                                       bmdFrameFlagDefault, &m_pool[i]) != S_OK) {
+            std::cerr << "Failed to create playout frame" << std::endl;
+            return false;
+        }
+    }
+    m_cursor.entry = 0;
+    m_cursor.frame = m_entries[0].in;
+    m_currentEntry = 0;
+    m_currentFrame = m_cursor.frame;
+    m_audioPosition = entryAudioStart(m_cursor.frame);
+    m_entriesStarted++;
+    m_minSlackUs = INT64_MAX;
+
+    m_running = true;
+    m_prefetchThread = std::thread(&ClipPlayout::prefetchLoop, this);
+
+    // The prefetch thread reads the first window in; preroll waits for the first frame rather than the disk.
+    const uint8_t* first = m_entries[0].clip->video + m_cursor.frame * m_frameBytes;
+    for (int attempt = 0; attempt < 200 && !resident(first, m_frameBytes); attempt++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    // Preroll all but one frame, then let completions drive the cadence.
+    for (int i = 0; i < kPoolSize - 1 && !m_ended; i++) {
+        if (!playFrame(i)) {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            m_freeFrames.push_back(i);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        m_freeFrames.push_back(kPoolSize - 1);
+    }
+    m_output->StartScheduledPlayback(0, m_timeScale, 1.0);
+    m_thread = std::thread(&ClipPlayout::playLoop, this);
+    return true;
+}
+
+void ClipPlayout::stop() {
+    if (!m_running.exchange(false)) return;
+    m_poolReady.notify_all();
+    m_prefetchWake.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+    if (m_prefetchThread.joinable()) m_prefetchThread.join();
+}
+
+void ClipPlayout::playLoop() {
+    while (m_running.load()) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(m_poolMutex);
+            m_poolReady.wait(lock, [this] { return !m_running.load() || !m_freeFrames.empty(); });
+            if (!m_running.load()) break;
+            if (m_ended) {
+                // Wait for the frames already scheduled to be displayed.
+                if (m_freeFrames.size() == static_cast<size_t>(kPoolSize)) {
+                    m_finished = true;
+                    break;
+                }
+                m_poolReady.wait(lock);
+                continue;
+            }
+            index = m_freeFrames.back();
+            m_freeFrames.pop_back();
+        }
+        if (!playFrame(index)) {
+            // The frame stays free, so back off for a frame period instead of retrying at once.
+            m_playErrors++;
+            std::unique_lock<std::mutex> lock(m_poolMutex);
+            m_freeFrames.push_back(index);
+            m_poolReady.wait_for(lock, std::chrono::nanoseconds(m_frameDuration * 1000000000 / m_timeScale),
+                                 [this] { return !m_running.load(); });
+        }
+    }
+}
+
+// Keeps the window of timeline frames after the one being scheduled advised, one frame per wake-up.
+void ClipPlayout::prefetchLoop() {
+    Cursor cursor = m_cursor;
+    int64_t advised = 0;
+    bool more = true;
+    while (m_running.load()) {
+        {
+            std::unique_lock<std::mutex> lock(m_prefetchMutex);
+            m_prefetchWake.wait(lock, [&] {
+                return !m_running.load() || (more && advised < m_scheduledIndex.load() + m_prefetchFrames);
+            });
+            if (!m_running.load()) break;
+        }
+        const Entry& entry = m_entries[cursor.entry];
+        const uint8_t* bytes = entry.clip->video + cursor.frame * m_frameBytes;
+        uint8_t* begin;
+        size_t span;
+        pageRange(bytes, m_frameBytes, begin, span);
+        madvise(begin, span, MADV_WILLNEED);
+        advised++;
+        more = step(cursor);
+    }
+}
+
+bool ClipPlayout::resident(const uint8_t* bytes, size_t length) {
+    uint8_t* begin;
+    size_t span;
+    pageRange(bytes, length, begin, span);
+    size_t pages = (span + kPageSize - 1) / kPageSize;
+    if (mincore(begin, span, m_residency.data()) != 0) return true;
+    for (size_t i = 0; i < pages; i++) {
+        if (!(m_residency[i] & 1)) return false;
+    }
+    return true;
+}
+
+bool ClipPlayout::playFrame(int poolIndex) {
+    IDeckLinkMutableVideoFrame* frame = m_pool[poolIndex];
+    const Entry& entry = m_entries[m_cursor.entry];
+    const uint8_t* source = entry.clip->video + m_cursor.frame * m_frameBytes;
+
+    if (!resident(source, m_frameBytes)) {
+        m_prefetchMisses++;
+    }
+    int64_t startNs = monotonicNowNs();
+    {
+        ScopedFrameAccess access(frame, bmdBufferAccessWrite);
+        if (!access) return false;
+        std::memcpy(access.bytes(), source, m_frameBytes);
+    }
+    int64_t elapsedUs = (monotonicNowNs() - startNs) / 1000;
+    m_copyUs.store(elapsedUs);
+    if (elapsedUs > m_copyMaxUs.load()) m_copyMaxUs.store(elapsedUs);
+
+    // A frame that missed its slot moves the output on, never the clip: the clip still plays every frame.
+    BMDTimeValue streamTime;
+    double speed;
+    bool playing = m_output->GetScheduledStreamTime(m_timeScale, &streamTime, &speed) == S_OK && speed > 0;
+    if (playing && m_nextTime <= streamTime) {
+        BMDTimeValue resumeTime = (streamTime / m_frameDuration + 2) * m_frameDuration;
+        m_framesSkipped += (resumeTime - m_nextTime) / m_frameDuration;
+        m_outputFrame += (resumeTime - m_nextTime) / m_frameDuration;
+        m_nextTime = resumeTime;
+    }
+    if (m_output->ScheduleVideoFrame(frame, m_nextTime, m_frameDuration, m_timeScale) != S_OK) {
+        return false;
+    }
+    scheduleAudio(*entry.clip);
+    if (playing) {
+        int64_t slackUs = (m_nextTime - streamTime) * 1000000 / m_timeScale;
+        m_slackUs.store(slackUs);
+        if (slackUs < m_minSlackUs.load()) m_minSlackUs.store(slackUs);
+    }
+    m_nextTime += m_frameDuration;
+    m_outputFrame++;
+    m_framesScheduled++;
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        m_scheduledIndex++;
+    }
+    m_prefetchWake.notify_one();
+
+    size_t entryIndex = m_cursor.entry;
+    if (!step(m_cursor)) {
+        m_ended = true;
+    } else if (m_cursor.entry != entryIndex || m_cursor.frame == m_entries[entryIndex].in) {
+        m_entriesStarted++;
+        m_audioPosition = entryAudioStart(m_cursor.frame);
+    }
+    m_currentEntry = static_cast<int>(m_cursor.entry);
+    m_currentFrame = m_cursor.frame;
+    return true;
+}
+
+int64_t ClipPlayout::entryAudioStart(int64_t clipFrame) const {
+    return clipFrame * kAudioRate * m_frameDuration / m_timeScale;
+}
+
+// Audio is placed by output frame, so every clip starts sample-aligned with its first video frame.
+// Within an entry the clip audio is read contiguously: the output cadence (1601/1602 samples at
+// 29.97) decides how many samples a frame takes, and the clip's own phase in that cadence does
+// not matter, so no sample is skipped or repeated.
+void ClipPlayout::scheduleAudio(const Clip& clip) {
+    int64_t outputStart = m_outputFrame * kAudioRate * m_frameDuration / m_timeScale;
+    int64_t count = (m_outputFrame + 1) * kAudioRate * m_frameDuration / m_timeScale - outputStart;
+    int64_t clipStart = m_audioPosition;
+    m_audioPosition += count;
+    if (!clip.audio) return;
+    int64_t available = std::max<int64_t>(0, std::min(count, clip.audioSamples - clipStart));
+
+    const int16_t* samples = clip.audio + clipStart * kAudioChannels;
+    if (available < count) {
+        // Short audio is padded with silence rather than running into the next clip's.
+        m_audioScratch.assign(count * kAudioChannels, 0);
+        if (available > 0) std::memcpy(m_audioScratch.data(), samples, available * kAudioChannels * sizeof(int16_t));
+        samples = m_audioScratch.data();
+        m_audioPadded += count - available;
+    }
+    // The driver may accept only part of the block when its buffer is nearly full.
+    int64_t offset = 0;
+    for (int attempt = 0; attempt < 2 && offset < count; attempt++) {
+        uint32_t written = 0;
+        if (m_output->ScheduleAudioSamples(const_cast<int16_t*>(samples) + offset * kAudioChannels,
+                                           static_cast<uint32_t>(count - offset), outputStart + offset, kAudioRate,
+                                           &written) != S_OK ||
+            written == 0) {
+            break;
+        }
+        offset += written;
+    }
+    if (offset < count) m_audioDropped += count - offset;
+}
+
+HRESULT ClipPlayout::QueryInterface(REFIID iid, LPVOID *ppv) {
+    if (!ppv) return E_INVALIDARG;
+    *ppv = nullptr;
+    if (memcmp(&iid, &kIID_IDeckLinkVideoOutputCallback, sizeof(REFIID)) == 0 ||
+        memcmp(&iid, &kIID_IUnknown, sizeof(REFIID)) == 0) {
+        *ppv = static_cast<IDeckLinkVideoOutputCallback*>(this);
+        AddRef();
+        return S_OK;
+    }
+    return E_NOINTERFACE;
+}
+
+ULONG ClipPlayout::AddRef() {
+    return ++refCount;
+}
+
+ULONG ClipPlayout::Release() {
+    ULONG newRef = --refCount;
+    if (newRef == 0) {
+        delete this;
+        return 0;
+    }
+    return newRef;
+}
+
+HRESULT ClipPlayout::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result) {
+    if (result == bmdOutputFrameDisplayedLate) m_framesLate++;
+    if (result == bmdOutputFrameDropped) m_framesDropped++;
+    for (int i = 0; i < kPoolSize; i++) {
+        if (m_pool[i] == completedFrame) {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            m_freeFrames.push_back(i);
+            m_poolReady.notify_one();
+            break;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT ClipPlayout::ScheduledPlaybackHasStopped() {
+    return S_OK;
+}
+
+int runClipPlayout(const AppOptions& options, const std::atomic<bool>& stopFlag) {
+    BMDDisplayMode selectedMode = bmdModeHD1080i5994;
+
+    IDeckLink* outputDevice = findDeckLinkDevice("DeckLink Duo", 0);
+    if (!outputDevice || !setDeviceProfile(outputDevice, bmdProfileTwoSubDevicesHalfDuplex)) {
+        std::cerr << "Could not find DeckLink Duo output sub-device" << std::endl;
+        if (outputDevice) outputDevice->Release();
+        return 1;
+    }
+    IDeckLinkOutput* output = nullptr;
+    outputDevice->QueryInterface(IID_IDeckLinkOutput, reinterpret_cast<void**>(&output));
+
+    IDeckLinkDisplayMode* displayMode = nullptr;
+    output->GetDisplayMode(selectedMode, &displayMode);
+    if (!displayMode) {
+        std::cerr << "Unsupported display mode" << std::endl;
+        output->Release();
+        outputDevice->Release();
+        return 1;
+    }
+    int width = displayMode->GetWidth();
+    int height = displayMode->GetHeight();
+    BMDTimeValue frameDuration;
+    BMDTimeScale timeScale;
+    displayMode->GetFrameRate(&frameDuration, &timeScale);
+    displayMode->Release();
+
+    std::vector<PlaylistEntry> playlist;
+    ClipPlayout* playout = new ClipPlayout(output, width, height, frameDuration, timeScale,
+                                           options.playoutPrefetchFrames, options.playoutLoop);
+    if (!loadPlaylist(options.playoutPlaylist, frameDuration, timeScale, playlist) || !playout->load(playlist)) {
+        std::cerr << "Nothing to play in " << options.playoutPlaylist << std::endl;
+        playout->Release();
+        output->Release();
+        outputDevice->Release();
+        return 1;
+    }
+
+    output->SetScheduledFrameCompletionCallback(playout);
+    if (output->EnableVideoOutput(selectedMode, bmdVideoOutputFlagDefault) != S_OK ||
+        output->EnableAudioOutput(bmdAudioSampleRate48kHz, bmdAudioSampleType16bitInteger, kAudioChannels,
+                                  bmdAudioOutputStreamTimestamped) != S_OK) {
+        std::cerr << "Failed to enable DeckLink output" << std::endl;
+        output->SetScheduledFrameCompletionCallback(nullptr);
+        playout->Release();
+        output->Release();
+        outputDevice->Release();
+        return 1;
+    }
+
+    int exitCode = 0;
+    if (!playout->start()) {
+        exitCode = 1;
+    } else {
+        std::cout << "Playout: " << playout->entryCount() << " entries" << (options.playoutLoop ? ", looping" : "")
+                  << ", prefetching " << options.playoutPrefetchFrames << " frames" << std::endl;
+        std::atomic<int64_t>& slackUs = statsValue("playout.schedule_slack_us");
+        std::atomic<int64_t>& minSlackUs = statsValue("playout.min_slack_us");
+        std::atomic<int64_t>& misses = statsValue("playout.prefetch_misses");
+        std::atomic<int64_t>& late = statsValue("playout.frames_late");
+        std::atomic<int64_t>& dropped = statsValue("playout.frames_dropped");
+        while (!stopFlag.load() && !playout->finished()) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            int entry = playout->currentEntry();
+            std::cout << "Playout: " << entry + 1 << "/" << playout->entryCount() << " " << playout->entryPath(entry)
+                      << " frame " << playout->currentFrame() << ", slack " << std::fixed << std::setprecision(1)
+                      << slackUs.load() / 1e3 << " ms (min " << minSlackUs.load() / 1e3 << "), prefetch misses "
+                      << misses.load() << ", late " << late.load() << ", dropped " << dropped.load() << std::endl;
+        }
+        if (playout->finished()) std::cout << "Playlist finished" << std::endl;
+    }
+
+    playout->stop();
+    output->StopScheduledPlayback(0, nullptr, timeScale);
+    output->DisableVideoOutput();
+    output->DisableAudioOutput();
+    output->SetScheduledFrameCompletionCallback(nullptr);
+    playout->Release();
+    output->Release();
+    outputDevice->Release();
+
+    std::cout << "Metrics:" << std::endl;
+    StatsRegistry::instance().print(std::cout, "playout.");
+    return exitCode;
+}
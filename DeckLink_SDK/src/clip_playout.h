@@ -0,0 +1,153 @@
+#ifndef CLIP_PLAYOUT_H
+#define CLIP_PLAYOUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "app_options.h"
+
+// One playlist line: frames [in, out) of a raw clip. The clip is a .v210 file
+// of back-to-back frames in the output mode (rows padded to 128 bytes, as
+// written by ffmpeg -c:v v210 -f rawvideo), with optional 48 kHz stereo
+// 16-bit PCM in a .pcm file of the same name.
+struct PlaylistEntry {
+    std::string path;
+    int64_t in = 0;
+    int64_t out = -1;            // exclusive, -1 for the end of the clip
+};
+
+// Reads "PATH [IN [OUT]]" lines; points are frame numbers or HH:MM:SS:FF at
+// the nominal rate of the mode. Relative paths are taken from the playlist's directory.
+bool loadPlaylist(const std::string& path, BMDTimeValue frameDuration, BMDTimeScale timeScale,
+                  std::vector<PlaylistEntry>& entries);
+
+// Plays a playlist of memory-mapped clips out through IDeckLinkOutput,
+// entry after entry with no gap, one clip frame per output frame. Frames are
+// copied from the mapping into pooled output frames; a prefetch thread keeps
+// the next prefetchFrames frames of the timeline (across entry boundaries)
+// advised with MADV_WILLNEED, and every frame is checked with mincore()
+// before it is copied, so a frame that still has to come from disk is
+// counted as a prefetch miss. The cadence is driven by frame completions as
+// in the multiviewer.
+class ClipPlayout : public IDeckLinkVideoOutputCallback {
+private:
+    static constexpr int kPoolSize = 6;
+
+    struct Clip {
+        std::string path;
+        const uint8_t* video = nullptr;
+        size_t videoBytes = 0;
+        const int16_t* audio = nullptr;
+        size_t audioBytes = 0;
+        int64_t frames = 0;
+        int64_t audioSamples = 0;
+        ~Clip();
+    };
+
+    struct Entry {
+        std::shared_ptr<Clip> clip;
+        int64_t in;
+        int64_t out;
+    };
+
+    // Position on the playlist timeline.
+    struct Cursor {
+        size_t entry = 0;
+        int64_t frame = 0;
+    };
+
+    std::atomic<ULONG> refCount{1};
+    IDeckLinkOutput* m_output;
+    int m_width;
+    int m_height;
+    long m_rowBytes;
+    size_t m_frameBytes;
+    BMDTimeValue m_frameDuration;
+    BMDTimeScale m_timeScale;
+    int m_prefetchFrames;
+    bool m_loop;
+    std::map<std::string, std::shared_ptr<Clip>> m_clips;
+    std::vector<Entry> m_entries;
+
+    IDeckLinkMutableVideoFrame* m_pool[kPoolSize] = {};
+    std::vector<int> m_freeFrames;
+    std::mutex m_poolMutex;
+    std::condition_variable m_poolReady;
+
+    // Playout thread only.
+    Cursor m_cursor;
+    bool m_ended = false;
+    int64_t m_outputFrame = 0;
+    int64_t m_audioPosition = 0;  // next clip sample of the current entry, advanced by what each frame scheduled
+    BMDTimeValue m_nextTime = 0;
+    std::vector<unsigned char> m_residency;
+    std::vector<int16_t> m_audioScratch;
+
+    std::atomic<int64_t> m_scheduledIndex{0};   // timeline frames handed to the output
+    std::atomic<bool> m_finished{false};
+    std::atomic<int> m_currentEntry{0};
+    std::atomic<int64_t> m_currentFrame{0};
+
+    std::thread m_thread;
+    std::thread m_prefetchThread;
+    std::mutex m_prefetchMutex;
+    std::condition_variable m_prefetchWake;
+    std::atomic<bool> m_running{false};
+
+    std::atomic<int64_t>& m_framesScheduled;
+    std::atomic<int64_t>& m_framesLate;
+    std::atomic<int64_t>& m_framesDropped;
+    std::atomic<int64_t>& m_framesSkipped;
+    std::atomic<int64_t>& m_prefetchMisses;
+    std::atomic<int64_t>& m_copyUs;
+    std::atomic<int64_t>& m_copyMaxUs;
+    std::atomic<int64_t>& m_slackUs;
+    std::atomic<int64_t>& m_minSlackUs;
+    std::atomic<int64_t>& m_entriesStarted;
+    std::atomic<int64_t>& m_audioPadded;
+    std::atomic<int64_t>& m_audioDropped;
+    std::atomic<int64_t>& m_playErrors;
+
+    std::shared_ptr<Clip> mapClip(const std::string& path);
+    bool step(Cursor& cursor) const;
+    void playLoop();
+    void prefetchLoop();
+    bool playFrame(int poolIndex);
+    bool resident(const uint8_t* bytes, size_t length);
+    void scheduleAudio(const Clip& clip);
+    int64_t entryAudioStart(int64_t clipFrame) const;
+
+public:
+    ClipPlayout(IDeckLinkOutput* output, int width, int height, BMDTimeValue frameDuration, BMDTimeScale timeScale,
+                int prefetchFrames, bool loop);
+    virtual ~ClipPlayout();
+
+    // Maps every clip and checks the in/out points; entries that cannot play are skipped with a message.
+    bool load(const std::vector<PlaylistEntry>& playlist);
+    bool start();
+    void stop();
+    // True once the last entry has been displayed (never when looping).
+    bool finished() const { return m_finished.load(); }
+    int currentEntry() const { return m_currentEntry.load(); }
+    int64_t currentFrame() const { return m_currentFrame.load(); }
+    size_t entryCount() const { return m_entries.size(); }
+    const std::string& entryPath(int index) const { return m_entries[index].clip->path; }
+
+    virtual HRESULT QueryInterface(REFIID iid, LPVOID *ppv) override;
+    virtual ULONG AddRef() override;
+    virtual ULONG Release() override;
+    virtual HRESULT ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result) override;
+    virtual HRESULT ScheduledPlaybackHasStopped() override;
+};
+
+// Runs the clip playout mode until the playlist ends or stopFlag is set; returns the process exit code.
+int runClipPlayout(const AppOptions& options, const std::atomic<bool>& stopFlag);
+
+#endif // CLIP_PLAYOUT_H
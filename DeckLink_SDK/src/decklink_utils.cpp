@@ -65,4 +65,50 @@ bool setDeviceProfile(IDeckLink* device, BMDProfileID profileID) {
     }
     profileMgr->Release();
     return true;
-}
\ No newline at end of file
+}
+
+bool parseDisplayMode(const std::string& name, BMDDisplayMode& mode) {
+    static const struct {
+        const char* name;
+        BMDDisplayMode mode;
+    } kModes[] = {
+        {"ntsc", bmdModeNTSC}, {"pal", bmdModePAL},
+        {"720p50", bmdModeHD720p50}, {"720p5994", bmdModeHD720p5994}, {"720p60", bmdModeHD720p60},
+        {"1080i50", bmdModeHD1080i50}, {"1080i5994", bmdModeHD1080i5994}, {"1080i60", bmdModeHD1080i6000},
+        {"1080p24", bmdModeHD1080p24}, {"1080p25", bmdModeHD1080p25}, {"1080p2997", bmdModeHD1080p2997},
+        {"1080p30", bmdModeHD1080p30}, {"1080p50", bmdModeHD1080p50}, {"1080p5994", bmdModeHD1080p5994},
+        {"1080p60", bmdModeHD1080p6000},
+        {"2160p25", bmdMode4K2160p25}, {"2160p2997", bmdMode4K2160p2997}, {"2160p50", bmdMode4K2160p50},
+        {"2160p5994", bmdMode4K2160p5994}, {"2160p60", bmdMode4K2160p60},
+    };
+    for (const auto& entry : kModes) {
+        if (name == entry.name) {
+            mode = entry.mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+ScopedFrameAccess::ScopedFrameAccess(IDeckLinkVideoFrame* frame, BMDBufferAccessFlags flags)
+    : m_flags(flags) {
+    if (!frame || frame->QueryInterface(IID_IDeckLinkVideoBuffer, reinterpret_cast<void**>(&m_buffer)) != S_OK) {
+        m_buffer = nullptr;
+        return;
+    }
+    if (m_buffer->StartAccess(m_flags) != S_OK) {
+        m_buffer->Release();
+        m_buffer = nullptr;
+        return;
+    }
+    if (m_buffer->GetBytes(&m_bytes) != S_OK) {
+        m_bytes = nullptr;
+    }
+}
+
+ScopedFrameAccess::~ScopedFrameAccess() {
+    if (m_buffer) {
+        m_buffer->EndAccess(m_flags);
+        m_buffer->Release();
+    }
+}
@@ -12,5 +12,25 @@ extern const REFIID kIID_IDeckLinkInputCallback;
 // Utility functions
 IDeckLink* findDeckLinkDevice(const std::string& modelName, int64_t subIndex);
 bool setDeviceProfile(IDeckLink* device, BMDProfileID profileID);
+// Accepts the decklinkvideosrc mode names used by the GStreamer scripts, e.g. "1080i5994".
+bool parseDisplayMode(const std::string& name, BMDDisplayMode& mode);
+
+// Maps a frame's pixel memory for the lifetime of the object. Since SDK 14.3
+// the bytes are reached through IDeckLinkVideoBuffer with Start/EndAccess.
+class ScopedFrameAccess {
+private:
+    IDeckLinkVideoBuffer* m_buffer = nullptr;
+    BMDBufferAccessFlags m_flags;
+    void* m_bytes = nullptr;
+
+public:
+    ScopedFrameAccess(IDeckLinkVideoFrame* frame, BMDBufferAccessFlags flags);
+    ~ScopedFrameAccess();
+    ScopedFrameAccess(const ScopedFrameAccess&) = delete;
+    ScopedFrameAccess& operator=(const ScopedFrameAccess&) = delete;
+
+    void* bytes() const { return m_bytes; }
+    explicit operator bool() const { return m_bytes != nullptr; }
+};
 
 #endif // DECKLINK_UTILS_H
\ No newline at end of file
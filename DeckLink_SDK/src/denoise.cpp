@@ -0,0 +1,221 @@
+#include "denoise.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "stats.h"
+#include "v210.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DENOISE_X86 1
+#endif
+
+namespace {
+// Rounded (a * b) >> 15, the same as _mm256_mulhrs_epi16 on each lane.
+inline int mulhrs(int a, int b) {
+    return (a * b + 16384) >> 15;
+}
+
+int denoiseRowScalar(const uint16_t* cur, const uint16_t* ref, uint16_t* out, int x, int n,
+                     const DenoiseParams& params) {
+    int moving = 0;
+    for (; x < n; x++) {
+        int c = cur[x];
+        int motion = (std::abs(cur[x - 1] - ref[x - 1]) + 2 * std::abs(c - ref[x]) + std::abs(cur[x + 1] - ref[x + 1])) >> 2;
+        int smooth = (cur[x - 1] + 2 * c + cur[x + 1] + 2) >> 2;
+        int current = c + mulhrs(smooth - c, params.spatial << 7);
+        int excess = std::max(motion - params.threshold, 0) * params.slope;
+        int weight = std::max(params.maxWeight - excess, 0);
+        out[x] = static_cast<uint16_t>(current + mulhrs(ref[x] - current, weight << 7));
+        moving += motion > params.threshold;
+    }
+    return moving;
+}
+
+#ifdef DENOISE_X86
+__attribute__((target("avx2")))
+int denoiseRowAvx2(const uint16_t* cur, const uint16_t* ref, uint16_t* out, int n, const DenoiseParams& params) {
+    const __m256i threshold = _mm256_set1_epi16(static_cast<short>(params.threshold));
+    const __m256i slope = _mm256_set1_epi16(static_cast<short>(params.slope));
+    const __m256i maxWeight = _mm256_set1_epi16(static_cast<short>(params.maxWeight));
+    const __m256i spatial = _mm256_set1_epi16(static_cast<short>(params.spatial << 7));
+    const __m256i two = _mm256_set1_epi16(2);
+    int moving = 0;
+    // Samples are 10-bit, so every intermediate fits a signed 16-bit lane.
+    for (int x = 0; x < n; x += 16) {
+        __m256i cl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + x - 1));
+        __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + x));
+        __m256i cr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cur + x + 1));
+        __m256i rl = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ref + x - 1));
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ref + x));
+        __m256i rr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ref + x + 1));
+        __m256i motion = _mm256_add_epi16(_mm256_abs_epi16(_mm256_sub_epi16(cl, rl)), _mm256_abs_epi16(_mm256_sub_epi16(cr, rr)));
+        motion = _mm256_srli_epi16(_mm256_add_epi16(motion, _mm256_slli_epi16(_mm256_abs_epi16(_mm256_sub_epi16(c, r)), 1)), 2);
+        __m256i smooth = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(cl, cr), _mm256_add_epi16(_mm256_slli_epi16(c, 1), two)), 2);
+        __m256i current = _mm256_add_epi16(c, _mm256_mulhrs_epi16(_mm256_sub_epi16(smooth, c), spatial));
+        __m256i excess = _mm256_mullo_epi16(_mm256_subs_epu16(motion, threshold), slope);
+        __m256i weight = _mm256_slli_epi16(_mm256_subs_epu16(maxWeight, excess), 7);
+        __m256i result = _mm256_add_epi16(current, _mm256_mulhrs_epi16(_mm256_sub_epi16(r, current), weight));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), result);
+        // Two mask bits per lane; lanes past the row end are not counted.
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpgt_epi16(motion, threshold)));
+        if (n - x < 16) mask &= (1u << (2 * (n - x))) - 1;
+        moving += __builtin_popcount(mask) / 2;
+    }
+    return moving;
+}
+#endif
+
+// Repeats the edge samples into the padding the neighbour taps read.
+inline void extendEdges(uint16_t* row, int n) {
+    row[-1] = row[0];
+    row[n] = row[n - 1];
+}
+}
+
+DenoiseParams denoiseParams(float strength, float spatial) {
+    strength = std::min(std::max(strength, 0.0f), 1.0f);
+    spatial = std::min(std::max(spatial, 0.0f), 1.0f);
+    DenoiseParams params;
+    params.maxWeight = static_cast<uint16_t>(std::lround(strength * 224));
+    params.threshold = static_cast<uint16_t>(2 + std::lround(strength * 14));
+    params.slope = 32;
+    params.spatial = static_cast<uint16_t>(std::lround(spatial * 192));
+    return params;
+}
+
+int denoiseRow(const uint16_t* cur, const uint16_t* ref, uint16_t* out, int n, const DenoiseParams& params) {
+#ifdef DENOISE_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2) return denoiseRowAvx2(cur, ref, out, n, params);
+#endif
+    return denoiseRowScalar(cur, ref, out, 0, n, params);
+}
+
+void Denoiser::Plane::allocate(int samplesPerRow, int rows) {
+    width = samplesPerRow;
+    stride = samplesPerRow + 2 * kPad;
+    samples.assign(static_cast<size_t>(stride) * rows + 2 * kPad, 0);
+}
+
+Denoiser::Denoiser(FrameScheduler& scheduler, const std::string& statsPrefix)
+    : m_stage(scheduler.registerStage(statsPrefix)),
+      m_scratch(scheduler.workers()),
+      m_frames(statsValue(statsPrefix + ".frames")),
+      m_cpuUs(statsValue(statsPrefix + ".cpu_us")),
+      m_cpuMaxUs(statsValue(statsPrefix + ".cpu_max_us")),
+      m_wallUs(statsValue(statsPrefix + ".wall_us")),
+      m_movingPct(statsValue(statsPrefix + ".moving_pct")),
+      m_resets(statsValue(statsPrefix + ".resets")) {}
+
+void Denoiser::setStrength(float strength, float spatial) {
+    m_strength = std::min(std::max(strength, 0.0f), 1.0f);
+    m_spatial = std::min(std::max(spatial, 0.0f), 1.0f);
+}
+
+void Denoiser::allocate(int width, int height) {
+    m_width = width;
+    m_height = height;
+    int chromaWidth = (width + 1) / 2;
+    for (History& history : m_history) {
+        history.y.allocate(width, height);
+        history.cb.allocate(chromaWidth, height);
+        history.cr.allocate(chromaWidth, height);
+    }
+    for (Scratch& scratch : m_scratch) {
+        scratch.y.assign(width + 2 * kPad, 0);
+        scratch.cb.assign(chromaWidth + 2 * kPad, 0);
+        scratch.cr.assign(chromaWidth + 2 * kPad, 0);
+    }
+}
+
+int Denoiser::schedule(FrameScheduler::Job& job, uint8_t* frame, long rowBytes, int width, int height,
+                       BMDPixelFormat format, std::initializer_list<int> after) {
+    if (format != bmdFormat10BitYUV) return -1;
+
+    // The previous frame's output is this frame's reference; it is not complete yet.
+    if (m_inFlight.load()) return -1;
+
+    DenoiseParams params = denoiseParams(m_strength.load(), m_spatial.load());
+    if (params.maxWeight == 0) {
+        m_primed = false;
+        return -1;
+    }
+    if (width != m_width || height != m_height) {
+        allocate(width, height);
+        m_primed = false;
+    }
+    if (!m_primed) m_resets++;
+    bool primed = m_primed;
+    m_primed = true;
+    m_current ^= 1;
+    int current = m_current;
+
+    m_inFlight = true;
+    m_rowsLeft = height;
+    m_frameCpuNs = 0;
+    m_frameMoving = 0;
+    m_firstSliceNs = 0;
+    int stage = job.addStage(m_stage, height, [this, params, frame, rowBytes, primed, current](int firstRow, int lastRow, int worker) {
+        int64_t start = monotonicNowNs();
+        int64_t unset = 0;
+        m_firstSliceNs.compare_exchange_strong(unset, start);
+        filterRows(params, frame, rowBytes, firstRow, lastRow, worker, primed, current);
+        int64_t end = monotonicNowNs();
+        m_frameCpuNs += end - start;
+        int rows = lastRow - firstRow;
+        if (m_rowsLeft.fetch_sub(rows) == rows) finishFrame(end);
+    }, after);
+    if (stage < 0) {
+        m_inFlight = false;
+        m_primed = false;
+    }
+    return stage;
+}
+
+void Denoiser::filterRows(const DenoiseParams& params, uint8_t* frame, long rowBytes, int firstRow, int lastRow,
+                          int worker, bool primed, int current) {
+    Scratch& scratch = m_scratch[worker];
+    uint16_t* y = scratch.y.data() + kPad;
+    uint16_t* cb = scratch.cb.data() + kPad;
+    uint16_t* cr = scratch.cr.data() + kPad;
+    History& out = m_history[current];
+    History& ref = m_history[current ^ 1];
+    int width = m_width;
+    int chromaWidth = out.cb.width;
+    int64_t moving = 0;
+
+    for (int row = firstRow; row < lastRow; row++) {
+        uint32_t* words = reinterpret_cast<uint32_t*>(frame + static_cast<size_t>(row) * rowBytes);
+        v210UnpackRow(words, width, y, cb, cr);
+        if (!primed) {
+            // First frame after a (re)start: it becomes the reference unchanged.
+            std::memcpy(out.y.row(row), y, width * sizeof(uint16_t));
+            std::memcpy(out.cb.row(row), cb, chromaWidth * sizeof(uint16_t));
+            std::memcpy(out.cr.row(row), cr, chromaWidth * sizeof(uint16_t));
+        } else {
+            extendEdges(y, width);
+            extendEdges(cb, chromaWidth);
+            extendEdges(cr, chromaWidth);
+            moving += denoiseRow(y, ref.y.row(row), out.y.row(row), width, params);
+            denoiseRow(cb, ref.cb.row(row), out.cb.row(row), chromaWidth, params);
+            denoiseRow(cr, ref.cr.row(row), out.cr.row(row), chromaWidth, params);
+            v210PackRow(out.y.row(row), out.cb.row(row), out.cr.row(row), width, words);
+        }
+        extendEdges(out.y.row(row), width);
+        extendEdges(out.cb.row(row), chromaWidth);
+        extendEdges(out.cr.row(row), chromaWidth);
+    }
+    m_frameMoving += moving;
+}
+
+void Denoiser::finishFrame(int64_t frameNs) {
+    int64_t cpuUs = m_frameCpuNs.load() / 1000;
+    m_frames++;
+    m_cpuUs = cpuUs;
+    if (cpuUs > m_cpuMaxUs.load()) m_cpuMaxUs = cpuUs;
+    m_wallUs = (frameNs - m_firstSliceNs.load()) / 1000;
+    m_movingPct = m_frameMoving.load() * 100 / (static_cast<int64_t>(m_width) * m_height);
+    m_inFlight = false;
+}
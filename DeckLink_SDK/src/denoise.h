@@ -0,0 +1,111 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "frame_scheduler.h"
+
+// Blend weights derived from the strength settings, in 1/256 steps.
+struct DenoiseParams {
+    uint16_t maxWeight = 0;      // weight of the reference where nothing moves, at most 224
+    uint16_t threshold = 0;      // motion below this many codes is treated as noise
+    uint16_t slope = 32;         // weight lost per code of motion above the threshold
+    uint16_t spatial = 0;        // [1 2 1] horizontal smoothing mixed into the current sample
+};
+
+DenoiseParams denoiseParams(float strength, float spatial);
+
+// Denoises one plane row of n samples into out, which may be written up to
+// 15 samples past n. cur and ref need one readable sample before the row and
+// 16 after it. Returns the number of samples treated as moving.
+int denoiseRow(const uint16_t* cur, const uint16_t* ref, uint16_t* out, int n, const DenoiseParams& params);
+
+// Motion-adaptive temporal noise reduction on 10-bit 4:2:2 (v210) frames, as
+// a FrameScheduler stage over row slices.
+//
+// Each sample is blended with the previous output (a recursive filter):
+// out = cur + w * (ref - cur). The reference weight w is highest in still
+// areas and falls to zero as the local difference, averaged over three
+// neighbouring samples, rises above the noise threshold, so moving edges do
+// not smear. An optional [1 2 1] horizontal filter takes some noise out of
+// areas that move. The blend runs sixteen samples at a time (AVX2, scalar
+// fallback) on rows unpacked to planar Y, Cb and Cr.
+//
+// The history is two planar frames allocated once and used in turn: frame N
+// reads the output of N-1 and writes its own into the other one, so a frame
+// cannot be scheduled until the previous one has been denoised. schedule()
+// runs in the capture callback and does not wait for that: the caller checks
+// busy() first and drops the frame, so the output repeats the last filtered
+// picture instead of airing an unfiltered one. setStrength() may be called
+// from any thread and applies from the next frame.
+class Denoiser {
+public:
+    explicit Denoiser(FrameScheduler& scheduler, const std::string& statsPrefix = "denoise");
+    Denoiser(const Denoiser&) = delete;
+    Denoiser& operator=(const Denoiser&) = delete;
+
+    // Both in [0, 1]; a temporal strength of 0 bypasses the stage and restarts the history.
+    void setStrength(float strength, float spatial);
+    float strength() const { return m_strength.load(); }
+    float spatial() const { return m_spatial.load(); }
+    // True while the previous frame is still being denoised; schedule() would return -1.
+    bool busy() const { return m_inFlight.load(); }
+
+    // Adds the filter to job and returns its stage index, or -1 when it is
+    // bypassed, busy(), or the frame is not v210.
+    int schedule(FrameScheduler::Job& job, uint8_t* frame, long rowBytes, int width, int height,
+                 BMDPixelFormat format, std::initializer_list<int> after = {});
+
+private:
+    static constexpr int kPad = 32;   // samples of slack before and after every planar row
+
+    struct Plane {
+        std::vector<uint16_t> samples;
+        int width = 0;
+        int stride = 0;
+        void allocate(int samplesPerRow, int rows);
+        uint16_t* row(int y) { return samples.data() + kPad + static_cast<size_t>(y) * stride; }
+    };
+    struct History {
+        Plane y, cb, cr;
+    };
+    struct Scratch {
+        std::vector<uint16_t> y, cb, cr;
+    };
+
+    int m_stage;
+    std::atomic<float> m_strength{0.0f};
+    std::atomic<float> m_spatial{0.0f};
+    std::vector<Scratch> m_scratch;
+
+    History m_history[2];
+    int m_width = 0;
+    int m_height = 0;
+    bool m_primed = false;        // m_history[m_current ^ 1] holds the previous output
+    int m_current = 0;
+
+    // Set by schedule() and cleared once the last slice of the frame is done.
+    std::atomic<bool> m_inFlight{false};
+    std::atomic<int> m_rowsLeft{0};
+    std::atomic<int64_t> m_frameCpuNs{0};
+    std::atomic<int64_t> m_frameMoving{0};
+    std::atomic<int64_t> m_firstSliceNs{0};
+
+    std::atomic<int64_t>& m_frames;
+    std::atomic<int64_t>& m_cpuUs;
+    std::atomic<int64_t>& m_cpuMaxUs;
+    std::atomic<int64_t>& m_wallUs;
+    std::atomic<int64_t>& m_movingPct;
+    std::atomic<int64_t>& m_resets;
+
+    void allocate(int width, int height);
+    void filterRows(const DenoiseParams& params, uint8_t* frame, long rowBytes, int firstRow, int lastRow, int worker,
+                    bool primed, int current);
+    void finishFrame(int64_t frameNs);
+};
+
+#endif // DENOISE_H
@@ -0,0 +1,189 @@
+#include "failover.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "decklink_utils.h"
+#include "overlay.h"
+#include "stats.h"
+#include "v210.h"
+
+namespace {
+const char* modeName(FailoverMode mode) {
+    switch (mode) {
+    case FailoverMode::Backup: return "backup";
+    case FailoverMode::Freeze: return "freeze";
+    case FailoverMode::Slate: return "slate";
+    }
+    return "unknown";
+}
+}
+
+bool parseFailoverMode(const std::string& name, FailoverMode& mode) {
+    for (FailoverMode candidate : {FailoverMode::Backup, FailoverMode::Freeze, FailoverMode::Slate}) {
+        if (name == modeName(candidate)) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+Failover::Failover(IDeckLinkOutput* output, FrameScheduler* scheduler, int width, int height, BMDTimeScale timeScale,
+                   FailoverMode mode, int restoreFrames, const std::string& statsPrefix)
+    : m_output(output), m_scheduler(scheduler), m_width(width), m_height(height), m_rowBytes(v210RowBytes(width)),
+      m_timeScale(timeScale), m_mode(mode), m_restoreFrames(std::max(1, restoreFrames)),
+      m_noSignal(statsValue(statsPrefix + ".no_signal_frames")),
+      m_formatMismatch(statsValue(statsPrefix + ".format_mismatch")),
+      m_failovers(statsValue(statsPrefix + ".failovers")),
+      m_restores(statsValue(statsPrefix + ".restores")),
+      m_framesBackup(statsValue(statsPrefix + ".frames_backup")),
+      m_framesFrozen(statsValue(statsPrefix + ".frames_frozen")),
+      m_framesSlate(statsValue(statsPrefix + ".frames_slate")),
+      m_substituteErrors(statsValue(statsPrefix + ".substitute_errors")),
+      m_switchUs(statsValue(statsPrefix + ".switch_us")),
+      m_switchMaxUs(statsValue(statsPrefix + ".switch_max_us")),
+      m_restoreUs(statsValue(statsPrefix + ".restore_us")),
+      m_outageMs(statsValue(statsPrefix + ".outage_ms")),
+      m_active(statsValue(statsPrefix + ".active")) {
+    m_slate.resize(static_cast<size_t>(m_rowBytes) * m_height);
+    renderOverBlack(nullptr, m_slate.data(), m_rowBytes, m_width, m_height, bmdFormat10BitYUV);
+}
+
+Failover::~Failover() {
+    if (m_backupFrame) m_backupFrame->Release();
+    if (m_lastGood) m_lastGood->Release();
+}
+
+bool Failover::setSlate(std::vector<uint8_t> slate) {
+    if (slate.size() != static_cast<size_t>(m_rowBytes) * m_height) {
+        return false;
+    }
+    m_slate = std::move(slate);
+    return true;
+}
+
+bool Failover::usable(IDeckLinkVideoFrame* frame) const {
+    return frame->GetPixelFormat() == bmdFormat10BitYUV && frame->GetWidth() == m_width &&
+           frame->GetHeight() == m_height && frame->GetRowBytes() >= m_rowBytes;
+}
+
+void Failover::refreshBackup() {
+    IDeckLinkVideoInputFrame* latest = m_backup ? m_backup->takeLatest() : nullptr;
+    if (!latest) {
+        // Nothing new this period; a slower backup repeats its last frame.
+        return;
+    }
+    bool signal = (latest->GetFlags() & bmdFrameHasNoInputSource) == 0;
+    if (signal && usable(latest)) {
+        std::swap(latest, m_backupFrame);
+    } else if (!signal) {
+        // A dead backup is no better than freezing the primary.
+        std::swap(latest, m_backupFrame);
+        m_backupFrame->Release();
+        m_backupFrame = nullptr;
+    }
+    if (latest) latest->Release();
+}
+
+bool Failover::scheduleCopy(const uint8_t* source, long sourceRowBytes, BMDTimeValue streamTime, BMDTimeValue duration) {
+    IDeckLinkMutableVideoFrame* frame = nullptr;
+    if (m_output->CreateVideoFrame(m_width, m_height, m_rowBytes, bmdFormat10BitYUV, bmdFrameFlagDefault, &frame) != S_OK) {
+        m_substituteErrors++;
+        return false;
+    }
+    {
+        ScopedFrameAccess access(frame, bmdBufferAccessWrite);
+        if (!access) {
+            frame->Release();
+            m_substituteErrors++;
+            return false;
+        }
+        uint8_t* dst = static_cast<uint8_t*>(access.bytes());
+        long rowBytes = std::min(m_rowBytes, sourceRowBytes);
+        for (int row = 0; row < m_height; row++) {
+            std::memcpy(dst + static_cast<size_t>(row) * m_rowBytes, source + static_cast<size_t>(row) * sourceRowBytes,
+                        static_cast<size_t>(rowBytes));
+        }
+    }
+    // The creation reference is handed to the output; its completion callback releases it.
+    if (m_output->ScheduleVideoFrame(frame, streamTime, duration, m_timeScale) != S_OK) {
+        frame->Release();
+        m_substituteErrors++;
+        return false;
+    }
+    return true;
+}
+
+bool Failover::scheduleCopy(IDeckLinkVideoFrame* source, BMDTimeValue streamTime, BMDTimeValue duration) {
+    ScopedFrameAccess access(source, bmdBufferAccessRead);
+    if (!access) {
+        return false;
+    }
+    return scheduleCopy(static_cast<const uint8_t*>(access.bytes()), source->GetRowBytes(), streamTime, duration);
+}
+
+void Failover::substitute(BMDTimeValue streamTime, BMDTimeValue duration) {
+    if (m_mode == FailoverMode::Backup && m_backupFrame && scheduleCopy(m_backupFrame, streamTime, duration)) {
+        m_framesBackup++;
+    } else if (m_mode != FailoverMode::Slate && m_lastGood && scheduleCopy(m_lastGood, streamTime, duration)) {
+        m_framesFrozen++;
+    } else if (scheduleCopy(m_slate.data(), m_rowBytes, streamTime, duration)) {
+        m_framesSlate++;
+    }
+}
+
+bool Failover::process(IDeckLinkVideoInputFrame* frame, BMDTimeValue streamTime, BMDTimeValue duration, int64_t arrivalNs) {
+    bool signal = (frame->GetFlags() & bmdFrameHasNoInputSource) == 0;
+    bool good = signal && usable(frame);
+    if (!signal) m_noSignal++;
+    if (signal && !good) m_formatMismatch++;
+    if (m_mode == FailoverMode::Backup) refreshBackup();
+
+    if (!m_failed.load()) {
+        if (good) {
+            // Kept as the freeze source; the swap is cheap, no pixels are copied.
+            if (m_mode != FailoverMode::Slate) {
+                frame->AddRef();
+                if (m_lastGood) m_lastGood->Release();
+                m_lastGood = frame;
+            }
+            return true;
+        }
+        m_failed = true;
+        m_active = 1;
+        m_failovers++;
+        m_lossNs = arrivalNs;
+        m_goodRun = 0;
+        if (m_scheduler && m_lastGood) m_scheduler->drain();
+        substitute(streamTime, duration);
+        int64_t switchUs = (monotonicNowNs() - arrivalNs) / 1000;
+        m_switchUs = switchUs;
+        if (switchUs > m_switchMaxUs.load()) m_switchMaxUs = switchUs;
+        std::cout << "Input lost (" << (signal ? "format mismatch" : "no signal") << "), failover to "
+                  << modeName(m_mode) << " in " << switchUs << " us" << std::endl;
+        return false;
+    }
+
+    if (good) {
+        if (m_goodRun++ == 0) m_firstGoodNs = arrivalNs;
+        if (m_goodRun >= m_restoreFrames) {
+            m_failed = false;
+            m_active = 0;
+            m_restores++;
+            m_restoreUs = (monotonicNowNs() - m_firstGoodNs) / 1000;
+            m_outageMs = (arrivalNs - m_lossNs) / 1000000;
+            if (m_mode != FailoverMode::Slate) {
+                frame->AddRef();
+                if (m_lastGood) m_lastGood->Release();
+                m_lastGood = frame;
+            }
+            std::cout << "Input restored after " << m_outageMs.load() << " ms" << std::endl;
+            return true;
+        }
+    } else {
+        // Hysteresis: a single bad frame restarts the count.
+        m_goodRun = 0;
+    }
+    substitute(streamTime, duration);
+    return false;
+}
@@ -0,0 +1,88 @@
+#ifndef FAILOVER_H
+#define FAILOVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "frame_scheduler.h"
+#include "multiviewer.h"
+
+// What the output shows while the primary input is lost. Each mode falls
+// back to the next when it has nothing to show: backup -> freeze -> slate.
+enum class FailoverMode { Backup, Freeze, Slate };
+
+bool parseFailoverMode(const std::string& name, FailoverMode& mode);
+
+// Loss-of-signal detection and failover on the passthrough path. Every
+// captured frame is checked on the capture thread before any processing; a
+// frame flagged bmdFrameHasNoInputSource (or in the wrong format) is never
+// passed through. Instead a substitute is scheduled for the same stream time,
+// so the switch lands on the very frame that was lost. The output returns to
+// the primary only after restoreFrames consecutive good frames.
+//
+// Substitutes are copied into frames from the output's own allocator and
+// released by the output completion callback like any scheduled frame.
+class Failover {
+private:
+    IDeckLinkOutput* m_output;
+    FrameScheduler* m_scheduler;
+    int m_width;
+    int m_height;
+    long m_rowBytes;
+    BMDTimeScale m_timeScale;
+    FailoverMode m_mode;
+    int m_restoreFrames;
+
+    MultiviewerInput* m_backup = nullptr;
+    IDeckLinkVideoInputFrame* m_backupFrame = nullptr;
+    IDeckLinkVideoInputFrame* m_lastGood = nullptr;
+    std::vector<uint8_t> m_slate;
+
+    std::atomic<bool> m_failed{false};
+    int m_goodRun = 0;
+    int64_t m_lossNs = 0;
+    int64_t m_firstGoodNs = 0;
+
+    std::atomic<int64_t>& m_noSignal;
+    std::atomic<int64_t>& m_formatMismatch;
+    std::atomic<int64_t>& m_failovers;
+    std::atomic<int64_t>& m_restores;
+    std::atomic<int64_t>& m_framesBackup;
+    std::atomic<int64_t>& m_framesFrozen;
+    std::atomic<int64_t>& m_framesSlate;
+    std::atomic<int64_t>& m_substituteErrors;
+    std::atomic<int64_t>& m_switchUs;
+    std::atomic<int64_t>& m_switchMaxUs;
+    std::atomic<int64_t>& m_restoreUs;
+    std::atomic<int64_t>& m_outageMs;
+    std::atomic<int64_t>& m_active;
+
+    bool usable(IDeckLinkVideoFrame* frame) const;
+    void refreshBackup();
+    bool scheduleCopy(const uint8_t* source, long sourceRowBytes, BMDTimeValue streamTime, BMDTimeValue duration);
+    bool scheduleCopy(IDeckLinkVideoFrame* source, BMDTimeValue streamTime, BMDTimeValue duration);
+    void substitute(BMDTimeValue streamTime, BMDTimeValue duration);
+
+public:
+    // scheduler, when given, is drained before the last good frame is frozen,
+    // since its stages may still be writing to it.
+    Failover(IDeckLinkOutput* output, FrameScheduler* scheduler, int width, int height, BMDTimeScale timeScale,
+             FailoverMode mode, int restoreFrames, const std::string& statsPrefix = "failover");
+    ~Failover();
+    Failover(const Failover&) = delete;
+    Failover& operator=(const Failover&) = delete;
+
+    // Latest frames of a second input sub-device, for FailoverMode::Backup.
+    void setBackup(MultiviewerInput* backup) { m_backup = backup; }
+    // A full v210 frame of this size (see renderOverBlack); black until one is set.
+    bool setSlate(std::vector<uint8_t> slate);
+
+    // Called for every captured frame before it is processed. Returns true to
+    // pass the frame through; false means a substitute has been scheduled.
+    bool process(IDeckLinkVideoInputFrame* frame, BMDTimeValue streamTime, BMDTimeValue duration, int64_t arrivalNs);
+    bool active() const { return m_failed.load(); }
+};
+
+#endif // FAILOVER_H
@@ -0,0 +1,395 @@
+#include "frame_bus.h"
+#include <linux/futex.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include "stats.h"
+
+namespace {
+constexpr size_t kPageBytes = 4096;
+constexpr size_t kHugePageBytes = 2 * 1024 * 1024;
+
+size_t roundUp(size_t value, size_t multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+bool busAddress(const std::string& name, sockaddr_un& address, socklen_t& length) {
+    // Abstract namespace: nothing to clean up when the producer dies.
+    std::string path = "decklink-bus." + name;
+    if (path.size() + 1 > sizeof(address.sun_path)) return false;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path + 1, path.data(), path.size());
+    length = static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + 1 + path.size());
+    return true;
+}
+
+void sendDescriptor(int socketFd, int fd) {
+    char byte = 0;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    sendmsg(socketFd, &message, MSG_NOSIGNAL);
+}
+
+int receiveDescriptor(int socketFd) {
+    char byte;
+    iovec iov{&byte, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    if (recvmsg(socketFd, &message, MSG_CMSG_CLOEXEC) <= 0) return -1;
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) return -1;
+    int fd;
+    std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    return fd;
+}
+
+// Shared, not FUTEX_PRIVATE: the word lives in memory mapped by several processes.
+long futexWait(uint32_t* word, uint32_t expected, int64_t timeoutNs) {
+    timespec timeout{static_cast<time_t>(timeoutNs / 1000000000), static_cast<long>(timeoutNs % 1000000000)};
+    return syscall(SYS_futex, word, FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+long futexWakeAll(uint32_t* word) {
+    return syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+}
+
+FrameBus::FrameBus(FrameScheduler& scheduler, const std::string& name, int slots, const std::string& statsPrefix)
+    : m_stage(scheduler.registerStage(statsPrefix)),
+      m_name(name),
+      m_statsPrefix(statsPrefix),
+      m_slotCount(std::min(std::max(slots, 3), FrameBusHeader::kMaxSlots)),
+      m_published(statsValue(statsPrefix + ".published")),
+      m_noSlot(statsValue(statsPrefix + ".no_slot")),
+      m_formatMismatch(statsValue(statsPrefix + ".format_mismatch")),
+      m_wakeups(statsValue(statsPrefix + ".wakeups")),
+      m_consumers(statsValue(statsPrefix + ".consumers")) {}
+
+FrameBus::~FrameBus() {
+    m_stop = true;
+    if (m_acceptThread.joinable()) m_acceptThread.join();
+    if (m_listenFd >= 0) close(m_listenFd);
+    if (m_header) {
+        // Consumers keep their mapping; tell them no more frames are coming.
+        __atomic_store_n(&m_header->closed, 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&m_header->futex, 1, __ATOMIC_SEQ_CST);
+        futexWakeAll(&m_header->futex);
+        munmap(m_header, m_header->totalBytes);
+    }
+    if (m_memfd >= 0) close(m_memfd);
+}
+
+bool FrameBus::open(size_t frameBytes) {
+    size_t slotBytes = roundUp(frameBytes, kPageBytes);
+    for (bool huge : {true, false}) {
+        // With hugepages the header gets a page of its own so every slot starts on one.
+        size_t dataOffset = huge ? kHugePageBytes : roundUp(sizeof(FrameBusHeader), kPageBytes);
+        size_t total = roundUp(dataOffset + slotBytes * m_slotCount, huge ? kHugePageBytes : kPageBytes);
+        int fd = memfd_create(("decklink-bus." + m_name).c_str(), MFD_CLOEXEC | (huge ? MFD_HUGETLB : 0));
+        if (fd < 0) continue;
+        void* mapping = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(total)) == 0) {
+            // Populated up front so the capture path never takes a page fault.
+            mapping = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        }
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            continue;
+        }
+        m_memfd = fd;
+        m_header = static_cast<FrameBusHeader*>(mapping);
+        m_data = static_cast<uint8_t*>(mapping) + dataOffset;
+        m_header->magic = FrameBusHeader::kMagic;
+        m_header->version = FrameBusHeader::kVersion;
+        m_header->slotCount = static_cast<uint32_t>(m_slotCount);
+        m_header->hugePages = huge ? 1 : 0;
+        m_header->slotBytes = slotBytes;
+        m_header->dataOffset = dataOffset;
+        m_header->totalBytes = total;
+        break;
+    }
+    if (!m_header) {
+        std::cerr << "Cannot create frame bus memory: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    sockaddr_un address;
+    socklen_t length;
+    m_listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (m_listenFd < 0 || !busAddress(m_name, address, length) ||
+        bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), length) != 0 || listen(m_listenFd, 8) != 0) {
+        std::cerr << "Cannot open frame bus socket @decklink-bus." << m_name << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    m_acceptThread = std::thread(&FrameBus::acceptLoop, this);
+    std::cout << "Frame bus @decklink-bus." << m_name << ": " << m_slotCount << " slots of " << slotBytes / 1024
+              << " KB" << (m_header->hugePages ? " on hugepages" : " (no hugepages reserved)") << std::endl;
+    return true;
+}
+
+void FrameBus::acceptLoop() {
+    pollfd listener{m_listenFd, POLLIN, 0};
+    while (!m_stop.load()) {
+        if (poll(&listener, 1, 200) <= 0) continue;
+        int connection = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) continue;
+        sendDescriptor(connection, m_memfd);
+        close(connection);
+    }
+}
+
+int FrameBus::reserveSlot() {
+    // Oldest first. A slot is claimed by marking it kWriting before looking
+    // at the pins, and a consumer pins before re-checking the slot, so one
+    // of the two always sees the other (both sides use seq_cst).
+    for (int tries = 0; tries < m_slotCount; tries++) {
+        int index = (m_nextSlot + tries) % m_slotCount;
+        FrameBusSlot& slot = m_header->slots[index];
+        uint64_t held = __atomic_load_n(&slot.sequence, __ATOMIC_SEQ_CST);
+        if (held == FrameBusSlot::kWriting) continue;
+        __atomic_store_n(&slot.sequence, FrameBusSlot::kWriting, __ATOMIC_SEQ_CST);
+        bool pinned = false;
+        for (FrameBusConsumer& consumer : m_header->consumers) {
+            if (held && __atomic_load_n(&consumer.pinned, __ATOMIC_SEQ_CST) == held) {
+                pinned = true;
+                break;
+            }
+        }
+        if (pinned) {
+            __atomic_store_n(&slot.sequence, held, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        m_nextSlot = (index + 1) % m_slotCount;
+        return index;
+    }
+    return -1;
+}
+
+int FrameBus::schedule(FrameScheduler::Job& job, const uint8_t* frame, long rowBytes, int width, int height,
+                       uint32_t pixelFormat, std::initializer_list<int> after) {
+    if (!m_header || job.stageCount() >= FrameScheduler::Job::kMaxStages) return -1;
+    if (static_cast<uint64_t>(rowBytes) * height > m_header->slotBytes) {
+        m_formatMismatch++;
+        return -1;
+    }
+    int index = reserveSlot();
+    if (index < 0) {
+        m_noSlot++;
+        return -1;
+    }
+    FrameBusSlot& slot = m_header->slots[index];
+    slot.width = static_cast<uint32_t>(width);
+    slot.height = static_cast<uint32_t>(height);
+    slot.rowBytes = static_cast<uint32_t>(rowBytes);
+    slot.pixelFormat = pixelFormat;
+    uint8_t* dst = m_data + static_cast<size_t>(index) * m_header->slotBytes;
+    job.addStage(m_stage, height, [dst, frame, rowBytes](int firstRow, int lastRow, int) {
+        size_t offset = static_cast<size_t>(firstRow) * rowBytes;
+        std::memcpy(dst + offset, frame + offset, static_cast<size_t>(lastRow - firstRow) * rowBytes);
+    }, after);
+    return index;
+}
+
+void FrameBus::publish(int index, int64_t streamTime, int64_t duration, int64_t timeScale, int64_t arrivalNs,
+                       uint32_t flags) {
+    FrameBusSlot& slot = m_header->slots[index];
+    slot.streamTime = streamTime;
+    slot.duration = duration;
+    slot.timeScale = timeScale;
+    slot.arrivalNs = arrivalNs;
+    slot.flags = flags;
+    uint64_t sequence = ++m_nextSequence;
+    __atomic_store_n(&slot.sequence, sequence, __ATOMIC_RELEASE);
+    __atomic_store_n(&m_header->published, sequence, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&m_header->futex, 1, __ATOMIC_SEQ_CST);
+    // Consumers count themselves in before sleeping, so the syscall is only made when one is.
+    if (__atomic_load_n(&m_header->waiters, __ATOMIC_SEQ_CST) > 0) {
+        futexWakeAll(&m_header->futex);
+        m_wakeups++;
+    }
+    m_published++;
+}
+
+void FrameBus::updateConsumers() {
+    if (!m_header) return;
+    uint64_t published = __atomic_load_n(&m_header->published, __ATOMIC_ACQUIRE);
+    int active = 0;
+    for (int i = 0; i < FrameBusHeader::kMaxConsumers; i++) {
+        FrameBusConsumer& consumer = m_header->consumers[i];
+        int32_t pid = __atomic_load_n(&consumer.pid, __ATOMIC_ACQUIRE);
+        if (pid == 0) continue;
+        std::string prefix = m_statsPrefix + ".consumer" + std::to_string(i);
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            // Exited without detaching: release its pin and entry.
+            std::cout << "Frame bus consumer " << std::string(consumer.name, strnlen(consumer.name, sizeof(consumer.name)))
+                      << " (pid " << pid << ") has gone" << std::endl;
+            __atomic_store_n(&consumer.pinned, 0, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&consumer.pid, 0, __ATOMIC_RELEASE);
+            statsValue(prefix + ".lag") = 0;
+            continue;
+        }
+        active++;
+        uint64_t cursor = __atomic_load_n(&consumer.cursor, __ATOMIC_RELAXED);
+        statsValue(prefix + ".lag") = static_cast<int64_t>(published > cursor ? published - cursor : 0);
+        statsValue(prefix + ".frames") = static_cast<int64_t>(__atomic_load_n(&consumer.frames, __ATOMIC_RELAXED));
+        statsValue(prefix + ".drops") = static_cast<int64_t>(__atomic_load_n(&consumer.drops, __ATOMIC_RELAXED));
+    }
+    m_consumers = active;
+}
+
+FrameBusHeader* mapFrameBus(const std::string& busName, size_t& mappedBytes, bool writable) {
+    sockaddr_un address;
+    socklen_t length;
+    if (!busAddress(busName, address, length)) return nullptr;
+    int connection = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (connection < 0) return nullptr;
+    int fd = -1;
+    if (connect(connection, reinterpret_cast<sockaddr*>(&address), length) == 0) {
+        fd = receiveDescriptor(connection);
+    }
+    close(connection);
+    if (fd < 0) {
+        std::cerr << "No frame bus @decklink-bus." << busName << std::endl;
+        return nullptr;
+    }
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(FrameBusHeader)) {
+        mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Cannot map frame bus " << busName << ": " << std::strerror(errno) << std::endl;
+        return nullptr;
+    }
+    FrameBusHeader* header = static_cast<FrameBusHeader*>(mapping);
+    if (header->magic != FrameBusHeader::kMagic || header->version != FrameBusHeader::kVersion) {
+        std::cerr << "Frame bus " << busName << " has an unknown layout" << std::endl;
+        munmap(mapping, static_cast<size_t>(info.st_size));
+        return nullptr;
+    }
+    mappedBytes = static_cast<size_t>(info.st_size);
+    return header;
+}
+
+FrameBusReader::~FrameBusReader() {
+    if (m_self) {
+        __atomic_store_n(&m_self->pinned, 0, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&m_self->pid, 0, __ATOMIC_RELEASE);
+    }
+    if (m_header) munmap(m_header, m_mappedBytes);
+}
+
+bool FrameBusReader::open(const std::string& busName, const std::string& consumerName, bool latestOnly) {
+    m_header = mapFrameBus(busName, m_mappedBytes, true);
+    if (!m_header) return false;
+    m_latestOnly = latestOnly;
+    int32_t pid = static_cast<int32_t>(getpid());
+    for (FrameBusConsumer& consumer : m_header->consumers) {
+        int32_t expected = 0;
+        if (__atomic_compare_exchange_n(&consumer.pid, &expected, pid, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            m_self = &consumer;
+            break;
+        }
+    }
+    if (!m_self) {
+        std::cerr << "Frame bus " << busName << " has no free consumer entries" << std::endl;
+        return false;
+    }
+    std::memset(m_self->name, 0, sizeof(m_self->name));
+    std::memcpy(m_self->name, consumerName.data(), std::min(consumerName.size(), sizeof(m_self->name) - 1));
+    __atomic_store_n(&m_self->frames, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_self->drops, 0, __ATOMIC_RELAXED);
+    // Start at the current frame rather than replaying what the ring still holds.
+    __atomic_store_n(&m_self->cursor, __atomic_load_n(&m_header->published, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    return true;
+}
+
+bool FrameBusReader::closed() const {
+    return m_header && __atomic_load_n(&m_header->closed, __ATOMIC_ACQUIRE) != 0;
+}
+
+uint64_t FrameBusReader::frames() const {
+    return m_self ? __atomic_load_n(&m_self->frames, __ATOMIC_RELAXED) : 0;
+}
+
+uint64_t FrameBusReader::drops() const {
+    return m_self ? __atomic_load_n(&m_self->drops, __ATOMIC_RELAXED) : 0;
+}
+
+void FrameBusReader::release() {
+    if (m_self) __atomic_store_n(&m_self->pinned, 0, __ATOMIC_RELEASE);
+}
+
+bool FrameBusReader::pin(uint64_t sequence, Frame& frame) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(m_header) + m_header->dataOffset;
+    for (uint32_t i = 0; i < m_header->slotCount; i++) {
+        FrameBusSlot& slot = m_header->slots[i];
+        if (__atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE) != sequence) continue;
+        __atomic_store_n(&m_self->pinned, sequence, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot.sequence, __ATOMIC_SEQ_CST) != sequence) {
+            // Claimed for a new frame between the two loads.
+            __atomic_store_n(&m_self->pinned, 0, __ATOMIC_RELEASE);
+            return false;
+        }
+        frame.bytes = data + static_cast<size_t>(i) * m_header->slotBytes;
+        frame.sequence = sequence;
+        frame.info = &slot;
+        return true;
+    }
+    return false;
+}
+
+bool FrameBusReader::next(Frame& frame, int timeoutMs) {
+    if (!m_self) return false;
+    release();
+    int64_t deadline = monotonicNowNs() + static_cast<int64_t>(timeoutMs) * 1000000;
+    while (!closed()) {
+        uint32_t futex = __atomic_load_n(&m_header->futex, __ATOMIC_ACQUIRE);
+        uint64_t published = __atomic_load_n(&m_header->published, __ATOMIC_ACQUIRE);
+        uint64_t cursor = __atomic_load_n(&m_self->cursor, __ATOMIC_RELAXED);
+        if (published > cursor) {
+            uint64_t wanted = m_latestOnly ? published : cursor + 1;
+            // Overwritten already: this reader fell a ring behind, skip to the newest frame.
+            if (pin(wanted, frame) || (wanted != published && pin(published, frame))) {
+                __atomic_store_n(&m_self->drops, drops() + (frame.sequence - cursor - 1), __ATOMIC_RELAXED);
+                __atomic_store_n(&m_self->frames, frames() + 1, __ATOMIC_RELAXED);
+                __atomic_store_n(&m_self->cursor, frame.sequence, __ATOMIC_RELAXED);
+                return true;
+            }
+        }
+        int64_t remaining = deadline - monotonicNowNs();
+        if (remaining <= 0) return false;
+        __atomic_add_fetch(&m_header->waiters, 1, __ATOMIC_SEQ_CST);
+        futexWait(&m_header->futex, futex, remaining);
+        __atomic_sub_fetch(&m_header->waiters, 1, __ATOMIC_SEQ_CST);
+    }
+    return false;
+}
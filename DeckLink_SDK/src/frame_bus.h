@@ -0,0 +1,158 @@
+#ifndef FRAME_BUS_H
+#define FRAME_BUS_H
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include "frame_scheduler.h"
+
+// Shared-memory ring of captured frames for consumer processes (recorders,
+// analysers, streamers). The producer owns a memfd, on hugepages when any are
+// reserved, and hands its descriptor to every process that connects to the
+// abstract unix socket "@decklink-bus.<name>". The memfd starts with a
+// FrameBusHeader; the frame slots follow at dataOffset.
+//
+// Fields shared between processes are only accessed with __atomic builtins.
+// A consumer pins the sequence it is reading, and the producer never reuses
+// a pinned slot. A reader that falls behind is skipped forward to the newest
+// frame, and the frames it missed are counted as drops. The producer never
+// waits for a consumer.
+struct FrameBusSlot {
+    static constexpr uint64_t kWriting = ~0ull;
+
+    uint64_t sequence;           // frame held, 0 when empty, kWriting while being filled
+    int64_t streamTime;
+    int64_t duration;
+    int64_t timeScale;
+    int64_t arrivalNs;           // CLOCK_MONOTONIC
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowBytes;
+    uint32_t pixelFormat;        // BMDPixelFormat
+    uint32_t flags;              // BMDFrameFlags
+    uint32_t reserved;
+};
+
+struct FrameBusConsumer {
+    int32_t pid;                 // 0 when the entry is free
+    uint32_t reserved;
+    uint64_t pinned;             // sequence being read, 0 for none
+    uint64_t cursor;             // last sequence taken
+    uint64_t frames;
+    uint64_t drops;
+    char name[32];
+    uint8_t padding[56];         // one entry per pair of cache lines
+};
+
+struct FrameBusHeader {
+    static constexpr uint32_t kMagic = 0x46425553; // "FBUS"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr int kMaxSlots = 32;
+    static constexpr int kMaxConsumers = 16;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t hugePages;
+    uint64_t slotBytes;
+    uint64_t dataOffset;
+    uint64_t totalBytes;
+    alignas(64) uint64_t published;    // newest complete sequence
+    uint32_t futex;                    // bumped on every publish; consumers FUTEX_WAIT on it
+    uint32_t waiters;                  // consumers asleep in FUTEX_WAIT, so idle publishes skip the wake
+    uint32_t closed;                   // set when the producer shuts down
+    alignas(64) FrameBusSlot slots[kMaxSlots];
+    alignas(64) FrameBusConsumer consumers[kMaxConsumers];
+};
+
+// Producer side, fed from the passthrough path as a FrameScheduler stage:
+// schedule() reserves a slot and copies the frame into it in row slices,
+// publish() makes it visible in capture order once the job has completed.
+class FrameBus {
+public:
+    FrameBus(FrameScheduler& scheduler, const std::string& name, int slots, const std::string& statsPrefix = "bus");
+    ~FrameBus();
+    FrameBus(const FrameBus&) = delete;
+    FrameBus& operator=(const FrameBus&) = delete;
+
+    // Creates the ring for frames of up to frameBytes and starts accepting consumers.
+    bool open(size_t frameBytes);
+
+    // Adds the copy to job and returns the reserved slot for publish(), or -1
+    // when the frame does not fit or every slot is pinned or still in flight.
+    int schedule(FrameScheduler::Job& job, const uint8_t* frame, long rowBytes, int width, int height,
+                 uint32_t pixelFormat, std::initializer_list<int> after = {});
+    void publish(int slot, int64_t streamTime, int64_t duration, int64_t timeScale, int64_t arrivalNs, uint32_t flags);
+
+    // Once a second: frees entries of consumers that have exited and exports
+    // bus.consumerN.{lag,frames,drops} and bus.consumers.
+    void updateConsumers();
+
+private:
+    int m_stage;
+    std::string m_name;
+    std::string m_statsPrefix;
+    int m_slotCount;
+    int m_memfd = -1;
+    int m_listenFd = -1;
+    FrameBusHeader* m_header = nullptr;
+    uint8_t* m_data = nullptr;
+    uint64_t m_nextSequence = 0;
+    int m_nextSlot = 0;
+    std::thread m_acceptThread;
+    std::atomic<bool> m_stop{false};
+
+    std::atomic<int64_t>& m_published;
+    std::atomic<int64_t>& m_noSlot;
+    std::atomic<int64_t>& m_formatMismatch;
+    std::atomic<int64_t>& m_wakeups;
+    std::atomic<int64_t>& m_consumers;
+
+    int reserveSlot();
+    void acceptLoop();
+};
+
+// Consumer side. Frames are read in place from the producer's memory; the
+// pointer returned by next() stays valid until the following next() or
+// release().
+class FrameBusReader {
+public:
+    struct Frame {
+        const uint8_t* bytes;
+        uint64_t sequence;
+        const FrameBusSlot* info;
+    };
+
+    FrameBusReader() = default;
+    ~FrameBusReader();
+    FrameBusReader(const FrameBusReader&) = delete;
+    FrameBusReader& operator=(const FrameBusReader&) = delete;
+
+    // latestOnly always jumps to the newest frame (monitoring); otherwise
+    // frames are taken in order as long as the ring still holds them.
+    bool open(const std::string& busName, const std::string& consumerName, bool latestOnly = false);
+    // Waits up to timeoutMs for a frame; false on timeout or once the producer has closed.
+    bool next(Frame& frame, int timeoutMs);
+    void release();
+
+    const FrameBusHeader* header() const { return m_header; }
+    bool closed() const;
+    uint64_t frames() const;
+    uint64_t drops() const;
+
+private:
+    FrameBusHeader* m_header = nullptr;
+    size_t m_mappedBytes = 0;
+    FrameBusConsumer* m_self = nullptr;
+    bool m_latestOnly = false;
+
+    bool pin(uint64_t sequence, Frame& frame);
+};
+
+// Maps a running bus without registering as a consumer; the memfd is
+// received over the bus socket. Read-only unless writable.
+FrameBusHeader* mapFrameBus(const std::string& busName, size_t& mappedBytes, bool writable);
+
+#endif // FRAME_BUS_H
@@ -0,0 +1,353 @@
+#include "frame_scheduler.h"
+#include <algorithm>
+#include <iostream>
+#include "stats.h"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+int FrameScheduler::Job::addStage(int stage, int rows, SliceFn fn, std::initializer_list<int> after,
+                                  int haloRows, int sliceRows) {
+    if (m_stageCount == kMaxStages || rows <= 0) return -1;
+    if (sliceRows <= 0) {
+        // About four slices per worker so stealing can even out uneven rows; multiples of 8 keep tile rows together.
+        int target = std::max(1, m_scheduler->workers() * 4);
+        sliceRows = std::max(8, ((rows + target - 1) / target + 7) / 8 * 8);
+    }
+    int index = m_stageCount++;
+    Stage& s = m_stages[index];
+    s.id = stage;
+    s.rows = rows;
+    s.sliceRows = sliceRows;
+    s.firstTask = static_cast<int>(m_tasks.size());
+    s.taskCount = (rows + sliceRows - 1) / sliceRows;
+    s.haloRows = haloRows;
+    s.afterCount = 0;
+    for (int producer : after) {
+        if (producer >= 0 && producer < index) s.after[s.afterCount++] = producer;
+    }
+    s.fn = std::move(fn);
+    for (int row = 0; row < rows; row += sliceRows) {
+        m_tasks.push_back({index, row, std::min(rows, row + sliceRows), 0, 0});
+    }
+    return index;
+}
+
+void FrameScheduler::Job::reset() {
+    for (int i = 0; i < m_stageCount; i++) m_stages[i].fn = nullptr;
+    m_stageCount = 0;
+    m_tasks.clear();
+    m_retained.clear();
+    m_onComplete = nullptr;
+    m_done = false;
+}
+
+void FrameScheduler::Job::buildGraph() {
+    size_t count = m_tasks.size();
+    if (m_waitingCapacity < count) {
+        m_waitingCapacity = count;
+        m_waitingOn.reset(new std::atomic<int>[count]);
+    }
+    for (size_t i = 0; i < count; i++) m_waitingOn[i].store(0, std::memory_order_relaxed);
+
+    // Calls edge(producer, consumer) for every slice dependency.
+    auto forEachEdge = [this](auto edge) {
+        for (int index = 0; index < m_stageCount; index++) {
+            const Stage& consumer = m_stages[index];
+            for (int a = 0; a < consumer.afterCount; a++) {
+                const Stage& producer = m_stages[consumer.after[a]];
+                for (int t = 0; t < consumer.taskCount; t++) {
+                    const Task& task = m_tasks[consumer.firstTask + t];
+                    int64_t first = static_cast<int64_t>(task.firstRow) * producer.rows / consumer.rows - consumer.haloRows;
+                    int64_t last = (static_cast<int64_t>(task.lastRow) * producer.rows + consumer.rows - 1) / consumer.rows +
+                                   consumer.haloRows;
+                    first = std::max<int64_t>(0, first);
+                    last = std::min<int64_t>(producer.rows, last);
+                    for (int64_t p = first / producer.sliceRows; p * producer.sliceRows < last; p++) {
+                        edge(producer.firstTask + static_cast<int>(p), consumer.firstTask + t);
+                    }
+                }
+            }
+        }
+    };
+
+    for (Task& task : m_tasks) task.dependentsBegin = task.dependentsEnd = 0;
+    forEachEdge([this](int producer, int consumer) {
+        m_tasks[producer].dependentsEnd++;
+        m_waitingOn[consumer].fetch_add(1, std::memory_order_relaxed);
+    });
+    int offset = 0;
+    for (Task& task : m_tasks) {
+        int dependents = task.dependentsEnd;
+        task.dependentsBegin = task.dependentsEnd = offset;
+        offset += dependents;
+    }
+    m_dependents.resize(offset);
+    forEachEdge([this](int producer, int consumer) {
+        m_dependents[m_tasks[producer].dependentsEnd++] = consumer;
+    });
+
+    m_ready.clear();
+    for (size_t i = 0; i < count; i++) {
+        if (m_waitingOn[i].load(std::memory_order_relaxed) == 0) m_ready.push_back(static_cast<int>(i));
+    }
+    for (int i = 0; i < m_stageCount; i++) {
+        m_stages[i].tasksLeft.store(m_stages[i].taskCount);
+        m_stages[i].busyNs.store(0);
+    }
+}
+
+FrameScheduler::FrameScheduler(int workers, const std::vector<int>& cpus, const std::string& statsPrefix,
+                               int maxInFlight)
+    : m_statsPrefix(statsPrefix),
+      m_frames(statsValue(statsPrefix + ".frames")),
+      m_latencyUs(statsValue(statsPrefix + ".latency_us")),
+      m_latencyMaxUs(statsValue(statsPrefix + ".latency_max_us")) {
+    for (int i = 0; i < std::max(1, maxInFlight); i++) {
+        m_jobPool.emplace_back(new Job());
+        m_jobPool.back()->m_scheduler = this;
+        m_freeJobs.push_back(m_jobPool.back().get());
+    }
+    m_lastUtilizationNs = monotonicNowNs();
+
+    int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    if (workers <= 0) workers = std::max(1, cores / 2);
+    for (int i = 0; i < workers; i++) {
+        std::unique_ptr<Worker> worker(new Worker());
+        std::string prefix = statsPrefix + ".worker" + std::to_string(i);
+        worker->busyUs = &statsValue(prefix + ".busy_us");
+        worker->taskCount = &statsValue(prefix + ".tasks");
+        worker->steals = &statsValue(prefix + ".steals");
+        worker->utilPct = &statsValue(prefix + ".util_pct");
+        if (perfCountersEnabled()) worker->perf.reset(new PerfTotals(prefix));
+        m_workers.push_back(std::move(worker));
+    }
+    for (int i = 0; i < static_cast<int>(m_workers.size()); i++) {
+        m_workers[i]->thread = std::thread(&FrameScheduler::workerLoop, this, i);
+#ifdef __linux__
+        int cpu = cpus.empty() ? (i + 1) % cores : cpus[i % cpus.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_t handle = m_workers[i]->thread.native_handle();
+        if (pthread_setaffinity_np(handle, sizeof(set), &set) != 0) {
+            std::cerr << "Cannot pin " << statsPrefix << " worker " << i << " to CPU " << cpu << std::endl;
+        }
+        std::string name = "sched-" + std::to_string(i);
+        pthread_setname_np(handle, name.c_str());
+#else
+        (void)cpus;
+        (void)cores;
+#endif
+    }
+}
+
+FrameScheduler::~FrameScheduler() {
+    drain();
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_running = false;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers) worker->thread.join();
+}
+
+int FrameScheduler::registerStage(const std::string& name) {
+    std::unique_ptr<StageStats> stage(new StageStats());
+    std::string prefix = m_statsPrefix + "." + name;
+    stage->busyUs = &statsValue(prefix + ".busy_us");
+    stage->slices = &statsValue(prefix + ".slices");
+    stage->frameUs = &statsValue(prefix + ".frame_us");
+    stage->utilPct = &statsValue(prefix + ".util_pct");
+    if (perfCountersEnabled()) stage->perf.reset(new PerfTotals(prefix));
+    m_stages.push_back(std::move(stage));
+    return static_cast<int>(m_stages.size()) - 1;
+}
+
+FrameScheduler::Job* FrameScheduler::newJob() {
+    std::unique_lock<std::mutex> lock(m_jobMutex);
+    m_jobDone.wait(lock, [this] { return !m_freeJobs.empty(); });
+    Job* job = m_freeJobs.back();
+    m_freeJobs.pop_back();
+    return job;
+}
+
+FrameScheduler::Job* FrameScheduler::tryNewJob() {
+    std::lock_guard<std::mutex> lock(m_jobMutex);
+    if (m_freeJobs.empty()) return nullptr;
+    Job* job = m_freeJobs.back();
+    m_freeJobs.pop_back();
+    return job;
+}
+
+uint64_t FrameScheduler::submit(Job* job) {
+    job->buildGraph();
+    job->m_submitNs = monotonicNowNs();
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        sequence = m_nextSequence++;
+        job->m_sequence = sequence;
+        m_inFlight.push_back(job);
+    }
+
+    // The extra count keeps the job alive while its first tasks are handed out.
+    job->m_tasksLeft.store(static_cast<int>(job->m_tasks.size()) + 1);
+    int slices = 0;
+    for (int task : job->m_ready) {
+        // Consecutive slices go to consecutive workers; their dependents then stay where the rows are cached.
+        push(slices++ % workers(), {job, task});
+    }
+    if (--job->m_tasksLeft == 0) finishJob(job);
+    return sequence;
+}
+
+void FrameScheduler::wait(uint64_t sequence) {
+    std::unique_lock<std::mutex> lock(m_jobMutex);
+    m_jobDone.wait(lock, [this, sequence] { return m_completedSequence >= sequence; });
+}
+
+void FrameScheduler::drain() {
+    uint64_t last;
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        last = m_nextSequence - 1;
+    }
+    wait(last);
+}
+
+void FrameScheduler::push(int index, const TaskRef& ref) {
+    Worker& worker = *m_workers[index];
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(ref);
+    }
+    m_queued++;
+    if (m_sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_wake.notify_all();
+    }
+}
+
+bool FrameScheduler::popTask(int index, TaskRef& ref) {
+    Worker& self = *m_workers[index];
+    {
+        std::lock_guard<std::mutex> lock(self.mutex);
+        if (!self.tasks.empty()) {
+            ref = self.tasks.back();
+            self.tasks.pop_back();
+            m_queued--;
+            return true;
+        }
+    }
+    int count = workers();
+    for (int i = 1; i < count; i++) {
+        Worker& victim = *m_workers[(index + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            ref = victim.tasks.front();
+            victim.tasks.pop_front();
+            m_queued--;
+            (*self.steals)++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void FrameScheduler::workerLoop(int index) {
+    while (true) {
+        TaskRef ref;
+        if (popTask(index, ref)) {
+            runTask(index, ref);
+            continue;
+        }
+        m_sleeping++;
+        {
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_wake.wait(lock, [this] { return m_queued.load() > 0 || !m_running.load(); });
+        }
+        m_sleeping--;
+        if (!m_running.load()) return;
+    }
+}
+
+void FrameScheduler::runTask(int index, const TaskRef& ref) {
+    Worker& worker = *m_workers[index];
+    Job* job = ref.job;
+    int current = ref.task;
+    while (current >= 0) {
+        const Job::Task& task = job->m_tasks[current];
+        Job::Stage& stage = job->m_stages[task.stage];
+        StageStats& stats = *m_stages[stage.id];
+
+        PerfSample perfStart;
+        bool perf = stats.perf && PerfCounters::forThisThread().read(perfStart);
+        int64_t startNs = monotonicNowNs();
+        stage.fn(task.firstRow, task.lastRow, index);
+        int64_t elapsedNs = monotonicNowNs() - startNs;
+        PerfSample perfEnd;
+        if (perf && PerfCounters::forThisThread().read(perfEnd)) {
+            stats.perf->add(perfStart, perfEnd);
+            worker.perf->add(perfStart, perfEnd);
+        }
+        worker.busyNs += elapsedNs;
+        (*worker.taskCount)++;
+        stats.busyNs += elapsedNs;
+        (*stats.slices)++;
+        int64_t stageNs = stage.busyNs += elapsedNs;
+        if (--stage.tasksLeft == 0) stats.frameUs->store(stageNs / 1000);
+
+        // Run the first released dependent next on this worker and offer the rest for stealing.
+        int next = -1;
+        for (int d = task.dependentsBegin; d < task.dependentsEnd; d++) {
+            int dependent = job->m_dependents[d];
+            if (--job->m_waitingOn[dependent] != 0) continue;
+            if (next < 0) {
+                next = dependent;
+            } else {
+                push(index, {job, dependent});
+            }
+        }
+        if (--job->m_tasksLeft == 0) finishJob(job);
+        current = next;
+    }
+}
+
+void FrameScheduler::finishJob(Job* job) {
+    std::lock_guard<std::mutex> lock(m_jobMutex);
+    job->m_done = true;
+    while (!m_inFlight.empty() && m_inFlight.front()->m_done) {
+        Job* front = m_inFlight.front();
+        m_inFlight.pop_front();
+        if (front->m_onComplete) front->m_onComplete();
+        int64_t latencyUs = (monotonicNowNs() - front->m_submitNs) / 1000;
+        m_latencyUs.store(latencyUs);
+        if (latencyUs > m_latencyMaxUs.load()) m_latencyMaxUs.store(latencyUs);
+        m_frames++;
+        m_completedSequence = front->m_sequence;
+        front->reset();
+        m_freeJobs.push_back(front);
+    }
+    m_jobDone.notify_all();
+}
+
+void FrameScheduler::updateUtilization() {
+    int64_t nowNs = monotonicNowNs();
+    int64_t intervalNs = std::max<int64_t>(1, nowNs - m_lastUtilizationNs);
+    m_lastUtilizationNs = nowNs;
+    for (auto& worker : m_workers) {
+        int64_t busyNs = worker->busyNs.load();
+        worker->utilPct->store((busyNs - worker->lastBusyNs) * 100 / intervalNs);
+        worker->busyUs->store(busyNs / 1000);
+        worker->lastBusyNs = busyNs;
+    }
+    // Stage utilization is its share of the whole pool.
+    for (auto& stage : m_stages) {
+        int64_t busyNs = stage->busyNs.load();
+        stage->utilPct->store((busyNs - stage->lastBusyNs) * 100 / (intervalNs * workers()));
+        stage->busyUs->store(busyNs / 1000);
+        stage->lastBusyNs = busyNs;
+    }
+}
@@ -0,0 +1,182 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "perf_counters.h"
+
+// Shared worker pool for per-frame processing. A frame is submitted as a job
+// made of stages; each stage is cut into row slices and every slice becomes a
+// task. A stage may depend on earlier stages of the same job, in which case
+// each of its slices waits only for the producer slices covering the same rows
+// (plus a halo), so a chain like LUT -> overlay flows slice by slice without a
+// full-frame barrier between operations.
+//
+// Workers are pinned and each owns a deque: a worker pops its newest task
+// (the dependent slice it just released, while those rows are still in cache)
+// and idle workers steal the oldest task from the others. Several jobs may be
+// in flight at once, so frame N+1's early stages start while frame N finishes;
+// completion callbacks still run in submission order.
+//
+// When hardware counters are enabled (setPerfCountersEnabled) before the
+// scheduler is created, every slice is also counted with the worker's
+// perf_event group into <prefix>.<stage>.* and <prefix>.workerN.*.
+class FrameScheduler {
+public:
+    // Processes rows [firstRow, lastRow); worker is in [0, workers()) for per-worker scratch.
+    using SliceFn = std::function<void(int firstRow, int lastRow, int worker)>;
+
+    class Job {
+    public:
+        static constexpr int kMaxStages = 16;
+
+        // Adds a stage over `rows` rows and returns its index within the job,
+        // for later stages to name in `after`. Rows of different-height stages
+        // are matched proportionally; haloRows widens each dependency.
+        // sliceRows of 0 picks a size from the row and worker counts.
+        int addStage(int stage, int rows, SliceFn fn, std::initializer_list<int> after = {},
+                     int haloRows = 0, int sliceRows = 0);
+        // Keeps an object (a LUT, a graphic) alive until the job has completed.
+        void retain(std::shared_ptr<const void> object) { m_retained.push_back(std::move(object)); }
+        // Runs on a worker thread once every stage has finished, in submission
+        // order; it must not call newJob() or submit().
+        void onComplete(std::function<void()> fn) { m_onComplete = std::move(fn); }
+        int stageCount() const { return m_stageCount; }
+
+    private:
+        friend class FrameScheduler;
+
+        struct Stage {
+            int id = 0;
+            int rows = 0;
+            int sliceRows = 0;
+            int firstTask = 0;
+            int taskCount = 0;
+            int haloRows = 0;
+            int after[kMaxStages] = {};
+            int afterCount = 0;
+            SliceFn fn;
+            std::atomic<int> tasksLeft{0};
+            std::atomic<int64_t> busyNs{0};
+        };
+        struct Task {
+            int stage;
+            int firstRow;
+            int lastRow;
+            int dependentsBegin;
+            int dependentsEnd;
+        };
+
+        FrameScheduler* m_scheduler = nullptr;
+        Stage m_stages[kMaxStages];
+        int m_stageCount = 0;
+        std::vector<Task> m_tasks;
+        std::vector<int> m_dependents;
+        std::vector<int> m_ready;
+        std::unique_ptr<std::atomic<int>[]> m_waitingOn;
+        size_t m_waitingCapacity = 0;
+        std::atomic<int> m_tasksLeft{0};
+        std::vector<std::shared_ptr<const void>> m_retained;
+        std::function<void()> m_onComplete;
+        uint64_t m_sequence = 0;
+        int64_t m_submitNs = 0;
+        bool m_done = false;
+
+        void reset();
+        void buildGraph();
+    };
+
+    // workers <= 0 uses half the cores. cpus lists the cores to pin worker i to
+    // (cpus[i % size]); empty pins worker i to core i + 1, leaving core 0 to
+    // the capture and output threads.
+    FrameScheduler(int workers, const std::vector<int>& cpus, const std::string& statsPrefix = "sched",
+                   int maxInFlight = 2);
+    ~FrameScheduler();
+    FrameScheduler(const FrameScheduler&) = delete;
+    FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+    // Registers a named stage with its own <prefix>.<name>.* stats; call before submitting.
+    int registerStage(const std::string& name);
+    int workers() const { return static_cast<int>(m_workers.size()); }
+
+    // Blocks while maxInFlight jobs are still running, which is the pipeline's back-pressure.
+    Job* newJob();
+    // Same, but returns nullptr instead of blocking; for callers that must not stall (the capture callback).
+    Job* tryNewJob();
+    // Hands the job over and returns a sequence number for wait(); the job must not be touched afterwards.
+    uint64_t submit(Job* job);
+    void wait(uint64_t sequence);
+    void drain();
+
+    // Recomputes the util_pct gauges over the interval since the previous call.
+    void updateUtilization();
+
+private:
+    struct TaskRef {
+        Job* job;
+        int task;
+    };
+    struct Worker {
+        std::thread thread;
+        std::mutex mutex;
+        std::deque<TaskRef> tasks;
+        std::atomic<int64_t> busyNs{0};
+        int64_t lastBusyNs = 0;
+        std::atomic<int64_t>* busyUs = nullptr;
+        std::atomic<int64_t>* taskCount = nullptr;
+        std::atomic<int64_t>* steals = nullptr;
+        std::atomic<int64_t>* utilPct = nullptr;
+        std::unique_ptr<PerfTotals> perf;
+    };
+    struct StageStats {
+        std::atomic<int64_t> busyNs{0};
+        int64_t lastBusyNs = 0;
+        std::atomic<int64_t>* busyUs = nullptr;
+        std::atomic<int64_t>* slices = nullptr;
+        std::atomic<int64_t>* frameUs = nullptr;
+        std::atomic<int64_t>* utilPct = nullptr;
+        std::unique_ptr<PerfTotals> perf;
+    };
+
+    std::string m_statsPrefix;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::unique_ptr<StageStats>> m_stages;
+    std::atomic<bool> m_running{true};
+
+    // Idle workers sleep here until tasks are queued.
+    std::mutex m_sleepMutex;
+    std::condition_variable m_wake;
+    std::atomic<int> m_queued{0};
+    std::atomic<int> m_sleeping{0};
+
+    // Job pool, in-flight jobs in submission order, and completion tracking.
+    std::mutex m_jobMutex;
+    std::condition_variable m_jobDone;
+    std::vector<std::unique_ptr<Job>> m_jobPool;
+    std::vector<Job*> m_freeJobs;
+    std::deque<Job*> m_inFlight;
+    uint64_t m_nextSequence = 1;
+    uint64_t m_completedSequence = 0;
+    int64_t m_lastUtilizationNs = 0;
+
+    std::atomic<int64_t>& m_frames;
+    std::atomic<int64_t>& m_latencyUs;
+    std::atomic<int64_t>& m_latencyMaxUs;
+
+    void workerLoop(int index);
+    bool popTask(int index, TaskRef& ref);
+    void push(int index, const TaskRef& ref);
+    void runTask(int index, const TaskRef& ref);
+    void finishJob(Job* job);
+};
+
+#endif // FRAME_SCHEDULER_H
@@ -0,0 +1,239 @@
+#include "frame_verify.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <iostream>
+#include "stats.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define VERIFY_X86 1
+#endif
+
+namespace {
+// Reflected Castagnoli polynomial, one byte per step.
+std::array<uint32_t, 256> makeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        table[i] = crc;
+    }
+    return table;
+}
+
+const std::array<uint32_t, 256> kCrcTable = makeCrcTable();
+
+uint32_t crcScalar(uint32_t crc, const uint8_t* bytes, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) crc = kCrcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+void rowCrcsScalar(const uint8_t* frame, long rowBytes, size_t activeBytes, int firstRow, int lastRow, uint32_t* out) {
+    for (int row = firstRow; row < lastRow; row++) {
+        out[row] = crcScalar(0, frame + static_cast<size_t>(row) * rowBytes, activeBytes);
+    }
+}
+
+#ifdef VERIFY_X86
+__attribute__((target("sse4.2")))
+uint32_t crcSse42(uint32_t crc, const uint8_t* bytes, size_t length) {
+    uint64_t c = ~crc;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    for (; i < length; i++) c = _mm_crc32_u8(static_cast<uint32_t>(c), bytes[i]);
+    return ~static_cast<uint32_t>(c);
+}
+
+// The crc32 instruction has a latency of three cycles and a throughput of
+// one, so three independent rows keep it busy.
+__attribute__((target("sse4.2")))
+void rowCrcsSse42(const uint8_t* frame, long rowBytes, size_t activeBytes, int firstRow, int lastRow, uint32_t* out) {
+    int row = firstRow;
+    for (; row + 3 <= lastRow; row += 3) {
+        const uint8_t* a = frame + static_cast<size_t>(row) * rowBytes;
+        const uint8_t* b = a + rowBytes;
+        const uint8_t* c = b + rowBytes;
+        uint64_t ca = 0xFFFFFFFFu, cb = 0xFFFFFFFFu, cc = 0xFFFFFFFFu;
+        size_t i = 0;
+        for (; i + 8 <= activeBytes; i += 8) {
+            uint64_t wa, wb, wc;
+            std::memcpy(&wa, a + i, 8);
+            std::memcpy(&wb, b + i, 8);
+            std::memcpy(&wc, c + i, 8);
+            ca = _mm_crc32_u64(ca, wa);
+            cb = _mm_crc32_u64(cb, wb);
+            cc = _mm_crc32_u64(cc, wc);
+        }
+        for (; i < activeBytes; i++) {
+            ca = _mm_crc32_u8(static_cast<uint32_t>(ca), a[i]);
+            cb = _mm_crc32_u8(static_cast<uint32_t>(cb), b[i]);
+            cc = _mm_crc32_u8(static_cast<uint32_t>(cc), c[i]);
+        }
+        out[row] = ~static_cast<uint32_t>(ca);
+        out[row + 1] = ~static_cast<uint32_t>(cb);
+        out[row + 2] = ~static_cast<uint32_t>(cc);
+    }
+    for (; row < lastRow; row++) {
+        out[row] = crcSse42(0, frame + static_cast<size_t>(row) * rowBytes, activeBytes);
+    }
+}
+#endif
+
+using RowCrcsFn = void (*)(const uint8_t*, long, size_t, int, int, uint32_t*);
+
+RowCrcsFn rowCrcsFunction() {
+#ifdef VERIFY_X86
+    static const bool hasSse42 = __builtin_cpu_supports("sse4.2");
+    if (hasSse42) return rowCrcsSse42;
+#endif
+    return rowCrcsScalar;
+}
+
+uint32_t pictureCrc(const std::vector<uint32_t>& rows) {
+    return crc32c(0, rows.data(), rows.size() * sizeof(uint32_t));
+}
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+#ifdef VERIFY_X86
+    static const bool hasSse42 = __builtin_cpu_supports("sse4.2");
+    if (hasSse42) return crcSse42(crc, bytes, length);
+#endif
+    return crcScalar(crc, bytes, length);
+}
+
+size_t activeRowBytes(int width, long rowBytes, BMDPixelFormat format) {
+    size_t bytes = static_cast<size_t>(rowBytes);
+    if (format == bmdFormat10BitYUV) {
+        // Six pixels per four words; a partial group needs a word per three of its samples.
+        int rest = width % 6;
+        bytes = static_cast<size_t>(width / 6) * 16 + static_cast<size_t>((2 * rest + 2) / 3) * 4;
+    } else if (format == bmdFormat8BitYUV) {
+        bytes = static_cast<size_t>(width) * 2;
+    }
+    return std::min(bytes, static_cast<size_t>(rowBytes));
+}
+
+FrameVerifier::FrameVerifier(FrameScheduler& scheduler, const std::string& logPath, int audioChannels,
+                             const std::string& statsPrefix)
+    : m_captureStage(scheduler.registerStage(statsPrefix)),
+      m_outputStage(scheduler.registerStage(statsPrefix + "_out")),
+      m_logPath(logPath),
+      m_audioChannels(audioChannels),
+      m_frames(statsValue(statsPrefix + ".frames")),
+      m_mismatches(statsValue(statsPrefix + ".mismatches")),
+      m_modified(statsValue(statsPrefix + ".frames_modified")),
+      m_rowsChanged(statsValue(statsPrefix + ".rows_changed")),
+      m_unverified(statsValue(statsPrefix + ".unverified")) {}
+
+FrameVerifier::~FrameVerifier() {
+    if (m_log) std::fclose(m_log);
+}
+
+bool FrameVerifier::open() {
+    m_log = std::fopen(m_logPath.c_str(), "w");
+    if (!m_log) {
+        std::cerr << "Cannot write verification log " << m_logPath << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    // A minute of lines fits, so the frame path rarely waits on a write.
+    m_logBuffer.resize(256 * 1024);
+    std::setvbuf(m_log, m_logBuffer.data(), _IOFBF, m_logBuffer.size());
+    std::fprintf(m_log, "# picture = CRC32C of the per-row CRC32C of the active bytes; audio = CRC32C of the packet\n");
+    std::fprintf(m_log, "# index stream_frame picture_in picture_out audio_samples audio status\n");
+    std::cout << "Verification log: " << m_logPath << std::endl;
+    return true;
+}
+
+std::shared_ptr<FrameVerifier::Record> FrameVerifier::begin(uint64_t index, BMDTimeValue streamTime,
+                                                            BMDTimeValue duration) {
+    Record* record;
+    {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        if (m_freeRecords.empty()) {
+            record = new Record();
+        } else {
+            record = m_freeRecords.back().release();
+            m_freeRecords.pop_back();
+        }
+    }
+    record->index = index;
+    record->streamTime = streamTime;
+    record->duration = duration;
+    record->audioSamples = 0;
+    record->audioCrc = 0;
+    return std::shared_ptr<Record>(record, [this](Record* released) {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        m_freeRecords.emplace_back(released);
+    });
+}
+
+void FrameVerifier::addAudio(Record& record, const void* samples, uint32_t sampleFrames) {
+    record.audioSamples = sampleFrames;
+    record.audioCrc = crc32c(0, samples, static_cast<size_t>(sampleFrames) * m_audioChannels * sizeof(int16_t));
+}
+
+int FrameVerifier::scheduleCapture(FrameScheduler::Job& job, Record& record, const uint8_t* frame, long rowBytes,
+                                   int width, int height, BMDPixelFormat format) {
+    record.captured.resize(height);
+    uint32_t* rows = record.captured.data();
+    size_t activeBytes = activeRowBytes(width, rowBytes, format);
+    return job.addStage(m_captureStage, height, [frame, rowBytes, activeBytes, rows](int firstRow, int lastRow, int) {
+        rowCrcsFunction()(frame, rowBytes, activeBytes, firstRow, lastRow, rows);
+    });
+}
+
+int FrameVerifier::scheduleOutput(FrameScheduler::Job& job, Record& record, const uint8_t* frame, long rowBytes,
+                                  int width, int height, BMDPixelFormat format, std::initializer_list<int> after) {
+    record.scheduled.resize(height);
+    uint32_t* rows = record.scheduled.data();
+    size_t activeBytes = activeRowBytes(width, rowBytes, format);
+    return job.addStage(m_outputStage, height, [frame, rowBytes, activeBytes, rows](int firstRow, int lastRow, int) {
+        rowCrcsFunction()(frame, rowBytes, activeBytes, firstRow, lastRow, rows);
+    }, after);
+}
+
+void FrameVerifier::finish(const Record& record, bool modified) {
+    m_frames++;
+    uint32_t in = pictureCrc(record.captured);
+    uint32_t out = pictureCrc(record.scheduled);
+    int firstChanged = -1, lastChanged = -1, changed = 0;
+    if (in != out) {
+        for (size_t row = 0; row < record.captured.size() && row < record.scheduled.size(); row++) {
+            if (record.captured[row] == record.scheduled[row]) continue;
+            if (firstChanged < 0) firstChanged = static_cast<int>(row);
+            lastChanged = static_cast<int>(row);
+            changed++;
+        }
+    }
+    int64_t streamFrame = record.duration > 0 ? record.streamTime / record.duration : record.streamTime;
+
+    char status[64] = "ok";
+    if (in != out && modified) {
+        m_modified++;
+        m_rowsChanged += changed;
+        std::snprintf(status, sizeof(status), "modified %d-%d", firstChanged, lastChanged);
+    } else if (in != out) {
+        int64_t mismatches = ++m_mismatches;
+        std::snprintf(status, sizeof(status), "MISMATCH %d-%d", firstChanged, lastChanged);
+        if (mismatches <= kMaxPrintedMismatches) {
+            std::cerr << "Verify: frame " << record.index << " (stream frame " << streamFrame << ") changed between capture and output in "
+                      << changed << " rows, " << firstChanged << "-" << lastChanged
+                      << (mismatches == kMaxPrintedMismatches ? "; further mismatches only in the log" : "") << std::endl;
+        }
+    }
+    if (m_log) {
+        std::lock_guard<std::mutex> lock(m_logMutex);
+        std::fprintf(m_log, "%" PRIu64 " %" PRId64 " %08x %08x %u %08x %s\n", record.index, streamFrame, in, out,
+                     record.audioSamples, record.audioCrc, status);
+    }
+}
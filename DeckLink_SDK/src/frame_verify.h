@@ -0,0 +1,94 @@
+#ifndef FRAME_VERIFY_H
+#define FRAME_VERIFY_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "frame_scheduler.h"
+
+// CRC32C (Castagnoli) of length bytes, continuing from crc (0 to start).
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+
+// Bytes of a row that carry active samples: whole v210 words or 4:2:2 pairs,
+// without the padding up to rowBytes.
+size_t activeRowBytes(int width, long rowBytes, BMDPixelFormat format);
+
+// Bit-exact passthrough verification. Every frame's active picture is
+// checksummed twice as FrameScheduler stages: right after capture, before any
+// other stage has touched it, and again once the last stage that writes to it
+// has run, just before it is scheduled. Each row gets its own CRC32C (SSE4.2,
+// three rows interleaved, table fallback), so a mismatch names the rows that
+// changed; the picture checksum is the CRC32C of the row checksums.
+//
+// Frames nothing was supposed to change must come out identical, and any
+// difference is a mismatch. Frames the denoiser, a LUT or an overlay ran on
+// are expected to differ and are counted as modified, with the band of rows that changed.
+// Audio is scheduled from the capture buffer without processing, so it is
+// checksummed once. One line per frame goes to a sidecar log for offline
+// comparison, e.g. against the log of a loopback capture.
+class FrameVerifier {
+public:
+    struct Record {
+        uint64_t index = 0;
+        BMDTimeValue streamTime = 0;
+        BMDTimeValue duration = 0;
+        uint32_t audioSamples = 0;
+        uint32_t audioCrc = 0;
+        std::vector<uint32_t> captured;
+        std::vector<uint32_t> scheduled;
+    };
+
+    // audioChannels of 16-bit samples, as enabled on the input.
+    FrameVerifier(FrameScheduler& scheduler, const std::string& logPath, int audioChannels = 2,
+                  const std::string& statsPrefix = "verify");
+    ~FrameVerifier();
+    FrameVerifier(const FrameVerifier&) = delete;
+    FrameVerifier& operator=(const FrameVerifier&) = delete;
+
+    // Creates the sidecar log; false if it cannot be written.
+    bool open();
+
+    // A pooled record for one captured frame, returned to the pool when released.
+    std::shared_ptr<Record> begin(uint64_t index, BMDTimeValue streamTime, BMDTimeValue duration);
+    void addAudio(Record& record, const void* samples, uint32_t sampleFrames);
+
+    // Adds the capture checksum to job and returns its stage index; stages
+    // that write to the frame must run after it.
+    int scheduleCapture(FrameScheduler::Job& job, Record& record, const uint8_t* frame, long rowBytes, int width,
+                        int height, BMDPixelFormat format);
+    // Adds the outgoing checksum after the stages in `after` and returns its stage index.
+    int scheduleOutput(FrameScheduler::Job& job, Record& record, const uint8_t* frame, long rowBytes, int width,
+                       int height, BMDPixelFormat format, std::initializer_list<int> after);
+    // Compares the two checksums and logs the frame; call once both stages have run.
+    void finish(const Record& record, bool modified);
+    // A captured frame that could not be checked (not mapped, or an unsupported format).
+    void skipped() { m_unverified++; }
+
+private:
+    static constexpr int kMaxPrintedMismatches = 10;
+
+    int m_captureStage;
+    int m_outputStage;
+    std::string m_logPath;
+    FILE* m_log = nullptr;
+    std::vector<char> m_logBuffer;
+    std::mutex m_logMutex;
+    int m_audioChannels;
+
+    std::mutex m_poolMutex;
+    std::vector<std::unique_ptr<Record>> m_freeRecords;
+
+    std::atomic<int64_t>& m_frames;
+    std::atomic<int64_t>& m_mismatches;
+    std::atomic<int64_t>& m_modified;
+    std::atomic<int64_t>& m_rowsChanged;
+    std::atomic<int64_t>& m_unverified;
+};
+
+#endif // FRAME_VERIFY_H
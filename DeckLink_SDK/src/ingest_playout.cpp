@@ -0,0 +1,427 @@
+#include "ingest_playout.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include "callbacks.h"
+#include "decklink_utils.h"
+#include "stats.h"
+#include "v210.h"
+
+namespace {
+constexpr int64_t kMaxRepeatFrames = 5;
+constexpr size_t kMaxPesSize = 8 * 1024 * 1024;
+}
+
+IngestPlayout::IngestPlayout(JitterBuffer& buffer, IDeckLinkOutput* output, int width, int height,
+                             BMDTimeValue frameDuration, BMDTimeScale timeScale, int64_t latencyNs)
+    : m_buffer(buffer), m_output(output), m_width(width), m_height(height),
+      m_frameDuration(frameDuration), m_timeScale(timeScale), m_latencyNs(latencyNs),
+      m_videoPesCount(statsValue("ingest.video_pes")),
+      m_audioPesCount(statsValue("ingest.audio_pes")),
+      m_framesScheduled(statsValue("ingest.video_frames_scheduled")),
+      m_framesLate(statsValue("ingest.video_frames_late")),
+      m_framesDropped(statsValue("ingest.video_frames_dropped")),
+      m_framesRepeated(statsValue("ingest.video_frames_repeated")),
+      m_audioLate(statsValue("ingest.audio_packets_late")),
+      m_audioDropped(statsValue("ingest.audio_samples_dropped")),
+      m_scheduleErrors(statsValue("ingest.schedule_errors")),
+      m_scheduleSlackUs(statsValue("ingest.schedule_slack_us")) {
+    m_videoPes.data.reserve(2 * 1024 * 1024);
+    m_audioPes.data.reserve(64 * 1024);
+}
+
+IngestPlayout::~IngestPlayout() {
+    stop();
+    if (m_lastFrame) {
+        m_lastFrame->Release();
+    }
+}
+
+void IngestPlayout::start() {
+    if (m_output) {
+        // Playback runs from the start; frames are placed by presentation time.
+        m_output->StartScheduledPlayback(0, m_timeScale, 1.0);
+    }
+    m_running = true;
+    m_thread = std::thread(&IngestPlayout::processLoop, this);
+}
+
+void IngestPlayout::stop() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void IngestPlayout::processLoop() {
+    while (m_running.load()) {
+        TsDatagram* datagram = m_buffer.front();
+        if (!datagram) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        int64_t wait = datagram->releaseNs - monotonicNowNs();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(std::min<int64_t>(wait, 2000000)));
+            continue;
+        }
+        if (m_analyzer) {
+            m_analyzer->feed(datagram->data, datagram->size, datagram->arrivalNs);
+        }
+        for (size_t offset = 0; offset + kTsPacketSize <= datagram->size; offset += kTsPacketSize) {
+            handlePacket(datagram->data + offset);
+        }
+        m_buffer.pop();
+    }
+}
+
+void IngestPlayout::handlePacket(const uint8_t* pkt) {
+    if (pkt[0] != kTsSyncByte || tsTransportError(pkt)) return;
+    uint16_t pid = tsPid(pkt);
+    size_t length;
+    const uint8_t* payload = tsPayload(pkt, length);
+    if (!payload) return;
+
+    // PSI sections are assumed to fit in the packet that starts them, which
+    // holds for the single-programme contribution feeds this path targets.
+    if (pid == kTsPidPat && tsPayloadUnitStart(pkt)) {
+        parsePat(payload, length);
+        return;
+    }
+    if (pid == m_pmtPid && tsPayloadUnitStart(pkt)) {
+        parsePmt(payload, length);
+        return;
+    }
+
+    PesAssembler* pes = pid == m_videoPid ? &m_videoPes : pid == m_audioPid ? &m_audioPes : nullptr;
+    if (!pes) return;
+    if (tsPayloadUnitStart(pkt)) {
+        flushPes(*pes, pes == &m_videoPes);
+        pes->active = true;
+    }
+    if (pes->active && pes->data.size() + length <= kMaxPesSize) {
+        pes->data.insert(pes->data.end(), payload, payload + length);
+    }
+}
+
+void IngestPlayout::parsePat(const uint8_t* payload, size_t length) {
+    size_t pointer = payload[0];
+    if (1 + pointer + 8 > length) return;
+    const uint8_t* section = payload + 1 + pointer;
+    size_t available = length - 1 - pointer;
+    if (section[0] != 0x00) return;
+    size_t sectionLength = ((section[1] & 0x0F) << 8) | section[2];
+    if (sectionLength < 9) return;
+    size_t end = std::min(available, 3 + sectionLength) - 4;
+
+    for (size_t i = 8; i + 4 <= end; i += 4) {
+        uint16_t program = static_cast<uint16_t>((section[i] << 8) | section[i + 1]);
+        uint16_t pid = static_cast<uint16_t>(((section[i + 2] & 0x1F) << 8) | section[i + 3]);
+        if (program != 0) {
+            m_pmtPid = pid;
+            return;
+        }
+    }
+}
+
+void IngestPlayout::parsePmt(const uint8_t* payload, size_t length) {
+    size_t pointer = payload[0];
+    if (1 + pointer + 12 > length) return;
+    const uint8_t* section = payload + 1 + pointer;
+    size_t available = length - 1 - pointer;
+    if (section[0] != 0x02) return;
+    size_t sectionLength = ((section[1] & 0x0F) << 8) | section[2];
+    size_t programInfoLength = ((section[10] & 0x0F) << 8) | section[11];
+    if (sectionLength < 13) return;
+    size_t end = std::min(available, 3 + sectionLength) - 4;
+
+    uint16_t videoPid = kTsPidNull, audioPid = kTsPidNull;
+    uint8_t videoType = 0, audioType = 0;
+    for (size_t i = 12 + programInfoLength; i + 5 <= end;) {
+        uint8_t streamType = section[i];
+        uint16_t pid = static_cast<uint16_t>(((section[i + 1] & 0x1F) << 8) | section[i + 2]);
+        size_t infoLength = ((section[i + 3] & 0x0F) << 8) | section[i + 4];
+        if (videoPid == kTsPidNull && tsIsVideoStreamType(streamType)) {
+            videoPid = pid;
+            videoType = streamType;
+        } else if (audioPid == kTsPidNull && tsIsAudioStreamType(streamType)) {
+            audioPid = pid;
+            audioType = streamType;
+        }
+        i += 5 + infoLength;
+    }
+
+    if (videoPid == m_videoPid && audioPid == m_audioPid) return;
+    m_videoPid = videoPid;
+    m_audioPid = audioPid;
+    m_videoPes = PesAssembler();
+    m_audioPes = PesAssembler();
+    std::cout << "Ingest programme: video PID 0x" << std::hex << videoPid << " (type 0x" << int(videoType)
+              << "), audio PID 0x" << audioPid << " (type 0x" << int(audioType) << ")" << std::dec << std::endl;
+
+#ifdef HAVE_LIBAV
+    m_decoder.reset(new TsDecoder(m_width, m_height));
+    if (videoPid != kTsPidNull && !m_decoder->openVideo(videoType)) {
+        std::cerr << "No decoder for video stream type 0x" << std::hex << int(videoType) << std::dec << std::endl;
+    }
+    if (audioPid != kTsPidNull && !m_decoder->openAudio(audioType)) {
+        std::cerr << "No decoder for audio stream type 0x" << std::hex << int(audioType) << std::dec << std::endl;
+    }
+#endif
+}
+
+void IngestPlayout::flushPes(PesAssembler& pes, bool video) {
+    if (!pes.active) return;
+    pes.active = false;
+    const std::vector<uint8_t>& data = pes.data;
+    if (data.size() < 9 || data[0] != 0x00 || data[1] != 0x00 || data[2] != 0x01) {
+        pes.data.clear();
+        return;
+    }
+    size_t headerEnd = 9 + data[8];
+    int64_t pts = -1;
+    if ((data[7] & 0x80) && data.size() >= 14) {
+        pts = pesReadTimestamp(&data[9]);
+    }
+    if (headerEnd < data.size()) {
+        (video ? m_videoPesCount : m_audioPesCount)++;
+#ifdef HAVE_LIBAV
+        if (m_decoder) {
+            if (video) {
+                m_decoder->decodeVideo(&data[headerEnd], data.size() - headerEnd, pts,
+                                       [this](const DecodedPicture& picture) { schedulePicture(picture); });
+            } else {
+                m_decoder->decodeAudio(&data[headerEnd], data.size() - headerEnd, pts,
+                                       [this](const DecodedAudio& audio) { scheduleAudio(audio); });
+            }
+        }
+#else
+        (void)pts;
+#endif
+    }
+    pes.data.clear();
+}
+
+bool IngestPlayout::presentationTime(int64_t pts, BMDTimeScale scale, BMDTimeValue& target, BMDTimeValue& now) {
+    double speed;
+    if (m_output->GetScheduledStreamTime(scale, &now, &speed) != S_OK) {
+        return false;
+    }
+    if (pts < 0) {
+        return false;
+    }
+    const PcrClock& clock = m_buffer.clock();
+    int64_t presentNs = clock.senderToLocalNs(clock.ptsToSenderNs(pts)) + m_buffer.targetDepthNs() + m_latencyNs;
+    int64_t aheadNs = presentNs - monotonicNowNs();
+    target = now + aheadNs * scale / 1000000000;
+    return true;
+}
+
+void IngestPlayout::scheduleVideo(IDeckLinkMutableVideoFrame* frame, int64_t slot) {
+    // The completion callback drops one reference per scheduled frame.
+    frame->AddRef();
+    if (m_output->ScheduleVideoFrame(frame, slot * m_frameDuration, m_frameDuration, m_timeScale) != S_OK) {
+        frame->Release();
+        m_scheduleErrors++;
+        return;
+    }
+    m_lastSlot = slot;
+    m_framesScheduled++;
+}
+
+#ifdef HAVE_LIBAV
+void IngestPlayout::schedulePicture(const DecodedPicture& picture) {
+    if (!m_output) return;
+
+    BMDTimeValue target = 0, now = 0;
+    int64_t slot;
+    if (presentationTime(picture.pts, m_timeScale, target, now)) {
+        slot = (target + m_frameDuration / 2) / m_frameDuration;
+    } else if (m_lastSlot != INT64_MIN) {
+        slot = m_lastSlot + 1;
+    } else {
+        return;
+    }
+
+    int64_t nowSlot = now / m_frameDuration;
+    if (slot <= nowSlot) {
+        m_framesLate++;
+        return;
+    }
+    if (m_lastSlot != INT64_MIN && slot <= m_lastSlot) {
+        // Sender clock running fast against the card: this slot is taken.
+        m_framesDropped++;
+        return;
+    }
+    m_scheduleSlackUs = (slot - nowSlot) * m_frameDuration * 1000000 / m_timeScale;
+
+    // Sender clock running slow: hold the previous picture over the gap.
+    if (m_lastFrame && m_lastSlot != INT64_MIN && slot - m_lastSlot - 1 <= kMaxRepeatFrames) {
+        while (m_lastSlot + 1 < slot) {
+            scheduleVideo(m_lastFrame, m_lastSlot + 1);
+            m_framesRepeated++;
+        }
+    }
+
+    IDeckLinkMutableVideoFrame* frame = nullptr;
+    long rowBytes = v210RowBytes(m_width);
+    if (m_output->CreateVideoFrame(m_width, m_height, static_cast<int32_t>(rowBytes), bmdFormat10BitYUV,
+                                   bmdFrameFlagDefault, &frame) != S_OK) {
+        m_scheduleErrors++;
+        return;
+    }
+    {
+        ScopedFrameAccess access(frame, bmdBufferAccessWrite);
+        if (!access) {
+            frame->Release();
+            m_scheduleErrors++;
+            return;
+        }
+        uint8_t* bytes = static_cast<uint8_t*>(access.bytes());
+        for (int y = 0; y < m_height; y++) {
+            v210PackRow(picture.planes[0] + y * picture.strides[0],
+                        picture.planes[1] + y * picture.strides[1],
+                        picture.planes[2] + y * picture.strides[2],
+                        m_width, reinterpret_cast<uint32_t*>(bytes + y * rowBytes));
+        }
+    }
+
+    scheduleVideo(frame, slot);
+    if (m_lastFrame) {
+        m_lastFrame->Release();
+    }
+    m_lastFrame = frame;
+}
+
+void IngestPlayout::scheduleAudio(const DecodedAudio& audio) {
+    if (!m_output) return;
+
+    BMDTimeValue target = 0, now = 0;
+    if (!presentationTime(audio.pts, bmdAudioSampleRate48kHz, target, now)) {
+        if (m_nextAudioTime < 0) return;
+        target = m_nextAudioTime;
+    }
+    if (target < now) {
+        m_audioLate++;
+        return;
+    }
+    // The driver may take only part of a packet when its buffer is full; retry
+    // the rest once and count whatever is still left as dropped.
+    uint32_t offset = 0;
+    for (int attempt = 0; attempt < 2 && offset < audio.frameCount; attempt++) {
+        uint32_t written = 0;
+        if (m_output->ScheduleAudioSamples(const_cast<int16_t*>(audio.samples) + offset * 2, audio.frameCount - offset,
+                                           target + offset, bmdAudioSampleRate48kHz, &written) != S_OK ||
+            written == 0) {
+            break;
+        }
+        offset += written;
+    }
+    if (offset < audio.frameCount) m_audioDropped += audio.frameCount - offset;
+    m_nextAudioTime = target + audio.frameCount;
+}
+#endif
+
+int runUdpIngest(const AppOptions& options, const std::atomic<bool>& stopFlag) {
+    BMDDisplayMode selectedMode = bmdModeHD1080i5994;
+    int width = 1920;
+    int height = 1080;
+    BMDTimeValue frameDuration = 1001;
+    BMDTimeScale timeScale = 30000;
+
+    IDeckLink* outputDevice = nullptr;
+    IDeckLinkOutput* output = nullptr;
+    OutputCallback* outputCb = nullptr;
+
+    // Without a decoder nothing would ever be scheduled and the output would underrun.
+    bool noOutput = options.noOutput;
+#ifndef HAVE_LIBAV
+    std::cerr << "Built without libavcodec: ingest runs in monitoring mode only, without a DeckLink output" << std::endl;
+    noOutput = true;
+#endif
+
+    if (!noOutput) {
+        outputDevice = findDeckLinkDevice("DeckLink Duo", 0);
+        if (!outputDevice || !setDeviceProfile(outputDevice, bmdProfileTwoSubDevicesHalfDuplex)) {
+            std::cerr << "Could not find DeckLink Duo output sub-device" << std::endl;
+            if (outputDevice) outputDevice->Release();
+            return 1;
+        }
+        outputDevice->QueryInterface(IID_IDeckLinkOutput, reinterpret_cast<void**>(&output));
+
+        IDeckLinkDisplayMode* displayMode = nullptr;
+        output->GetDisplayMode(selectedMode, &displayMode);
+        if (!displayMode) {
+            std::cerr << "Unsupported display mode" << std::endl;
+            output->Release();
+            outputDevice->Release();
+            return 1;
+        }
+        width = displayMode->GetWidth();
+        height = displayMode->GetHeight();
+        displayMode->GetFrameRate(&frameDuration, &timeScale);
+        displayMode->Release();
+
+        outputCb = new OutputCallback();
+        output->SetScheduledFrameCompletionCallback(outputCb);
+        if (output->EnableVideoOutput(selectedMode, bmdVideoOutputFlagDefault) != S_OK ||
+            output->EnableAudioOutput(bmdAudioSampleRate48kHz, bmdAudioSampleType16bitInteger, 2,
+                                      bmdAudioOutputStreamTimestamped) != S_OK) {
+            std::cerr << "Failed to enable DeckLink output" << std::endl;
+            output->SetScheduledFrameCompletionCallback(nullptr);
+            outputCb->Release();
+            output->Release();
+            outputDevice->Release();
+            return 1;
+        }
+    }
+
+    JitterBuffer buffer(16384, 2000000, static_cast<int64_t>(options.ingestMaxJitterMs) * 1000000);
+    UdpTsReceiver receiver(options.ingestAddress, options.ingestPort, buffer);
+    std::unique_ptr<TsAnalyzer> analyzer;
+    if (options.analyzeIngest) {
+        analyzer.reset(new TsAnalyzer());
+    }
+    int exitCode = 0;
+    {
+        IngestPlayout playout(buffer, output, width, height, frameDuration, timeScale,
+                              static_cast<int64_t>(options.ingestLatencyMs) * 1000000);
+        playout.setAnalyzer(analyzer.get());
+        if (receiver.start()) {
+            std::cout << "UDP ingest listening on " << options.ingestAddress << ":" << options.ingestPort << std::endl;
+            playout.start();
+
+            std::atomic<int64_t>& latePackets = statsValue("ingest.late_packets");
+            std::atomic<int64_t>& jitterUs = statsValue("ingest.arrival_jitter_us");
+            while (!stopFlag.load()) {
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                std::cout << "Ingest: depth " << std::fixed << std::setprecision(1)
+                          << buffer.targetDepthNs() / 1e6 << " ms, queued " << buffer.queued()
+                          << ", jitter " << jitterUs.load() / 1e3 << " ms, late packets " << latePackets.load()
+                          << ", drift " << std::setprecision(2) << buffer.clock().driftPpm() << " ppm"
+                          << (buffer.clock().locked() ? "" : " (unlocked)") << std::endl;
+            }
+            receiver.stop();
+            playout.stop();
+        } else {
+            exitCode = 1;
+        }
+    }
+
+    if (output) {
+        output->StopScheduledPlayback(0, nullptr, timeScale);
+        output->DisableVideoOutput();
+        output->DisableAudioOutput();
+        output->SetScheduledFrameCompletionCallback(nullptr);
+        outputCb->Release();
+        output->Release();
+        outputDevice->Release();
+    }
+
+    std::cout << "Metrics:" << std::endl;
+    StatsRegistry::instance().print(std::cout, "ingest.");
+    if (analyzer) {
+        analyzer->print(std::cout);
+    }
+    return exitCode;
+}
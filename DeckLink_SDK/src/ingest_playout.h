@@ -0,0 +1,94 @@
+#ifndef INGEST_PLAYOUT_H
+#define INGEST_PLAYOUT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "app_options.h"
+#include "ts_analyzer.h"
+#include "udp_ingest.h"
+
+#ifdef HAVE_LIBAV
+#include "ts_decoder.h"
+#endif
+
+// Consumes datagrams released by the jitter buffer, demuxes the first
+// programme's video and audio PES, decodes them and schedules the result on
+// a DeckLink output. Presentation times are PTS mapped through the recovered
+// PCR clock onto CLOCK_MONOTONIC and from there onto the output's scheduled
+// stream time, so sender/card clock drift shows up as dropped or repeated
+// frames rather than a growing or draining output queue.
+class IngestPlayout {
+private:
+    struct PesAssembler {
+        std::vector<uint8_t> data;
+        bool active = false;
+    };
+
+    JitterBuffer& m_buffer;
+    IDeckLinkOutput* m_output;
+    TsAnalyzer* m_analyzer = nullptr;
+    int m_width;
+    int m_height;
+    BMDTimeValue m_frameDuration;
+    BMDTimeScale m_timeScale;
+    int64_t m_latencyNs;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+
+    uint16_t m_pmtPid = kTsPidNull;
+    uint16_t m_videoPid = kTsPidNull;
+    uint16_t m_audioPid = kTsPidNull;
+    PesAssembler m_videoPes;
+    PesAssembler m_audioPes;
+#ifdef HAVE_LIBAV
+    std::unique_ptr<TsDecoder> m_decoder;
+#endif
+
+    int64_t m_lastSlot = INT64_MIN;
+    IDeckLinkMutableVideoFrame* m_lastFrame = nullptr;
+    BMDTimeValue m_nextAudioTime = -1;
+
+    std::atomic<int64_t>& m_videoPesCount;
+    std::atomic<int64_t>& m_audioPesCount;
+    std::atomic<int64_t>& m_framesScheduled;
+    std::atomic<int64_t>& m_framesLate;
+    std::atomic<int64_t>& m_framesDropped;
+    std::atomic<int64_t>& m_framesRepeated;
+    std::atomic<int64_t>& m_audioLate;
+    std::atomic<int64_t>& m_audioDropped;
+    std::atomic<int64_t>& m_scheduleErrors;
+    std::atomic<int64_t>& m_scheduleSlackUs;
+
+    void processLoop();
+    void handlePacket(const uint8_t* pkt);
+    void parsePat(const uint8_t* payload, size_t length);
+    void parsePmt(const uint8_t* payload, size_t length);
+    void flushPes(PesAssembler& pes, bool video);
+    bool presentationTime(int64_t pts, BMDTimeScale scale, BMDTimeValue& target, BMDTimeValue& now);
+    void scheduleVideo(IDeckLinkMutableVideoFrame* frame, int64_t slot);
+#ifdef HAVE_LIBAV
+    void schedulePicture(const DecodedPicture& picture);
+    void scheduleAudio(const DecodedAudio& audio);
+#endif
+
+public:
+    IngestPlayout(JitterBuffer& buffer, IDeckLinkOutput* output, int width, int height,
+                  BMDTimeValue frameDuration, BMDTimeScale timeScale, int64_t latencyNs);
+    ~IngestPlayout();
+
+    // Optional; sees every datagram at its network arrival time.
+    void setAnalyzer(TsAnalyzer* analyzer) { m_analyzer = analyzer; }
+
+    void start();
+    void stop();
+};
+
+// Runs the UDP ingest mode until stopFlag is set; returns the process exit code.
+int runUdpIngest(const AppOptions& options, const std::atomic<bool>& stopFlag);
+
+#endif // INGEST_PLAYOUT_H
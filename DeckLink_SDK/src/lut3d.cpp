@@ -0,0 +1,464 @@
+#include "lut3d.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LUT3D_X86 1
+#endif
+
+namespace {
+constexpr float kReferenceWhiteNits = 203.0f;
+constexpr float kHlgPeakNits = 1000.0f;
+constexpr float kHlgGamma = 1.2f;
+
+const float kRec709To2020[9] = {0.6274f, 0.3293f, 0.0433f, 0.0691f, 0.9195f, 0.0114f, 0.0164f, 0.0880f, 0.8956f};
+const float kRec2020To709[9] = {1.6605f, -0.5876f, -0.0728f, -0.1246f, 1.1329f, -0.0083f, -0.0182f, -0.1006f, 1.1187f};
+
+struct Coefficients {
+    float kr, kb;
+};
+
+Coefficients coefficients(YCbCrMatrix matrix) {
+    return matrix == YCbCrMatrix::Rec2020 ? Coefficients{0.2627f, 0.0593f} : Coefficients{0.2126f, 0.0722f};
+}
+
+void multiply(const float m[9], float rgb[3]) {
+    float r = rgb[0], g = rgb[1], b = rgb[2];
+    rgb[0] = m[0] * r + m[1] * g + m[2] * b;
+    rgb[1] = m[3] * r + m[4] * g + m[5] * b;
+    rgb[2] = m[6] * r + m[7] * g + m[8] * b;
+}
+
+// SDR: BT.1886 display gamma, 1.0 == reference white.
+float sdrToLinear(float v) { return std::pow(std::max(v, 0.0f), 2.4f); }
+float linearToSdr(float l) { return std::pow(std::min(std::max(l, 0.0f), 1.0f), 1.0f / 2.4f); }
+
+// SMPTE ST 2084, in cd/m2.
+float pqToNits(float v) {
+    const float m1 = 0.1593017578125f, m2 = 78.84375f, c1 = 0.8359375f, c2 = 18.8515625f, c3 = 18.6875f;
+    float p = std::pow(std::max(v, 0.0f), 1.0f / m2);
+    return 10000.0f * std::pow(std::max(p - c1, 0.0f) / (c2 - c3 * p), 1.0f / m1);
+}
+float nitsToPq(float nits) {
+    const float m1 = 0.1593017578125f, m2 = 78.84375f, c1 = 0.8359375f, c2 = 18.8515625f, c3 = 18.6875f;
+    float y = std::pow(std::min(std::max(nits, 0.0f) / 10000.0f, 1.0f), m1);
+    return std::pow((c1 + c2 * y) / (1.0f + c3 * y), m2);
+}
+
+// ARIB STD-B67 / BT.2100 HLG, scene light in [0, 1].
+float hlgOetf(float e) {
+    const float a = 0.17883277f, b = 0.28466892f, c = 0.55991073f;
+    e = std::max(e, 0.0f);
+    return e <= 1.0f / 12.0f ? std::sqrt(3.0f * e) : a * std::log(12.0f * e - b) + c;
+}
+float hlgInverseOetf(float v) {
+    const float a = 0.17883277f, b = 0.28466892f, c = 0.55991073f;
+    v = std::max(v, 0.0f);
+    return v <= 0.5f ? v * v / 3.0f : (std::exp((v - c) / a) + b) / 12.0f;
+}
+
+// Soft shoulder above 0.9 of reference white on maxRGB, so hue survives the roll-off.
+void toneMapToSdr(float rgb[3]) {
+    const float knee = 0.9f;
+    for (int i = 0; i < 3; i++) rgb[i] = std::max(rgb[i], 0.0f);
+    float peak = std::max(rgb[0], std::max(rgb[1], rgb[2]));
+    if (peak <= knee) return;
+    float mapped = knee + (1.0f - knee) * (1.0f - std::exp(-(peak - knee) / (1.0f - knee)));
+    for (int i = 0; i < 3; i++) rgb[i] *= mapped / peak;
+}
+
+void applyTransform(ColorTransform transform, float rgb[3]) {
+    switch (transform) {
+    case ColorTransform::Rec709ToRec2020:
+        for (int i = 0; i < 3; i++) rgb[i] = sdrToLinear(rgb[i]);
+        multiply(kRec709To2020, rgb);
+        for (int i = 0; i < 3; i++) rgb[i] = linearToSdr(rgb[i]);
+        break;
+    case ColorTransform::Rec2020ToRec709:
+        for (int i = 0; i < 3; i++) rgb[i] = sdrToLinear(rgb[i]);
+        multiply(kRec2020To709, rgb);
+        for (int i = 0; i < 3; i++) rgb[i] = linearToSdr(rgb[i]);
+        break;
+    case ColorTransform::Rec709ToPq:
+        for (int i = 0; i < 3; i++) rgb[i] = sdrToLinear(rgb[i]) * kReferenceWhiteNits;
+        multiply(kRec709To2020, rgb);
+        for (int i = 0; i < 3; i++) rgb[i] = nitsToPq(rgb[i]);
+        break;
+    case ColorTransform::PqToRec709:
+        for (int i = 0; i < 3; i++) rgb[i] = pqToNits(rgb[i]) / kReferenceWhiteNits;
+        multiply(kRec2020To709, rgb);
+        toneMapToSdr(rgb);
+        for (int i = 0; i < 3; i++) rgb[i] = linearToSdr(rgb[i]);
+        break;
+    case ColorTransform::Rec709ToHlg: {
+        // SDR display light placed on a 1000 cd/m2 HLG display, then the inverse OOTF.
+        for (int i = 0; i < 3; i++) rgb[i] = sdrToLinear(rgb[i]) * kReferenceWhiteNits / kHlgPeakNits;
+        multiply(kRec709To2020, rgb);
+        for (int i = 0; i < 3; i++) rgb[i] = std::max(rgb[i], 0.0f);
+        float yd = 0.2627f * rgb[0] + 0.6780f * rgb[1] + 0.0593f * rgb[2];
+        float ys = std::pow(yd, 1.0f / kHlgGamma);
+        float scale = yd > 0 ? 1.0f / std::pow(ys, kHlgGamma - 1.0f) : 0.0f;
+        for (int i = 0; i < 3; i++) rgb[i] = hlgOetf(rgb[i] * scale);
+        break;
+    }
+    case ColorTransform::HlgToRec709: {
+        for (int i = 0; i < 3; i++) rgb[i] = hlgInverseOetf(rgb[i]);
+        float ys = 0.2627f * rgb[0] + 0.6780f * rgb[1] + 0.0593f * rgb[2];
+        float scale = kHlgPeakNits * std::pow(ys, kHlgGamma - 1.0f) / kReferenceWhiteNits;
+        for (int i = 0; i < 3; i++) rgb[i] *= scale;
+        multiply(kRec2020To709, rgb);
+        toneMapToSdr(rgb);
+        for (int i = 0; i < 3; i++) rgb[i] = linearToSdr(rgb[i]);
+        break;
+    }
+    }
+}
+
+// Tetrahedral interpolation of an RGB cube at normalised coordinates.
+void sampleCube(const CubeLut& cube, const float in[3], float out[3]) {
+    float pos[3];
+    int base[3];
+    float frac[3];
+    for (int i = 0; i < 3; i++) {
+        float range = cube.domainMax[i] - cube.domainMin[i];
+        pos[i] = std::min(std::max((in[i] - cube.domainMin[i]) / (range > 0 ? range : 1.0f), 0.0f), 1.0f) * (cube.size - 1);
+        base[i] = std::min(static_cast<int>(pos[i]), cube.size - 2);
+        frac[i] = pos[i] - base[i];
+    }
+    auto entry = [&](int r, int g, int b) {
+        return &cube.rgb[(static_cast<size_t>(b) * cube.size * cube.size + static_cast<size_t>(g) * cube.size + r) * 3];
+    };
+    // Walk from the base corner along axes in order of decreasing fraction.
+    int order[3] = {0, 1, 2};
+    std::sort(order, order + 3, [&](int a, int b) { return frac[a] > frac[b]; });
+    int corner[3] = {base[0], base[1], base[2]};
+    const float* previous = entry(corner[0], corner[1], corner[2]);
+    for (int c = 0; c < 3; c++) out[c] = previous[c];
+    for (int step = 0; step < 3; step++) {
+        corner[order[step]]++;
+        const float* next = entry(corner[0], corner[1], corner[2]);
+        for (int c = 0; c < 3; c++) out[c] += frac[order[step]] * (next[c] - previous[c]);
+        previous = next;
+    }
+}
+
+inline uint32_t component(uint32_t node, int shift) {
+    return (node >> shift) & 0x3FF;
+}
+
+// Scalar reference for the lattice walk; see Lut3D for the node layout.
+inline void lookupScalar(const uint32_t* nodes, uint32_t& y, uint32_t& cb, uint32_t& cr) {
+    uint32_t fy = y & 31, fb = cb & 31, fr = cr & 31;
+    uint32_t base = (y >> 5) + (cb >> 5) * Lut3D::kStrideCb + (cr >> 5) * Lut3D::kStrideCr;
+    // Ties resolve so that the largest and smallest axes are always distinct.
+    uint32_t maxOffset, minOffset, f1, f3;
+    if (fy >= fb && fy >= fr) { maxOffset = 1; f1 = fy; }
+    else if (fb >= fr) { maxOffset = Lut3D::kStrideCb; f1 = fb; }
+    else { maxOffset = Lut3D::kStrideCr; f1 = fr; }
+    if (fr <= fb && fr <= fy) { minOffset = Lut3D::kStrideCr; f3 = fr; }
+    else if (fb <= fy) { minOffset = Lut3D::kStrideCb; f3 = fb; }
+    else { minOffset = 1; f3 = fy; }
+    uint32_t f2 = fy + fb + fr - f1 - f3;
+    const uint32_t all = 1 + Lut3D::kStrideCb + Lut3D::kStrideCr;
+
+    uint32_t c0 = nodes[base], ca = nodes[base + maxOffset], cab = nodes[base + all - minOffset], c1 = nodes[base + all];
+    uint32_t* outputs[3] = {&y, &cb, &cr};
+    for (int i = 0; i < 3; i++) {
+        int shift = i * 10;
+        int32_t v0 = component(c0, shift), va = component(ca, shift), vab = component(cab, shift), v1 = component(c1, shift);
+        int32_t v = 32 * v0 + static_cast<int32_t>(f1) * (va - v0) + static_cast<int32_t>(f2) * (vab - va) +
+                    static_cast<int32_t>(f3) * (v1 - vab);
+        *outputs[i] = static_cast<uint32_t>((v + 16) >> 5);
+    }
+}
+
+void lookupRowScalar(const uint32_t* nodes, uint32_t* y, uint32_t* cb, uint32_t* cr, int count) {
+    for (int i = 0; i < count; i++) lookupScalar(nodes, y[i], cb[i], cr[i]);
+}
+
+#ifdef LUT3D_X86
+__attribute__((target("avx2")))
+inline __m256i interpolateAvx2(__m256i c0, __m256i ca, __m256i cab, __m256i c1, __m256i f1, __m256i f2, __m256i f3, int shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i mask = _mm256_set1_epi32(0x3FF);
+    __m256i v0 = _mm256_and_si256(_mm256_srl_epi32(c0, count), mask);
+    __m256i va = _mm256_and_si256(_mm256_srl_epi32(ca, count), mask);
+    __m256i vab = _mm256_and_si256(_mm256_srl_epi32(cab, count), mask);
+    __m256i v1 = _mm256_and_si256(_mm256_srl_epi32(c1, count), mask);
+    __m256i v = _mm256_slli_epi32(v0, 5);
+    v = _mm256_add_epi32(v, _mm256_mullo_epi32(f1, _mm256_sub_epi32(va, v0)));
+    v = _mm256_add_epi32(v, _mm256_mullo_epi32(f2, _mm256_sub_epi32(vab, va)));
+    v = _mm256_add_epi32(v, _mm256_mullo_epi32(f3, _mm256_sub_epi32(v1, vab)));
+    return _mm256_srai_epi32(_mm256_add_epi32(v, _mm256_set1_epi32(16)), 5);
+}
+
+__attribute__((target("avx2")))
+void lookupRowAvx2(const uint32_t* nodes, uint32_t* y, uint32_t* cb, uint32_t* cr, int count) {
+    const int* table = reinterpret_cast<const int*>(nodes);
+    const __m256i fracMask = _mm256_set1_epi32(31);
+    const __m256i strideY = _mm256_set1_epi32(1);
+    const __m256i strideCb = _mm256_set1_epi32(Lut3D::kStrideCb);
+    const __m256i strideCr = _mm256_set1_epi32(Lut3D::kStrideCr);
+    const __m256i all = _mm256_set1_epi32(1 + Lut3D::kStrideCb + Lut3D::kStrideCr);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i vy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cb + i));
+        __m256i vr = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cr + i));
+        __m256i fy = _mm256_and_si256(vy, fracMask);
+        __m256i fb = _mm256_and_si256(vb, fracMask);
+        __m256i fr = _mm256_and_si256(vr, fracMask);
+        __m256i base = _mm256_add_epi32(_mm256_srli_epi32(vy, 5),
+                                        _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(vb, 5), strideCb),
+                                                         _mm256_mullo_epi32(_mm256_srli_epi32(vr, 5), strideCr)));
+
+        // Same tie-breaking as lookupScalar: max prefers Y, then Cb; min prefers Cr, then Cb.
+        __m256i yGeB = _mm256_cmpeq_epi32(_mm256_max_epu32(fy, fb), fy);
+        __m256i yGeR = _mm256_cmpeq_epi32(_mm256_max_epu32(fy, fr), fy);
+        __m256i bGeR = _mm256_cmpeq_epi32(_mm256_max_epu32(fb, fr), fb);
+        __m256i maxIsY = _mm256_and_si256(yGeB, yGeR);
+        __m256i maxOffset = _mm256_blendv_epi8(_mm256_blendv_epi8(strideCr, strideCb, bGeR), strideY, maxIsY);
+        __m256i rLeB = bGeR;
+        __m256i rLeY = yGeR;
+        __m256i minIsR = _mm256_and_si256(rLeB, rLeY);
+        __m256i minOffset = _mm256_blendv_epi8(_mm256_blendv_epi8(strideY, strideCb, yGeB), strideCr, minIsR);
+        __m256i f1 = _mm256_max_epu32(fy, _mm256_max_epu32(fb, fr));
+        __m256i f3 = _mm256_min_epu32(fy, _mm256_min_epu32(fb, fr));
+        __m256i f2 = _mm256_sub_epi32(_mm256_add_epi32(fy, _mm256_add_epi32(fb, fr)), _mm256_add_epi32(f1, f3));
+
+        __m256i c0 = _mm256_i32gather_epi32(table, base, 4);
+        __m256i ca = _mm256_i32gather_epi32(table, _mm256_add_epi32(base, maxOffset), 4);
+        __m256i cab = _mm256_i32gather_epi32(table, _mm256_sub_epi32(_mm256_add_epi32(base, all), minOffset), 4);
+        __m256i c1 = _mm256_i32gather_epi32(table, _mm256_add_epi32(base, all), 4);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), interpolateAvx2(c0, ca, cab, c1, f1, f2, f3, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(cb + i), interpolateAvx2(c0, ca, cab, c1, f1, f2, f3, 10));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(cr + i), interpolateAvx2(c0, ca, cab, c1, f1, f2, f3, 20));
+    }
+    lookupRowScalar(nodes, y + i, cb + i, cr + i, count - i);
+}
+#endif
+
+using LookupFn = void (*)(const uint32_t*, uint32_t*, uint32_t*, uint32_t*, int);
+
+LookupFn lookupFunction() {
+#ifdef LUT3D_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2) return lookupRowAvx2;
+#endif
+    return lookupRowScalar;
+}
+}
+
+bool loadCubeFile(const std::string& path, CubeLut& lut) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "Cannot open LUT " << path << std::endl;
+        return false;
+    }
+    lut = CubeLut();
+    std::string line;
+    size_t expected = 0;
+    while (std::getline(file, line)) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') continue;
+        std::istringstream fields(line.substr(start));
+        std::string keyword;
+        fields >> keyword;
+        if (keyword == "TITLE") {
+            continue;
+        } else if (keyword == "LUT_3D_SIZE") {
+            fields >> lut.size;
+            if (lut.size < 2 || lut.size > 256) {
+                std::cerr << "Unsupported LUT_3D_SIZE in " << path << std::endl;
+                return false;
+            }
+            expected = static_cast<size_t>(lut.size) * lut.size * lut.size * 3;
+            lut.rgb.reserve(expected);
+        } else if (keyword == "LUT_1D_SIZE") {
+            std::cerr << "1D LUTs are not supported: " << path << std::endl;
+            return false;
+        } else if (keyword == "DOMAIN_MIN") {
+            fields >> lut.domainMin[0] >> lut.domainMin[1] >> lut.domainMin[2];
+        } else if (keyword == "DOMAIN_MAX") {
+            fields >> lut.domainMax[0] >> lut.domainMax[1] >> lut.domainMax[2];
+        } else if (keyword == "LUT_3D_INPUT_RANGE") {
+            // Resolve's form of the domain: one range for all three channels.
+            float low, high;
+            if (!(fields >> low >> high) || high <= low) {
+                std::cerr << "Malformed LUT_3D_INPUT_RANGE in " << path << std::endl;
+                return false;
+            }
+            for (int c = 0; c < 3; c++) {
+                lut.domainMin[c] = low;
+                lut.domainMax[c] = high;
+            }
+        } else {
+            std::istringstream values(line.substr(start));
+            float r, g, b;
+            if (!(values >> r >> g >> b)) {
+                std::cerr << "Malformed line in " << path << ": " << line << std::endl;
+                return false;
+            }
+            lut.rgb.push_back(r);
+            lut.rgb.push_back(g);
+            lut.rgb.push_back(b);
+        }
+    }
+    if (lut.size == 0 || lut.rgb.size() != expected) {
+        std::cerr << "Incomplete 3D LUT in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+CubeLut generateCubeLut(ColorTransform transform, int size) {
+    CubeLut lut;
+    lut.size = size;
+    lut.rgb.resize(static_cast<size_t>(size) * size * size * 3);
+    float* out = lut.rgb.data();
+    for (int b = 0; b < size; b++) {
+        for (int g = 0; g < size; g++) {
+            for (int r = 0; r < size; r++) {
+                float rgb[3] = {static_cast<float>(r) / (size - 1), static_cast<float>(g) / (size - 1),
+                                static_cast<float>(b) / (size - 1)};
+                applyTransform(transform, rgb);
+                for (int c = 0; c < 3; c++) *out++ = std::min(std::max(rgb[c], 0.0f), 1.0f);
+            }
+        }
+    }
+    return lut;
+}
+
+bool parseColorTransform(const std::string& name, ColorTransform& transform) {
+    static const struct {
+        const char* name;
+        ColorTransform transform;
+    } kNames[] = {
+        {"709-to-2020", ColorTransform::Rec709ToRec2020}, {"2020-to-709", ColorTransform::Rec2020ToRec709},
+        {"709-to-pq", ColorTransform::Rec709ToPq},        {"pq-to-709", ColorTransform::PqToRec709},
+        {"709-to-hlg", ColorTransform::Rec709ToHlg},      {"hlg-to-709", ColorTransform::HlgToRec709},
+    };
+    for (const auto& entry : kNames) {
+        if (name == entry.name) {
+            transform = entry.transform;
+            return true;
+        }
+    }
+    return false;
+}
+
+YCbCrMatrix inputMatrix(ColorTransform transform) {
+    switch (transform) {
+    case ColorTransform::Rec2020ToRec709:
+    case ColorTransform::PqToRec709:
+    case ColorTransform::HlgToRec709:
+        return YCbCrMatrix::Rec2020;
+    default:
+        return YCbCrMatrix::Rec709;
+    }
+}
+
+YCbCrMatrix outputMatrix(ColorTransform transform) {
+    return inputMatrix(transform) == YCbCrMatrix::Rec709 ? YCbCrMatrix::Rec2020 : YCbCrMatrix::Rec709;
+}
+
+std::shared_ptr<const Lut3D> Lut3D::fromCube(const CubeLut& cube, YCbCrMatrix in, YCbCrMatrix out) {
+    if (cube.size < 2) return nullptr;
+    Coefficients ci = coefficients(in), co = coefficients(out);
+    std::shared_ptr<Lut3D> lut(new Lut3D());
+    lut->m_nodes.resize(static_cast<size_t>(kNodes) * kNodes * kNodes);
+    for (int r = 0; r < kNodes; r++) {
+        for (int b = 0; b < kNodes; b++) {
+            for (int y = 0; y < kNodes; y++) {
+                // Limited-range 10-bit Y'CbCr at this node -> R'G'B'.
+                float yn = (y * 32.0f - 64.0f) / 876.0f;
+                float pb = (b * 32.0f - 512.0f) / 896.0f;
+                float pr = (r * 32.0f - 512.0f) / 896.0f;
+                float rgb[3];
+                rgb[0] = yn + 2.0f * (1.0f - ci.kr) * pr;
+                rgb[2] = yn + 2.0f * (1.0f - ci.kb) * pb;
+                rgb[1] = (yn - ci.kr * rgb[0] - ci.kb * rgb[2]) / (1.0f - ci.kr - ci.kb);
+                for (int c = 0; c < 3; c++) rgb[c] = std::min(std::max(rgb[c], 0.0f), 1.0f);
+
+                float mapped[3];
+                sampleCube(cube, rgb, mapped);
+                float luma = co.kr * mapped[0] + (1.0f - co.kr - co.kb) * mapped[1] + co.kb * mapped[2];
+                float codes[3] = {
+                    64.0f + 876.0f * luma,
+                    512.0f + 896.0f * (mapped[2] - luma) / (2.0f * (1.0f - co.kb)),
+                    512.0f + 896.0f * (mapped[0] - luma) / (2.0f * (1.0f - co.kr)),
+                };
+                uint32_t node = 0;
+                for (int c = 0; c < 3; c++) {
+                    uint32_t code = static_cast<uint32_t>(std::min(std::max(std::lround(codes[c]), 4L), 1019L));
+                    node |= code << (10 * c);
+                }
+                lut->m_nodes[static_cast<size_t>(r) * kStrideCr + static_cast<size_t>(b) * kStrideCb + y] = node;
+            }
+        }
+    }
+    return lut;
+}
+
+void Lut3D::applyRow(uint32_t* row, int width, Scratch& scratch) const {
+    // Whole v210 groups; rows are padded so the last group is always present.
+    int padded = (width + 5) / 6 * 6;
+    scratch.y.resize(padded);
+    scratch.cb.resize(padded);
+    scratch.cr.resize(padded);
+    uint32_t* y = scratch.y.data();
+    uint32_t* cb = scratch.cb.data();
+    uint32_t* cr = scratch.cr.data();
+
+    // Each pixel of a pair is looked up with the shared chroma.
+    const uint32_t* src = row;
+    for (int x = 0; x < padded; x += 6, src += 4) {
+        uint32_t w0 = src[0], w1 = src[1], w2 = src[2], w3 = src[3];
+        cb[x] = cb[x + 1] = w0 & 0x3FF;            y[x] = (w0 >> 10) & 0x3FF;             cr[x] = cr[x + 1] = (w0 >> 20) & 0x3FF;
+        y[x + 1] = w1 & 0x3FF;                     cb[x + 2] = cb[x + 3] = (w1 >> 10) & 0x3FF; y[x + 2] = (w1 >> 20) & 0x3FF;
+        cr[x + 2] = cr[x + 3] = w2 & 0x3FF;        y[x + 3] = (w2 >> 10) & 0x3FF;         cb[x + 4] = cb[x + 5] = (w2 >> 20) & 0x3FF;
+        y[x + 4] = w3 & 0x3FF;                     cr[x + 4] = cr[x + 5] = (w3 >> 10) & 0x3FF; y[x + 5] = (w3 >> 20) & 0x3FF;
+    }
+
+    static const LookupFn lookup = lookupFunction();
+    lookup(m_nodes.data(), y, cb, cr, padded);
+
+    uint32_t* dst = row;
+    for (int x = 0; x < padded; x += 6, dst += 4) {
+        uint32_t cb0 = (cb[x] + cb[x + 1] + 1) >> 1, cb1 = (cb[x + 2] + cb[x + 3] + 1) >> 1, cb2 = (cb[x + 4] + cb[x + 5] + 1) >> 1;
+        uint32_t cr0 = (cr[x] + cr[x + 1] + 1) >> 1, cr1 = (cr[x + 2] + cr[x + 3] + 1) >> 1, cr2 = (cr[x + 4] + cr[x + 5] + 1) >> 1;
+        dst[0] = cb0 | (y[x] << 10) | (cr0 << 20);
+        dst[1] = y[x + 1] | (cb1 << 10) | (y[x + 2] << 20);
+        dst[2] = cr1 | (y[x + 3] << 10) | (cb2 << 20);
+        dst[3] = y[x + 4] | (cr2 << 10) | (y[x + 5] << 20);
+    }
+}
+
+LutStage::LutStage(FrameScheduler& scheduler, const std::string& statsPrefix)
+    : m_stage(scheduler.registerStage(statsPrefix)),
+      m_scratch(scheduler.workers()),
+      m_frames(statsValue(statsPrefix + ".frames")) {}
+
+void LutStage::setLut(std::shared_ptr<const Lut3D> lut) {
+    std::atomic_store(&m_lut, std::move(lut));
+}
+
+int LutStage::schedule(FrameScheduler::Job& job, uint8_t* frame, long rowBytes, int width, int height,
+                       std::initializer_list<int> after) {
+    std::shared_ptr<const Lut3D> lut = std::atomic_load(&m_lut);
+    if (!lut) return -1;
+    const Lut3D* active = lut.get();
+    job.retain(std::move(lut));
+    m_frames++;
+    return job.addStage(m_stage, height, [this, active, frame, rowBytes, width](int firstRow, int lastRow, int worker) {
+        for (int row = firstRow; row < lastRow; row++) {
+            active->applyRow(reinterpret_cast<uint32_t*>(frame + static_cast<size_t>(row) * rowBytes), width, m_scratch[worker]);
+        }
+    }, after);
+}
@@ -0,0 +1,86 @@
+#ifndef LUT3D_H
+#define LUT3D_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "frame_scheduler.h"
+
+// R'G'B' -> R'G'B' lattice as found in .cube files: size^3 entries with red
+// varying fastest, inputs normalised to [0, 1] over the domain.
+struct CubeLut {
+    int size = 0;
+    std::vector<float> rgb;
+    float domainMin[3] = {0.0f, 0.0f, 0.0f};
+    float domainMax[3] = {1.0f, 1.0f, 1.0f};
+};
+
+enum class ColorTransform {
+    Rec709ToRec2020,
+    Rec2020ToRec709,
+    Rec709ToPq,
+    PqToRec709,
+    Rec709ToHlg,
+    HlgToRec709,
+};
+
+enum class YCbCrMatrix { Rec709, Rec2020 };
+
+bool loadCubeFile(const std::string& path, CubeLut& lut);
+// Standard conversions with SDR reference white at 203 cd/m2 (BT.2408).
+CubeLut generateCubeLut(ColorTransform transform, int size = 33);
+bool parseColorTransform(const std::string& name, ColorTransform& transform);
+YCbCrMatrix inputMatrix(ColorTransform transform);
+YCbCrMatrix outputMatrix(ColorTransform transform);
+
+// A cube resampled once into a 10-bit Y'CbCr -> Y'CbCr lattice, so frames are
+// transformed without per-pixel matrices. Nodes sit every 32 code values
+// (33 per axis) so index and fraction are shifts; each node packs Y, Cb and
+// Cr into one 32-bit word like v210, letting AVX2 fetch a whole vertex with a
+// single gather. Y is the fastest-varying axis because neighbouring pixels
+// differ mostly in luma, which keeps successive lookups in the same lines;
+// the whole table is 144 KB and stays in L2.
+class Lut3D {
+public:
+    static constexpr int kNodes = 33;
+    static constexpr int kStrideCb = kNodes;
+    static constexpr int kStrideCr = kNodes * kNodes;
+
+    static std::shared_ptr<const Lut3D> fromCube(const CubeLut& cube, YCbCrMatrix in, YCbCrMatrix out);
+
+    // Transforms one v210 row in place; scratch is reused between calls.
+    struct Scratch {
+        std::vector<uint32_t> y, cb, cr;
+    };
+    void applyRow(uint32_t* row, int width, Scratch& scratch) const;
+
+    const uint32_t* nodes() const { return m_nodes.data(); }
+
+private:
+    std::vector<uint32_t> m_nodes;
+    Lut3D() = default;
+};
+
+// Applies the current Lut3D to v210 frames as a FrameScheduler stage, one row
+// slice per task. setLut() may be called from any thread and takes effect on
+// the next frame.
+class LutStage {
+private:
+    int m_stage;
+    std::shared_ptr<const Lut3D> m_lut;
+    std::vector<Lut3D::Scratch> m_scratch;
+
+    std::atomic<int64_t>& m_frames;
+
+public:
+    explicit LutStage(FrameScheduler& scheduler, const std::string& statsPrefix = "lut");
+
+    void setLut(std::shared_ptr<const Lut3D> lut);
+    // Adds the transform to job and returns its stage index, or -1 without a LUT.
+    int schedule(FrameScheduler::Job& job, uint8_t* frame, long rowBytes, int width, int height,
+                 std::initializer_list<int> after = {});
+};
+
+#endif // LUT3D_H
@@ -0,0 +1,586 @@
+#include "multiviewer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include "decklink_utils.h"
+#include "stats.h"
+#include "v210.h"
+
+namespace {
+constexpr uint16_t kBlackY = 64;
+constexpr uint16_t kNeutralC = 512;
+constexpr uint16_t kLabelY = 940;
+
+// 5x7 glyphs, one byte per row with bit 4 as the leftmost column.
+const uint8_t kDigits[10][7] = {
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+};
+const uint8_t kLetters[26][7] = {
+    {0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11}, {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E},
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C},
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11},
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C},
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F},
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11},
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10},
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11},
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04},
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11},
+    {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F},
+};
+const uint8_t kDash[7] = {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00};
+const uint8_t kColon[7] = {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00};
+const uint8_t kDot[7] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C};
+const uint8_t kSlash[7] = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00};
+const uint8_t kBlank[7] = {};
+
+const uint8_t* glyph(char c) {
+    if (c >= '0' && c <= '9') return kDigits[c - '0'];
+    if (c >= 'A' && c <= 'Z') return kLetters[c - 'A'];
+    if (c >= 'a' && c <= 'z') return kLetters[c - 'a'];
+    switch (c) {
+    case '-': return kDash;
+    case ':': return kColon;
+    case '.': return kDot;
+    case '/': return kSlash;
+    default: return kBlank;
+    }
+}
+
+// Adds one v210 row into 32-bit column sums without an intermediate planar row.
+void accumulateV210Row(const uint32_t* src, int width, uint32_t* y, uint32_t* cb, uint32_t* cr) {
+    int x = 0;
+    for (; x + 6 <= width; x += 6, src += 4) {
+        uint32_t w0 = src[0], w1 = src[1], w2 = src[2], w3 = src[3];
+        int c = x / 2;
+        cb[c] += w0 & 0x3FF;          y[x] += (w0 >> 10) & 0x3FF;      cr[c] += (w0 >> 20) & 0x3FF;
+        y[x + 1] += w1 & 0x3FF;       cb[c + 1] += (w1 >> 10) & 0x3FF; y[x + 2] += (w1 >> 20) & 0x3FF;
+        cr[c + 1] += w2 & 0x3FF;      y[x + 3] += (w2 >> 10) & 0x3FF;  cb[c + 2] += (w2 >> 20) & 0x3FF;
+        y[x + 4] += w3 & 0x3FF;       cr[c + 2] += (w3 >> 10) & 0x3FF; y[x + 5] += (w3 >> 20) & 0x3FF;
+    }
+    if (x < width) {
+        uint16_t ys[6], cbs[3], crs[3];
+        v210UnpackRow(src, 6, ys, cbs, crs);
+        for (int i = 0; x + i < width; i++) y[x + i] += ys[i];
+        for (int i = 0; x / 2 + i < (width + 1) / 2; i++) {
+            cb[x / 2 + i] += cbs[i];
+            cr[x / 2 + i] += crs[i];
+        }
+    }
+}
+
+void fillBlack(IDeckLinkMutableVideoFrame* frame) {
+    ScopedFrameAccess access(frame, bmdBufferAccessWrite);
+    if (!access) return;
+    int width = static_cast<int>(frame->GetWidth());
+    std::vector<uint16_t> y(width, kBlackY), c((width + 1) / 2, kNeutralC);
+    for (long row = 0; row < frame->GetHeight(); row++) {
+        v210PackRow(y.data(), c.data(), c.data(), width,
+                    reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(access.bytes()) + row * frame->GetRowBytes()));
+    }
+}
+}
+
+MultiviewerInput::MultiviewerInput(IDeckLinkInput* input, const std::string& statsPrefix)
+    : m_input(input),
+      m_framesReceived(statsValue(statsPrefix + ".frames_received")),
+      m_formatChanges(statsValue(statsPrefix + ".format_changes")) {}
+
+MultiviewerInput::~MultiviewerInput() {
+    IDeckLinkVideoInputFrame* frame = m_latest.exchange(nullptr);
+    if (frame) frame->Release();
+}
+
+HRESULT MultiviewerInput::QueryInterface(REFIID iid, LPVOID *ppv) {
+    if (!ppv) return E_INVALIDARG;
+    *ppv = nullptr;
+    if (memcmp(&iid, &kIID_IDeckLinkInputCallback, sizeof(REFIID)) == 0 ||
+        memcmp(&iid, &kIID_IUnknown, sizeof(REFIID)) == 0) {
+        *ppv = static_cast<IDeckLinkInputCallback*>(this);
+        AddRef();
+        return S_OK;
+    }
+    return E_NOINTERFACE;
+}
+
+ULONG MultiviewerInput::AddRef() {
+    return ++refCount;
+}
+
+ULONG MultiviewerInput::Release() {
+    ULONG newRef = --refCount;
+    if (newRef == 0) {
+        delete this;
+        return 0;
+    }
+    return newRef;
+}
+
+HRESULT MultiviewerInput::VideoInputFormatChanged(BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode* mode, BMDDetectedVideoInputFormatFlags flags) {
+    (void)flags;
+    if (!(events & bmdVideoInputDisplayModeChanged) || !mode) {
+        return S_OK;
+    }
+    // Always capture v210; the card converts RGB sources.
+    m_input->PauseStreams();
+    m_input->EnableVideoInput(mode->GetDisplayMode(), bmdFormat10BitYUV, bmdVideoInputEnableFormatDetection);
+    m_input->FlushStreams();
+    m_input->StartStreams();
+    m_formatChanges++;
+    return S_OK;
+}
+
+HRESULT MultiviewerInput::VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket) {
+    (void)audioPacket;
+    if (!videoFrame) return S_OK;
+    videoFrame->AddRef();
+    IDeckLinkVideoInputFrame* previous = m_latest.exchange(videoFrame);
+    if (previous) previous->Release();
+    m_framesReceived++;
+    return S_OK;
+}
+
+IDeckLinkVideoInputFrame* MultiviewerInput::takeLatest() {
+    return m_latest.exchange(nullptr);
+}
+
+Multiviewer::Multiviewer(IDeckLinkOutput* output, FrameScheduler& scheduler, int width, int height,
+                         BMDTimeValue frameDuration, BMDTimeScale timeScale, int columns, int rows)
+    : m_output(output), m_scheduler(scheduler), m_scratch(scheduler.workers()), m_width(width), m_height(height), m_frameDuration(frameDuration),
+      m_timeScale(timeScale), m_columns(columns), m_rows(rows),
+      m_framesComposed(statsValue("multiviewer.frames_composed")),
+      m_framesLate(statsValue("multiviewer.frames_late")),
+      m_framesDropped(statsValue("multiviewer.frames_dropped")),
+      m_framesSkipped(statsValue("multiviewer.frames_skipped")),
+      m_composeUs(statsValue("multiviewer.compose_us")),
+      m_composeMaxUs(statsValue("multiviewer.compose_max_us")),
+      m_composeErrors(statsValue("multiviewer.compose_errors")) {}
+
+Multiviewer::~Multiviewer() {
+    stop();
+    for (int i = 0; i < kPoolSize; i++) {
+        if (m_pool[i]) m_pool[i]->Release();
+    }
+}
+
+void Multiviewer::addInput(MultiviewerInput* input, const std::string& label) {
+    std::unique_ptr<Tile> tile(new Tile());
+    std::string prefix = "multiviewer.tile" + std::to_string(m_tiles.size());
+    tile->input = input;
+    tile->label = label;
+    tile->stage = m_scheduler.registerStage("tile" + std::to_string(m_tiles.size()));
+    tile->newFrames = &statsValue(prefix + ".new_frames");
+    tile->repeatedFrames = &statsValue(prefix + ".repeated_frames");
+    tile->noSignal = &statsValue(prefix + ".no_signal");
+    m_tiles.push_back(std::move(tile));
+}
+
+bool Multiviewer::start() {
+    if (m_tiles.empty()) return false;
+
+    int count = static_cast<int>(m_tiles.size());
+    if (m_columns <= 0) m_columns = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(count))));
+    if (m_rows <= 0) m_rows = (count + m_columns - 1) / m_columns;
+    // Cells start on v210 group boundaries (6 pixels) so tiles pack without read-modify-write.
+    int cellWidth = m_width / m_columns / 6 * 6;
+    int cellHeight = m_height / m_rows;
+    for (int i = 0; i < count && i < m_columns * m_rows; i++) {
+        Tile& tile = *m_tiles[i];
+        tile.x = (i % m_columns) * cellWidth + 6;
+        tile.y = (i / m_columns) * cellHeight + 4;
+        tile.width = cellWidth - 12;
+        tile.height = cellHeight - 8;
+    }
+    m_tiles.resize(std::min(count, m_columns * m_rows));
+    for (Scratch& scratch : m_scratch) {
+        scratch.outY.resize(cellWidth);
+        scratch.outCb.resize(cellWidth / 2);
+        scratch.outCr.resize(cellWidth / 2);
+    }
+
+    for (int i = 0; i < kPoolSize; i++) {
+        if (m_output->CreateVideoFrame(m_width, m_height, static_cast<int32_t>(v210RowBytes(m_width)),
+                                       bmdFormat10BitYUV, bmdFrameFlagDefault, &m_pool[i]) != S_OK) {
+            std::cerr << "Failed to create multiviewer output frame" << std::endl;
+            return false;
+        }
+        fillBlack(m_pool[i]);
+    }
+
+    m_running = true;
+
+    // Preroll all but one frame, then let completions drive the cadence.
+    for (int i = 0; i < kPoolSize - 1; i++) {
+        composeFrame(i);
+    }
+    m_freeFrames.push_back(kPoolSize - 1);
+    m_output->StartScheduledPlayback(0, m_timeScale, 1.0);
+    m_thread = std::thread(&Multiviewer::composeLoop, this);
+    return true;
+}
+
+void Multiviewer::stop() {
+    if (!m_running.exchange(false)) return;
+    m_poolReady.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+    for (auto& tile : m_tiles) {
+        if (tile->current) {
+            tile->current->Release();
+            tile->current = nullptr;
+        }
+    }
+}
+
+void Multiviewer::composeLoop() {
+    while (m_running.load()) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(m_poolMutex);
+            m_poolReady.wait(lock, [this] { return !m_running.load() || !m_freeFrames.empty(); });
+            if (!m_running.load()) break;
+            index = m_freeFrames.back();
+            m_freeFrames.pop_back();
+        }
+        if (!composeFrame(index)) {
+            // The frame stays free, so back off for a frame period instead of retrying at once.
+            m_composeErrors++;
+            std::unique_lock<std::mutex> lock(m_poolMutex);
+            m_freeFrames.push_back(index);
+            m_poolReady.wait_for(lock, std::chrono::nanoseconds(m_frameDuration * 1000000000 / m_timeScale),
+                                 [this] { return !m_running.load(); });
+        }
+    }
+}
+
+bool Multiviewer::composeFrame(int poolIndex) {
+    IDeckLinkMutableVideoFrame* frame = m_pool[poolIndex];
+    for (auto& tile : m_tiles) {
+        IDeckLinkVideoInputFrame* latest = tile->input->takeLatest();
+        if (latest) {
+            if (tile->current) tile->current->Release();
+            tile->current = latest;
+            (*tile->newFrames)++;
+        } else {
+            (*tile->repeatedFrames)++;
+        }
+    }
+
+    int64_t startNs = monotonicNowNs();
+    {
+        ScopedFrameAccess access(frame, bmdBufferAccessReadAndWrite);
+        if (!access) return false;
+        uint8_t* target = static_cast<uint8_t*>(access.bytes());
+        long targetRowBytes = frame->GetRowBytes();
+        FrameScheduler::Job* job = m_scheduler.newJob();
+        for (auto& tile : m_tiles) {
+            prepareTile(*tile);
+            Tile* t = tile.get();
+            job->addStage(t->stage, t->height, [this, t, target, targetRowBytes](int firstRow, int lastRow, int worker) {
+                composeTileRows(*t, target, targetRowBytes, firstRow, lastRow, m_scratch[worker]);
+            });
+        }
+        m_scheduler.wait(m_scheduler.submit(job));
+        for (auto& tile : m_tiles) tile->access.reset();
+    }
+    int64_t elapsedUs = (monotonicNowNs() - startNs) / 1000;
+    m_composeUs.store(elapsedUs);
+    if (elapsedUs > m_composeMaxUs.load()) m_composeMaxUs.store(elapsedUs);
+
+    // If composing fell behind playback, jump ahead instead of scheduling frames that are already late.
+    BMDTimeValue streamTime;
+    double speed;
+    if (m_output->GetScheduledStreamTime(m_timeScale, &streamTime, &speed) == S_OK && speed > 0 &&
+        m_nextTime <= streamTime) {
+        BMDTimeValue resumeTime = (streamTime / m_frameDuration + 2) * m_frameDuration;
+        m_framesSkipped += (resumeTime - m_nextTime) / m_frameDuration;
+        m_nextTime = resumeTime;
+    }
+    if (m_output->ScheduleVideoFrame(frame, m_nextTime, m_frameDuration, m_timeScale) != S_OK) {
+        return false;
+    }
+    m_nextTime += m_frameDuration;
+    m_framesComposed++;
+    return true;
+}
+
+void Multiviewer::prepareTile(Tile& tile) {
+    IDeckLinkVideoInputFrame* frame = tile.current;
+    bool signal = frame && !(frame->GetFlags() & bmdFrameHasNoInputSource) &&
+                  frame->GetPixelFormat() == bmdFormat10BitYUV;
+    tile.source = nullptr;
+    if (signal) {
+        tile.access.reset(new ScopedFrameAccess(frame, bmdBufferAccessRead));
+        tile.source = static_cast<const uint8_t*>(tile.access->bytes());
+        signal = tile.source != nullptr;
+    }
+    tile.noSignal->store(signal ? 0 : 1);
+    tile.text = signal ? tile.label : tile.label + " - NO SIGNAL";
+    if (!signal) return;
+
+    int sourceWidth = static_cast<int>(frame->GetWidth());
+    int sourceHeight = static_cast<int>(frame->GetHeight());
+    tile.sourceRowBytes = frame->GetRowBytes();
+    int chromaWidth = tile.width / 2;
+    if (tile.sourceWidth != sourceWidth || tile.sourceHeight != sourceHeight) {
+        tile.sourceWidth = sourceWidth;
+        tile.sourceHeight = sourceHeight;
+        tile.lumaBegin.resize(tile.width + 1);
+        tile.chromaBegin.resize(chromaWidth + 1);
+        for (int x = 0; x <= tile.width; x++) tile.lumaBegin[x] = static_cast<int>(static_cast<int64_t>(x) * sourceWidth / tile.width);
+        for (int x = 0; x <= chromaWidth; x++) tile.chromaBegin[x] = static_cast<int>(static_cast<int64_t>(x) * (sourceWidth / 2) / chromaWidth);
+        // Reciprocals for every possible box area, so averaging needs no divides.
+        int maxArea = (sourceWidth / tile.width + 2) * (sourceHeight / tile.height + 2);
+        tile.reciprocal.resize(maxArea + 1);
+        for (int n = 1; n <= maxArea; n++) tile.reciprocal[n] = ((1u << 24) + n / 2) / n;
+    }
+    for (Scratch& scratch : m_scratch) {
+        if (scratch.sumY.size() < static_cast<size_t>(sourceWidth)) {
+            scratch.sumY.resize(sourceWidth);
+            scratch.sumCb.resize((sourceWidth + 1) / 2);
+            scratch.sumCr.resize((sourceWidth + 1) / 2);
+        }
+    }
+}
+
+void Multiviewer::composeTileRows(Tile& tile, uint8_t* target, long targetRowBytes, int firstRow, int lastRow,
+                                  Scratch& scratch) {
+    bool signal = tile.source != nullptr;
+    const uint8_t* source = tile.source;
+    long sourceRowBytes = tile.sourceRowBytes;
+    int sourceWidth = tile.sourceWidth;
+    int sourceHeight = tile.sourceHeight;
+    int chromaWidth = tile.width / 2;
+    const std::string& label = tile.text;
+    int scale = std::max(1, tile.height / 180);
+    int labelHeight = 11 * scale;
+    int labelTop = tile.height - labelHeight;
+
+    for (int oy = firstRow; oy < lastRow; oy++) {
+        if (signal) {
+            // Box filter: average the source rows and columns that fall inside each output sample.
+            int sy0 = static_cast<int>(static_cast<int64_t>(oy) * sourceHeight / tile.height);
+            int sy1 = std::max(sy0 + 1, static_cast<int>(static_cast<int64_t>(oy + 1) * sourceHeight / tile.height));
+            std::fill(scratch.sumY.begin(), scratch.sumY.end(), 0);
+            std::fill(scratch.sumCb.begin(), scratch.sumCb.end(), 0);
+            std::fill(scratch.sumCr.begin(), scratch.sumCr.end(), 0);
+            for (int sy = sy0; sy < sy1; sy++) {
+                accumulateV210Row(reinterpret_cast<const uint32_t*>(source + sy * sourceRowBytes), sourceWidth,
+                                  scratch.sumY.data(), scratch.sumCb.data(), scratch.sumCr.data());
+            }
+            int rows = sy1 - sy0;
+            for (int ox = 0; ox < tile.width; ox++) {
+                int begin = tile.lumaBegin[ox], end = std::max(begin + 1, tile.lumaBegin[ox + 1]);
+                uint32_t sum = 0;
+                for (int x = begin; x < end; x++) sum += scratch.sumY[x];
+                uint64_t scale = tile.reciprocal[(end - begin) * rows];
+                scratch.outY[ox] = static_cast<uint16_t>((sum * scale + (1u << 23)) >> 24);
+            }
+            for (int ox = 0; ox < chromaWidth; ox++) {
+                int begin = tile.chromaBegin[ox], end = std::max(begin + 1, tile.chromaBegin[ox + 1]);
+                uint32_t sumCb = 0, sumCr = 0;
+                for (int x = begin; x < end; x++) {
+                    sumCb += scratch.sumCb[x];
+                    sumCr += scratch.sumCr[x];
+                }
+                uint64_t scale = tile.reciprocal[(end - begin) * rows];
+                scratch.outCb[ox] = static_cast<uint16_t>((sumCb * scale + (1u << 23)) >> 24);
+                scratch.outCr[ox] = static_cast<uint16_t>((sumCr * scale + (1u << 23)) >> 24);
+            }
+        } else {
+            std::fill(scratch.outY.begin(), scratch.outY.end(), kBlackY);
+            std::fill(scratch.outCb.begin(), scratch.outCb.end(), kNeutralC);
+            std::fill(scratch.outCr.begin(), scratch.outCr.end(), kNeutralC);
+        }
+
+        if (oy >= labelTop) {
+            // Darkened strip with the label in white, 2 * scale rows of padding above the glyphs.
+            for (int x = 0; x < tile.width; x++) scratch.outY[x] = static_cast<uint16_t>(kBlackY + (scratch.outY[x] - kBlackY) / 4);
+            for (int x = 0; x < chromaWidth; x++) {
+                scratch.outCb[x] = static_cast<uint16_t>(kNeutralC + (scratch.outCb[x] - kNeutralC) / 4);
+                scratch.outCr[x] = static_cast<uint16_t>(kNeutralC + (scratch.outCr[x] - kNeutralC) / 4);
+            }
+            int glyphRow = (oy - labelTop - 2 * scale) / scale;
+            if (oy - labelTop >= 2 * scale && glyphRow < 7) {
+                for (size_t i = 0; i < label.size(); i++) {
+                    uint8_t bits = glyph(label[i])[glyphRow];
+                    int charX = 3 * scale + static_cast<int>(i) * 6 * scale;
+                    for (int column = 0; column < 5; column++) {
+                        if (!(bits & (0x10 >> column))) continue;
+                        for (int x = charX + column * scale; x < charX + (column + 1) * scale && x < tile.width; x++) {
+                            scratch.outY[x] = kLabelY;
+                            scratch.outCb[x / 2] = kNeutralC;
+                            scratch.outCr[x / 2] = kNeutralC;
+                        }
+                    }
+                }
+            }
+        }
+
+        uint32_t* dst = reinterpret_cast<uint32_t*>(target + static_cast<size_t>(tile.y + oy) * targetRowBytes) + tile.x / 6 * 4;
+        v210PackRow(scratch.outY.data(), scratch.outCb.data(), scratch.outCr.data(), tile.width, dst);
+    }
+}
+
+HRESULT Multiviewer::QueryInterface(REFIID iid, LPVOID *ppv) {
+    if (!ppv) return E_INVALIDARG;
+    *ppv = nullptr;
+    if (memcmp(&iid, &kIID_IDeckLinkVideoOutputCallback, sizeof(REFIID)) == 0 ||
+        memcmp(&iid, &kIID_IUnknown, sizeof(REFIID)) == 0) {
+        *ppv = static_cast<IDeckLinkVideoOutputCallback*>(this);
+        AddRef();
+        return S_OK;
+    }
+    return E_NOINTERFACE;
+}
+
+ULONG Multiviewer::AddRef() {
+    return ++refCount;
+}
+
+ULONG Multiviewer::Release() {
+    ULONG newRef = --refCount;
+    if (newRef == 0) {
+        delete this;
+        return 0;
+    }
+    return newRef;
+}
+
+HRESULT Multiviewer::ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result) {
+    if (result == bmdOutputFrameDisplayedLate) m_framesLate++;
+    if (result == bmdOutputFrameDropped) m_framesDropped++;
+    // Pool frames stay referenced by the multiviewer; completion just returns them.
+    for (int i = 0; i < kPoolSize; i++) {
+        if (m_pool[i] == completedFrame) {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            m_freeFrames.push_back(i);
+            m_poolReady.notify_one();
+            break;
+        }
+    }
+    return S_OK;
+}
+
+HRESULT Multiviewer::ScheduledPlaybackHasStopped() {
+    return S_OK;
+}
+
+int runMultiviewer(const AppOptions& options, const std::atomic<bool>& stopFlag) {
+    BMDDisplayMode selectedMode = bmdModeHD1080i5994;
+
+    IDeckLink* outputDevice = findDeckLinkDevice("DeckLink Duo", options.multiviewerOutput);
+    if (!outputDevice || !setDeviceProfile(outputDevice, bmdProfileFourSubDevicesHalfDuplex)) {
+        std::cerr << "Could not find DeckLink Duo output sub-device " << options.multiviewerOutput << std::endl;
+        if (outputDevice) outputDevice->Release();
+        return 1;
+    }
+    IDeckLinkOutput* output = nullptr;
+    outputDevice->QueryInterface(IID_IDeckLinkOutput, reinterpret_cast<void**>(&output));
+
+    IDeckLinkDisplayMode* displayMode = nullptr;
+    output->GetDisplayMode(selectedMode, &displayMode);
+    if (!displayMode) {
+        std::cerr << "Unsupported display mode" << std::endl;
+        output->Release();
+        outputDevice->Release();
+        return 1;
+    }
+    int width = displayMode->GetWidth();
+    int height = displayMode->GetHeight();
+    BMDTimeValue frameDuration;
+    BMDTimeScale timeScale;
+    displayMode->GetFrameRate(&frameDuration, &timeScale);
+    displayMode->Release();
+
+    FrameScheduler scheduler(options.workers, options.workerCpus);
+    Multiviewer* multiviewer = new Multiviewer(output, scheduler, width, height, frameDuration, timeScale,
+                                               options.multiviewerColumns, options.multiviewerRows);
+    output->SetScheduledFrameCompletionCallback(multiviewer);
+    if (output->EnableVideoOutput(selectedMode, bmdVideoOutputFlagDefault) != S_OK) {
+        std::cerr << "Failed to enable video output" << std::endl;
+        output->SetScheduledFrameCompletionCallback(nullptr);
+        multiviewer->Release();
+        output->Release();
+        outputDevice->Release();
+        return 1;
+    }
+
+    struct Route {
+        IDeckLink* device;
+        IDeckLinkInput* input;
+        MultiviewerInput* callback;
+    };
+    std::vector<Route> routes;
+    for (int index : options.multiviewerInputs) {
+        IDeckLink* device = findDeckLinkDevice("DeckLink Duo", index);
+        IDeckLinkInput* input = nullptr;
+        if (!device || device->QueryInterface(IID_IDeckLinkInput, reinterpret_cast<void**>(&input)) != S_OK) {
+            std::cerr << "Skipping input sub-device " << index << std::endl;
+            if (device) device->Release();
+            continue;
+        }
+        std::string name = "SDI " + std::to_string(index);
+        MultiviewerInput* callback = new MultiviewerInput(input, "multiviewer.input" + std::to_string(index));
+        input->SetCallback(callback);
+        if (input->EnableVideoInput(selectedMode, bmdFormat10BitYUV, bmdVideoInputEnableFormatDetection) != S_OK ||
+            input->StartStreams() != S_OK) {
+            std::cerr << "Failed to start input sub-device " << index << std::endl;
+        }
+        multiviewer->addInput(callback, name);
+        routes.push_back({device, input, callback});
+    }
+
+    int exitCode = 0;
+    if (routes.empty() || !multiviewer->start()) {
+        std::cerr << "Multiviewer has no usable inputs" << std::endl;
+        exitCode = 1;
+    } else {
+        std::cout << "Multiviewer: " << routes.size() << " inputs on sub-device " << options.multiviewerOutput << std::endl;
+        std::atomic<int64_t>& composeUs = statsValue("multiviewer.compose_us");
+        std::atomic<int64_t>& framesLate = statsValue("multiviewer.frames_late");
+        while (!stopFlag.load()) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            scheduler.updateUtilization();
+            std::cout << "Multiviewer: compose " << std::fixed << std::setprecision(2) << composeUs.load() / 1e3 << " ms, tiles";
+            for (size_t i = 0; i < routes.size(); i++) {
+                std::cout << " " << statsValue("sched.tile" + std::to_string(i) + ".frame_us").load() / 1e3;
+            }
+            std::cout << " ms cpu, workers";
+            for (int i = 0; i < scheduler.workers(); i++) {
+                std::cout << " " << statsValue("sched.worker" + std::to_string(i) + ".util_pct").load() << "%";
+            }
+            std::cout << ", late " << framesLate.load() << std::endl;
+        }
+    }
+
+    multiviewer->stop();
+    output->StopScheduledPlayback(0, nullptr, timeScale);
+    output->DisableVideoOutput();
+    for (Route& route : routes) {
+        route.input->StopStreams();
+        route.input->DisableVideoInput();
+        route.input->SetCallback(nullptr);
+        route.callback->Release();
+        route.input->Release();
+        route.device->Release();
+    }
+    output->SetScheduledFrameCompletionCallback(nullptr);
+    multiviewer->Release();
+    output->Release();
+    outputDevice->Release();
+
+    std::cout << "Metrics:" << std::endl;
+    scheduler.updateUtilization();
+    StatsRegistry::instance().print(std::cout, "multiviewer.");
+    StatsRegistry::instance().print(std::cout, "sched.");
+    return exitCode;
+}
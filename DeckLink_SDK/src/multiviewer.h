@@ -0,0 +1,133 @@
+#ifndef MULTIVIEWER_H
+#define MULTIVIEWER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "app_options.h"
+#include "decklink_utils.h"
+#include "frame_scheduler.h"
+
+// Capture side of one multiviewer route. The input thread only swaps the
+// newest frame into a single slot, so a slow or stalled compositor can never
+// back up the capture, and inputs at different rates never wait on each other.
+// Format detection is enabled so a source changing mode re-arms the input.
+class MultiviewerInput : public IDeckLinkInputCallback {
+private:
+    std::atomic<ULONG> refCount{1};
+    IDeckLinkInput* m_input;
+    std::atomic<IDeckLinkVideoInputFrame*> m_latest{nullptr};
+    std::atomic<int64_t>& m_framesReceived;
+    std::atomic<int64_t>& m_formatChanges;
+
+public:
+    MultiviewerInput(IDeckLinkInput* input, const std::string& statsPrefix);
+    virtual ~MultiviewerInput();
+
+    virtual HRESULT QueryInterface(REFIID iid, LPVOID *ppv) override;
+    virtual ULONG AddRef() override;
+    virtual ULONG Release() override;
+    virtual HRESULT VideoInputFormatChanged(BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode* mode, BMDDetectedVideoInputFormatFlags flags) override;
+    virtual HRESULT VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioPacket) override;
+
+    // Newest frame since the previous call, or nullptr; the caller owns the reference.
+    IDeckLinkVideoInputFrame* takeLatest();
+};
+
+// Composes the latest frame of each input into a columns x rows mosaic on a
+// pooled v210 output frame and schedules it on an IDeckLinkOutput. Each tile
+// is a FrameScheduler stage box-downscaled in row slices, so a large tile is
+// spread over the pool instead of pinning one thread; the output cadence is
+// driven by frame completions, so it never depends on any input's rate.
+class Multiviewer : public IDeckLinkVideoOutputCallback {
+private:
+    static constexpr int kPoolSize = 4;
+
+    struct Tile {
+        MultiviewerInput* input = nullptr;
+        std::string label;
+        int stage = 0;
+        int x = 0, y = 0, width = 0, height = 0;
+        IDeckLinkVideoInputFrame* current = nullptr;
+        // Source of the frame being composed, set up before its slices run.
+        std::unique_ptr<ScopedFrameAccess> access;
+        const uint8_t* source = nullptr;
+        long sourceRowBytes = 0;
+        std::string text;
+        // Horizontal source ranges, rebuilt when the source size changes.
+        int sourceWidth = 0;
+        int sourceHeight = 0;
+        std::vector<int> lumaBegin, chromaBegin;
+        std::vector<uint32_t> reciprocal;
+        std::atomic<int64_t>* newFrames = nullptr;
+        std::atomic<int64_t>* repeatedFrames = nullptr;
+        std::atomic<int64_t>* noSignal = nullptr;
+    };
+
+    // Row buffers, one set per scheduler worker.
+    struct Scratch {
+        std::vector<uint16_t> outY, outCb, outCr;
+        std::vector<uint32_t> sumY, sumCb, sumCr;
+    };
+
+    std::atomic<ULONG> refCount{1};
+    IDeckLinkOutput* m_output;
+    FrameScheduler& m_scheduler;
+    std::vector<Scratch> m_scratch;
+    int m_width;
+    int m_height;
+    BMDTimeValue m_frameDuration;
+    BMDTimeScale m_timeScale;
+    int m_columns;
+    int m_rows;
+    std::vector<std::unique_ptr<Tile>> m_tiles;
+
+    IDeckLinkMutableVideoFrame* m_pool[kPoolSize] = {};
+    std::vector<int> m_freeFrames;
+    std::mutex m_poolMutex;
+    std::condition_variable m_poolReady;
+    BMDTimeValue m_nextTime = 0;
+
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+
+    std::atomic<int64_t>& m_framesComposed;
+    std::atomic<int64_t>& m_framesLate;
+    std::atomic<int64_t>& m_framesDropped;
+    std::atomic<int64_t>& m_framesSkipped;
+    std::atomic<int64_t>& m_composeUs;
+    std::atomic<int64_t>& m_composeMaxUs;
+    std::atomic<int64_t>& m_composeErrors;
+
+    void composeLoop();
+    bool composeFrame(int poolIndex);
+    void prepareTile(Tile& tile);
+    void composeTileRows(Tile& tile, uint8_t* target, long targetRowBytes, int firstRow, int lastRow, Scratch& scratch);
+
+public:
+    Multiviewer(IDeckLinkOutput* output, FrameScheduler& scheduler, int width, int height,
+                BMDTimeValue frameDuration, BMDTimeScale timeScale, int columns, int rows);
+    virtual ~Multiviewer();
+
+    // Tiles fill the grid row by row in the order inputs are added.
+    void addInput(MultiviewerInput* input, const std::string& label);
+    bool start();
+    void stop();
+
+    virtual HRESULT QueryInterface(REFIID iid, LPVOID *ppv) override;
+    virtual ULONG AddRef() override;
+    virtual ULONG Release() override;
+    virtual HRESULT ScheduledFrameCompleted(IDeckLinkVideoFrame* completedFrame, BMDOutputFrameCompletionResult result) override;
+    virtual HRESULT ScheduledPlaybackHasStopped() override;
+};
+
+// Runs the multiviewer mode until stopFlag is set; returns the process exit code.
+int runMultiviewer(const AppOptions& options, const std::atomic<bool>& stopFlag);
+
+#endif // MULTIVIEWER_H
@@ -0,0 +1,389 @@
+#include "overlay.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "stats.h"
+#include "v210.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OVERLAY_X86 1
+#endif
+
+namespace {
+constexpr uint32_t kV210Transparent = 0x3FFFFFFF;
+
+// 10-bit code values of the premultiplied fill for one row, plus alpha.
+struct PlanarRow {
+    std::vector<float> y, cb, cr, alphaY, alphaC;
+    explicit PlanarRow(int width)
+        : y(width), cb((width + 1) / 2), cr((width + 1) / 2), alphaY(width), alphaC((width + 1) / 2) {}
+};
+
+inline uint16_t toCode(float value, float maxValue) {
+    return static_cast<uint16_t>(std::min(std::max(std::lround(value), 0L), static_cast<long>(maxValue)));
+}
+
+inline uint32_t blendV210Slot(uint32_t bg, uint32_t fill, uint32_t inverseAlpha) {
+    // bg * inverseAlpha / 1023, rounded, without a divide.
+    uint32_t t = bg * inverseAlpha + 512;
+    uint32_t v = fill + ((t + (t >> 10)) >> 10);
+    return std::min(std::max(v, 4u), 1019u);
+}
+
+void blendV210Scalar(uint8_t* dst, const uint8_t* fill, const uint8_t* inverseAlpha, long bytes) {
+    for (long i = 0; i + 4 <= bytes; i += 4) {
+        uint32_t w, f, a;
+        std::memcpy(&w, dst + i, 4);
+        std::memcpy(&f, fill + i, 4);
+        std::memcpy(&a, inverseAlpha + i, 4);
+        uint32_t out = 0;
+        for (int shift = 0; shift < 30; shift += 10) {
+            out |= blendV210Slot((w >> shift) & 0x3FF, (f >> shift) & 0x3FF, (a >> shift) & 0x3FF) << shift;
+        }
+        std::memcpy(dst + i, &out, 4);
+    }
+}
+
+void blendUyvyScalar(uint8_t* dst, const uint8_t* fill, const uint8_t* inverseAlpha, long bytes) {
+    for (long i = 0; i < bytes; i++) {
+        // bg * inverseAlpha / 255, rounded.
+        uint32_t t = dst[i] * inverseAlpha[i] + 128u;
+        uint32_t v = fill[i] + ((t + (t >> 8)) >> 8);
+        dst[i] = static_cast<uint8_t>(std::min(std::max(v, 1u), 254u));
+    }
+}
+
+#ifdef OVERLAY_X86
+__attribute__((target("avx2")))
+inline __m256i blendV210SlotsAvx2(__m256i bg, __m256i fill, __m256i inverseAlpha, int shift) {
+    const __m128i count = _mm_cvtsi32_si128(shift);
+    const __m256i mask = _mm256_set1_epi32(0x3FF);
+    __m256i b = _mm256_and_si256(_mm256_srl_epi32(bg, count), mask);
+    __m256i f = _mm256_and_si256(_mm256_srl_epi32(fill, count), mask);
+    __m256i a = _mm256_and_si256(_mm256_srl_epi32(inverseAlpha, count), mask);
+    __m256i t = _mm256_add_epi32(_mm256_mullo_epi32(b, a), _mm256_set1_epi32(512));
+    __m256i v = _mm256_add_epi32(f, _mm256_srli_epi32(_mm256_add_epi32(t, _mm256_srli_epi32(t, 10)), 10));
+    v = _mm256_min_epi32(_mm256_max_epi32(v, _mm256_set1_epi32(4)), _mm256_set1_epi32(1019));
+    return _mm256_sll_epi32(v, count);
+}
+
+__attribute__((target("avx2")))
+void blendV210Avx2(uint8_t* dst, const uint8_t* fill, const uint8_t* inverseAlpha, long bytes) {
+    long i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(fill + i));
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inverseAlpha + i));
+        __m256i out = _mm256_or_si256(_mm256_or_si256(blendV210SlotsAvx2(w, f, a, 0), blendV210SlotsAvx2(w, f, a, 10)),
+                                      blendV210SlotsAvx2(w, f, a, 20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), out);
+    }
+    blendV210Scalar(dst + i, fill + i, inverseAlpha + i, bytes - i);
+}
+
+__attribute__((target("avx2")))
+void blendUyvyAvx2(uint8_t* dst, const uint8_t* fill, const uint8_t* inverseAlpha, long bytes) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi16(128);
+    long i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(inverseAlpha + i));
+        __m256i tLo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), _mm256_unpacklo_epi8(a, zero)), round);
+        __m256i tHi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), _mm256_unpackhi_epi8(a, zero)), round);
+        tLo = _mm256_srli_epi16(_mm256_add_epi16(tLo, _mm256_srli_epi16(tLo, 8)), 8);
+        tHi = _mm256_srli_epi16(_mm256_add_epi16(tHi, _mm256_srli_epi16(tHi, 8)), 8);
+        __m256i v = _mm256_adds_epu8(_mm256_packus_epi16(tLo, tHi),
+                                     _mm256_loadu_si256(reinterpret_cast<const __m256i*>(fill + i)));
+        v = _mm256_min_epu8(_mm256_max_epu8(v, _mm256_set1_epi8(1)), _mm256_set1_epi8(static_cast<char>(254)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+    }
+    blendUyvyScalar(dst + i, fill + i, inverseAlpha + i, bytes - i);
+}
+#endif
+
+using BlendFn = void (*)(uint8_t*, const uint8_t*, const uint8_t*, long);
+
+BlendFn blendFunction(BMDPixelFormat format) {
+#ifdef OVERLAY_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2) return format == bmdFormat10BitYUV ? blendV210Avx2 : blendUyvyAvx2;
+#endif
+    return format == bmdFormat10BitYUV ? blendV210Scalar : blendUyvyScalar;
+}
+}
+
+std::shared_ptr<const OverlayGraphic> OverlayGraphic::fromRgba(const uint8_t* rgba, int width, int height, bool premultiplied,
+                                                               int x, int y, int frameWidth, int frameHeight,
+                                                               BMDPixelFormat format, const LumaKey* key) {
+    if (format != bmdFormat10BitYUV && format != bmdFormat8BitYUV) {
+        return nullptr;
+    }
+    std::shared_ptr<OverlayGraphic> graphic(new OverlayGraphic());
+    graphic->m_frameWidth = frameWidth;
+    graphic->m_frameHeight = frameHeight;
+    graphic->m_format = format;
+    graphic->m_rowBytes = format == bmdFormat10BitYUV ? v210RowBytes(frameWidth) : static_cast<long>(frameWidth) * 2;
+    size_t frameBytes = static_cast<size_t>(graphic->m_rowBytes) * frameHeight;
+    graphic->m_fill.assign(frameBytes, 0);
+    graphic->m_inverseAlpha.resize(frameBytes);
+    if (format == bmdFormat10BitYUV) {
+        uint32_t* words = reinterpret_cast<uint32_t*>(graphic->m_inverseAlpha.data());
+        std::fill(words, words + frameBytes / 4, kV210Transparent);
+    } else {
+        std::fill(graphic->m_inverseAlpha.begin(), graphic->m_inverseAlpha.end(), 0xFF);
+    }
+
+    // BT.601 for SD rasters, BT.709 otherwise; limited range.
+    const float kr = frameHeight <= 576 ? 0.299f : 0.2126f;
+    const float kb = frameHeight <= 576 ? 0.114f : 0.0722f;
+    const float kg = 1.0f - kr - kb;
+
+    PlanarRow row(frameWidth);
+    std::vector<uint16_t> fillY(frameWidth), fillCb(row.cb.size()), fillCr(row.cr.size());
+    std::vector<uint16_t> invY(frameWidth), invC(row.cb.size());
+    int firstRow = std::max(0, y), lastRow = std::min(frameHeight, y + height);
+    for (int fy = firstRow; fy < lastRow; fy++) {
+        const uint8_t* src = rgba + static_cast<size_t>(fy - y) * width * 4;
+        bool any = false;
+        for (int fx = 0; fx < frameWidth; fx++) {
+            int gx = fx - x;
+            float r = 0, g = 0, b = 0, a = 0;
+            if (gx >= 0 && gx < width) {
+                const uint8_t* p = src + static_cast<size_t>(gx) * 4;
+                r = p[0] / 255.0f;
+                g = p[1] / 255.0f;
+                b = p[2] / 255.0f;
+                if (key) {
+                    float luma = kr * r + kg * g + kb * b;
+                    a = std::min(std::max((luma - key->clip) * key->gain, 0.0f), 1.0f);
+                } else {
+                    a = p[3] / 255.0f;
+                }
+                if (premultiplied && !key) {
+                    // Colour above alpha is not valid premultiplied data.
+                    r = std::min(r, a);
+                    g = std::min(g, a);
+                    b = std::min(b, a);
+                } else {
+                    r *= a;
+                    g *= a;
+                    b *= a;
+                }
+                any = any || a > 0;
+            }
+            // alpha * (offset + matrix * rgb) == alpha * offset + matrix * premultiplied rgb
+            float luma = kr * r + kg * g + kb * b;
+            row.y[fx] = a * 64.0f + 876.0f * luma;
+            row.alphaY[fx] = a;
+            if ((fx & 1) == 0) {
+                row.cb[fx / 2] = a * 512.0f + 896.0f * (b - luma) / (2.0f * (1.0f - kb));
+                row.cr[fx / 2] = a * 512.0f + 896.0f * (r - luma) / (2.0f * (1.0f - kr));
+                row.alphaC[fx / 2] = a;
+            } else {
+                // Co-sited chroma takes the mean of the pair.
+                row.cb[fx / 2] = 0.5f * (row.cb[fx / 2] + a * 512.0f + 896.0f * (b - luma) / (2.0f * (1.0f - kb)));
+                row.cr[fx / 2] = 0.5f * (row.cr[fx / 2] + a * 512.0f + 896.0f * (r - luma) / (2.0f * (1.0f - kr)));
+                row.alphaC[fx / 2] = 0.5f * (row.alphaC[fx / 2] + a);
+            }
+        }
+        if (!any) continue;
+
+        uint8_t* fillRow = graphic->m_fill.data() + static_cast<size_t>(fy) * graphic->m_rowBytes;
+        uint8_t* invRow = graphic->m_inverseAlpha.data() + static_cast<size_t>(fy) * graphic->m_rowBytes;
+        if (format == bmdFormat10BitYUV) {
+            for (int i = 0; i < frameWidth; i++) {
+                fillY[i] = toCode(row.y[i], 1023.0f);
+                invY[i] = toCode(1023.0f * (1.0f - row.alphaY[i]), 1023.0f);
+            }
+            for (size_t i = 0; i < row.cb.size(); i++) {
+                fillCb[i] = toCode(row.cb[i], 1023.0f);
+                fillCr[i] = toCode(row.cr[i], 1023.0f);
+                invC[i] = toCode(1023.0f * (1.0f - row.alphaC[i]), 1023.0f);
+            }
+            v210PackRow(fillY.data(), fillCb.data(), fillCr.data(), frameWidth, reinterpret_cast<uint32_t*>(fillRow));
+            v210PackRow(invY.data(), invC.data(), invC.data(), frameWidth, reinterpret_cast<uint32_t*>(invRow));
+        } else {
+            // UYVY: Cb Y0 Cr Y1 per pixel pair.
+            for (int i = 0; i < frameWidth; i++) {
+                int c = i / 2;
+                fillRow[i * 2 + 1] = static_cast<uint8_t>(toCode(row.y[i] / 4.0f, 255.0f));
+                invRow[i * 2 + 1] = static_cast<uint8_t>(toCode(255.0f * (1.0f - row.alphaY[i]), 255.0f));
+                fillRow[i * 2] = static_cast<uint8_t>(toCode((i & 1 ? row.cr[c] : row.cb[c]) / 4.0f, 255.0f));
+                invRow[i * 2] = static_cast<uint8_t>(toCode(255.0f * (1.0f - row.alphaC[c]), 255.0f));
+            }
+        }
+    }
+
+    graphic->classifyTiles();
+    return graphic;
+}
+
+void OverlayGraphic::classifyTiles() {
+    m_tileCols = static_cast<int>((m_rowBytes + kTileBytes - 1) / kTileBytes);
+    int tileRowCount = (m_frameHeight + kTileRows - 1) / kTileRows;
+    m_tiles.assign(static_cast<size_t>(tileRowCount) * m_tileCols, kTileTransparent);
+
+    for (int tileRow = 0; tileRow < tileRowCount; tileRow++) {
+        for (int col = 0; col < m_tileCols; col++) {
+            long offset = col * kTileBytes;
+            long bytes = std::min(kTileBytes, m_rowBytes - offset);
+            bool transparent = true, opaque = true;
+            for (int r = tileRow * kTileRows; r < std::min(m_frameHeight, (tileRow + 1) * kTileRows); r++) {
+                const uint8_t* inv = m_inverseAlpha.data() + static_cast<size_t>(r) * m_rowBytes + offset;
+                if (m_format == bmdFormat10BitYUV) {
+                    for (long i = 0; i < bytes; i += 4) {
+                        uint32_t word;
+                        std::memcpy(&word, inv + i, 4);
+                        transparent = transparent && word == kV210Transparent;
+                        opaque = opaque && word == 0;
+                    }
+                } else {
+                    for (long i = 0; i < bytes; i++) {
+                        transparent = transparent && inv[i] == 0xFF;
+                        opaque = opaque && inv[i] == 0;
+                    }
+                }
+            }
+            m_tiles[static_cast<size_t>(tileRow) * m_tileCols + col] =
+                transparent ? kTileTransparent : (opaque ? kTileOpaque : kTileBlend);
+        }
+    }
+}
+
+bool readPamRgba(const std::string& path, std::vector<uint8_t>& rgba, int& width, int& height) {
+    std::ifstream file(path, std::ios::binary);
+    std::string line;
+    if (!file || !std::getline(file, line) || line != "P7") {
+        return false;
+    }
+    int depth = 0, maxValue = 0;
+    width = height = 0;
+    while (std::getline(file, line) && line != "ENDHDR") {
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        if (name == "WIDTH") fields >> width;
+        else if (name == "HEIGHT") fields >> height;
+        else if (name == "DEPTH") fields >> depth;
+        else if (name == "MAXVAL") fields >> maxValue;
+    }
+    if (width <= 0 || height <= 0 || maxValue != 255 || (depth != 3 && depth != 4)) {
+        return false;
+    }
+
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * depth);
+    if (!file.read(reinterpret_cast<char*>(pixels.data()), static_cast<std::streamsize>(pixels.size()))) {
+        return false;
+    }
+    rgba.resize(static_cast<size_t>(width) * height * 4);
+    for (size_t i = 0, n = static_cast<size_t>(width) * height; i < n; i++) {
+        rgba[i * 4] = pixels[i * depth];
+        rgba[i * 4 + 1] = pixels[i * depth + 1];
+        rgba[i * 4 + 2] = pixels[i * depth + 2];
+        rgba[i * 4 + 3] = depth == 4 ? pixels[i * depth + 3] : 0xFF;
+    }
+    return true;
+}
+
+void renderOverBlack(const OverlayGraphic* graphic, uint8_t* frame, long rowBytes, int width, int height,
+                     BMDPixelFormat format) {
+    std::vector<uint16_t> y(width, 64), c((width + 1) / 2, 512);
+    for (int row = 0; row < height; row++) {
+        uint8_t* dst = frame + static_cast<size_t>(row) * rowBytes;
+        if (format == bmdFormat10BitYUV) {
+            v210PackRow(y.data(), c.data(), c.data(), width, reinterpret_cast<uint32_t*>(dst));
+        } else {
+            for (int i = 0; i < width; i++) {
+                dst[i * 2] = 0x80;
+                dst[i * 2 + 1] = 0x10;
+            }
+        }
+    }
+    if (!graphic || graphic->format() != format || graphic->frameWidth() != width || graphic->frameHeight() != height) {
+        return;
+    }
+    BlendFn blend = blendFunction(format);
+    for (int row = 0; row < height; row++) {
+        size_t offset = static_cast<size_t>(row) * graphic->rowBytes();
+        blend(frame + static_cast<size_t>(row) * rowBytes, graphic->fill() + offset, graphic->inverseAlpha() + offset,
+              graphic->rowBytes());
+    }
+}
+
+Overlay::Overlay(FrameScheduler& scheduler, const std::string& statsPrefix)
+    : m_stage(scheduler.registerStage(statsPrefix)),
+      m_frames(statsValue(statsPrefix + ".frames")),
+      m_tilesSkipped(statsValue(statsPrefix + ".tiles_skipped")),
+      m_tilesCopied(statsValue(statsPrefix + ".tiles_copied")),
+      m_tilesBlended(statsValue(statsPrefix + ".tiles_blended")),
+      m_formatMismatch(statsValue(statsPrefix + ".format_mismatch")),
+      m_swaps(statsValue(statsPrefix + ".graphic_swaps")) {}
+
+void Overlay::setGraphic(std::shared_ptr<const OverlayGraphic> graphic) {
+    std::atomic_store(&m_graphic, std::move(graphic));
+    m_swaps++;
+}
+
+std::shared_ptr<const OverlayGraphic> Overlay::graphic() const {
+    return std::atomic_load(&m_graphic);
+}
+
+int Overlay::schedule(FrameScheduler::Job& job, uint8_t* frame, long rowBytes, int width, int height,
+                      BMDPixelFormat format, std::initializer_list<int> after) {
+    // The job holds the reference, so a graphic swapped mid-frame stays alive until the frame is done.
+    std::shared_ptr<const OverlayGraphic> graphic = std::atomic_load(&m_graphic);
+    if (!graphic) {
+        return -1;
+    }
+    if (graphic->format() != format || graphic->frameWidth() != width || graphic->frameHeight() != height ||
+        rowBytes < graphic->rowBytes()) {
+        m_formatMismatch++;
+        return -1;
+    }
+    const OverlayGraphic* active = graphic.get();
+    job.retain(std::move(graphic));
+    m_frames++;
+    return job.addStage(m_stage, height, [this, active, frame, rowBytes](int firstRow, int lastRow, int) {
+        applyRows(*active, frame, rowBytes, firstRow, lastRow);
+    }, after);
+}
+
+void Overlay::applyRows(const OverlayGraphic& graphic, uint8_t* frame, long rowBytes, int firstRow, int lastRow) {
+    static const BlendFn blend10 = blendFunction(bmdFormat10BitYUV);
+    static const BlendFn blend8 = blendFunction(bmdFormat8BitYUV);
+    BlendFn blend = graphic.format() == bmdFormat10BitYUV ? blend10 : blend8;
+
+    const long graphicRowBytes = graphic.rowBytes();
+    const int tileCols = graphic.tileCols();
+    int64_t skipped = 0, copied = 0, blended = 0;
+    for (int row = firstRow; row < lastRow; row++) {
+        uint8_t* dst = frame + static_cast<size_t>(row) * rowBytes;
+        const uint8_t* fill = graphic.fill() + static_cast<size_t>(row) * graphicRowBytes;
+        const uint8_t* inverseAlpha = graphic.inverseAlpha() + static_cast<size_t>(row) * graphicRowBytes;
+        bool firstTileRow = row % OverlayGraphic::kTileRows == 0;
+        for (int col = 0; col < tileCols; col++) {
+            long offset = col * OverlayGraphic::kTileBytes;
+            long bytes = std::min(OverlayGraphic::kTileBytes, graphicRowBytes - offset);
+            switch (graphic.tile(row, col)) {
+            case OverlayGraphic::kTileTransparent:
+                skipped += firstTileRow;
+                break;
+            case OverlayGraphic::kTileOpaque:
+                std::memcpy(dst + offset, fill + offset, static_cast<size_t>(bytes));
+                copied += firstTileRow;
+                break;
+            case OverlayGraphic::kTileBlend:
+                blend(dst + offset, fill + offset, inverseAlpha + offset, bytes);
+                blended += firstTileRow;
+                break;
+            }
+        }
+    }
+    m_tilesSkipped += skipped;
+    m_tilesCopied += copied;
+    m_tilesBlended += blended;
+}
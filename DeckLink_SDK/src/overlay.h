@@ -0,0 +1,100 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "frame_scheduler.h"
+
+// Derives the key from the fill's luma instead of its alpha channel, for
+// graphics rendered over black: alpha = clamp((luma - clip) * gain).
+struct LumaKey {
+    float clip = 0.0f;
+    float gain = 1.0f;
+};
+
+// A graphic converted once into the frame's own packed 4:2:2 layout
+// (bmdFormat10BitYUV or bmdFormat8BitYUV) so that compositing never touches
+// RGB. Every component slot holds the premultiplied fill alpha * value, and a
+// second plane with the same layout holds the inverse alpha, so blending is
+// fill + background * inverseAlpha per slot. Tiles of kTileBytes x kTileRows
+// are classified up front so that transparent areas are skipped and opaque
+// ones copied.
+class OverlayGraphic {
+public:
+    enum TileClass : uint8_t { kTileTransparent = 0, kTileOpaque = 1, kTileBlend = 2 };
+    static constexpr long kTileBytes = 128;
+    static constexpr int kTileRows = 8;
+
+    // rgba is width x height, tightly packed, placed at (x, y) on the frame.
+    // With premultiplied set the colour channels are already scaled by alpha.
+    static std::shared_ptr<const OverlayGraphic> fromRgba(const uint8_t* rgba, int width, int height, bool premultiplied,
+                                                          int x, int y, int frameWidth, int frameHeight,
+                                                          BMDPixelFormat format, const LumaKey* key = nullptr);
+
+    int frameWidth() const { return m_frameWidth; }
+    int frameHeight() const { return m_frameHeight; }
+    BMDPixelFormat format() const { return m_format; }
+    long rowBytes() const { return m_rowBytes; }
+    const uint8_t* fill() const { return m_fill.data(); }
+    const uint8_t* inverseAlpha() const { return m_inverseAlpha.data(); }
+    int tileCols() const { return m_tileCols; }
+    TileClass tile(int row, int col) const { return static_cast<TileClass>(m_tiles[static_cast<size_t>(row / kTileRows) * m_tileCols + col]); }
+
+private:
+    int m_frameWidth = 0;
+    int m_frameHeight = 0;
+    BMDPixelFormat m_format = bmdFormat10BitYUV;
+    long m_rowBytes = 0;
+    int m_tileCols = 0;
+    std::vector<uint8_t> m_fill;
+    std::vector<uint8_t> m_inverseAlpha;
+    std::vector<uint8_t> m_tiles;
+
+    OverlayGraphic() = default;
+    void classifyTiles();
+};
+
+// Reads a binary Netpbm PAM (P7, MAXVAL 255, DEPTH 3 or 4) into tightly
+// packed RGBA; `convert logo.png logo.pam` produces one.
+bool readPamRgba(const std::string& path, std::vector<uint8_t>& rgba, int& width, int& height);
+
+// Fills a whole frame with black and composites the graphic over it, for
+// stills prepared once (the failover slate). graphic may be null for black.
+void renderOverBlack(const OverlayGraphic* graphic, uint8_t* frame, long rowBytes, int width, int height,
+                     BMDPixelFormat format);
+
+// Composites the current graphic onto frames in place as a FrameScheduler
+// stage. setGraphic() may be called from any thread; the frame path picks the
+// new graphic up on its next frame without waiting for the conversion, which
+// happens beforehand.
+class Overlay {
+private:
+    int m_stage;
+    std::shared_ptr<const OverlayGraphic> m_graphic;
+
+    std::atomic<int64_t>& m_frames;
+    std::atomic<int64_t>& m_tilesSkipped;
+    std::atomic<int64_t>& m_tilesCopied;
+    std::atomic<int64_t>& m_tilesBlended;
+    std::atomic<int64_t>& m_formatMismatch;
+    std::atomic<int64_t>& m_swaps;
+
+    void applyRows(const OverlayGraphic& graphic, uint8_t* frame, long rowBytes, int firstRow, int lastRow);
+
+public:
+    explicit Overlay(FrameScheduler& scheduler, const std::string& statsPrefix = "overlay");
+
+    void setGraphic(std::shared_ptr<const OverlayGraphic> graphic);
+    std::shared_ptr<const OverlayGraphic> graphic() const;
+
+    // Adds compositing to job and returns its stage index, or -1 when there is
+    // no graphic or it does not match the frame.
+    int schedule(FrameScheduler::Job& job, uint8_t* frame, long rowBytes, int width, int height,
+                 BMDPixelFormat format, std::initializer_list<int> after = {});
+};
+
+#endif // OVERLAY_H
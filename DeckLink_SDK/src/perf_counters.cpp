@@ -0,0 +1,141 @@
+#include "perf_counters.h"
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include "stats.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+std::atomic<bool> g_perfCountersEnabled{false};
+
+namespace {
+const char* const kEventNames[kPerfEventCount] = {"cycles", "instructions", "llc_misses", "dtlb_misses"};
+
+#ifdef __linux__
+struct EventConfig {
+    uint32_t type;
+    uint64_t config;
+};
+
+// PERF_COUNT_HW_CACHE_MISSES is the last-level cache on x86 and most ARM cores.
+const EventConfig kEvents[kPerfEventCount] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                             (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+int openEvent(const EventConfig& event, int groupFd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event.type;
+    attr.config = event.config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // User space only, which perf_event_paranoid 2 (the usual default) allows without privileges.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0));
+}
+#endif
+}
+
+const char* perfEventName(int event) {
+    return event >= 0 && event < kPerfEventCount ? kEventNames[event] : "unknown";
+}
+
+PerfCounters& PerfCounters::forThisThread() {
+    thread_local PerfCounters counters;
+    if (!counters.m_tried) counters.open();
+    return counters;
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int fd : m_fds) {
+        if (fd >= 0) close(fd);
+    }
+#endif
+}
+
+bool PerfCounters::open() {
+    if (m_tried) return isOpen();
+    m_tried = true;
+#ifdef __linux__
+    int leader = openEvent(kEvents[PerfCycles], -1);
+    if (leader < 0) {
+        static std::atomic<bool> warned{false};
+        if (!warned.exchange(true)) {
+            std::cerr << "Performance counters unavailable: " << std::strerror(errno)
+                      << " (needs a PMU and kernel.perf_event_paranoid <= 2)" << std::endl;
+        }
+        statsValue("perf.unavailable_threads")++;
+        return false;
+    }
+    m_leader = m_fds[PerfCycles] = leader;
+    m_slot[PerfCycles] = m_members++;
+    for (int event = PerfCycles + 1; event < kPerfEventCount; event++) {
+        int fd = openEvent(kEvents[event], leader);
+        if (fd < 0) continue;
+        m_fds[event] = fd;
+        m_slot[event] = m_members++;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    statsValue("perf.threads")++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool PerfCounters::read(PerfSample& sample) const {
+#ifdef __linux__
+    if (m_leader < 0) return false;
+    // nr, time_enabled, time_running, then one value per member.
+    uint64_t buffer[3 + kPerfEventCount];
+    ssize_t expected = static_cast<ssize_t>((3 + m_members) * sizeof(uint64_t));
+    if (::read(m_leader, buffer, sizeof(buffer)) < expected) return false;
+    uint64_t enabled = buffer[1];
+    uint64_t running = buffer[2];
+    for (int event = 0; event < kPerfEventCount; event++) {
+        if (m_slot[event] < 0) {
+            sample.values[event] = 0;
+            continue;
+        }
+        uint64_t value = buffer[3 + m_slot[event]];
+        // Shared with other groups for part of the time: extrapolate to the whole of it.
+        if (running > 0 && running < enabled) {
+            value = static_cast<uint64_t>(static_cast<double>(value) * enabled / running);
+        }
+        sample.values[event] = value;
+    }
+    return true;
+#else
+    (void)sample;
+    return false;
+#endif
+}
+
+PerfTotals::PerfTotals(const std::string& prefix)
+    : m_ipcX100(statsValue(prefix + ".ipc_x100")) {
+    for (int event = 0; event < kPerfEventCount; event++) {
+        m_values[event] = &statsValue(prefix + "." + kEventNames[event]);
+    }
+}
+
+void PerfTotals::add(const PerfSample& start, const PerfSample& end) {
+    for (int event = 0; event < kPerfEventCount; event++) {
+        // Scaled counts of a multiplexed group can step back slightly.
+        if (end.values[event] > start.values[event]) {
+            *m_values[event] += static_cast<int64_t>(end.values[event] - start.values[event]);
+        }
+    }
+    int64_t cycles = m_values[PerfCycles]->load(std::memory_order_relaxed);
+    if (cycles > 0) m_ipcX100 = m_values[PerfInstructions]->load(std::memory_order_relaxed) * 100 / cycles;
+}
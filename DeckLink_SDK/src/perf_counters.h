@@ -0,0 +1,98 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Hardware events counted per thread, in user space only.
+enum PerfEvent {
+    PerfCycles,
+    PerfInstructions,
+    PerfLlcMisses,
+    PerfDtlbMisses,
+    kPerfEventCount
+};
+
+// Stats name of an event: cycles, instructions, llc_misses, dtlb_misses.
+const char* perfEventName(int event);
+
+// Running event counts of one thread, scaled up when the kernel had to
+// multiplex the counters.
+struct PerfSample {
+    uint64_t values[kPerfEventCount] = {};
+};
+
+extern std::atomic<bool> g_perfCountersEnabled;
+
+// Off by default; switch on before the scheduler and stages are created.
+// Readers only test the flag, so the disabled path costs a branch.
+inline void setPerfCountersEnabled(bool enabled) {
+    g_perfCountersEnabled.store(enabled);
+}
+inline bool perfCountersEnabled() {
+    return g_perfCountersEnabled.load(std::memory_order_relaxed);
+}
+
+// One perf_event_open group (cycles as leader, then instructions, LLC misses
+// and dTLB load misses) counting the calling thread on whatever core it runs.
+// A group is read with a single read() of about a microsecond, so wrapping a
+// row slice costs two system calls, independent of the frame size. Events the
+// CPU or hypervisor does not provide read as 0; if cycles cannot be counted
+// (perf_event_paranoid above 2, no PMU in a VM) the group stays closed.
+class PerfCounters {
+public:
+    // The calling thread's group, opened on first use.
+    static PerfCounters& forThisThread();
+
+    PerfCounters() = default;
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool open();
+    bool isOpen() const { return m_leader >= 0; }
+    // False when the group is not open or the read failed.
+    bool read(PerfSample& sample) const;
+
+private:
+    int m_leader = -1;
+    int m_fds[kPerfEventCount] = {-1, -1, -1, -1};
+    int m_slot[kPerfEventCount] = {-1, -1, -1, -1};   // position in the group read, -1 if not counted
+    int m_members = 0;
+    bool m_tried = false;
+};
+
+// Per-stage or per-thread totals under <prefix>.cycles, .instructions,
+// .llc_misses, .dtlb_misses and .ipc_x100 (instructions per cycle times 100).
+class PerfTotals {
+public:
+    explicit PerfTotals(const std::string& prefix);
+
+    void add(const PerfSample& start, const PerfSample& end);
+
+private:
+    std::atomic<int64_t>* m_values[kPerfEventCount];
+    std::atomic<int64_t>& m_ipcX100;
+};
+
+// Counts the calling thread between construction and destruction into totals;
+// does nothing when totals is null or counters are disabled.
+class PerfScope {
+public:
+    explicit PerfScope(PerfTotals* totals) : m_totals(totals) {
+        if (m_totals && !PerfCounters::forThisThread().read(m_start)) m_totals = nullptr;
+    }
+    ~PerfScope() {
+        PerfSample end;
+        if (m_totals && PerfCounters::forThisThread().read(end)) m_totals->add(m_start, end);
+    }
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    PerfTotals* m_totals;
+    PerfSample m_start;
+};
+
+#endif // PERF_COUNTERS_H
@@ -0,0 +1,349 @@
+#include "scopes.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include "stats.h"
+#include "v210.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCOPES_X86 1
+#endif
+
+namespace {
+constexpr size_t kHeaderBytes = 128;
+constexpr size_t kCellBytes = static_cast<size_t>(Scopes::kScopeSize) * Scopes::kScopeSize * sizeof(uint32_t);
+constexpr size_t kHistogramBytes = 6 * Scopes::kHistogramBins * sizeof(uint32_t);
+constexpr size_t kImageBytes = 5 * static_cast<size_t>(Scopes::kScopeSize) * Scopes::kScopeSize;
+static_assert(sizeof(ScopesHeader) <= kHeaderBytes, "ScopesHeader outgrew its slot");
+
+// Limited-range Y'CbCr -> R'G'B' in luma code values: each component is
+// Y + (k[0] * (Cb - 512) + k[1] * (Cr - 512)) / 4096.
+using Matrix = int[3][2];
+
+inline uint16_t component(int luma, int db, int dr, const int k[2]) {
+    int v = luma + ((k[0] * db + k[1] * dr + 2048) >> 12);
+    return static_cast<uint16_t>(std::min(std::max(v, 0), 1023));
+}
+
+// R'G'B' codes of each pixel plus its parade cell, [level / 4][column].
+struct RgbRow {
+    uint16_t* r;
+    uint16_t* g;
+    uint16_t* b;
+    uint32_t* cellR;
+    uint32_t* cellG;
+    uint32_t* cellB;
+};
+
+void rgbRowScalar(const Matrix m, const uint16_t* y, const uint16_t* cb, const uint16_t* cr, const uint16_t* column,
+                  int x, int width, const RgbRow& out) {
+    for (; x < width; x++) {
+        int luma = y[x], db = cb[x >> 1] - 512, dr = cr[x >> 1] - 512;
+        out.r[x] = component(luma, db, dr, m[0]);
+        out.g[x] = component(luma, db, dr, m[1]);
+        out.b[x] = component(luma, db, dr, m[2]);
+        out.cellR[x] = static_cast<uint32_t>(out.r[x] >> 2) << 8 | column[x];
+        out.cellG[x] = static_cast<uint32_t>(out.g[x] >> 2) << 8 | column[x];
+        out.cellB[x] = static_cast<uint32_t>(out.b[x] >> 2) << 8 | column[x];
+    }
+}
+
+#ifdef SCOPES_X86
+__attribute__((target("avx2")))
+inline __m256i componentAvx2(__m256i luma, __m256i db, __m256i dr, const int k[2]) {
+    __m256i v = _mm256_add_epi32(_mm256_mullo_epi32(db, _mm256_set1_epi32(k[0])), _mm256_mullo_epi32(dr, _mm256_set1_epi32(k[1])));
+    v = _mm256_add_epi32(luma, _mm256_srai_epi32(_mm256_add_epi32(v, _mm256_set1_epi32(2048)), 12));
+    return _mm256_min_epi32(_mm256_max_epi32(v, _mm256_setzero_si256()), _mm256_set1_epi32(1023));
+}
+
+__attribute__((target("avx2")))
+inline void storeAvx2(__m256i v, __m256i column, uint16_t* codes, uint32_t* cells) {
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(codes), _mm256_castsi256_si128(packed));
+    __m256i cell = _mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(v, 2), 8), column);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(cells), cell);
+}
+
+__attribute__((target("avx2")))
+void rgbRowAvx2(const Matrix m, const uint16_t* y, const uint16_t* cb, const uint16_t* cr, const uint16_t* column,
+                int x, int width, const RgbRow& out) {
+    // Eight pixels share four chroma pairs; duplicate each pair across two lanes.
+    const __m256i pairs = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+    const __m256i neutral = _mm256_set1_epi32(512);
+    for (; x + 8 <= width; x += 8) {
+        __m256i luma = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)));
+        __m256i db = _mm256_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(cb + x / 2)));
+        __m256i dr = _mm256_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(cr + x / 2)));
+        db = _mm256_sub_epi32(_mm256_permutevar8x32_epi32(db, pairs), neutral);
+        dr = _mm256_sub_epi32(_mm256_permutevar8x32_epi32(dr, pairs), neutral);
+        __m256i col = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(column + x)));
+        storeAvx2(componentAvx2(luma, db, dr, m[0]), col, out.r + x, out.cellR + x);
+        storeAvx2(componentAvx2(luma, db, dr, m[1]), col, out.g + x, out.cellG + x);
+        storeAvx2(componentAvx2(luma, db, dr, m[2]), col, out.b + x, out.cellB + x);
+    }
+    rgbRowScalar(m, y, cb, cr, column, x, width, out);
+}
+#endif
+
+using RgbRowFn = void (*)(const Matrix, const uint16_t*, const uint16_t*, const uint16_t*, const uint16_t*, int, int,
+                          const RgbRow&);
+
+RgbRowFn rgbRowFunction() {
+#ifdef SCOPES_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2) return rgbRowAvx2;
+#endif
+    return rgbRowScalar;
+}
+
+// log2(v) in 8.8 fixed point, the fraction taken linearly from the mantissa.
+inline uint32_t log2Q8(uint32_t v) {
+    int bits = 31 - __builtin_clz(v);
+    return static_cast<uint32_t>(bits) << 8 | ((v << (31 - bits)) >> 23 & 0xFF);
+}
+
+// Q16 factor mapping log2 of the busiest cell to 254.
+uint32_t logScale(const uint32_t* cells, size_t count) {
+    uint32_t peak = *std::max_element(cells, cells + count);
+    return peak > 1 ? (254u << 16) / log2Q8(peak) : 0;
+}
+
+// Log-scaled intensity so a few samples remain visible next to flat areas.
+void renderCells(const uint32_t* cells, uint8_t* image, int imageStride, uint32_t scale) {
+    for (int level = 0; level < Scopes::kScopeSize; level++) {
+        const uint32_t* src = cells + static_cast<size_t>(level) * Scopes::kScopeSize;
+        uint8_t* dst = image + static_cast<size_t>(Scopes::kScopeSize - 1 - level) * imageStride;
+        for (int x = 0; x < Scopes::kScopeSize; x++) {
+            dst[x] = src[x] ? static_cast<uint8_t>(1 + std::min<uint32_t>((log2Q8(src[x]) * scale) >> 16, 254)) : 0;
+        }
+    }
+}
+}
+
+Scopes::Scopes(FrameScheduler& scheduler, const std::string& shmName, double rateHz, int lineStep, bool images,
+               const std::string& statsPrefix)
+    : m_accumulateStage(scheduler.registerStage(statsPrefix)),
+      m_publishStage(scheduler.registerStage(statsPrefix + "_publish")),
+      m_shmName(shmName.empty() || shmName[0] == '/' ? shmName : "/" + shmName),
+      m_intervalNs(rateHz > 0 ? static_cast<int64_t>(1e9 / rateHz) : 0),
+      m_lineStep(std::max(1, lineStep)),
+      m_images(images),
+      m_scratch(scheduler.workers()),
+      m_published(statsValue(statsPrefix + ".published")),
+      m_skippedBusy(statsValue(statsPrefix + ".skipped_busy")),
+      m_formatMismatch(statsValue(statsPrefix + ".format_mismatch")),
+      m_publishUs(statsValue(statsPrefix + ".publish_us")),
+      m_latencyUs(statsValue(statsPrefix + ".latency_us")) {
+    for (int i = 0; i < scheduler.workers(); i++) m_workerBins.emplace_back(new Bins());
+    m_payload.resize(kHistogramBytes + 5 * kCellBytes + (m_images ? kImageBytes : 0));
+}
+
+Scopes::~Scopes() {
+    if (m_shm) {
+        munmap(m_shm, m_shmBytes);
+        shm_unlink(m_shmName.c_str());
+    }
+}
+
+bool Scopes::open() {
+    if (m_shmName.size() < 2) {
+        std::cerr << "Scopes need a shared memory name" << std::endl;
+        return false;
+    }
+    int fd = shm_open(m_shmName.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        std::cerr << "Cannot create shared memory " << m_shmName << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    size_t bytes = kHeaderBytes + m_payload.size();
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0) {
+        mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    int error = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Cannot map shared memory " << m_shmName << ": " << std::strerror(error) << std::endl;
+        shm_unlink(m_shmName.c_str());
+        return false;
+    }
+    m_shm = static_cast<uint8_t*>(mapping);
+    m_shmBytes = bytes;
+    std::memset(m_shm, 0, bytes);
+
+    ScopesHeader* header = reinterpret_cast<ScopesHeader*>(m_shm);
+    header->magic = ScopesHeader::kMagic;
+    header->version = ScopesHeader::kVersion;
+    header->totalBytes = static_cast<uint32_t>(bytes);
+    header->lineStep = static_cast<uint32_t>(m_lineStep);
+    header->histogramBins = kHistogramBins;
+    header->scopeSize = kScopeSize;
+    header->histogramOffset = static_cast<uint32_t>(kHeaderBytes);
+    header->waveformOffset = static_cast<uint32_t>(kHeaderBytes + kHistogramBytes);
+    header->paradeOffset = static_cast<uint32_t>(header->waveformOffset + kCellBytes);
+    header->vectorscopeOffset = static_cast<uint32_t>(header->paradeOffset + 3 * kCellBytes);
+    header->imageOffset = m_images ? static_cast<uint32_t>(header->vectorscopeOffset + kCellBytes) : 0;
+    std::cout << "Scopes published to /dev/shm" << m_shmName << " (" << bytes / 1024 << " KB)" << std::endl;
+    return true;
+}
+
+void Scopes::configure(int width, int height) {
+    m_width = width;
+    m_height = height;
+    // BT.601 for SD rasters, BT.709 otherwise.
+    double kr = height <= 576 ? 0.299 : 0.2126;
+    double kb = height <= 576 ? 0.114 : 0.0722;
+    double kg = 1.0 - kr - kb;
+    auto q12 = [](double v) { return static_cast<int>(std::lround(v * 4096.0 * 876.0 / 896.0)); };
+    int matrix[3][2] = {{0, q12(2.0 * (1.0 - kr))},
+                        {q12(-2.0 * (1.0 - kb) * kb / kg), q12(-2.0 * (1.0 - kr) * kr / kg)},
+                        {q12(2.0 * (1.0 - kb)), 0}};
+    std::memcpy(m_matrix, matrix, sizeof(m_matrix));
+    // Pad to whole v210 groups and SIMD blocks so neither needs a tail check on the buffers.
+    size_t padded = static_cast<size_t>(width + 15) / 6 * 6 + 8;
+    m_column.assign(padded, 0);
+    for (int x = 0; x < width; x++) m_column[x] = static_cast<uint16_t>(static_cast<int64_t>(x) * kScopeSize / width);
+    for (Scratch& scratch : m_scratch) {
+        for (auto* plane : {&scratch.y, &scratch.cb, &scratch.cr, &scratch.r, &scratch.g, &scratch.b}) plane->assign(padded, 0);
+        for (auto* cells : {&scratch.paradeR, &scratch.paradeG, &scratch.paradeB}) cells->assign(padded, 0);
+    }
+}
+
+int Scopes::schedule(FrameScheduler::Job& job, const uint8_t* frame, long rowBytes, int width, int height,
+                     BMDPixelFormat format, std::initializer_list<int> after) {
+    if (!m_shm) return -1;
+    if (format != bmdFormat10BitYUV || width <= 0 || height <= 0) {
+        m_formatMismatch++;
+        return -1;
+    }
+    int64_t now = monotonicNowNs();
+    if (m_lastPassNs && now - m_lastPassNs < m_intervalNs) return -1;
+    if (job.stageCount() + 2 > FrameScheduler::Job::kMaxStages) return -1;
+    if (m_busy.exchange(true)) {
+        // The previous pass is still running; analyse a later frame instead of queueing.
+        m_skippedBusy++;
+        return -1;
+    }
+    m_lastPassNs = now;
+    if (width != m_width || height != m_height) configure(width, height);
+
+    int rows = (height + m_lineStep - 1) / m_lineStep;
+    int accumulate = job.addStage(m_accumulateStage, rows, [this, frame, rowBytes](int firstRow, int lastRow, int worker) {
+        accumulateRows(frame, rowBytes, firstRow, lastRow, worker);
+    }, after);
+    // A single row depends on every row of the accumulation, so the merge sees all bins.
+    return job.addStage(m_publishStage, 1, [this, now](int, int, int) { publish(now); }, {accumulate});
+}
+
+void Scopes::accumulateRows(const uint8_t* frame, long rowBytes, int firstRow, int lastRow, int worker) {
+    static const RgbRowFn rgbRow = rgbRowFunction();
+    Scratch& s = m_scratch[worker];
+    Bins& bins = *m_workerBins[worker];
+    const uint16_t* column = m_column.data();
+    int width = m_width;
+    int chroma = (width + 1) / 2;
+    RgbRow out{s.r.data(), s.g.data(), s.b.data(), s.paradeR.data(), s.paradeG.data(), s.paradeB.data()};
+
+    for (int row = firstRow; row < lastRow; row++) {
+        const uint8_t* src = frame + static_cast<size_t>(row) * m_lineStep * rowBytes;
+        v210UnpackRow(reinterpret_cast<const uint32_t*>(src), width, s.y.data(), s.cb.data(), s.cr.data());
+        rgbRow(m_matrix, s.y.data(), s.cb.data(), s.cr.data(), column, 0, width, out);
+
+        // Neighbouring samples go to different copies of each histogram, so a
+        // flat area does not make every increment wait on the previous one.
+        for (int x = 0; x < width; x++) {
+            int lane = x & (kSplits - 1);
+            uint16_t luma = s.y[x];
+            bins.histograms[0][lane][luma]++;
+            bins.histograms[3][lane][s.r[x]]++;
+            bins.histograms[4][lane][s.g[x]]++;
+            bins.histograms[5][lane][s.b[x]]++;
+            bins.waveform[static_cast<uint32_t>(luma >> 2) << 8 | column[x]]++;
+            bins.parade[0][s.paradeR[x]]++;
+            bins.parade[1][s.paradeG[x]]++;
+            bins.parade[2][s.paradeB[x]]++;
+        }
+        for (int c = 0; c < chroma; c++) {
+            int lane = c & (kSplits - 1);
+            uint16_t cb = s.cb[c], cr = s.cr[c];
+            bins.histograms[1][lane][cb]++;
+            bins.histograms[2][lane][cr]++;
+            bins.vectorscope[static_cast<uint32_t>(cr >> 2) << 8 | (cb >> 2)]++;
+        }
+        bins.samples += static_cast<uint32_t>(width);
+    }
+    bins.used = true;
+}
+
+void Scopes::publish(int64_t startNs) {
+    int64_t mergeStart = monotonicNowNs();
+    uint32_t* histograms = reinterpret_cast<uint32_t*>(m_payload.data());
+    uint32_t* waveform = histograms + 6 * kHistogramBins;
+    uint32_t* parade = waveform + kScopeCells;
+    uint32_t* vectorscope = parade + 3 * kScopeCells;
+    std::memset(histograms, 0, kHistogramBytes + 5 * kCellBytes);
+
+    // Every accumulation task has finished, so the worker bins are read
+    // and cleared here without any locking.
+    uint32_t samples = 0;
+    for (auto& worker : m_workerBins) {
+        Bins& bins = *worker;
+        if (!bins.used) continue;
+        for (int h = 0; h < 6; h++) {
+            uint32_t* dst = histograms + h * kHistogramBins;
+            for (int split = 0; split < kSplits; split++) {
+                for (int i = 0; i < kHistogramBins; i++) dst[i] += bins.histograms[h][split][i];
+            }
+        }
+        for (size_t i = 0; i < kScopeCells; i++) waveform[i] += bins.waveform[i];
+        for (int c = 0; c < 3; c++) {
+            for (size_t i = 0; i < kScopeCells; i++) parade[c * kScopeCells + i] += bins.parade[c][i];
+        }
+        for (size_t i = 0; i < kScopeCells; i++) vectorscope[i] += bins.vectorscope[i];
+        samples += bins.samples;
+        std::memset(&bins, 0, sizeof(Bins));
+    }
+    if (m_images) renderImages();
+
+    // Seqlock: readers that overlap this copy see an odd or changed sequence and retry.
+    ScopesHeader* header = reinterpret_cast<ScopesHeader*>(m_shm);
+    uint32_t sequence = header->sequence;
+    __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    header->publishCount++;
+    header->publishedNs = monotonicNowNs();
+    header->frameWidth = static_cast<uint32_t>(m_width);
+    header->frameHeight = static_cast<uint32_t>(m_height);
+    header->samples = samples;
+    std::memcpy(m_shm + kHeaderBytes, m_payload.data(), m_payload.size());
+    __atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    int64_t end = monotonicNowNs();
+    m_published++;
+    m_publishUs = (end - mergeStart) / 1000;
+    m_latencyUs = (end - startNs) / 1000;
+    m_busy = false;
+}
+
+void Scopes::renderImages() {
+    const uint32_t* waveform = reinterpret_cast<const uint32_t*>(m_payload.data()) + 6 * kHistogramBins;
+    const uint32_t* parade = waveform + kScopeCells;
+    const uint32_t* vectorscope = parade + 3 * kScopeCells;
+    uint8_t* image = m_payload.data() + kHistogramBytes + 5 * kCellBytes;
+
+    renderCells(waveform, image, kScopeSize, logScale(waveform, kScopeCells));
+    image += kScopeCells;
+    // The three parade panels share one scale so their heights compare.
+    uint32_t scale = logScale(parade, 3 * kScopeCells);
+    for (int c = 0; c < 3; c++) {
+        renderCells(parade + c * kScopeCells, image + c * kScopeSize, 3 * kScopeSize, scale);
+    }
+    image += 3 * kScopeCells;
+    renderCells(vectorscope, image, kScopeSize, logScale(vectorscope, kScopeCells));
+}
@@ -0,0 +1,123 @@
+#ifndef SCOPES_H
+#define SCOPES_H
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+#include "DeckLinkAPI.h"
+#include "frame_scheduler.h"
+
+// Shared-memory block written by Scopes (/dev/shm/<name>). Readers copy what
+// they need between two reads of `sequence` and retry if it was odd or
+// changed (a seqlock); the writer never waits for them. Offsets are in bytes
+// from the start of the block, all values little-endian uint32 unless noted.
+struct ScopesHeader {
+    static constexpr uint32_t kMagic = 0x53434F50; // "SCOP"
+    static constexpr uint32_t kVersion = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;
+    uint32_t totalBytes;
+    uint64_t publishCount;
+    int64_t publishedNs;         // CLOCK_MONOTONIC
+    uint32_t frameWidth;
+    uint32_t frameHeight;
+    uint32_t lineStep;           // every lineStep-th line was analysed
+    uint32_t samples;            // luma samples counted
+    uint32_t histogramBins;      // 1024, one per 10-bit code
+    uint32_t scopeSize;          // 256: scope cells cover 4 codes
+    uint32_t histogramOffset;    // 6 x histogramBins: Y, Cb, Cr, R, G, B
+    uint32_t waveformOffset;     // scopeSize levels x scopeSize columns, [level][column]
+    uint32_t paradeOffset;       // 3 x waveform: R, G, B
+    uint32_t vectorscopeOffset;  // scopeSize x scopeSize, [Cr][Cb]
+    uint32_t imageOffset;        // 0, or uint8 images with the highest level on the top row:
+                                 // waveform S x S, parade 3S x S, vectorscope S x S
+    uint32_t reserved;
+};
+
+// Confidence-monitoring scopes on captured 10-bit frames: luma/chroma and
+// R'G'B' histograms, luma waveform, R'G'B' parade and vectorscope.
+//
+// A pass is scheduled at most rateHz times per second as two FrameScheduler
+// stages. The first reads every lineStep-th row in slices; each worker
+// counts into its own bins, with R'G'B' and cell indices computed eight
+// pixels at a time (AVX2, scalar fallback) and the 1D histograms split four
+// ways so runs of equal values do not serialise on one counter. The second,
+// a single task released once all slices are done, sums the worker bins
+// without locks, clears them and publishes. A frame arriving while the
+// previous pass is still running is not analysed, so the stage can never
+// back up the pipeline.
+class Scopes {
+public:
+    static constexpr int kHistogramBins = 1024;
+    static constexpr int kScopeSize = 256;
+
+    Scopes(FrameScheduler& scheduler, const std::string& shmName, double rateHz, int lineStep, bool images,
+           const std::string& statsPrefix = "scopes");
+    ~Scopes();
+    Scopes(const Scopes&) = delete;
+    Scopes& operator=(const Scopes&) = delete;
+
+    // Creates the shared-memory block; false if it cannot be mapped.
+    bool open();
+
+    // Adds a pass over the frame to job when one is due and returns the
+    // publishing stage's index, or -1. The frame is only read.
+    int schedule(FrameScheduler::Job& job, const uint8_t* frame, long rowBytes, int width, int height,
+                 BMDPixelFormat format, std::initializer_list<int> after = {});
+
+private:
+    static constexpr int kSplits = 4;
+    static constexpr size_t kScopeCells = static_cast<size_t>(kScopeSize) * kScopeSize;
+
+    // Counters of one worker, or the merged totals.
+    struct Bins {
+        uint32_t histograms[6][kSplits][kHistogramBins];
+        uint32_t waveform[kScopeCells];
+        uint32_t parade[3][kScopeCells];
+        uint32_t vectorscope[kScopeCells];
+        uint32_t samples;
+        bool used;
+    };
+    struct Scratch {
+        std::vector<uint16_t> y, cb, cr, r, g, b;
+        std::vector<uint32_t> paradeR, paradeG, paradeB;
+    };
+
+    int m_accumulateStage;
+    int m_publishStage;
+    std::string m_shmName;
+    int64_t m_intervalNs;
+    int m_lineStep;
+    bool m_images;
+
+    std::vector<std::unique_ptr<Bins>> m_workerBins;
+    std::vector<Scratch> m_scratch;
+    std::vector<uint8_t> m_payload;   // merged arrays and images, copied out under the seqlock
+    std::vector<uint16_t> m_column;
+    int m_width = 0;
+    int m_height = 0;
+    int m_matrix[3][2] = {};          // Q12 Cb/Cr weights of R', G', B'
+
+    uint8_t* m_shm = nullptr;
+    size_t m_shmBytes = 0;
+    std::atomic<bool> m_busy{false};
+    int64_t m_lastPassNs = 0;
+
+    std::atomic<int64_t>& m_published;
+    std::atomic<int64_t>& m_skippedBusy;
+    std::atomic<int64_t>& m_formatMismatch;
+    std::atomic<int64_t>& m_publishUs;
+    std::atomic<int64_t>& m_latencyUs;
+
+    void configure(int width, int height);
+    void accumulateRows(const uint8_t* frame, long rowBytes, int firstRow, int lastRow, int worker);
+    void publish(int64_t startNs);
+    void renderImages();
+};
+
+#endif // SCOPES_H
@@ -0,0 +1,31 @@
+#include "stats.h"
+
+StatsRegistry& StatsRegistry::instance() {
+    static StatsRegistry registry;
+    return registry;
+}
+
+std::atomic<int64_t>& StatsRegistry::get(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& slot = m_values[name];
+    if (!slot) {
+        slot.reset(new std::atomic<int64_t>(0));
+    }
+    return *slot;
+}
+
+std::map<std::string, int64_t> StatsRegistry::snapshot() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<std::string, int64_t> values;
+    for (const auto& entry : m_values) {
+        values[entry.first] = entry.second->load(std::memory_order_relaxed);
+    }
+    return values;
+}
+
+void StatsRegistry::print(std::ostream& os, const std::string& prefix) const {
+    for (const auto& entry : snapshot()) {
+        if (entry.first.compare(0, prefix.size(), prefix) != 0) continue;
+        os << entry.first << ": " << entry.second << std::endl;
+    }
+}
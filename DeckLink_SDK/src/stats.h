@@ -0,0 +1,43 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+// Process-wide registry of named counters and gauges. Components look their
+// entries up once at construction and then update them lock-free from the
+// frame path; main() prints the registry next to the InputCallback metrics.
+class StatsRegistry {
+private:
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::unique_ptr<std::atomic<int64_t>>> m_values;
+
+    StatsRegistry() = default;
+
+public:
+    static StatsRegistry& instance();
+
+    // Returns a stable reference; the entry is created on first use.
+    std::atomic<int64_t>& get(const std::string& name);
+
+    std::map<std::string, int64_t> snapshot() const;
+    void print(std::ostream& os, const std::string& prefix = "") const;
+};
+
+inline std::atomic<int64_t>& statsValue(const std::string& name) {
+    return StatsRegistry::instance().get(name);
+}
+
+// steady_clock is CLOCK_MONOTONIC on Linux; all stage timings use it.
+inline int64_t monotonicNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // STATS_H
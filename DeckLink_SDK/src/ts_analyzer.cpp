@@ -0,0 +1,464 @@
+#include "ts_analyzer.h"
+#include <algorithm>
+#include <cstdlib>
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TS_ANALYZER_X86 1
+#endif
+
+namespace {
+constexpr int kSyncAcquirePackets = 5;
+constexpr int kSyncLossPackets = 2;
+constexpr size_t kMaxSectionSize = 4096 + 3;
+constexpr int64_t kCheckPeriodNs = 10000000;
+constexpr size_t kSyncSpan = 2 * kTsPacketSize + 1;
+
+struct Crc32Table {
+    uint32_t values[256];
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i << 24;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+            }
+            values[i] = crc;
+        }
+    }
+};
+
+const Crc32Table kCrc32Table;
+
+size_t findSyncScalar(const uint8_t* data, size_t size, size_t start) {
+    for (size_t i = start; i + kSyncSpan <= size; i++) {
+        if (data[i] == kTsSyncByte && data[i + kTsPacketSize] == kTsSyncByte &&
+            data[i + 2 * kTsPacketSize] == kTsSyncByte) {
+            return i;
+        }
+    }
+    return size;
+}
+
+#ifdef TS_ANALYZER_X86
+size_t findSyncSse2(const uint8_t* data, size_t size) {
+    const __m128i sync = _mm_set1_epi8(static_cast<char>(kTsSyncByte));
+    size_t i = 0;
+    for (; i + 2 * kTsPacketSize + 16 <= size; i += 16) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), sync);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + kTsPacketSize)), sync);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 2 * kTsPacketSize)), sync);
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+        if (mask) return i + static_cast<size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+    }
+    return findSyncScalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+size_t findSyncAvx2(const uint8_t* data, size_t size) {
+    const __m256i sync = _mm256_set1_epi8(static_cast<char>(kTsSyncByte));
+    size_t i = 0;
+    for (; i + 2 * kTsPacketSize + 32 <= size; i += 32) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), sync);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + kTsPacketSize)), sync);
+        __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 2 * kTsPacketSize)), sync);
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), c)));
+        if (mask) return i + static_cast<size_t>(__builtin_ctz(mask));
+    }
+    return findSyncScalar(data, size, i);
+}
+#endif
+}
+
+size_t tsFindSync(const uint8_t* data, size_t size) {
+#ifdef TS_ANALYZER_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2 ? findSyncAvx2(data, size) : findSyncSse2(data, size);
+#else
+    return findSyncScalar(data, size, 0);
+#endif
+}
+
+uint32_t tsCrc32(const uint8_t* data, size_t size) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc = (crc << 8) ^ kCrc32Table.values[((crc >> 24) ^ data[i]) & 0xFF];
+    }
+    return crc;
+}
+
+TsAnalyzer::TsAnalyzer(const std::string& statsPrefix, const TsAnalyzerConfig& config)
+    : m_config(config), m_pids(kTsPidNull + 1),
+      m_syncLoss{&statsValue(statsPrefix + ".ts_sync_loss")},
+      m_syncByteError{&statsValue(statsPrefix + ".sync_byte_error")},
+      m_patError{&statsValue(statsPrefix + ".pat_error")},
+      m_ccError{&statsValue(statsPrefix + ".continuity_count_error")},
+      m_pmtError{&statsValue(statsPrefix + ".pmt_error")},
+      m_pidError{&statsValue(statsPrefix + ".pid_error")},
+      m_transportError{&statsValue(statsPrefix + ".transport_error")},
+      m_crcError{&statsValue(statsPrefix + ".crc_error")},
+      m_pcrRepetitionError{&statsValue(statsPrefix + ".pcr_repetition_error")},
+      m_pcrDiscontinuityError{&statsValue(statsPrefix + ".pcr_discontinuity_error")},
+      m_pcrAccuracyError{&statsValue(statsPrefix + ".pcr_accuracy_error")},
+      m_ptsError{&statsValue(statsPrefix + ".pts_error")},
+      m_catError{&statsValue(statsPrefix + ".cat_error")},
+      m_packetCount(statsValue(statsPrefix + ".packets")),
+      m_pcrAccuracyMaxNs(statsValue(statsPrefix + ".pcr_accuracy_max_ns")),
+      m_bitrate(statsValue(statsPrefix + ".bitrate_bps")) {
+    m_carry.reserve(kTsPacketSize);
+    m_acquired.reserve(kSyncAcquirePackets * kTsPacketSize);
+}
+
+void TsAnalyzer::feed(const uint8_t* data, size_t size, int64_t arrivalNs) {
+    if (arrivalNs >= 0) {
+        m_liveClock = true;
+        m_nowNs = arrivalNs;
+    }
+    int64_t packetsBefore = m_packets;
+
+    // Finish a packet split across the previous chunk.
+    if (!m_carry.empty()) {
+        size_t need = kTsPacketSize - m_carry.size();
+        size_t take = std::min(need, size);
+        m_carry.insert(m_carry.end(), data, data + take);
+        data += take;
+        size -= take;
+        if (m_carry.size() < kTsPacketSize) return;
+        if (m_carry[0] == kTsSyncByte) {
+            if (m_inSync) {
+                processPacket(m_carry.data());
+            } else {
+                acquirePacket(m_carry.data());
+            }
+        } else if (m_inSync) {
+            m_syncByteError.add();
+            if (++m_badSyncRun >= kSyncLossPackets) {
+                m_inSync = false;
+                m_goodSyncRun = 0;
+                m_syncLoss.add();
+            }
+            m_byteIndex += static_cast<int64_t>(kTsPacketSize);
+        } else {
+            m_goodSyncRun = 0;
+            m_acquired.clear();
+            m_byteIndex += static_cast<int64_t>(kTsPacketSize);
+        }
+        m_carry.clear();
+    }
+
+    while (size >= kTsPacketSize) {
+        if (m_inSync) {
+            if (data[0] == kTsSyncByte) {
+                m_badSyncRun = 0;
+                processPacket(data);
+            } else {
+                m_syncByteError.add();
+                if (++m_badSyncRun >= kSyncLossPackets) {
+                    m_inSync = false;
+                    m_goodSyncRun = 0;
+                    m_acquired.clear();
+                    m_syncLoss.add();
+                    continue;
+                }
+                m_byteIndex += static_cast<int64_t>(kTsPacketSize);
+            }
+            data += kTsPacketSize;
+            size -= kTsPacketSize;
+            continue;
+        }
+
+        // Out of sync: need kSyncAcquirePackets consecutive sync bytes.
+        if (data[0] != kTsSyncByte || m_goodSyncRun == 0) {
+            size_t offset = data[0] == kTsSyncByte ? 0 : tsFindSync(data, size);
+            if (offset >= size) {
+                // Not enough bytes to confirm alignment; drop them.
+                m_byteIndex += static_cast<int64_t>(size);
+                size = 0;
+                break;
+            }
+            data += offset;
+            size -= offset;
+            m_byteIndex += static_cast<int64_t>(offset);
+            m_goodSyncRun = 0;
+            m_acquired.clear();
+            if (size < kTsPacketSize) break;
+        }
+        if (data[0] == kTsSyncByte) {
+            acquirePacket(data);
+            data += kTsPacketSize;
+            size -= kTsPacketSize;
+        } else {
+            m_goodSyncRun = 0;
+            m_acquired.clear();
+            data++;
+            size--;
+            m_byteIndex++;
+        }
+    }
+
+    // A run still being confirmed keeps its alignment across chunks too.
+    if ((m_inSync || m_goodSyncRun > 0) && size > 0) {
+        m_carry.assign(data, data + size);
+    }
+    m_packetCount += m_packets - packetsBefore;
+}
+
+void TsAnalyzer::acquirePacket(const uint8_t* pkt) {
+    m_acquired.insert(m_acquired.end(), pkt, pkt + kTsPacketSize);
+    m_byteIndex += static_cast<int64_t>(kTsPacketSize);
+    if (++m_goodSyncRun < kSyncAcquirePackets) return;
+    m_inSync = true;
+    m_badSyncRun = 0;
+    // The packets that confirmed the alignment are analysed too, so the PAT,
+    // PMT and PCR at the very start of a stream or file are not missed.
+    m_byteIndex -= static_cast<int64_t>(m_acquired.size());
+    for (size_t offset = 0; offset < m_acquired.size(); offset += kTsPacketSize) {
+        processPacket(m_acquired.data() + offset);
+    }
+    m_acquired.clear();
+}
+
+void TsAnalyzer::processPacket(const uint8_t* pkt) {
+    m_packets++;
+    if (!m_liveClock && m_bytesPerPcrTick > 0.0) {
+        m_nowNs = static_cast<int64_t>(static_cast<double>(m_byteIndex) / m_bytesPerPcrTick * 1000.0 / 27.0);
+    }
+
+    uint16_t pid = tsPid(pkt);
+    PidState& state = m_pids[pid];
+    state.lastSeenNs = m_nowNs;
+
+    if (tsTransportError(pkt)) {
+        // Header fields cannot be trusted once the demodulator flags the packet.
+        m_transportError.add();
+    } else if (pid != kTsPidNull) {
+        if (tsScrambling(pkt) != 0) {
+            if (!m_catSeen) m_catError.add();
+            if (pid == kTsPidPat) m_patError.add();
+            if (state.isPmt) m_pmtError.add();
+        }
+        checkContinuity(state, pkt, pid);
+        if (tsHasAdaptation(pkt)) checkPcr(state, pkt, pid);
+        if (pid == kTsPidPat || pid == 0x0001 || state.isPmt) {
+            collectSection(state, pkt, pid);
+        } else if (state.isEs && tsPayloadUnitStart(pkt)) {
+            checkPes(state, pkt);
+        }
+    }
+
+    m_byteIndex += static_cast<int64_t>(kTsPacketSize);
+    if (timeValid() && m_nowNs - m_lastCheckNs >= kCheckPeriodNs) {
+        m_lastCheckNs = m_nowNs;
+        checkIntervals();
+    }
+}
+
+void TsAnalyzer::checkContinuity(PidState& state, const uint8_t* pkt, uint16_t pid) {
+    (void)pid;
+    uint8_t cc = tsContinuityCounter(pkt);
+    if (!state.hasCc || tsDiscontinuity(pkt)) {
+        state.hasCc = true;
+        state.lastCc = cc;
+        state.duplicates = 0;
+        return;
+    }
+    if (!tsHasPayload(pkt)) {
+        // Adaptation-only packets must not advance the counter.
+        if (cc != state.lastCc) m_ccError.add();
+        state.lastCc = cc;
+        return;
+    }
+    if (cc == ((state.lastCc + 1) & 0x0F)) {
+        state.duplicates = 0;
+    } else if (cc == state.lastCc && state.duplicates == 0) {
+        state.duplicates = 1;
+    } else {
+        m_ccError.add();
+        state.duplicates = 0;
+    }
+    state.lastCc = cc;
+}
+
+void TsAnalyzer::checkPcr(PidState& state, const uint8_t* pkt, uint16_t pid) {
+    int64_t pcr;
+    if (!tsReadPcr(pkt, pcr)) return;
+    if (!state.isPcr) {
+        state.isPcr = true;
+        m_pcrPidList.push_back(pid);
+    }
+    if (m_clockPid == kTsPidNull) m_clockPid = pid;
+
+    if (state.lastPcr >= 0 && !tsDiscontinuity(pkt)) {
+        int64_t delta = wrapDelta(pcr, state.lastPcr, kPcrWrap);
+        if (delta <= 0 || delta * 1000 / 27 > m_config.pcrIntervalNs) {
+            m_pcrDiscontinuityError.add();
+        } else if (pid == m_clockPid) {
+            // PCR_AC: PCR against its byte position at the long-term transport rate.
+            double bytes = static_cast<double>(m_byteIndex - state.lastPcrByte);
+            if (m_bytesPerPcrTick > 0.0) {
+                double errorNs = (static_cast<double>(delta) - bytes / m_bytesPerPcrTick) * 1000.0 / 27.0;
+                int64_t magnitude = static_cast<int64_t>(std::abs(errorNs));
+                if (magnitude > m_pcrAccuracyMaxNs.load(std::memory_order_relaxed)) {
+                    m_pcrAccuracyMaxNs = magnitude;
+                }
+                if (magnitude > m_config.pcrAccuracyNs) m_pcrAccuracyError.add();
+            }
+            double rate = bytes / static_cast<double>(delta);
+            m_bytesPerPcrTick = m_bytesPerPcrTick > 0.0 ? m_bytesPerPcrTick * 0.98 + rate * 0.02 : rate;
+            m_bitrate = static_cast<int64_t>(m_bytesPerPcrTick * 8.0 * kPcrClockHz);
+        }
+    }
+    state.lastPcr = pcr;
+    state.lastPcrNs = m_nowNs;
+    state.lastPcrByte = m_byteIndex;
+}
+
+void TsAnalyzer::checkPes(PidState& state, const uint8_t* pkt) {
+    size_t length;
+    const uint8_t* payload = tsPayload(pkt, length);
+    if (!payload || length < 14 || payload[0] != 0x00 || payload[1] != 0x00 || payload[2] != 0x01) return;
+    state.isPes = true;
+    if (payload[7] & 0x80) {
+        state.lastPtsNs = m_nowNs;
+    }
+}
+
+void TsAnalyzer::collectSection(PidState& state, const uint8_t* pkt, uint16_t pid) {
+    size_t length;
+    const uint8_t* payload = tsPayload(pkt, length);
+    if (!payload) return;
+    if (!state.section) state.section.reset(new SectionBuffer());
+    std::vector<uint8_t>& data = state.section->data;
+
+    auto drain = [&]() {
+        while (data.size() >= 3) {
+            if (data[0] == 0xFF) {
+                data.clear();
+                return;
+            }
+            size_t total = 3 + (((data[1] & 0x0F) << 8) | data[2]);
+            if (data.size() < total) return;
+            handleSection(data.data(), total, pid);
+            data.erase(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(total));
+        }
+    };
+
+    if (tsPayloadUnitStart(pkt)) {
+        size_t pointer = payload[0];
+        if (1 + pointer > length) {
+            data.clear();
+            return;
+        }
+        if (!data.empty()) {
+            data.insert(data.end(), payload + 1, payload + 1 + pointer);
+            drain();
+        }
+        data.assign(payload + 1 + pointer, payload + length);
+        drain();
+    } else if (!data.empty()) {
+        data.insert(data.end(), payload, payload + length);
+        drain();
+    }
+    if (data.size() > kMaxSectionSize) data.clear();
+}
+
+void TsAnalyzer::handleSection(const uint8_t* section, size_t length, uint16_t pid) {
+    uint8_t tableId = section[0];
+    if ((section[1] & 0x80) && (length < 12 || tsCrc32(section, length) != 0)) {
+        m_crcError.add();
+        return;
+    }
+    if (length < 12) return;
+
+    if (pid == kTsPidPat) {
+        if (tableId != 0x00) {
+            m_patError.add();
+            return;
+        }
+        m_lastPatNs = m_nowNs;
+        for (size_t i = 8; i + 4 <= length - 4; i += 4) {
+            uint16_t program = static_cast<uint16_t>((section[i] << 8) | section[i + 1]);
+            uint16_t pmtPid = static_cast<uint16_t>(((section[i + 2] & 0x1F) << 8) | section[i + 3]);
+            if (program == 0 || m_pids[pmtPid].isPmt) continue;
+            m_pids[pmtPid].isPmt = true;
+            m_pids[pmtPid].lastSectionNs = m_nowNs;
+            m_pmtPidList.push_back(pmtPid);
+        }
+        return;
+    }
+
+    if (pid == 0x0001) {
+        if (tableId == 0x01) m_catSeen = true;
+        return;
+    }
+
+    if (tableId != 0x02 || length < 16) return;
+    m_pids[pid].lastSectionNs = m_nowNs;
+    m_clockPid = static_cast<uint16_t>(((section[8] & 0x1F) << 8) | section[9]);
+    size_t programInfoLength = ((section[10] & 0x0F) << 8) | section[11];
+    for (size_t i = 12 + programInfoLength; i + 5 <= length - 4;) {
+        uint16_t esPid = static_cast<uint16_t>(((section[i + 1] & 0x1F) << 8) | section[i + 2]);
+        size_t infoLength = ((section[i + 3] & 0x0F) << 8) | section[i + 4];
+        PidState& es = m_pids[esPid];
+        if (!es.isEs) {
+            es.isEs = true;
+            // Start the PID_error timeout at discovery, not at first packet.
+            if (es.lastSeenNs < 0) es.lastSeenNs = m_nowNs;
+            m_esPidList.push_back(esPid);
+        }
+        i += 5 + infoLength;
+    }
+}
+
+void TsAnalyzer::checkIntervals() {
+    if (m_lastPatNs < 0) m_lastPatNs = m_nowNs;
+    if (m_nowNs - m_lastPatNs > m_config.patIntervalNs) {
+        m_patError.add();
+        m_lastPatNs = m_nowNs;
+    }
+    for (uint16_t pid : m_pmtPidList) {
+        PidState& state = m_pids[pid];
+        if (m_nowNs - state.lastSectionNs > m_config.pmtIntervalNs) {
+            m_pmtError.add();
+            state.lastSectionNs = m_nowNs;
+        }
+    }
+    for (uint16_t pid : m_esPidList) {
+        PidState& state = m_pids[pid];
+        if (m_nowNs - state.lastSeenNs > m_config.pidTimeoutNs) {
+            m_pidError.add();
+            state.lastSeenNs = m_nowNs;
+        }
+        if (state.lastPtsNs >= 0 && m_nowNs - state.lastPtsNs > m_config.ptsIntervalNs) {
+            m_ptsError.add();
+            state.lastPtsNs = m_nowNs;
+        }
+    }
+    for (uint16_t pid : m_pcrPidList) {
+        PidState& state = m_pids[pid];
+        if (m_nowNs - state.lastPcrNs > m_config.pcrRepetitionNs) {
+            m_pcrRepetitionError.add();
+            state.lastPcrNs = m_nowNs;
+        }
+    }
+}
+
+void TsAnalyzer::print(std::ostream& os) const {
+    os << "Packets: " << m_packets << std::endl
+       << "Priority 1" << std::endl
+       << "  1.1 TS_sync_loss:            " << m_syncLoss.local << std::endl
+       << "  1.2 Sync_byte_error:         " << m_syncByteError.local << std::endl
+       << "  1.3 PAT_error:               " << m_patError.local << std::endl
+       << "  1.4 Continuity_count_error:  " << m_ccError.local << std::endl
+       << "  1.5 PMT_error:               " << m_pmtError.local << std::endl
+       << "  1.6 PID_error:               " << m_pidError.local << std::endl
+       << "Priority 2" << std::endl
+       << "  2.1 Transport_error:         " << m_transportError.local << std::endl
+       << "  2.2 CRC_error:               " << m_crcError.local << std::endl
+       << "  2.3 PCR_repetition_error:    " << m_pcrRepetitionError.local << std::endl
+       << "  2.3 PCR_discontinuity_error: " << m_pcrDiscontinuityError.local << std::endl
+       << "  2.4 PCR_accuracy_error:      " << m_pcrAccuracyError.local
+       << " (max " << m_pcrAccuracyMaxNs.load() << " ns)" << std::endl
+       << "  2.5 PTS_error:               " << m_ptsError.local << std::endl
+       << "  2.6 CAT_error:               " << m_catError.local << std::endl;
+}
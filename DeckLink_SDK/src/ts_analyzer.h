@@ -0,0 +1,114 @@
+#ifndef TS_ANALYZER_H
+#define TS_ANALYZER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ts_packet.h"
+
+// ETSI TR 101 290 priority 1 and 2 checks over a transport stream:
+//   1.1 TS_sync_loss      1.2 Sync_byte_error   1.3 PAT_error
+//   1.4 Continuity_count  1.5 PMT_error         1.6 PID_error
+//   2.1 Transport_error   2.2 CRC_error         2.3 PCR_error (repetition/discontinuity)
+//   2.4 PCR_accuracy      2.5 PTS_error         2.6 CAT_error
+// Counters are published in the StatsRegistry under "<prefix>.<name>".
+struct TsAnalyzerConfig {
+    int64_t patIntervalNs = 500000000;
+    int64_t pmtIntervalNs = 500000000;
+    int64_t pidTimeoutNs = 5000000000;
+    int64_t pcrIntervalNs = 100000000;     // PCR_discontinuity_indicator_error: larger jumps between PCRs
+    int64_t pcrRepetitionNs = 40000000;    // PCR_repetition_error: 40 ms in TR 101 290 2.3a
+    int64_t ptsIntervalNs = 700000000;
+    int64_t pcrAccuracyNs = 500;
+};
+
+class TsAnalyzer {
+private:
+    struct SectionBuffer {
+        std::vector<uint8_t> data;
+    };
+
+    struct PidState {
+        int64_t lastSeenNs = -1;
+        int64_t lastSectionNs = -1;
+        int64_t lastPcr = -1;
+        int64_t lastPcrNs = -1;
+        int64_t lastPcrByte = 0;
+        int64_t lastPtsNs = -1;
+        uint8_t lastCc = 0;
+        uint8_t duplicates = 0;
+        bool hasCc = false;
+        bool isPmt = false;
+        bool isPcr = false;
+        bool isEs = false;
+        bool isPes = false;
+        std::unique_ptr<SectionBuffer> section;
+    };
+
+    struct Counter {
+        std::atomic<int64_t>* value;
+        int64_t local = 0;
+        void add(int64_t n = 1) { local += n; *value += n; }
+    };
+
+    TsAnalyzerConfig m_config;
+    std::vector<PidState> m_pids;
+    std::vector<uint8_t> m_carry;
+    std::vector<uint8_t> m_acquired;   // packets of the current sync acquisition run, analysed once locked
+
+    bool m_inSync = false;
+    int m_goodSyncRun = 0;
+    int m_badSyncRun = 0;
+    int64_t m_byteIndex = 0;
+    int64_t m_nowNs = 0;
+    bool m_liveClock = false;
+    int64_t m_lastPatNs = -1;
+    int64_t m_lastCheckNs = 0;
+    std::vector<uint16_t> m_pmtPidList;
+    std::vector<uint16_t> m_esPidList;
+    std::vector<uint16_t> m_pcrPidList;
+    bool m_catSeen = false;
+    uint16_t m_clockPid = kTsPidNull;
+    double m_bytesPerPcrTick = 0.0;
+
+    Counter m_syncLoss, m_syncByteError, m_patError, m_ccError, m_pmtError, m_pidError;
+    Counter m_transportError, m_crcError, m_pcrRepetitionError, m_pcrDiscontinuityError;
+    Counter m_pcrAccuracyError, m_ptsError, m_catError;
+    int64_t m_packets = 0;
+    std::atomic<int64_t>& m_packetCount;
+    std::atomic<int64_t>& m_pcrAccuracyMaxNs;
+    std::atomic<int64_t>& m_bitrate;
+
+    void processPacket(const uint8_t* pkt);
+    void acquirePacket(const uint8_t* pkt);
+    void checkContinuity(PidState& state, const uint8_t* pkt, uint16_t pid);
+    void checkPcr(PidState& state, const uint8_t* pkt, uint16_t pid);
+    void checkPes(PidState& state, const uint8_t* pkt);
+    void collectSection(PidState& state, const uint8_t* pkt, uint16_t pid);
+    void handleSection(const uint8_t* section, size_t length, uint16_t pid);
+    void checkIntervals();
+    bool timeValid() const { return m_liveClock || m_bytesPerPcrTick > 0.0; }
+
+public:
+    explicit TsAnalyzer(const std::string& statsPrefix = "tr101290", const TsAnalyzerConfig& config = TsAnalyzerConfig());
+
+    // Feeds raw TS bytes in any chunking. arrivalNs is the monotonic arrival
+    // time of the chunk; pass -1 for offline input to time checks from PCR.
+    void feed(const uint8_t* data, size_t size, int64_t arrivalNs);
+
+    int64_t packets() const { return m_packets; }
+    void print(std::ostream& os) const;
+};
+
+// Offset of the first position where three consecutive packets start with
+// the sync byte, or size when there is none. Vectorized with SSE2/AVX2.
+size_t tsFindSync(const uint8_t* data, size_t size);
+
+// CRC-32/MPEG-2 as used by PSI sections; 0 over a section including its CRC.
+uint32_t tsCrc32(const uint8_t* data, size_t size);
+
+#endif // TS_ANALYZER_H
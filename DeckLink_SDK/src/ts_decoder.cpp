@@ -0,0 +1,206 @@
+#include "ts_decoder.h"
+#include <algorithm>
+#include <iostream>
+#include "stats.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+}
+
+namespace {
+AVCodecID codecForStreamType(uint8_t streamType) {
+    switch (streamType) {
+        case 0x01:
+        case 0x02: return AV_CODEC_ID_MPEG2VIDEO;
+        case 0x1B: return AV_CODEC_ID_H264;
+        case 0x24: return AV_CODEC_ID_HEVC;
+        case 0x03:
+        case 0x04: return AV_CODEC_ID_MP2;
+        case 0x0F: return AV_CODEC_ID_AAC;
+        case 0x11: return AV_CODEC_ID_AAC_LATM;
+        case 0x81: return AV_CODEC_ID_AC3;
+        default: return AV_CODEC_ID_NONE;
+    }
+}
+
+int frameChannels(const AVFrame* frame) {
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100)
+    return frame->ch_layout.nb_channels;
+#else
+    return frame->channels;
+#endif
+}
+
+int16_t sampleAt(const AVFrame* frame, int channel, int index, int channels) {
+    AVSampleFormat format = static_cast<AVSampleFormat>(frame->format);
+    bool planar = av_sample_fmt_is_planar(format) != 0;
+    const uint8_t* base = planar ? frame->extended_data[channel] : frame->extended_data[0];
+    int offset = planar ? index : index * channels + channel;
+
+    switch (av_get_packed_sample_fmt(format)) {
+        case AV_SAMPLE_FMT_U8:
+            return static_cast<int16_t>((base[offset] - 128) << 8);
+        case AV_SAMPLE_FMT_S16:
+            return reinterpret_cast<const int16_t*>(base)[offset];
+        case AV_SAMPLE_FMT_S32:
+            return static_cast<int16_t>(reinterpret_cast<const int32_t*>(base)[offset] >> 16);
+        case AV_SAMPLE_FMT_FLT: {
+            float value = reinterpret_cast<const float*>(base)[offset];
+            return static_cast<int16_t>(std::max(-1.0f, std::min(1.0f, value)) * 32767.0f);
+        }
+        case AV_SAMPLE_FMT_DBL: {
+            double value = reinterpret_cast<const double*>(base)[offset];
+            return static_cast<int16_t>(std::max(-1.0, std::min(1.0, value)) * 32767.0);
+        }
+        default:
+            return 0;
+    }
+}
+}
+
+TsDecoder::TsDecoder(int outputWidth, int outputHeight)
+    : m_outputWidth(outputWidth), m_outputHeight(outputHeight),
+      m_videoFrames(statsValue("ingest.video_frames_decoded")),
+      m_audioFrames(statsValue("ingest.audio_frames_decoded")),
+      m_decodeErrors(statsValue("ingest.decode_errors")),
+      m_unsupportedAudio(statsValue("ingest.audio_unsupported")) {
+    m_packet = av_packet_alloc();
+    m_frame = av_frame_alloc();
+    if (av_image_alloc(m_planes, m_lineSizes, outputWidth, outputHeight, AV_PIX_FMT_YUV422P10LE, 64) < 0) {
+        std::cerr << "Failed to allocate ingest conversion planes" << std::endl;
+    }
+}
+
+TsDecoder::~TsDecoder() {
+    closeStream(m_video);
+    closeStream(m_audio);
+    sws_freeContext(m_sws);
+    av_freep(&m_planes[0]);
+    av_frame_free(&m_frame);
+    av_packet_free(&m_packet);
+}
+
+bool TsDecoder::openStream(Stream& stream, uint8_t streamType) {
+    closeStream(stream);
+    AVCodecID id = codecForStreamType(streamType);
+    const AVCodec* codec = id != AV_CODEC_ID_NONE ? avcodec_find_decoder(id) : nullptr;
+    if (!codec) {
+        return false;
+    }
+    stream.codec = avcodec_alloc_context3(codec);
+    stream.codec->thread_count = 0;
+    stream.codec->pkt_timebase = AVRational{1, 90000};
+    if (avcodec_open2(stream.codec, codec, nullptr) < 0) {
+        avcodec_free_context(&stream.codec);
+        return false;
+    }
+    // PES payloads need not align with access units; split them with the parser.
+    stream.parser = av_parser_init(id);
+    return true;
+}
+
+void TsDecoder::closeStream(Stream& stream) {
+    if (stream.parser) {
+        av_parser_close(stream.parser);
+        stream.parser = nullptr;
+    }
+    avcodec_free_context(&stream.codec);
+}
+
+void TsDecoder::sendPacket(Stream& stream, const std::function<void(AVFrame*)>& onFrame) {
+    if (avcodec_send_packet(stream.codec, m_packet) < 0) {
+        m_decodeErrors++;
+        return;
+    }
+    while (avcodec_receive_frame(stream.codec, m_frame) == 0) {
+        onFrame(m_frame);
+        av_frame_unref(m_frame);
+    }
+}
+
+void TsDecoder::feed(Stream& stream, const uint8_t* data, size_t size, int64_t pts,
+                     const std::function<void(AVFrame*)>& onFrame) {
+    if (!stream.codec) return;
+    int64_t packetPts = pts >= 0 ? pts : AV_NOPTS_VALUE;
+
+    if (!stream.parser) {
+        m_packet->data = const_cast<uint8_t*>(data);
+        m_packet->size = static_cast<int>(size);
+        m_packet->pts = packetPts;
+        sendPacket(stream, onFrame);
+        return;
+    }
+
+    while (size > 0) {
+        uint8_t* out = nullptr;
+        int outSize = 0;
+        int used = av_parser_parse2(stream.parser, stream.codec, &out, &outSize,
+                                    data, static_cast<int>(size), packetPts, packetPts, 0);
+        if (used < 0) {
+            m_decodeErrors++;
+            return;
+        }
+        data += used;
+        size -= static_cast<size_t>(used);
+        packetPts = AV_NOPTS_VALUE;
+        if (outSize > 0) {
+            m_packet->data = out;
+            m_packet->size = outSize;
+            m_packet->pts = stream.parser->pts;
+            sendPacket(stream, onFrame);
+        }
+    }
+}
+
+void TsDecoder::convertPicture(AVFrame* frame, const PictureHandler& handler) {
+    m_sws = sws_getCachedContext(m_sws, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                 m_outputWidth, m_outputHeight, AV_PIX_FMT_YUV422P10LE,
+                                 SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!m_sws || !m_planes[0]) {
+        m_decodeErrors++;
+        return;
+    }
+    sws_scale(m_sws, frame->data, frame->linesize, 0, frame->height, m_planes, m_lineSizes);
+    m_videoFrames++;
+
+    DecodedPicture picture;
+    picture.width = m_outputWidth;
+    picture.height = m_outputHeight;
+    for (int i = 0; i < 3; i++) {
+        picture.planes[i] = reinterpret_cast<const uint16_t*>(m_planes[i]);
+        picture.strides[i] = m_lineSizes[i] / 2;
+    }
+    picture.pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : -1;
+    handler(picture);
+}
+
+void TsDecoder::convertAudio(AVFrame* frame, const AudioHandler& handler) {
+    int channels = frameChannels(frame);
+    if (frame->sample_rate != 48000 || channels <= 0) {
+        m_unsupportedAudio++;
+        return;
+    }
+    m_audioSamples.resize(static_cast<size_t>(frame->nb_samples) * 2);
+    for (int i = 0; i < frame->nb_samples; i++) {
+        for (int ch = 0; ch < 2; ch++) {
+            m_audioSamples[i * 2 + ch] = sampleAt(frame, std::min(ch, channels - 1), i, channels);
+        }
+    }
+    m_audioFrames++;
+
+    DecodedAudio audio;
+    audio.samples = m_audioSamples.data();
+    audio.frameCount = static_cast<uint32_t>(frame->nb_samples);
+    audio.pts = frame->best_effort_timestamp != AV_NOPTS_VALUE ? frame->best_effort_timestamp : -1;
+    handler(audio);
+}
+
+void TsDecoder::decodeVideo(const uint8_t* data, size_t size, int64_t pts, const PictureHandler& handler) {
+    feed(m_video, data, size, pts, [&](AVFrame* frame) { convertPicture(frame, handler); });
+}
+
+void TsDecoder::decodeAudio(const uint8_t* data, size_t size, int64_t pts, const AudioHandler& handler) {
+    feed(m_audio, data, size, pts, [&](AVFrame* frame) { convertAudio(frame, handler); });
+}
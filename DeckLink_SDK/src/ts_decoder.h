@@ -0,0 +1,83 @@
+#ifndef TS_DECODER_H
+#define TS_DECODER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct AVCodecContext;
+struct AVCodecParserContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+// Picture converted to planar 10-bit 4:2:2 at the output raster.
+struct DecodedPicture {
+    int width;
+    int height;
+    const uint16_t* planes[3];  // Y, Cb, Cr
+    int strides[3];             // in samples
+    int64_t pts;                // 90 kHz, -1 when unknown
+};
+
+// Audio converted to interleaved 48 kHz stereo 16-bit.
+struct DecodedAudio {
+    const int16_t* samples;
+    uint32_t frameCount;
+    int64_t pts;                // 90 kHz, -1 when unknown
+};
+
+// libavcodec decoder for the elementary streams of the TS ingest path.
+// Only built when libavcodec/libswscale are found (HAVE_LIBAV).
+class TsDecoder {
+public:
+    using PictureHandler = std::function<void(const DecodedPicture&)>;
+    using AudioHandler = std::function<void(const DecodedAudio&)>;
+
+private:
+    struct Stream {
+        AVCodecContext* codec = nullptr;
+        AVCodecParserContext* parser = nullptr;
+    };
+
+    int m_outputWidth;
+    int m_outputHeight;
+    Stream m_video;
+    Stream m_audio;
+    AVPacket* m_packet = nullptr;
+    AVFrame* m_frame = nullptr;
+    SwsContext* m_sws = nullptr;
+    uint8_t* m_planes[4] = {nullptr, nullptr, nullptr, nullptr};
+    int m_lineSizes[4] = {0, 0, 0, 0};
+    std::vector<int16_t> m_audioSamples;
+
+    std::atomic<int64_t>& m_videoFrames;
+    std::atomic<int64_t>& m_audioFrames;
+    std::atomic<int64_t>& m_decodeErrors;
+    std::atomic<int64_t>& m_unsupportedAudio;
+
+    bool openStream(Stream& stream, uint8_t streamType);
+    void closeStream(Stream& stream);
+    void feed(Stream& stream, const uint8_t* data, size_t size, int64_t pts,
+              const std::function<void(AVFrame*)>& onFrame);
+    void sendPacket(Stream& stream, const std::function<void(AVFrame*)>& onFrame);
+    void convertPicture(AVFrame* frame, const PictureHandler& handler);
+    void convertAudio(AVFrame* frame, const AudioHandler& handler);
+
+public:
+    TsDecoder(int outputWidth, int outputHeight);
+    ~TsDecoder();
+    TsDecoder(const TsDecoder&) = delete;
+    TsDecoder& operator=(const TsDecoder&) = delete;
+
+    bool openVideo(uint8_t streamType) { return openStream(m_video, streamType); }
+    bool openAudio(uint8_t streamType) { return openStream(m_audio, streamType); }
+
+    // data is one PES payload; pts is its 90 kHz timestamp or -1.
+    void decodeVideo(const uint8_t* data, size_t size, int64_t pts, const PictureHandler& handler);
+    void decodeAudio(const uint8_t* data, size_t size, int64_t pts, const AudioHandler& handler);
+};
+
+#endif // TS_DECODER_H
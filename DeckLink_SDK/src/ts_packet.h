@@ -0,0 +1,83 @@
+#ifndef TS_PACKET_H
+#define TS_PACKET_H
+
+#include <cstddef>
+#include <cstdint>
+
+// MPEG-2 transport stream packet helpers (ISO/IEC 13818-1).
+constexpr size_t kTsPacketSize = 188;
+constexpr uint8_t kTsSyncByte = 0x47;
+constexpr uint16_t kTsPidPat = 0x0000;
+constexpr uint16_t kTsPidNull = 0x1FFF;
+constexpr int64_t kPcrClockHz = 27000000;
+constexpr int64_t kPtsClockHz = 90000;
+// PCR base is 33 bits at 90 kHz, extension counts 0..299 at 27 MHz.
+constexpr int64_t kPcrWrap = (int64_t(1) << 33) * 300;
+constexpr int64_t kPtsWrap = int64_t(1) << 33;
+
+inline uint16_t tsPid(const uint8_t* pkt) {
+    return static_cast<uint16_t>(((pkt[1] & 0x1F) << 8) | pkt[2]);
+}
+
+inline bool tsTransportError(const uint8_t* pkt) { return (pkt[1] & 0x80) != 0; }
+inline bool tsPayloadUnitStart(const uint8_t* pkt) { return (pkt[1] & 0x40) != 0; }
+inline uint8_t tsScrambling(const uint8_t* pkt) { return (pkt[3] >> 6) & 0x03; }
+inline bool tsHasAdaptation(const uint8_t* pkt) { return (pkt[3] & 0x20) != 0; }
+inline bool tsHasPayload(const uint8_t* pkt) { return (pkt[3] & 0x10) != 0; }
+inline uint8_t tsContinuityCounter(const uint8_t* pkt) { return pkt[3] & 0x0F; }
+
+inline uint8_t tsAdaptationLength(const uint8_t* pkt) {
+    return tsHasAdaptation(pkt) ? pkt[4] : 0;
+}
+
+inline bool tsDiscontinuity(const uint8_t* pkt) {
+    return tsAdaptationLength(pkt) > 0 && (pkt[5] & 0x80) != 0;
+}
+
+// Extracts the PCR in 27 MHz ticks; false when the packet carries none.
+inline bool tsReadPcr(const uint8_t* pkt, int64_t& pcr) {
+    if (tsAdaptationLength(pkt) < 7 || (pkt[5] & 0x10) == 0) return false;
+    const uint8_t* p = pkt + 6;
+    int64_t base = (int64_t(p[0]) << 25) | (int64_t(p[1]) << 17) | (int64_t(p[2]) << 9) |
+                   (int64_t(p[3]) << 1) | (p[4] >> 7);
+    int64_t ext = ((p[4] & 0x01) << 8) | p[5];
+    pcr = base * 300 + ext;
+    return true;
+}
+
+// Returns the payload start and sets its length; nullptr when there is none.
+inline const uint8_t* tsPayload(const uint8_t* pkt, size_t& length) {
+    size_t offset = 4;
+    if (tsHasAdaptation(pkt)) offset += 1 + pkt[4];
+    if (!tsHasPayload(pkt) || offset >= kTsPacketSize) {
+        length = 0;
+        return nullptr;
+    }
+    length = kTsPacketSize - offset;
+    return pkt + offset;
+}
+
+// PMT stream_type values the ingest path knows how to decode.
+inline bool tsIsVideoStreamType(uint8_t type) {
+    return type == 0x01 || type == 0x02 || type == 0x1B || type == 0x24;
+}
+
+inline bool tsIsAudioStreamType(uint8_t type) {
+    return type == 0x03 || type == 0x04 || type == 0x0F || type == 0x11 || type == 0x81;
+}
+
+// Reads a 33-bit PTS/DTS field from a PES header.
+inline int64_t pesReadTimestamp(const uint8_t* p) {
+    return (int64_t(p[0] & 0x0E) << 29) | (int64_t(p[1]) << 22) | (int64_t(p[2] & 0xFE) << 14) |
+           (int64_t(p[3]) << 7) | (p[4] >> 1);
+}
+
+// Difference a - b of two wrapping timestamps, folded into (-wrap/2, wrap/2].
+inline int64_t wrapDelta(int64_t a, int64_t b, int64_t wrap) {
+    int64_t d = (a - b) % wrap;
+    if (d > wrap / 2) d -= wrap;
+    if (d <= -wrap / 2) d += wrap;
+    return d;
+}
+
+#endif // TS_PACKET_H
@@ -0,0 +1,377 @@
+#include "udp_ingest.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "stats.h"
+
+namespace {
+constexpr int64_t kFloorWindowNs = 500000000;       // 0.5 s per floor sample
+constexpr size_t kMaxFloorPoints = 40;              // 20 s regression window
+constexpr int64_t kOffsetStepNs = 500000000;        // offset jump treated as discontinuity
+constexpr double kMaxSlope = 0.001;                 // clamp drift to +/-1000 ppm
+constexpr double kJitterHalfLifeNs = 5e9;
+constexpr int64_t kJitterMarginNs = 1000000;
+constexpr size_t kBatchSize = 64;
+}
+
+PcrClock::PcrClock()
+    : m_discontinuities(statsValue("ingest.pcr_discontinuities")),
+      m_driftPpb(statsValue("ingest.clock_drift_ppb")) {}
+
+void PcrClock::reset() {
+    m_points.clear();
+    m_windowStartNs = 0;
+    m_locked = false;
+    m_slope = 0.0;
+}
+
+void PcrClock::refit() {
+    m_originNs = m_points.front().first;
+    if (m_points.size() < 2) {
+        m_interceptNs = static_cast<double>(m_points.front().second);
+        m_slope = 0.0;
+        return;
+    }
+    double n = static_cast<double>(m_points.size());
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for (const auto& point : m_points) {
+        double x = static_cast<double>(point.first - m_originNs);
+        double y = static_cast<double>(point.second);
+        sumX += x;
+        sumY += y;
+        sumXX += x * x;
+        sumXY += x * y;
+    }
+    double denom = n * sumXX - sumX * sumX;
+    m_slope = denom > 0 ? (n * sumXY - sumX * sumY) / denom : 0.0;
+    m_slope = std::max(-kMaxSlope, std::min(kMaxSlope, m_slope));
+    m_interceptNs = (sumY - m_slope * sumX) / n;
+    m_driftPpb = static_cast<int64_t>(m_slope * 1e9);
+}
+
+int64_t PcrClock::predictOffsetLocked(int64_t senderNs) const {
+    if (!m_locked) return m_windowMinOffsetNs;
+    return static_cast<int64_t>(m_interceptNs + m_slope * static_cast<double>(senderNs - m_originNs));
+}
+
+int64_t PcrClock::update(int64_t pcr, int64_t arrivalNs) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_hasPcr) {
+        int64_t delta = wrapDelta(pcr, m_lastPcr, kPcrWrap);
+        // PCRs repeat at least every 100 ms; anything else is a new timeline.
+        // The unwrapped sender time keeps running so downstream stays monotonic.
+        if (delta < 0 || delta > kPcrClockHz) {
+            m_discontinuities++;
+            reset();
+        } else {
+            m_senderTicks += delta;
+        }
+    }
+    m_hasPcr = true;
+    m_lastPcr = pcr;
+
+    int64_t senderNs = m_senderTicks * 1000 / 27;
+    int64_t offset = arrivalNs - senderNs;
+    if (m_locked && std::llabs(offset - predictOffsetLocked(senderNs)) > kOffsetStepNs) {
+        m_discontinuities++;
+        reset();
+    }
+
+    if (m_windowStartNs == 0) {
+        m_windowStartNs = arrivalNs;
+        m_windowMinOffsetNs = offset;
+        m_windowMinSenderNs = senderNs;
+    } else if (offset < m_windowMinOffsetNs) {
+        m_windowMinOffsetNs = offset;
+        m_windowMinSenderNs = senderNs;
+    }
+
+    if (arrivalNs - m_windowStartNs >= kFloorWindowNs) {
+        m_points.emplace_back(m_windowMinSenderNs, m_windowMinOffsetNs);
+        if (m_points.size() > kMaxFloorPoints) m_points.pop_front();
+        refit();
+        m_locked = true;
+        m_windowStartNs = arrivalNs;
+        m_windowMinOffsetNs = offset;
+        m_windowMinSenderNs = senderNs;
+    }
+    return senderNs;
+}
+
+bool PcrClock::locked() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_locked;
+}
+
+int64_t PcrClock::senderToLocalNs(int64_t senderNs) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return senderNs + predictOffsetLocked(senderNs);
+}
+
+int64_t PcrClock::ptsToSenderNs(int64_t pts) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int64_t ticks = m_senderTicks + wrapDelta(pts * 300, m_lastPcr, kPcrWrap);
+    return ticks * 1000 / 27;
+}
+
+double PcrClock::driftPpm() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_slope * 1e6;
+}
+
+JitterBuffer::JitterBuffer(size_t capacity, int64_t minDepthNs, int64_t maxDepthNs)
+    : m_minDepthNs(minDepthNs), m_maxDepthNs(maxDepthNs), m_targetDepthNs(minDepthNs),
+      m_datagramCount(statsValue("ingest.datagrams")),
+      m_latePackets(statsValue("ingest.late_packets")),
+      m_overflowDrops(statsValue("ingest.overflow_drops")),
+      m_syncErrors(statsValue("ingest.sync_errors")),
+      m_depthUs(statsValue("ingest.buffer_depth_us")),
+      m_jitterUs(statsValue("ingest.arrival_jitter_us")),
+      m_fill(statsValue("ingest.buffer_fill")) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    m_slots.reset(new TsDatagram[size]);
+    m_mask = size - 1;
+    m_depthUs = minDepthNs / 1000;
+}
+
+size_t JitterBuffer::reserve(TsDatagram** slots, size_t max) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    size_t tail = m_tail.load(std::memory_order_acquire);
+    size_t available = (m_mask + 1) - (head - tail);
+    size_t count = std::min(max, available);
+    for (size_t i = 0; i < count; i++) {
+        slots[i] = &m_slots[(head + i) & m_mask];
+    }
+    return count;
+}
+
+int64_t JitterBuffer::estimateSenderNs(const TsDatagram& datagram) {
+    int64_t estimate = -1;
+    if (m_lastPcrByte >= 0 && m_bytesPerNs > 0.0) {
+        estimate = m_lastPcrSenderNs +
+                   static_cast<int64_t>(static_cast<double>(m_byteIndex - m_lastPcrByte) / m_bytesPerNs);
+    }
+
+    for (size_t offset = 0; offset + kTsPacketSize <= datagram.size; offset += kTsPacketSize) {
+        const uint8_t* pkt = datagram.data + offset;
+        int64_t pcr;
+        if (pkt[0] != kTsSyncByte || !tsReadPcr(pkt, pcr)) continue;
+
+        int64_t senderNs = m_clock.update(pcr, datagram.arrivalNs);
+        int64_t byte = m_byteIndex + static_cast<int64_t>(offset);
+        if (m_lastPcrByte >= 0 && senderNs > m_lastPcrSenderNs) {
+            double rate = static_cast<double>(byte - m_lastPcrByte) /
+                          static_cast<double>(senderNs - m_lastPcrSenderNs);
+            m_bytesPerNs = m_bytesPerNs > 0.0 ? m_bytesPerNs * 0.9 + rate * 0.1 : rate;
+        }
+        if (estimate < 0) {
+            estimate = senderNs;
+        }
+        m_lastPcrByte = byte;
+        m_lastPcrSenderNs = senderNs;
+    }
+    m_byteIndex += static_cast<int64_t>(datagram.size);
+    return estimate;
+}
+
+void JitterBuffer::updateJitter(int64_t jitterNs, int64_t nowNs) {
+    if (m_lastJitterUpdateNs != 0) {
+        double elapsed = static_cast<double>(nowNs - m_lastJitterUpdateNs);
+        m_peakJitterNs *= std::exp2(-elapsed / kJitterHalfLifeNs);
+    }
+    m_lastJitterUpdateNs = nowNs;
+    if (jitterNs > m_peakJitterNs) m_peakJitterNs = static_cast<double>(jitterNs);
+
+    int64_t target = static_cast<int64_t>(m_peakJitterNs * 1.25) + kJitterMarginNs;
+    target = std::max(m_minDepthNs, std::min(m_maxDepthNs, target));
+    m_targetDepthNs.store(target, std::memory_order_relaxed);
+    m_depthUs = target / 1000;
+    m_jitterUs = static_cast<int64_t>(m_peakJitterNs / 1000.0);
+}
+
+void JitterBuffer::commit(size_t count) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; i++) {
+        TsDatagram& datagram = m_slots[(head + i) & m_mask];
+        if (datagram.size == 0 || datagram.size % kTsPacketSize != 0 || datagram.data[0] != kTsSyncByte) {
+            m_syncErrors++;
+        }
+
+        int64_t senderNs = estimateSenderNs(datagram);
+        int64_t depth = m_targetDepthNs.load(std::memory_order_relaxed);
+        if (senderNs >= 0 && m_clock.locked()) {
+            int64_t ideal = m_clock.senderToLocalNs(senderNs);
+            updateJitter(datagram.arrivalNs - ideal, datagram.arrivalNs);
+            datagram.releaseNs = ideal + depth;
+            if (datagram.arrivalNs > datagram.releaseNs) {
+                m_latePackets += static_cast<int64_t>(datagram.size / kTsPacketSize);
+                datagram.releaseNs = datagram.arrivalNs;
+            }
+        } else {
+            datagram.releaseNs = datagram.arrivalNs + depth;
+        }
+    }
+    m_head.store(head + count, std::memory_order_release);
+    m_datagramCount += static_cast<int64_t>(count);
+    m_fill = static_cast<int64_t>(queued());
+}
+
+TsDatagram* JitterBuffer::front() {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load(std::memory_order_acquire)) return nullptr;
+    return &m_slots[tail & m_mask];
+}
+
+void JitterBuffer::pop() {
+    m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    m_fill = static_cast<int64_t>(queued());
+}
+
+size_t JitterBuffer::queued() const {
+    return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+}
+
+UdpTsReceiver::UdpTsReceiver(const std::string& address, uint16_t port, JitterBuffer& buffer)
+    : m_address(address), m_port(port), m_buffer(buffer),
+      m_batches(statsValue("ingest.recv_batches")),
+      m_bytes(statsValue("ingest.bytes")) {}
+
+UdpTsReceiver::~UdpTsReceiver() {
+    stop();
+}
+
+bool UdpTsReceiver::start() {
+    in_addr group{};
+    if (inet_pton(AF_INET, m_address.c_str(), &group) != 1) {
+        std::cerr << "Invalid ingest address: " << m_address << std::endl;
+        return false;
+    }
+
+    m_socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (m_socket < 0) {
+        std::cerr << "Failed to create UDP socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(m_socket, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+    int receiveBuffer = 8 * 1024 * 1024;
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    timeval timeout{0, 100000};
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(m_port);
+    addr.sin_addr = group;
+    if (bind(m_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        std::cerr << "Failed to bind " << m_address << ":" << m_port << ": " << strerror(errno) << std::endl;
+        close(m_socket);
+        m_socket = -1;
+        return false;
+    }
+
+    if (IN_MULTICAST(ntohl(group.s_addr))) {
+        ip_mreq membership{};
+        membership.imr_multiaddr = group;
+        membership.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(m_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+            std::cerr << "Failed to join multicast group " << m_address << ": " << strerror(errno) << std::endl;
+            close(m_socket);
+            m_socket = -1;
+            return false;
+        }
+    }
+
+    m_running = true;
+    m_thread = std::thread(&UdpTsReceiver::receiveLoop, this);
+    return true;
+}
+
+void UdpTsReceiver::stop() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    if (m_socket >= 0) {
+        close(m_socket);
+        m_socket = -1;
+    }
+}
+
+void UdpTsReceiver::receiveLoop() {
+    mmsghdr messages[kBatchSize];
+    iovec vectors[kBatchSize];
+    alignas(cmsghdr) char control[kBatchSize][CMSG_SPACE(sizeof(timespec))];
+    TsDatagram* slots[kBatchSize];
+    std::unique_ptr<TsDatagram> scratch(new TsDatagram());
+
+    while (m_running.load()) {
+        size_t count = m_buffer.reserve(slots, kBatchSize);
+        bool overflow = count == 0;
+        if (overflow) {
+            // Keep draining the socket so the kernel queue never backs up.
+            slots[0] = scratch.get();
+            count = 1;
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            vectors[i].iov_base = slots[i]->data;
+            vectors[i].iov_len = kMaxDatagramSize;
+            std::memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_control = control[i];
+            messages[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+
+        int received = recvmmsg(m_socket, messages, static_cast<unsigned int>(count), MSG_WAITFORONE, nullptr);
+        if (received <= 0) {
+            if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                std::cerr << "UDP receive failed: " << strerror(errno) << std::endl;
+                break;
+            }
+            continue;
+        }
+
+        // Kernel timestamps are CLOCK_REALTIME; shift them onto CLOCK_MONOTONIC.
+        int64_t monotonicNs = monotonicNowNs();
+        timespec realtime;
+        clock_gettime(CLOCK_REALTIME, &realtime);
+        int64_t realtimeOffset = (int64_t(realtime.tv_sec) * 1000000000 + realtime.tv_nsec) - monotonicNs;
+
+        int64_t bytes = 0;
+        for (int i = 0; i < received; i++) {
+            TsDatagram* datagram = slots[i];
+            datagram->size = messages[i].msg_len;
+            datagram->arrivalNs = monotonicNs;
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&messages[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&messages[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                    timespec stamp;
+                    std::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+                    int64_t arrival = int64_t(stamp.tv_sec) * 1000000000 + stamp.tv_nsec - realtimeOffset;
+                    datagram->arrivalNs = std::min(arrival, monotonicNs);
+                }
+            }
+            bytes += static_cast<int64_t>(datagram->size);
+        }
+
+        if (overflow) {
+            m_buffer.countOverflow(static_cast<size_t>(received));
+        } else {
+            m_buffer.commit(static_cast<size_t>(received));
+        }
+        m_batches++;
+        m_bytes += bytes;
+    }
+}
@@ -0,0 +1,140 @@
+#ifndef UDP_INGEST_H
+#define UDP_INGEST_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include "ts_packet.h"
+
+constexpr size_t kMaxDatagramSize = 1500;
+
+// Recovers the sender's 27 MHz clock from PCR arrivals. Each PCR gives an
+// offset (local arrival - sender time); the minimum offset per window is the
+// network floor, and a least-squares fit over the window minima yields the
+// offset and drift of the sender clock against CLOCK_MONOTONIC.
+class PcrClock {
+private:
+    mutable std::mutex m_mutex;
+    bool m_hasPcr = false;
+    int64_t m_lastPcr = 0;          // last raw PCR, 27 MHz
+    int64_t m_senderTicks = 0;      // unwrapped sender time of m_lastPcr, 27 MHz
+
+    int64_t m_windowStartNs = 0;
+    int64_t m_windowMinOffsetNs = 0;
+    int64_t m_windowMinSenderNs = 0;
+    std::deque<std::pair<int64_t, int64_t>> m_points; // (sender ns, floor offset ns)
+
+    int64_t m_originNs = 0;         // sender ns the fit is anchored at
+    double m_interceptNs = 0.0;
+    double m_slope = 0.0;
+    bool m_locked = false;
+
+    std::atomic<int64_t>& m_discontinuities;
+    std::atomic<int64_t>& m_driftPpb;
+
+    void reset();
+    void refit();
+    int64_t predictOffsetLocked(int64_t senderNs) const;
+
+public:
+    PcrClock();
+
+    // Feeds a PCR that arrived at arrivalNs (monotonic); returns its unwrapped sender time in ns.
+    int64_t update(int64_t pcr, int64_t arrivalNs);
+
+    bool locked() const;
+    int64_t senderToLocalNs(int64_t senderNs) const;
+    // Unwraps a 90 kHz PTS/DTS into the sender time domain of the last PCR.
+    int64_t ptsToSenderNs(int64_t pts) const;
+    double driftPpm() const;
+};
+
+struct TsDatagram {
+    uint8_t data[kMaxDatagramSize];
+    size_t size = 0;
+    int64_t arrivalNs = 0;
+    int64_t releaseNs = 0;
+};
+
+// Single-producer/single-consumer ring of datagrams. The receiver writes
+// straight into reserved slots with recvmmsg; commit() stamps each datagram
+// with a release time of (ideal arrival on the recovered PCR clock + target
+// depth). The depth tracks a decaying peak of the measured arrival jitter.
+class JitterBuffer {
+private:
+    std::unique_ptr<TsDatagram[]> m_slots;
+    size_t m_mask;
+    std::atomic<size_t> m_head{0};
+    std::atomic<size_t> m_tail{0};
+
+    PcrClock m_clock;
+    int64_t m_minDepthNs;
+    int64_t m_maxDepthNs;
+    std::atomic<int64_t> m_targetDepthNs;
+    double m_peakJitterNs = 0.0;
+    int64_t m_lastJitterUpdateNs = 0;
+
+    // PCR interpolation between PCR-bearing packets, by byte position.
+    int64_t m_byteIndex = 0;
+    int64_t m_lastPcrByte = -1;
+    int64_t m_lastPcrSenderNs = 0;
+    double m_bytesPerNs = 0.0;
+
+    std::atomic<int64_t>& m_datagramCount;
+    std::atomic<int64_t>& m_latePackets;
+    std::atomic<int64_t>& m_overflowDrops;
+    std::atomic<int64_t>& m_syncErrors;
+    std::atomic<int64_t>& m_depthUs;
+    std::atomic<int64_t>& m_jitterUs;
+    std::atomic<int64_t>& m_fill;
+
+    int64_t estimateSenderNs(const TsDatagram& datagram);
+    void updateJitter(int64_t jitterNs, int64_t nowNs);
+
+public:
+    JitterBuffer(size_t capacity, int64_t minDepthNs, int64_t maxDepthNs);
+
+    // Producer side.
+    size_t reserve(TsDatagram** slots, size_t max);
+    void commit(size_t count);
+    void countOverflow(size_t datagrams) { m_overflowDrops += static_cast<int64_t>(datagrams); }
+
+    // Consumer side.
+    TsDatagram* front();
+    void pop();
+
+    const PcrClock& clock() const { return m_clock; }
+    int64_t targetDepthNs() const { return m_targetDepthNs.load(std::memory_order_relaxed); }
+    size_t queued() const;
+};
+
+// Receives TS over UDP (unicast or multicast) in recvmmsg batches directly
+// into the jitter buffer, using kernel receive timestamps for arrival times.
+class UdpTsReceiver {
+private:
+    std::string m_address;
+    uint16_t m_port;
+    JitterBuffer& m_buffer;
+    int m_socket = -1;
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+
+    std::atomic<int64_t>& m_batches;
+    std::atomic<int64_t>& m_bytes;
+
+    void receiveLoop();
+
+public:
+    UdpTsReceiver(const std::string& address, uint16_t port, JitterBuffer& buffer);
+    ~UdpTsReceiver();
+
+    bool start();
+    void stop();
+};
+
+#endif // UDP_INGEST_H
@@ -0,0 +1,50 @@
+#include "v210.h"
+#include <algorithm>
+
+namespace {
+inline uint32_t packWord(uint32_t a, uint32_t b, uint32_t c) {
+    return (a & 0x3FF) | ((b & 0x3FF) << 10) | ((c & 0x3FF) << 20);
+}
+}
+
+void v210PackRow(const uint16_t* y, const uint16_t* cb, const uint16_t* cr, int width, uint32_t* dst) {
+    int chromaWidth = (width + 1) / 2;
+    int x = 0;
+    for (; x + 6 <= width; x += 6) {
+        int c = x / 2;
+        *dst++ = packWord(cb[c], y[x], cr[c]);
+        *dst++ = packWord(y[x + 1], cb[c + 1], y[x + 2]);
+        *dst++ = packWord(cr[c + 1], y[x + 3], cb[c + 2]);
+        *dst++ = packWord(y[x + 4], cr[c + 2], y[x + 5]);
+    }
+    if (x < width) {
+        // Partial group: replicate the last sample into the padding.
+        uint16_t ys[6], cbs[3], crs[3];
+        for (int i = 0; i < 6; i++) ys[i] = y[std::min(x + i, width - 1)];
+        for (int i = 0; i < 3; i++) {
+            int c = std::min(x / 2 + i, chromaWidth - 1);
+            cbs[i] = cb[c];
+            crs[i] = cr[c];
+        }
+        *dst++ = packWord(cbs[0], ys[0], crs[0]);
+        *dst++ = packWord(ys[1], cbs[1], ys[2]);
+        *dst++ = packWord(crs[1], ys[3], cbs[2]);
+        *dst++ = packWord(ys[4], crs[2], ys[5]);
+    }
+}
+
+void v210UnpackRow(const uint32_t* src, int width, uint16_t* y, uint16_t* cb, uint16_t* cr) {
+    for (int x = 0; x < width; x += 6, src += 4) {
+        uint16_t ys[6], cbs[3], crs[3];
+        cbs[0] = src[0] & 0x3FF;          ys[0] = (src[0] >> 10) & 0x3FF;  crs[0] = (src[0] >> 20) & 0x3FF;
+        ys[1] = src[1] & 0x3FF;           cbs[1] = (src[1] >> 10) & 0x3FF; ys[2] = (src[1] >> 20) & 0x3FF;
+        crs[1] = src[2] & 0x3FF;          ys[3] = (src[2] >> 10) & 0x3FF;  cbs[2] = (src[2] >> 20) & 0x3FF;
+        ys[4] = src[3] & 0x3FF;           crs[2] = (src[3] >> 10) & 0x3FF; ys[5] = (src[3] >> 20) & 0x3FF;
+        int count = std::min(6, width - x);
+        for (int i = 0; i < count; i++) y[x + i] = ys[i];
+        for (int i = 0; i < (count + 1) / 2; i++) {
+            cb[x / 2 + i] = cbs[i];
+            cr[x / 2 + i] = crs[i];
+        }
+    }
+}
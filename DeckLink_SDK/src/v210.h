@@ -0,0 +1,20 @@
+#ifndef V210_H
+#define V210_H
+
+#include <cstdint>
+
+// v210 (bmdFormat10BitYUV): 10-bit 4:2:2 with six pixels packed into four
+// little-endian 32-bit words, each row padded to a multiple of 128 bytes.
+//   w0 = Cb0 | Y0 << 10 | Cr0 << 20
+//   w1 = Y1  | Cb1 << 10 | Y2 << 20
+//   w2 = Cr1 | Y3 << 10 | Cb2 << 20
+//   w3 = Y4  | Cr2 << 10 | Y5 << 20
+inline long v210RowBytes(int width) {
+    return static_cast<long>((width + 47) / 48) * 128;
+}
+
+// Planar rows hold width luma and (width + 1) / 2 samples per chroma plane.
+void v210PackRow(const uint16_t* y, const uint16_t* cb, const uint16_t* cr, int width, uint32_t* dst);
+void v210UnpackRow(const uint32_t* src, int width, uint16_t* y, uint16_t* cb, uint16_t* cr);
+
+#endif // V210_H
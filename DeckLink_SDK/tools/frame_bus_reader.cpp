@@ -0,0 +1,119 @@
+// Example consumer of the DeckLink-SDK frame bus (--bus NAME): maps frames in
+// place and reports rate, lag and drops once a second.
+//
+//   Frame-Bus-Reader NAME [--latest] [--delay-ms MS] [--as LABEL]
+//   Frame-Bus-Reader NAME --list
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "frame_bus.h"
+#include "stats.h"
+
+std::atomic<bool> g_stopFlag{false};
+
+void signalHandler(int signum) {
+    std::cout << "Interrupt signal (" << signum << ") received." << std::endl;
+    g_stopFlag = true;
+}
+
+static int listConsumers(const std::string& busName) {
+    size_t bytes = 0;
+    FrameBusHeader* header = mapFrameBus(busName, bytes, false);
+    if (!header) return 1;
+    uint64_t published = __atomic_load_n(&header->published, __ATOMIC_ACQUIRE);
+    std::cout << "Bus " << busName << ": " << header->slotCount << " slots of " << header->slotBytes / 1024 << " KB"
+              << (header->hugePages ? " on hugepages" : "") << ", " << published << " frames published" << std::endl;
+    for (int i = 0; i < FrameBusHeader::kMaxConsumers; i++) {
+        const FrameBusConsumer& consumer = header->consumers[i];
+        int32_t pid = __atomic_load_n(&consumer.pid, __ATOMIC_ACQUIRE);
+        if (pid == 0) continue;
+        uint64_t cursor = __atomic_load_n(&consumer.cursor, __ATOMIC_RELAXED);
+        std::cout << "  consumer" << i << " " << std::string(consumer.name, strnlen(consumer.name, sizeof(consumer.name)))
+                  << " pid " << pid << ": frames " << consumer.frames << ", drops " << consumer.drops << ", lag "
+                  << (published > cursor ? published - cursor : 0) << std::endl;
+    }
+    munmap(header, bytes);
+    return 0;
+}
+
+// Mean of the luma samples on the middle line, to show the frame is read in place.
+static double middleLuma(const FrameBusReader::Frame& frame) {
+    const FrameBusSlot& info = *frame.info;
+    if (info.pixelFormat != 0x76323130 /* v210 */ || info.width < 6) return 0.0;
+    const uint32_t* row = reinterpret_cast<const uint32_t*>(frame.bytes + static_cast<size_t>(info.height / 2) * info.rowBytes);
+    uint64_t sum = 0;
+    uint32_t groups = info.width / 6;
+    for (uint32_t g = 0; g < groups; g++, row += 4) {
+        sum += ((row[0] >> 10) & 0x3FF) + (row[1] & 0x3FF) + ((row[1] >> 20) & 0x3FF) +
+               ((row[2] >> 10) & 0x3FF) + (row[3] & 0x3FF) + ((row[3] >> 20) & 0x3FF);
+    }
+    return static_cast<double>(sum) / (groups * 6);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " NAME [--latest] [--delay-ms MS] [--as LABEL] | NAME --list" << std::endl;
+        return 1;
+    }
+    std::string busName = argv[1];
+    std::string label = "reader";
+    bool latest = false;
+    int delayMs = 0;
+    for (int i = 2; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--list") == 0) {
+            return listConsumers(busName);
+        } else if (std::strcmp(argv[i], "--latest") == 0) {
+            latest = true;
+        } else if (std::strcmp(argv[i], "--delay-ms") == 0 && hasValue) {
+            delayMs = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--as") == 0 && hasValue) {
+            label = argv[++i];
+        } else {
+            std::cerr << "Unknown or incomplete option: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    FrameBusReader reader;
+    if (!reader.open(busName, label, latest)) return 1;
+    std::signal(SIGINT, signalHandler);
+    std::cout << "Reading bus " << busName << " as " << label << (latest ? " (latest frame only)" : "") << std::endl;
+
+    uint64_t lastFrames = 0;
+    auto lastPrint = std::chrono::steady_clock::now();
+    FrameBusReader::Frame frame{};
+    while (!g_stopFlag.load() && !reader.closed()) {
+        // The frame stays pinned, and safe to read, until the next call.
+        bool haveFrame = reader.next(frame, 1000);
+        if (haveFrame) {
+            // A slow consumer holds its pinned frame for the whole delay; capture carries on regardless.
+            if (delayMs > 0) std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+        }
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastPrint).count();
+        if (seconds >= 1.0) {
+            uint64_t published = __atomic_load_n(&reader.header()->published, __ATOMIC_ACQUIRE);
+            std::cout << "FPS: " << std::fixed << std::setprecision(2) << (reader.frames() - lastFrames) / seconds
+                      << " | lag " << (haveFrame ? published - frame.sequence : 0) << " | drops " << reader.drops();
+            if (haveFrame) {
+                std::cout << " | " << frame.info->width << "x" << frame.info->height << " middle-line luma "
+                          << std::setprecision(1) << middleLuma(frame);
+            }
+            std::cout << std::endl;
+            lastFrames = reader.frames();
+            lastPrint = now;
+        }
+    }
+    if (reader.closed()) std::cout << "Producer closed the bus" << std::endl;
+    std::cout << "Frames: " << reader.frames() << ", drops: " << reader.drops() << std::endl;
+    return 0;
+}
@@ -0,0 +1,114 @@
+// TR 101 290 priority 1/2 analyzer for a UDP feed or a recorded .ts file.
+//
+//   TS-Analyzer udp://239.1.16.47:1234 [--interval SECONDS]
+//   TS-Analyzer capture.ts
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "stats.h"
+#include "ts_analyzer.h"
+#include "udp_ingest.h"
+
+std::atomic<bool> g_stopFlag{false};
+
+void signalHandler(int signum) {
+    std::cout << "Interrupt signal (" << signum << ") received." << std::endl;
+    g_stopFlag = true;
+}
+
+static int analyzeFile(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return 1;
+    }
+
+    TsAnalyzer analyzer;
+    std::vector<char> chunk(4 * 1024 * 1024);
+    int64_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (file && !g_stopFlag.load()) {
+        file.read(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+        std::streamsize got = file.gcount();
+        if (got <= 0) break;
+        analyzer.feed(reinterpret_cast<const uint8_t*>(chunk.data()), static_cast<size_t>(got), -1);
+        bytes += got;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    analyzer.print(std::cout);
+    std::cout << "Analyzed " << bytes << " bytes in " << std::fixed << std::setprecision(3) << seconds << " s ("
+              << std::setprecision(1) << (seconds > 0 ? bytes * 8 / seconds / 1e6 : 0.0) << " Mbit/s)" << std::endl;
+    return 0;
+}
+
+static int analyzeUdp(const std::string& address, uint16_t port, int intervalSeconds) {
+    // Zero depth: the analyzer wants datagrams at their arrival times.
+    JitterBuffer buffer(16384, 0, 0);
+    UdpTsReceiver receiver(address, port, buffer);
+    if (!receiver.start()) {
+        return 1;
+    }
+    std::cout << "Analyzing udp://" << address << ":" << port << std::endl;
+
+    TsAnalyzer analyzer;
+    auto lastPrint = std::chrono::steady_clock::now();
+    while (!g_stopFlag.load()) {
+        TsDatagram* datagram = buffer.front();
+        if (!datagram) {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+        } else {
+            analyzer.feed(datagram->data, datagram->size, datagram->arrivalNs);
+            buffer.pop();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastPrint >= std::chrono::seconds(intervalSeconds)) {
+            analyzer.print(std::cout);
+            std::cout << "Bitrate: " << statsValue("tr101290.bitrate_bps").load() / 1000 << " kbit/s" << std::endl;
+            lastPrint = now;
+        }
+    }
+    receiver.stop();
+
+    std::cout << "Metrics:" << std::endl;
+    StatsRegistry::instance().print(std::cout, "tr101290.");
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " udp://ADDR:PORT [--interval SECONDS] | FILE.ts" << std::endl;
+        return 1;
+    }
+    int intervalSeconds = 5;
+    for (int i = 2; i + 1 < argc; i++) {
+        if (std::strcmp(argv[i], "--interval") == 0) {
+            intervalSeconds = std::max(1, std::atoi(argv[++i]));
+        }
+    }
+    std::signal(SIGINT, signalHandler);
+
+    std::string source = argv[1];
+    if (source.compare(0, 6, "udp://") == 0) {
+        std::string hostPort = source.substr(6);
+        size_t colon = hostPort.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Missing port in " << source << std::endl;
+            return 1;
+        }
+        // Drop any ?query such as the ffmpeg-style overrun_nonfatal options.
+        std::string port = hostPort.substr(colon + 1);
+        port = port.substr(0, port.find('?'));
+        return analyzeUdp(hostPort.substr(0, colon), static_cast<uint16_t>(std::atoi(port.c_str())), intervalSeconds);
+    }
+    return analyzeFile(source.c_str());
+}
@@ -1,10 +1,133 @@
+/*
+    SDI passthrough: DeckLink input 3 -> output 0, video and audio
+    Usage:
+        01_sdi_base [--verify LOG]
+    With --verify every video and audio buffer is checksummed (CRC32C) as it enters
+    the DeckLink sink and one line per buffer goes to LOG. Source and sink are linked
+    directly, so there is nothing in between to compare: the check is the log itself,
+    against a loopback capture of the output. Video lines use the same picture checksum
+    as the DeckLink_SDK --verify log (CRC32C of the per-row CRC32C of the active bytes),
+    so the logs of both programs can be compared offline.
+*/
+
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <glib.h>
 
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define VERIFY_X86 1
+#endif
+
 static GMainLoop *loop = NULL;
 
+// One per stream, only touched from the sink's streaming thread.
+typedef struct _VerifyStream {
+    const gchar *name;
+    gboolean video;
+    guint64 index;
+    guint64 discontinuities;    // buffers flagged DISCONT: something upstream was dropped
+} VerifyStream;
+
+static FILE *verify_log = NULL;
+static GMutex verify_log_lock;
+static guint32 crc_table[256];
+
+static void crc_init(void) {
+    for (guint32 i = 0; i < 256; i++) {
+        guint32 crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        crc_table[i] = crc;
+    }
+}
+
+static guint32 crc32c_scalar(guint32 crc, const guint8 *bytes, gsize length) {
+    crc = ~crc;
+    for (gsize i = 0; i < length; i++) crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#ifdef VERIFY_X86
+__attribute__((target("sse4.2")))
+static guint32 crc32c_sse42(guint32 crc, const guint8 *bytes, gsize length) {
+    guint64 c = ~crc;
+    gsize i = 0;
+    for (; i + 8 <= length; i += 8) {
+        guint64 word;
+        memcpy(&word, bytes + i, 8);
+        c = _mm_crc32_u64(c, word);
+    }
+    for (; i < length; i++) c = _mm_crc32_u8((guint32)c, bytes[i]);
+    return ~(guint32)c;
+}
+#endif
+
+static guint32 crc32c(guint32 crc, const void *data, gsize length) {
+#ifdef VERIFY_X86
+    static int has_sse42 = -1;
+    if (has_sse42 < 0) has_sse42 = __builtin_cpu_supports("sse4.2");
+    if (has_sse42) return crc32c_sse42(crc, data, length);
+#endif
+    return crc32c_scalar(crc, data, length);
+}
+
+// Video: CRC32C of the per-row CRC32C of the active bytes; audio: CRC32C of the buffer.
+static guint32 buffer_checksum(GstPad *pad, GstBuffer *buffer, gboolean video) {
+    GstMapInfo map;
+    guint32 crc = 0;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) return 0;
+
+    GstCaps *caps = video ? gst_pad_get_current_caps(pad) : NULL;
+    GstVideoInfo info;
+    if (caps && gst_video_info_from_caps(&info, caps)) {
+        gint width = GST_VIDEO_INFO_WIDTH(&info);
+        gint height = GST_VIDEO_INFO_HEIGHT(&info);
+        gsize stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+        gsize active = stride;
+        if (GST_VIDEO_INFO_FORMAT(&info) == GST_VIDEO_FORMAT_v210) {
+            active = (gsize)(width / 6) * 16 + (gsize)((2 * (width % 6) + 2) / 3) * 4;
+        } else if (GST_VIDEO_INFO_FORMAT(&info) == GST_VIDEO_FORMAT_UYVY) {
+            active = (gsize)width * 2;
+        }
+        if (active > stride) active = stride;
+        for (gint row = 0; row < height && (gsize)(row + 1) * stride <= map.size; row++) {
+            guint32 row_crc = crc32c(0, map.data + (gsize)row * stride, active);
+            crc = crc32c(crc, &row_crc, sizeof(row_crc));
+        }
+    } else {
+        crc = crc32c(0, map.data, map.size);
+    }
+    if (caps) gst_caps_unref(caps);
+    gst_buffer_unmap(buffer, &map);
+    return crc;
+}
+
+static GstPadProbeReturn sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    VerifyStream *stream = user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    guint32 crc = buffer_checksum(pad, buffer, stream->video);
+    guint64 index = stream->index++;
+    gboolean discont = index > 0 && GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+    if (discont) stream->discontinuities++;
+
+    g_mutex_lock(&verify_log_lock);
+    fprintf(verify_log, "%s %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %08x %s\n", stream->name, index,
+            (guint64)GST_BUFFER_PTS(buffer), crc, discont ? "DISCONT" : "ok");
+    g_mutex_unlock(&verify_log_lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static void add_verify_probe(GstElement *pipeline, const gchar *sink, VerifyStream *stream) {
+    GstElement *sink_element = gst_bin_get_by_name(GST_BIN(pipeline), sink);
+    GstPad *sink_pad = gst_element_get_static_pad(sink_element, "sink");
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, sink_probe, stream, NULL);
+    gst_object_unref(sink_pad);
+    gst_object_unref(sink_element);
+}
+
 static void handle_sigint(int sig) {
     if (loop) {
         g_print("Received SIGINT, stopping pipeline...\n");
@@ -51,10 +174,22 @@ int main(int argc, char *argv[]) {
     GstElement *pipeline;
     GstBus *bus;
     GError *error = NULL;
+    const gchar *verify_path = NULL;
+    VerifyStream video_stream = { .name = "video", .video = TRUE };
+    VerifyStream audio_stream = { .name = "audio", .video = FALSE };
 
     // Initialize GStreamer
     gst_init(&argc, &argv);
 
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+            verify_path = argv[++i];
+        } else {
+            g_printerr("Usage: %s [--verify LOG]\n", argv[0]);
+            return -1;
+        }
+    }
+
     // Create main loop
     loop = g_main_loop_new(NULL, FALSE);
     if (!loop) {
@@ -67,8 +202,8 @@ int main(int argc, char *argv[]) {
 
     const gchar *pipeline_str =
         "decklinkvideosrc device-number=3 connection=sdi mode=1080i5994 ! "
-        "decklinkvideosink device-number=0 mode=1080i5994 "
-        "decklinkaudiosrc device-number=3 ! decklinkaudiosink device-number=0";
+        "decklinkvideosink name=vsink device-number=0 mode=1080i5994 "
+        "decklinkaudiosrc device-number=3 ! decklinkaudiosink name=asink device-number=0";
 
     pipeline = gst_parse_launch(pipeline_str, &error);
     if (!pipeline || error) {
@@ -78,6 +213,21 @@ int main(int argc, char *argv[]) {
         return -1;
     }
 
+    if (verify_path) {
+        verify_log = fopen(verify_path, "w");
+        if (!verify_log) {
+            g_printerr("Cannot write verification log %s\n", verify_path);
+            gst_object_unref(pipeline);
+            g_main_loop_unref(loop);
+            return -1;
+        }
+        fprintf(verify_log, "# stream index pts_ns checksum status\n");
+        crc_init();
+        g_mutex_init(&verify_log_lock);
+        add_verify_probe(pipeline, "vsink", &video_stream);
+        add_verify_probe(pipeline, "asink", &audio_stream);
+    }
+
     // Set up bus to handle messages
     bus = gst_element_get_bus(pipeline);
     gst_bus_add_watch(bus, bus_callback, pipeline);
@@ -101,5 +251,14 @@ int main(int argc, char *argv[]) {
     gst_object_unref(pipeline);
     g_main_loop_unref(loop);
 
+    if (verify_log) {
+        VerifyStream *streams[] = { &video_stream, &audio_stream };
+        for (int i = 0; i < 2; i++) {
+            g_print("Verify %s: %" G_GUINT64_FORMAT " buffers checksummed, %" G_GUINT64_FORMAT " discontinuities\n",
+                    streams[i]->name, streams[i]->index, streams[i]->discontinuities);
+        }
+        fclose(verify_log);
+    }
+
     return 0;
 }
\ No newline at end of file
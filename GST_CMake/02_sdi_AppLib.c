@@ -4,16 +4,218 @@
     3. References:
         - https://gstreamer.freedesktop.org/documentation/applib/gstappsink.html?gi-language=c
         - https://gstreamer.freedesktop.org/documentation/applib/gstappsrc.html?gi-language=c
+    4. Usage: 02_sdi_AppLib [--perf-counters]
+       With --perf-counters every filter/converter element (deinterlace, videoconvert,
+       videorate, audioconvert, audioresample) is measured with hardware counters
+       (cycles, instructions, LLC misses, dTLB load misses) from a buffer entering its
+       sink pad to the first buffer leaving its src pad, on the streaming thread that
+       runs it. Totals per element and per thread are printed every 10 s and on exit.
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // pthread_getname_np
+#endif
 #include <gst/gst.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <glib.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 static GMainLoop *loop = NULL;
 static GstElement *video_src, *audio_src;
 
+// Same events and names as the DeckLink_SDK --perf-counters stats.
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES, PERF_EVENTS };
+static const gchar *perf_event_names[PERF_EVENTS] = { "cycles", "instructions", "llc_misses", "dtlb_misses" };
+
+// One perf_event_open group per streaming thread, kept after the thread exits for the report.
+typedef struct _ThreadPerf {
+    gchar *name;
+    int fds[PERF_EVENTS];
+    int slot[PERF_EVENTS];
+    int members;
+    guint64 totals[PERF_EVENTS];
+} ThreadPerf;
+
+// Totals of one element; start is taken on its sink pad by the streaming thread that runs it.
+typedef struct _ElementPerf {
+    gchar *name;
+    GMutex lock;
+    ThreadPerf *thread;
+    guint64 start[PERF_EVENTS];
+    gboolean started;
+    guint64 buffers;
+    guint64 totals[PERF_EVENTS];
+} ElementPerf;
+
+static GPrivate thread_perf_key;
+static GMutex perf_lock;
+static GPtrArray *perf_threads = NULL;
+static GPtrArray *perf_elements = NULL;
+
+#ifdef __linux__
+static int perf_open_event(guint32 type, guint64 config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+#endif
+
+// The calling thread's group, opened on first use; NULL if cycles cannot be counted.
+static ThreadPerf *thread_perf(void) {
+    ThreadPerf *perf = g_private_get(&thread_perf_key);
+    if (perf) return perf->members > 0 ? perf : NULL;
+
+    perf = g_new0(ThreadPerf, 1);
+    char name[16] = "";
+#ifdef __linux__
+    static const struct { guint32 type; guint64 config; } events[PERF_EVENTS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        perf->fds[i] = perf_open_event(events[i].type, events[i].config, i == 0 ? -1 : perf->fds[0]);
+        perf->slot[i] = perf->fds[i] >= 0 ? perf->members++ : -1;
+        if (i == 0 && perf->fds[0] < 0) {
+            static gint warned = 0;
+            if (g_atomic_int_compare_and_exchange(&warned, 0, 1))
+                g_printerr("Performance counters unavailable on thread %s (needs a PMU and kernel.perf_event_paranoid <= 2)\n",
+                           name);
+            break;
+        }
+    }
+    if (perf->members > 0) ioctl(perf->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    perf->name = g_strdup_printf("%s/%ld", name, (long)syscall(SYS_gettid));
+    g_private_set(&thread_perf_key, perf);
+    g_mutex_lock(&perf_lock);
+    g_ptr_array_add(perf_threads, perf);
+    g_mutex_unlock(&perf_lock);
+    return perf->members > 0 ? perf : NULL;
+}
+
+// Reads the group in one system call, scaled up if the counters were multiplexed.
+static gboolean thread_perf_read(ThreadPerf *perf, guint64 values[PERF_EVENTS]) {
+#ifdef __linux__
+    guint64 buffer[3 + PERF_EVENTS];
+    if (read(perf->fds[0], buffer, sizeof(buffer)) < (ssize_t)((3 + perf->members) * sizeof(guint64))) return FALSE;
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        guint64 value = perf->slot[i] >= 0 ? buffer[3 + perf->slot[i]] : 0;
+        if (buffer[2] > 0 && buffer[2] < buffer[1]) value = (guint64)((double)value * buffer[1] / buffer[2]);
+        values[i] = value;
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+static GstPadProbeReturn perf_sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ElementPerf *element = user_data;
+    ThreadPerf *perf = thread_perf();
+    if (!perf) return GST_PAD_PROBE_OK;
+    g_mutex_lock(&element->lock);
+    element->started = thread_perf_read(perf, element->start);
+    element->thread = perf;
+    g_mutex_unlock(&element->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+// A buffer pushed from another thread than the one that received the input (or a second
+// output for the same input, as from videorate) is not counted.
+static GstPadProbeReturn perf_src_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    ElementPerf *element = user_data;
+    ThreadPerf *perf = g_private_get(&thread_perf_key);
+    guint64 end[PERF_EVENTS];
+    g_mutex_lock(&element->lock);
+    if (element->started && element->thread == perf && thread_perf_read(perf, end)) {
+        for (int i = 0; i < PERF_EVENTS; i++) {
+            guint64 delta = end[i] > element->start[i] ? end[i] - element->start[i] : 0;
+            element->totals[i] += delta;
+            perf->totals[i] += delta;
+        }
+        element->buffers++;
+    }
+    element->started = FALSE;
+    g_mutex_unlock(&element->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+// Instruments every filter/converter element of the pipeline; queues, capsfilters,
+// sources and sinks are left alone.
+static void add_perf_probes(GstElement *pipeline) {
+    GstIterator *it = gst_bin_iterate_elements(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        GstElement *child = g_value_get_object(&item);
+        GstElementFactory *factory = gst_element_get_factory(child);
+        const gchar *klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+        GstPad *sink_pad = gst_element_get_static_pad(child, "sink");
+        GstPad *src_pad = gst_element_get_static_pad(child, "src");
+        if (klass && strstr(klass, "Filter") && !strstr(klass, "Generic") && sink_pad && src_pad) {
+            ElementPerf *element = g_new0(ElementPerf, 1);
+            element->name = g_strdup_printf("%s/%s", GST_OBJECT_NAME(pipeline), GST_OBJECT_NAME(child));
+            g_mutex_init(&element->lock);
+            g_ptr_array_add(perf_elements, element);
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, perf_sink_probe, element, NULL);
+            gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, perf_src_probe, element, NULL);
+        }
+        if (sink_pad) gst_object_unref(sink_pad);
+        if (src_pad) gst_object_unref(src_pad);
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+}
+
+static void print_perf_totals(const gchar *name, const guint64 totals[PERF_EVENTS], guint64 buffers) {
+    g_print("  %-40s", name);
+    if (buffers > 0) g_print(" %8" G_GUINT64_FORMAT " buffers", buffers);
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        g_print("  %s %" G_GUINT64_FORMAT, perf_event_names[i], buffers > 0 ? totals[i] / buffers : totals[i]);
+    }
+    g_print("  ipc %.2f\n", totals[PERF_CYCLES] ? (double)totals[PERF_INSTRUCTIONS] / totals[PERF_CYCLES] : 0.0);
+}
+
+static gboolean print_perf_report(gpointer user_data) {
+    g_print("Performance counters per element (per buffer):\n");
+    for (guint i = 0; i < perf_elements->len; i++) {
+        ElementPerf *element = g_ptr_array_index(perf_elements, i);
+        guint64 totals[PERF_EVENTS];
+        g_mutex_lock(&element->lock);
+        memcpy(totals, element->totals, sizeof(totals));
+        guint64 buffers = element->buffers;
+        g_mutex_unlock(&element->lock);
+        if (buffers > 0) print_perf_totals(element->name, totals, buffers);
+    }
+    // Thread totals are read without their elements' locks; a report may be off by a buffer.
+    g_print("Performance counters per thread (total):\n");
+    g_mutex_lock(&perf_lock);
+    for (guint i = 0; i < perf_threads->len; i++) {
+        ThreadPerf *perf = g_ptr_array_index(perf_threads, i);
+        if (perf->members > 0) print_perf_totals(perf->name, perf->totals, 0);
+    }
+    g_mutex_unlock(&perf_lock);
+    return G_SOURCE_CONTINUE;
+}
+
 static void handle_sigint(int sig) {
     if (loop) {
         g_print("Received SIGINT, stopping pipelines...\n");
@@ -101,10 +303,20 @@ int main(int argc, char *argv[]) {
     GstBus *video_capture_bus, *audio_capture_bus;
     GstBus *video_output_bus, *audio_output_bus;
     GError *error = NULL;
+    gboolean perf_counters = FALSE;
 
     // Initialize GStreamer
     gst_init(&argc, &argv);
 
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--perf-counters") == 0) {
+            perf_counters = TRUE;
+        } else {
+            g_printerr("Usage: %s [--perf-counters]\n", argv[0]);
+            return -1;
+        }
+    }
+
     // Create main loop
     loop = g_main_loop_new(NULL, FALSE);
     if (!loop) {
@@ -199,6 +411,17 @@ int main(int argc, char *argv[]) {
         goto cleanup;
     }
 
+    // Probes are only added with --perf-counters, so without it nothing is measured.
+    if (perf_counters) {
+        perf_threads = g_ptr_array_new();
+        perf_elements = g_ptr_array_new();
+        add_perf_probes(video_capture_pipeline);
+        add_perf_probes(audio_capture_pipeline);
+        add_perf_probes(video_output_pipeline);
+        add_perf_probes(audio_output_pipeline);
+        g_timeout_add_seconds(10, print_perf_report, NULL);
+    }
+
     // Connect new-sample signals
     g_signal_connect(video_sink, "new-sample", G_CALLBACK(on_new_video_sample), NULL);
     g_signal_connect(audio_sink, "new-sample", G_CALLBACK(on_new_audio_sample), NULL);
@@ -251,6 +474,7 @@ cleanup:
     gst_element_set_state(audio_capture_pipeline, GST_STATE_NULL);
     gst_element_set_state(video_output_pipeline, GST_STATE_NULL);
     gst_element_set_state(audio_output_pipeline, GST_STATE_NULL);
+    if (perf_counters) print_perf_report(NULL);
 
     gst_object_unref(video_sink);
     gst_object_unref(audio_sink);
@@ -1,7 +1,24 @@
+/*
+    Progressive download of a URL with playbin, with an optional read-ahead disk cache
+    Usage:
+        03_url_480p [--cache DIR [--cache-size MB] [--prefetch CHUNKS]] [URI]
+    With --cache, http/https URIs are read through cachedurlsrc (url_cache.c): 1 MiB
+    chunks are fetched ahead of the read position by worker threads and kept in DIR,
+    so a seek lands on cached data and a repeat play does not touch the network.
+    Time to first frame, buffering stalls and cache hits are printed on exit.
+*/
+
 #include <gst/gst.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_CURL
+#include <gst/base/gstbasesrc.h>
+#include "url_cache.h"
+#endif
+
 #define GRAPH_LENGTH 78
+#define DEFAULT_URI "https://gstreamer.freedesktop.org/data/media/sintel_trailer-480p.webm"
 
 /* playbin flags */
 typedef enum {
@@ -13,8 +30,206 @@ typedef struct _CustomData {
   GstElement *pipeline;
   GMainLoop *loop;
   gint buffering_level;
+  gint64 start_time;
+  gint64 first_frame_time;      /* 0 until the pipeline has prerolled */
+  guint stalls;                 /* buffering pauses after the first frame */
+  gint64 stall_start;
+  gint64 stall_time;
 } CustomData;
 
+#ifdef HAVE_CURL
+/* cachedurlsrc: a GstBaseSrc that serves http/https URIs out of a UrlCache.
+   It answers byte-range reads at any offset, so demuxers can pull and seek. */
+
+typedef struct _CachedUrlSrc {
+  GstBaseSrc parent;
+  gchar *uri;
+  UrlCache *cache;
+} CachedUrlSrc;
+
+typedef struct _CachedUrlSrcClass {
+  GstBaseSrcClass parent_class;
+} CachedUrlSrcClass;
+
+static gchar *cache_dir;
+static guint64 cache_max_bytes = 2048ull * 1024 * 1024;
+static gint cache_prefetch = 16;
+static UrlCacheStats cache_totals;    /* summed when each cache is closed */
+
+static GstStaticPadTemplate cached_url_src_template =
+    GST_STATIC_PAD_TEMPLATE ("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void cached_url_src_uri_handler_init (gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE (CachedUrlSrc, cached_url_src, GST_TYPE_BASE_SRC,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_URI_HANDLER, cached_url_src_uri_handler_init))
+
+static gboolean cached_url_src_start (GstBaseSrc *base) {
+  CachedUrlSrc *src = (CachedUrlSrc *)base;
+
+  if (src->uri == NULL) {
+    GST_ELEMENT_ERROR (src, RESOURCE, NOT_FOUND, ("No URI set"), (NULL));
+    return FALSE;
+  }
+  src->cache = url_cache_open (cache_dir, cache_max_bytes, src->uri, cache_prefetch, 4);
+  if (src->cache == NULL) {
+    GST_ELEMENT_ERROR (src, RESOURCE, OPEN_READ, ("Cannot open %s through the cache", src->uri), (NULL));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean cached_url_src_stop (GstBaseSrc *base) {
+  CachedUrlSrc *src = (CachedUrlSrc *)base;
+  UrlCacheStats stats;
+
+  if (src->cache) {
+    url_cache_get_stats (src->cache, &stats);
+    cache_totals.chunks_cached_at_open += stats.chunks_cached_at_open;
+    cache_totals.chunks_read += stats.chunks_read;
+    cache_totals.chunks_hit += stats.chunks_hit;
+    cache_totals.chunks_downloaded += stats.chunks_downloaded;
+    cache_totals.bytes_downloaded += stats.bytes_downloaded;
+    cache_totals.bytes_read += stats.bytes_read;
+    cache_totals.stalls += stats.stalls;
+    cache_totals.stall_ms += stats.stall_ms;
+    cache_totals.fetch_errors += stats.fetch_errors;
+    cache_totals.evicted_bytes += stats.evicted_bytes;
+    url_cache_close (src->cache);
+    src->cache = NULL;
+  }
+  return TRUE;
+}
+
+static gboolean cached_url_src_get_size (GstBaseSrc *base, guint64 *size) {
+  CachedUrlSrc *src = (CachedUrlSrc *)base;
+
+  if (src->cache == NULL)
+    return FALSE;
+  *size = url_cache_size (src->cache);
+  return TRUE;
+}
+
+static gboolean cached_url_src_is_seekable (GstBaseSrc *base) {
+  return TRUE;
+}
+
+static GstFlowReturn cached_url_src_fill (GstBaseSrc *base, guint64 offset, guint length, GstBuffer *buf) {
+  CachedUrlSrc *src = (CachedUrlSrc *)base;
+  GstMapInfo map;
+  gsize filled = 0;
+
+  if (!gst_buffer_map (buf, &map, GST_MAP_WRITE))
+    return GST_FLOW_ERROR;
+  while (filled < length) {
+    gssize got = url_cache_read (src->cache, offset + filled, map.data + filled, length - filled);
+    if (got == URL_CACHE_FLUSHING) {
+      gst_buffer_unmap (buf, &map);
+      return GST_FLOW_FLUSHING;
+    }
+    if (got < 0) {
+      gst_buffer_unmap (buf, &map);
+      GST_ELEMENT_ERROR (src, RESOURCE, READ, ("Cannot read %s at offset %" G_GUINT64_FORMAT, src->uri,
+          offset + filled), (NULL));
+      return GST_FLOW_ERROR;
+    }
+    if (got == 0)
+      break;
+    filled += got;
+  }
+  gst_buffer_unmap (buf, &map);
+
+  if (filled == 0)
+    return GST_FLOW_EOS;
+  gst_buffer_set_size (buf, filled);
+  GST_BUFFER_OFFSET (buf) = offset;
+  GST_BUFFER_OFFSET_END (buf) = offset + filled;
+  return GST_FLOW_OK;
+}
+
+/* Called on flushing seeks and state changes while fill() may be waiting for the network. */
+static gboolean cached_url_src_unlock (GstBaseSrc *base) {
+  CachedUrlSrc *src = (CachedUrlSrc *)base;
+
+  if (src->cache)
+    url_cache_set_flushing (src->cache, TRUE);
+  return TRUE;
+}
+
+static gboolean cached_url_src_unlock_stop (GstBaseSrc *base) {
+  CachedUrlSrc *src = (CachedUrlSrc *)base;
+
+  if (src->cache)
+    url_cache_set_flushing (src->cache, FALSE);
+  return TRUE;
+}
+
+static void cached_url_src_finalize (GObject *object) {
+  CachedUrlSrc *src = (CachedUrlSrc *)object;
+
+  g_free (src->uri);
+  G_OBJECT_CLASS (cached_url_src_parent_class)->finalize (object);
+}
+
+static void cached_url_src_class_init (CachedUrlSrcClass *klass) {
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *base_class = GST_BASE_SRC_CLASS (klass);
+
+  gobject_class->finalize = cached_url_src_finalize;
+  gst_element_class_add_static_pad_template (element_class, &cached_url_src_template);
+  gst_element_class_set_static_metadata (element_class, "Cached URL source", "Source/Network",
+      "Reads http/https URIs through a read-ahead disk chunk cache", "GST-DeckLink");
+  base_class->start = cached_url_src_start;
+  base_class->stop = cached_url_src_stop;
+  base_class->get_size = cached_url_src_get_size;
+  base_class->is_seekable = cached_url_src_is_seekable;
+  base_class->fill = cached_url_src_fill;
+  base_class->unlock = cached_url_src_unlock;
+  base_class->unlock_stop = cached_url_src_unlock_stop;
+}
+
+static void cached_url_src_init (CachedUrlSrc *src) {
+  gst_base_src_set_format (GST_BASE_SRC (src), GST_FORMAT_BYTES);
+  /* Demuxers pull their own sizes; this only sets the push-mode read size. */
+  gst_base_src_set_blocksize (GST_BASE_SRC (src), 64 * 1024);
+}
+
+static GstURIType cached_url_src_uri_get_type (GType type) {
+  return GST_URI_SRC;
+}
+
+static const gchar *const *cached_url_src_uri_get_protocols (GType type) {
+  static const gchar *protocols[] = { "http", "https", NULL };
+  return protocols;
+}
+
+static gchar *cached_url_src_uri_get_uri (GstURIHandler *handler) {
+  return g_strdup (((CachedUrlSrc *)handler)->uri);
+}
+
+static gboolean cached_url_src_uri_set_uri (GstURIHandler *handler, const gchar *uri, GError **error) {
+  CachedUrlSrc *src = (CachedUrlSrc *)handler;
+
+  if (GST_STATE (src) != GST_STATE_NULL && GST_STATE (src) != GST_STATE_READY) {
+    g_set_error (error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE, "Cannot change the URI while streaming");
+    return FALSE;
+  }
+  g_free (src->uri);
+  src->uri = g_strdup (uri);
+  return TRUE;
+}
+
+static void cached_url_src_uri_handler_init (gpointer g_iface, gpointer iface_data) {
+  GstURIHandlerInterface *iface = (GstURIHandlerInterface *)g_iface;
+
+  iface->get_type = cached_url_src_uri_get_type;
+  iface->get_protocols = cached_url_src_uri_get_protocols;
+  iface->get_uri = cached_url_src_uri_get_uri;
+  iface->set_uri = cached_url_src_uri_set_uri;
+}
+#endif
+
 static void got_location (GstObject *gstobject, GstObject *prop_object, GParamSpec *prop, gpointer data) {
   gchar *location;
   g_object_get (G_OBJECT (prop_object), "temp-location", &location, NULL);
@@ -45,18 +260,36 @@ static void cb_message (GstBus *bus, GstMessage *msg, CustomData *data) {
       gst_element_set_state (data->pipeline, GST_STATE_READY);
       g_main_loop_quit (data->loop);
       break;
-    case GST_MESSAGE_BUFFERING:
+    case GST_MESSAGE_BUFFERING: {
+      gint previous_level = data->buffering_level;
+
       /* If the stream is live, we do not care about buffering. */
       if (data->is_live) break;
 
       gst_message_parse_buffering (msg, &data->buffering_level);
 
+      /* A drop below 100% once playback has started is a stall the viewer sees */
+      if (data->first_frame_time && previous_level == 100 && data->buffering_level < 100) {
+        data->stalls++;
+        data->stall_start = g_get_monotonic_time ();
+      } else if (data->stall_start && data->buffering_level == 100) {
+        data->stall_time += g_get_monotonic_time () - data->stall_start;
+        data->stall_start = 0;
+      }
+
       /* Wait until buffering is complete before start/resume playing */
       if (data->buffering_level < 100)
         gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
       else
         gst_element_set_state (data->pipeline, GST_STATE_PLAYING);
       break;
+    }
+    case GST_MESSAGE_ASYNC_DONE:
+      /* The first preroll is the first frame reaching the sinks */
+      if (data->first_frame_time == 0 && GST_MESSAGE_SRC (msg) == GST_OBJECT (data->pipeline)) {
+        data->first_frame_time = g_get_monotonic_time ();
+      }
+      break;
     case GST_MESSAGE_CLOCK_LOST:
       /* Get a new clock */
       gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
@@ -118,27 +351,60 @@ int main(int argc, char *argv[]) {
   GMainLoop *main_loop;
   CustomData data;
   guint flags;
+  const gchar *uri = DEFAULT_URI;
+  gint i;
 
   /* Initialize GStreamer */
   gst_init (&argc, &argv);
 
+  for (i = 1; i < argc; i++) {
+#ifdef HAVE_CURL
+    if (strcmp (argv[i], "--cache") == 0 && i + 1 < argc) {
+      cache_dir = argv[++i];
+      continue;
+    } else if (strcmp (argv[i], "--cache-size") == 0 && i + 1 < argc) {
+      cache_max_bytes = g_ascii_strtoull (argv[++i], NULL, 10) * 1024 * 1024;
+      continue;
+    } else if (strcmp (argv[i], "--prefetch") == 0 && i + 1 < argc) {
+      cache_prefetch = atoi (argv[++i]);
+      continue;
+    }
+#endif
+    if (argv[i][0] == '-') {
+      g_printerr ("Usage: %s [--cache DIR [--cache-size MB] [--prefetch CHUNKS]] [URI]\n", argv[0]);
+      return -1;
+    }
+    uri = argv[i];
+  }
+
+#ifdef HAVE_CURL
+  /* Outrank souphttpsrc so playbin reads http/https through the cache */
+  if (cache_dir)
+    gst_element_register (NULL, "cachedurlsrc", GST_RANK_PRIMARY + 100, cached_url_src_get_type ());
+#endif
+
   /* Initialize our data structure */
   memset (&data, 0, sizeof (data));
   data.buffering_level = 100;
 
   /* Build the pipeline */
-  pipeline = gst_parse_launch ("playbin uri=https://gstreamer.freedesktop.org/data/media/sintel_trailer-480p.webm", NULL);
+  pipeline = gst_element_factory_make ("playbin", NULL);
+  g_object_set (pipeline, "uri", uri, NULL);
   bus = gst_element_get_bus (pipeline);
 
-  /* Set the download flag */
+  /* Set the download flag; the disk cache already keeps the whole file */
   g_object_get (pipeline, "flags", &flags, NULL);
-  flags |= GST_PLAY_FLAG_DOWNLOAD;
+#ifdef HAVE_CURL
+  if (cache_dir == NULL)
+#endif
+    flags |= GST_PLAY_FLAG_DOWNLOAD;
   g_object_set (pipeline, "flags", flags, NULL);
 
   /* Uncomment this line to limit the amount of downloaded data */
   /* g_object_set (pipeline, "ring-buffer-max-size", (guint64)4000000, NULL); */
 
   /* Start playing */
+  data.start_time = g_get_monotonic_time ();
   ret = gst_element_set_state (pipeline, GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE) {
     g_printerr ("Unable to set the pipeline to the playing state.\n");
@@ -167,5 +433,21 @@ int main(int argc, char *argv[]) {
   gst_element_set_state (pipeline, GST_STATE_NULL);
   gst_object_unref (pipeline);
   g_print ("\n");
+
+  if (data.first_frame_time)
+    g_print ("Time to first frame: %.1f ms\n", (data.first_frame_time - data.start_time) / 1000.0);
+  g_print ("Buffering stalls: %u (%.1f s)\n", data.stalls, data.stall_time / 1e6);
+#ifdef HAVE_CURL
+  if (cache_dir) {
+    g_print ("Cache: %" G_GUINT64_FORMAT " chunks read, %" G_GUINT64_FORMAT " hit (%.1f%%), %" G_GUINT64_FORMAT
+        " already on disk at open\n", cache_totals.chunks_read, cache_totals.chunks_hit,
+        cache_totals.chunks_read ? 100.0 * cache_totals.chunks_hit / cache_totals.chunks_read : 0.0,
+        cache_totals.chunks_cached_at_open);
+    g_print ("Cache: %.1f MB downloaded, %.1f MB read, %" G_GUINT64_FORMAT " reads waited %" G_GUINT64_FORMAT
+        " ms on the network, %" G_GUINT64_FORMAT " fetch errors, %.1f MB evicted\n",
+        cache_totals.bytes_downloaded / 1048576.0, cache_totals.bytes_read / 1048576.0, cache_totals.stalls,
+        cache_totals.stall_ms, cache_totals.fetch_errors, cache_totals.evicted_bytes / 1048576.0);
+  }
+#endif
   return 0;
 }
\ No newline at end of file
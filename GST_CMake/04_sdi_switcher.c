@@ -0,0 +1,488 @@
+/*
+    1. Seamless source switcher: N pre-warmed source pipelines -> one program output
+    2. Every source runs in its own pipeline in PLAYING, converted to the program caps
+       (UYVY 1080i59.94, the format of the SDI feeds) and parked in an appsink, so a cut
+       never renegotiates. SDI sources pass through without being deinterlaced; progressive
+       sources are sent as both fields of one picture (PsF)
+    3. The program pipeline is fed by one thread that pushes exactly one frame per output
+       frame; a cut takes effect on the next frame it pushes, and the last frame is repeated
+       rather than letting the output underrun
+    4. Standby sources only let one frame in STANDBY_KEEPALIVE past the capture or decoder,
+       so everything downstream stays negotiated and warm at a fraction of the CPU cost
+    5. Usage:
+        04_sdi_switcher [--output N] [--preview] [--auto SECONDS] SOURCE...
+        SOURCE: sdi:DEVICE | test:PATTERN | file:PATH | URI
+        Type a source number and Enter to cut to it, q to quit
+    6. References:
+        - https://gstreamer.freedesktop.org/documentation/applib/gstappsink.html?gi-language=c
+        - https://gstreamer.freedesktop.org/documentation/additional/design/probes.html?gi-language=c
+*/
+
+#include <gst/gst.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <glib.h>
+
+#define MAX_SOURCES 8
+#define STANDBY_KEEPALIVE 30
+#define FRAME_RATE_N 30000
+#define FRAME_RATE_D 1001
+#define PROGRAM_CAPS "video/x-raw,format=UYVY,width=1920,height=1080,framerate=30000/1001," \
+                     "interlace-mode=interleaved,pixel-aspect-ratio=1/1"
+// First element after the capture or decoder, so standby frames are dropped before any processing.
+#define GATE "queue name=gate max-size-buffers=2 leaky=downstream"
+#define SINK "appsink name=sink max-buffers=1 drop=true sync=false emit-signals=true"
+// Progressive pictures at the program rate become one interlaced frame each, both fields from the same instant.
+#define PROGRESSIVE_TO_PROGRAM "videoconvert ! videoscale ! video/x-raw,width=1920,height=1080,pixel-aspect-ratio=1/1 ! " \
+                               "interlace field-pattern=2:2 top-field-first=true ! " PROGRAM_CAPS
+
+typedef struct _Source {
+    gint index;
+    gchar *name;
+    GstElement *pipeline;
+    GstElement *sink;
+    gint gate_open;       // set while the source is on air or a cut to it is pending
+    gint keepalive;       // standby frames seen since the last one let through
+    gint arrived;         // samples queued in the appsink
+    gint arrived_at_request;
+    guint64 passed;
+    guint64 dropped;
+} Source;
+
+typedef struct _Switcher {
+    Source sources[MAX_SOURCES];
+    gint source_count;
+    GstElement *program;
+    GstElement *program_src;
+    GThread *pusher;
+    gint stopping;
+
+    gint active;
+    gint pending;                // source index requested, -1 for none
+    gint64 request_time;         // gst_util_get_timestamp() of the pending request
+    GMutex cut_lock;             // guards cut_pts and cut_request_time, read by the output probe
+    GstClockTime cut_pts;        // first program frame of the last cut
+    gint64 cut_request_time;     // 0 once the cut has reached the output
+
+    // Switch latency: request -> first frame pushed, and request -> frame reaching the output sink.
+    guint cuts;
+    gdouble ready_ms_sum, ready_ms_min, ready_ms_max;
+    gdouble output_ms_sum, output_ms_min, output_ms_max;
+    guint output_measured;
+    guint64 pushed;
+    guint64 repeated;
+} Switcher;
+
+static GMainLoop *loop = NULL;
+static Switcher switcher;
+
+static void handle_sigint(int sig) {
+    if (loop) {
+        g_print("Received SIGINT, stopping pipelines...\n");
+        g_main_loop_quit(loop);
+    }
+}
+
+static gchar *source_launch_string(const gchar *spec) {
+    // Already in the program format: only the pixel layout may need converting.
+    if (g_str_has_prefix(spec, "sdi:")) {
+        return g_strdup_printf("decklinkvideosrc device-number=%s connection=sdi mode=1080i5994 "
+                               "drop-no-signal-frames=true ! " GATE " ! videoconvert ! " PROGRAM_CAPS " ! " SINK,
+                               spec + 4);
+    }
+    if (g_str_has_prefix(spec, "test:")) {
+        return g_strdup_printf("videotestsrc is-live=true pattern=%s ! video/x-raw,framerate=30000/1001 ! "
+                               GATE " ! " PROGRESSIVE_TO_PROGRAM " ! " SINK, spec + 5);
+    }
+    // Files are not live: identity paces decoding to real time, also while the gate drops frames.
+    // videorate only retimestamps and duplicates references, so it can run ahead of the gate;
+    // interlaced files are deinterlaced first and re-interlaced like any progressive source.
+    gchar *uri = strstr(spec, "://") ? g_strdup(spec)
+                                     : gst_filename_to_uri(g_str_has_prefix(spec, "file:") ? spec + 5 : spec, NULL);
+    if (!uri) {
+        return NULL;
+    }
+    gchar *launch = g_strdup_printf("uridecodebin uri=\"%s\" ! video/x-raw ! identity sync=true ! "
+                                    "videorate ! video/x-raw,framerate=30000/1001 ! " GATE " ! "
+                                    "videoconvert ! deinterlace ! " PROGRESSIVE_TO_PROGRAM " ! " SINK, uri);
+    g_free(uri);
+    return launch;
+}
+
+// Runs in the source's streaming thread, straight after the capture or decoder.
+static GstPadProbeReturn gate_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Source *source = (Source *)user_data;
+    if (g_atomic_int_get(&source->gate_open) || ++source->keepalive >= STANDBY_KEEPALIVE) {
+        source->keepalive = 0;
+        source->passed++;
+        return GST_PAD_PROBE_OK;
+    }
+    source->dropped++;
+    return GST_PAD_PROBE_DROP;
+}
+
+// Emitted once the sample is queued, so a pull after it never returns the keepalive frame it replaced.
+static GstFlowReturn on_new_sample(GstElement *sink, gpointer user_data) {
+    Source *source = (Source *)user_data;
+    g_atomic_int_inc(&source->arrived);
+    return GST_FLOW_OK;
+}
+
+static GstPadProbeReturn output_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    Switcher *sw = (Switcher *)user_data;
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    g_mutex_lock(&sw->cut_lock);
+    if (sw->cut_request_time && GST_BUFFER_PTS(buffer) >= sw->cut_pts) {
+        gdouble ms = (gst_util_get_timestamp() - sw->cut_request_time) / 1e6;
+        sw->cut_request_time = 0;
+        sw->output_ms_sum += ms;
+        if (sw->output_measured == 0 || ms < sw->output_ms_min) sw->output_ms_min = ms;
+        if (ms > sw->output_ms_max) sw->output_ms_max = ms;
+        sw->output_measured++;
+        g_print("Cut reached the output after %.1f ms\n", ms);
+    }
+    g_mutex_unlock(&sw->cut_lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstSample *take_sample(Source *source, GstClockTime timeout) {
+    GstSample *sample = NULL;
+    g_signal_emit_by_name(source->sink, "try-pull-sample", timeout, &sample);
+    return sample;
+}
+
+static void request_cut(Switcher *sw, gint index) {
+    if (index < 0 || index >= sw->source_count) {
+        g_printerr("No source %d\n", index + 1);
+        return;
+    }
+    gint previous = g_atomic_int_get(&sw->pending);
+    if (index == g_atomic_int_get(&sw->active) && previous < 0) {
+        return;
+    }
+    Source *source = &sw->sources[index];
+    // Open the gate first so the cut waits for a frame captured after the request, not a keepalive one.
+    source->arrived_at_request = g_atomic_int_get(&source->arrived);
+    g_atomic_int_set(&source->gate_open, 1);
+    if (previous >= 0 && previous != index && previous != g_atomic_int_get(&sw->active)) {
+        g_atomic_int_set(&sw->sources[previous].gate_open, 0);
+    }
+    sw->request_time = gst_util_get_timestamp();
+    g_atomic_int_set(&sw->pending, index);
+    g_print("Cut to source %d (%s) requested\n", index + 1, source->name);
+}
+
+// Pushes one buffer per program frame; appsrc blocks once its queue is full, so the output sink paces this loop.
+static gpointer pusher_thread(gpointer data) {
+    Switcher *sw = (Switcher *)data;
+    GstClockTime frame_duration = gst_util_uint64_scale(GST_SECOND, FRAME_RATE_D, FRAME_RATE_N);
+    GstBuffer *last = NULL;
+    GstClockTime first_pts = GST_CLOCK_TIME_NONE;
+    guint64 frame = 0;
+
+    while (!g_atomic_int_get(&sw->stopping)) {
+        gint active = g_atomic_int_get(&sw->active);
+        gint pending = g_atomic_int_get(&sw->pending);
+        GstSample *sample = NULL;
+        gboolean cut = FALSE;
+
+        // Cut only once the new source has delivered a frame from after the request; until then the old one stays on air.
+        if (pending >= 0 && pending != active) {
+            Source *next = &sw->sources[pending];
+            if (g_atomic_int_get(&next->arrived) != next->arrived_at_request) {
+                sample = take_sample(next, 0);
+                cut = sample != NULL;
+            }
+        } else if (pending == active) {
+            g_atomic_int_compare_and_exchange(&sw->pending, pending, -1);
+        }
+
+        if (cut) {
+            gdouble ms = (gst_util_get_timestamp() - sw->request_time) / 1e6;
+            g_atomic_int_set(&sw->sources[active].gate_open, 0);
+            g_atomic_int_set(&sw->active, pending);
+            // A newer request that raced with this cut stays pending.
+            g_atomic_int_compare_and_exchange(&sw->pending, pending, -1);
+            active = pending;
+            sw->cuts++;
+            sw->ready_ms_sum += ms;
+            if (sw->cuts == 1 || ms < sw->ready_ms_min) sw->ready_ms_min = ms;
+            if (ms > sw->ready_ms_max) sw->ready_ms_max = ms;
+            g_mutex_lock(&sw->cut_lock);
+            sw->cut_pts = GST_CLOCK_TIME_IS_VALID(first_pts) ? first_pts + frame * frame_duration : 0;
+            sw->cut_request_time = sw->request_time;
+            g_mutex_unlock(&sw->cut_lock);
+            g_print("On air: source %d (%s), ready after %.1f ms\n", active + 1, sw->sources[active].name, ms);
+        } else {
+            sample = take_sample(&sw->sources[active], last ? 0 : 100 * GST_MSECOND);
+        }
+
+        if (sample) {
+            if (last) gst_buffer_unref(last);
+            last = gst_buffer_ref(gst_sample_get_buffer(sample));
+            gst_sample_unref(sample);
+        } else if (!last) {
+            continue; // nothing captured yet, nothing to repeat
+        } else {
+            sw->repeated++;
+        }
+
+        if (!GST_CLOCK_TIME_IS_VALID(first_pts)) {
+            // Start one frame ahead of the program pipeline's running time.
+            GstClock *clock = gst_element_get_clock(sw->program);
+            first_pts = frame_duration;
+            if (clock) {
+                GstClockTime now = gst_clock_get_time(clock);
+                GstClockTime base = gst_element_get_base_time(sw->program);
+                if (now > base) first_pts += now - base;
+                gst_object_unref(clock);
+            }
+        }
+        GstBuffer *out = gst_buffer_copy(last); // shares the memory; only the timestamps differ
+        GST_BUFFER_PTS(out) = first_pts + frame * frame_duration;
+        GST_BUFFER_DTS(out) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DURATION(out) = frame_duration;
+        frame++;
+
+        GstFlowReturn ret;
+        g_signal_emit_by_name(sw->program_src, "push-buffer", out, &ret);
+        gst_buffer_unref(out);
+        if (ret != GST_FLOW_OK) {
+            if (ret != GST_FLOW_FLUSHING) g_printerr("Failed to push program frame: %d\n", ret);
+            break;
+        }
+        sw->pushed++;
+    }
+
+    if (last) gst_buffer_unref(last);
+    return NULL;
+}
+
+static gboolean bus_callback(GstBus *bus, GstMessage *msg, gpointer data) {
+    GstElement *pipeline = (GstElement *)data;
+
+    switch (GST_MESSAGE_TYPE(msg)) {
+        case GST_MESSAGE_ERROR: {
+            GError *err = NULL;
+            gchar *debug_info = NULL;
+            gst_message_parse_error(msg, &err, &debug_info);
+            g_printerr("Error from %s in pipeline %s: %s\n",
+                      GST_OBJECT_NAME(msg->src), GST_OBJECT_NAME(pipeline), err->message);
+            g_printerr("Debugging info: %s\n", debug_info ? debug_info : "none");
+            g_clear_error(&err);
+            g_free(debug_info);
+            g_main_loop_quit(loop);
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            if (pipeline == switcher.program) {
+                g_print("End-Of-Stream reached in pipeline %s.\n", GST_OBJECT_NAME(pipeline));
+                g_main_loop_quit(loop);
+            } else {
+                // Clips loop so a file source never runs dry on standby or on air.
+                gst_element_seek_simple(pipeline, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, 0);
+            }
+            break;
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+static gboolean stdin_callback(GIOChannel *channel, GIOCondition condition, gpointer data) {
+    gchar *line = NULL;
+    if (g_io_channel_read_line(channel, &line, NULL, NULL, NULL) != G_IO_STATUS_NORMAL) {
+        return TRUE;
+    }
+    g_strstrip(line);
+    if (line[0] == 'q') {
+        g_main_loop_quit(loop);
+    } else if (line[0] != '\0') {
+        request_cut(&switcher, atoi(line) - 1);
+    }
+    g_free(line);
+    return TRUE;
+}
+
+static gboolean auto_cut(gpointer data) {
+    request_cut(&switcher, (g_atomic_int_get(&switcher.active) + 1) % switcher.source_count);
+    return TRUE;
+}
+
+int main(int argc, char *argv[]) {
+    GError *error = NULL;
+    GstBus *bus;
+    GstPad *pad;
+    GIOChannel *input = NULL;
+    gint output_device = 0;
+    gboolean preview = FALSE;
+    gint auto_seconds = 0;
+    gint i;
+
+    // Initialize GStreamer
+    gst_init(&argc, &argv);
+
+    memset(&switcher, 0, sizeof(switcher));
+    switcher.pending = -1;
+    g_mutex_init(&switcher.cut_lock);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_device = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--preview") == 0) {
+            preview = TRUE;
+        } else if (strcmp(argv[i], "--auto") == 0 && i + 1 < argc) {
+            auto_seconds = atoi(argv[++i]);
+        } else if (switcher.source_count < MAX_SOURCES) {
+            Source *source = &switcher.sources[switcher.source_count];
+            source->index = switcher.source_count++;
+            source->name = argv[i];
+        } else {
+            g_printerr("At most %d sources are supported\n", MAX_SOURCES);
+            return -1;
+        }
+    }
+    if (switcher.source_count == 0) {
+        g_printerr("Usage: %s [--output N] [--preview] [--auto SECONDS] SOURCE...\n"
+                   "  SOURCE: sdi:DEVICE | test:PATTERN | file:PATH | URI\n", argv[0]);
+        return -1;
+    }
+
+    // Create main loop
+    loop = g_main_loop_new(NULL, FALSE);
+    if (!loop) {
+        g_printerr("Failed to create main loop.\n");
+        return -1;
+    }
+
+    // Set up signal handler for SIGINT
+    signal(SIGINT, handle_sigint);
+
+    gchar *program_str = preview
+        ? g_strdup("appsrc name=program_src format=time is-live=true block=true caps=" PROGRAM_CAPS " ! "
+                   "queue max-size-buffers=2 ! deinterlace ! videoconvert ! autovideosink name=out")
+        : g_strdup_printf("appsrc name=program_src format=time is-live=true block=true caps=" PROGRAM_CAPS " ! "
+                          "queue max-size-buffers=2 ! "
+                          "decklinkvideosink name=out device-number=%d mode=1080i5994 video-format=8bit-yuv",
+                          output_device);
+    switcher.program = gst_parse_launch(program_str, &error);
+    g_free(program_str);
+    if (!switcher.program || error) {
+        g_printerr("Failed to create program pipeline: %s\n", error ? error->message : "Unknown error");
+        if (error) g_clear_error(&error);
+        g_main_loop_unref(loop);
+        return -1;
+    }
+    g_object_set(switcher.program, "name", "program-pipeline", NULL);
+    switcher.program_src = gst_bin_get_by_name(GST_BIN(switcher.program), "program_src");
+    // Two frames queued in appsrc keep the output fed while a cut is being prepared.
+    g_object_set(switcher.program_src, "max-bytes", (guint64)(2 * 1920 * 1080 * 2), NULL);
+
+    GstElement *out = gst_bin_get_by_name(GST_BIN(switcher.program), "out");
+    pad = gst_element_get_static_pad(out, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, output_probe, &switcher, NULL);
+    gst_object_unref(pad);
+    gst_object_unref(out);
+
+    bus = gst_element_get_bus(switcher.program);
+    gst_bus_add_watch(bus, bus_callback, switcher.program);
+    gst_object_unref(bus);
+
+    // Pre-warm every source: all of them reach PLAYING with the program caps negotiated before anything goes on air.
+    for (i = 0; i < switcher.source_count; i++) {
+        Source *source = &switcher.sources[i];
+        gchar *launch = source_launch_string(source->name);
+        gchar *pipeline_name = g_strdup_printf("source%d-pipeline", i + 1);
+
+        source->pipeline = launch ? gst_parse_launch(launch, &error) : NULL;
+        g_free(launch);
+        if (!source->pipeline || error) {
+            g_printerr("Failed to create source %s: %s\n", source->name, error ? error->message : "Unknown error");
+            if (error) g_clear_error(&error);
+            g_free(pipeline_name);
+            goto cleanup;
+        }
+        g_object_set(source->pipeline, "name", pipeline_name, NULL);
+        g_free(pipeline_name);
+
+        GstElement *gate = gst_bin_get_by_name(GST_BIN(source->pipeline), "gate");
+        pad = gst_element_get_static_pad(gate, "sink");
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, gate_probe, source, NULL);
+        gst_object_unref(pad);
+        gst_object_unref(gate);
+
+        source->sink = gst_bin_get_by_name(GST_BIN(source->pipeline), "sink");
+        g_signal_connect(source->sink, "new-sample", G_CALLBACK(on_new_sample), source);
+
+        source->gate_open = (i == 0);
+        bus = gst_element_get_bus(source->pipeline);
+        gst_bus_add_watch(bus, bus_callback, source->pipeline);
+        gst_object_unref(bus);
+
+        if (gst_element_set_state(source->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+            g_printerr("Unable to set source %s to playing state.\n", source->name);
+            goto cleanup;
+        }
+    }
+    for (i = 0; i < switcher.source_count; i++) {
+        Source *source = &switcher.sources[i];
+        if (gst_element_get_state(source->pipeline, NULL, NULL, 5 * GST_SECOND) == GST_STATE_CHANGE_FAILURE) {
+            g_printerr("Source %s failed to preroll.\n", source->name);
+            goto cleanup;
+        }
+        g_print("Source %d ready: %s\n", i + 1, source->name);
+    }
+
+    if (gst_element_set_state(switcher.program, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Unable to set program pipeline to playing state.\n");
+        goto cleanup;
+    }
+    switcher.pusher = g_thread_new("program-pusher", pusher_thread, &switcher);
+
+    input = g_io_channel_unix_new(0);
+    g_io_add_watch(input, G_IO_IN, stdin_callback, NULL);
+    if (auto_seconds > 0) {
+        g_timeout_add_seconds(auto_seconds, auto_cut, NULL);
+    }
+
+    // Run main loop
+    g_print("On air: source 1 (%s). Type a source number and Enter to cut, q to quit.\n", switcher.sources[0].name);
+    g_main_loop_run(loop);
+
+cleanup:
+    // Clean up
+    g_print("Cleaning up...\n");
+    g_atomic_int_set(&switcher.stopping, 1);
+    // Going to NULL flushes appsrc, which releases a pusher blocked in push-buffer.
+    gst_element_set_state(switcher.program, GST_STATE_NULL);
+    if (switcher.pusher) g_thread_join(switcher.pusher);
+
+    g_print("Program frames: %" G_GUINT64_FORMAT ", repeated: %" G_GUINT64_FORMAT "\n", switcher.pushed, switcher.repeated);
+    if (switcher.cuts > 0) {
+        g_print("Cuts: %u, ready min/avg/max %.1f/%.1f/%.1f ms\n", switcher.cuts, switcher.ready_ms_min,
+                switcher.ready_ms_sum / switcher.cuts, switcher.ready_ms_max);
+    }
+    if (switcher.output_measured > 0) {
+        g_print("Cut to output min/avg/max %.1f/%.1f/%.1f ms\n", switcher.output_ms_min,
+                switcher.output_ms_sum / switcher.output_measured, switcher.output_ms_max);
+    }
+    for (i = 0; i < switcher.source_count; i++) {
+        Source *source = &switcher.sources[i];
+        if (source->pipeline) {
+            g_print("Source %d (%s): converted %" G_GUINT64_FORMAT ", dropped on standby %" G_GUINT64_FORMAT "\n",
+                    i + 1, source->name, source->passed, source->dropped);
+            gst_element_set_state(source->pipeline, GST_STATE_NULL);
+            if (source->sink) gst_object_unref(source->sink);
+            gst_object_unref(source->pipeline);
+        }
+    }
+
+    if (input) g_io_channel_unref(input);
+    gst_object_unref(switcher.program_src);
+    gst_object_unref(switcher.program);
+    g_mutex_clear(&switcher.cut_lock);
+    g_main_loop_unref(loop);
+
+    return 0;
+}
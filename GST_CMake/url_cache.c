@@ -0,0 +1,601 @@
+#include "url_cache.h"
+#include <curl/curl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FETCH_ATTEMPTS 5
+#define FETCH_BACKOFF_MS 200    // doubled after each failure of the same chunk
+#define VALIDATOR_LENGTH 256
+
+enum { CHUNK_ABSENT, CHUNK_QUEUED, CHUNK_FETCHING, CHUNK_PRESENT, CHUNK_FAILED };
+
+struct _UrlCache {
+    char *url;
+    char *root;
+    char *url_dir;          // root/<url hash>
+    uint64_t max_bytes;
+    uint64_t size;
+    char validator[VALIDATOR_LENGTH];   // ETag, else Last-Modified, of the version being cached; may be empty
+    uint32_t chunk_count;
+    uint32_t prefetch;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // workers wait here for queued chunks
+    pthread_cond_t ready;   // readers wait here for fetched chunks
+    uint8_t *state;
+    uint8_t *attempts;      // failed fetches since the chunk was last asked for
+    uint8_t *touched;       // read at least once in this run
+    uint32_t playhead;
+    uint64_t disk_bytes;    // every chunk under root
+    int stopping;
+    int flushing;
+    UrlCacheStats stats;
+
+    pthread_t *threads;
+    int thread_count;
+    pthread_mutex_t evict_lock;
+
+    // Reader side, one streaming thread at a time.
+    int read_fd;
+    uint32_t read_chunk;
+};
+
+typedef struct _Download {
+    uint8_t *data;
+    size_t capacity;
+    size_t received;
+    uint64_t total_size;    // from Content-Range
+    char etag[VALIDATOR_LENGTH];
+    char last_modified[VALIDATOR_LENGTH];
+} Download;
+
+static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+
+static void curl_init_once(void) {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t fnv1a64(const char *text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (; *text; text++) {
+        hash = (hash ^ (uint8_t)*text) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint32_t chunk_length(const UrlCache *cache, uint32_t index) {
+    uint64_t offset = (uint64_t)index * URL_CACHE_CHUNK;
+    return (uint32_t)(cache->size - offset < URL_CACHE_CHUNK ? cache->size - offset : URL_CACHE_CHUNK);
+}
+
+// Chunks are keyed by their byte range.
+static void chunk_path(const UrlCache *cache, uint32_t index, char *path, size_t size) {
+    snprintf(path, size, "%s/%" PRIu64 "-%u.chunk", cache->url_dir, (uint64_t)index * URL_CACHE_CHUNK,
+             chunk_length(cache, index));
+}
+
+static int make_dirs(const char *path) {
+    char *copy = strdup(path);
+    for (char *p = copy + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(copy, 0755);
+            *p = '/';
+        }
+    }
+    int ok = mkdir(copy, 0755) == 0 || errno == EEXIST;
+    free(copy);
+    return ok;
+}
+
+static int write_file(const char *path, const void *data, size_t length) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.%lu.tmp", path, (unsigned long)pthread_self());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return 0;
+    const uint8_t *bytes = data;
+    size_t written = 0;
+    while (written < length) {
+        ssize_t n = write(fd, bytes + written, length - written);
+        if (n <= 0) break;
+        written += (size_t)n;
+    }
+    close(fd);
+    // The rename is what makes a chunk visible, so a crash never leaves a short one behind.
+    if (written != length || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+// Copies the value of a "Name: value" header line, without the surrounding white space.
+static void header_value(const char *line, size_t length, size_t name_length, char *value, size_t size) {
+    const char *begin = line + name_length, *end = line + length;
+    while (begin < end && (*begin == ' ' || *begin == '\t')) begin++;
+    while (end > begin && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' ')) end--;
+    size_t copied = (size_t)(end - begin) < size - 1 ? (size_t)(end - begin) : size - 1;
+    memcpy(value, begin, copied);
+    value[copied] = '\0';
+}
+
+static size_t header_callback(char *line, size_t size, size_t count, void *user_data) {
+    Download *download = user_data;
+    size_t length = size * count;
+    const char *slash;
+    if (length > 5 && strncmp(line, "HTTP/", 5) == 0) {
+        // A new response, after a redirect: forget the headers of the previous one.
+        download->total_size = 0;
+        download->etag[0] = download->last_modified[0] = '\0';
+    } else if (length > 14 && strncasecmp(line, "Content-Range:", 14) == 0 && (slash = memchr(line, '/', length))) {
+        download->total_size = strtoull(slash + 1, NULL, 10);
+    } else if (length > 5 && strncasecmp(line, "ETag:", 5) == 0) {
+        header_value(line, length, 5, download->etag, sizeof(download->etag));
+    } else if (length > 14 && strncasecmp(line, "Last-Modified:", 14) == 0) {
+        header_value(line, length, 14, download->last_modified, sizeof(download->last_modified));
+    }
+    return length;
+}
+
+// The ETag identifies a version of the resource; Last-Modified is the fallback when there is none.
+static const char *download_validator(const Download *download) {
+    return download->etag[0] ? download->etag : download->last_modified;
+}
+
+static size_t write_callback(char *data, size_t size, size_t count, void *user_data) {
+    Download *download = user_data;
+    size_t length = size * count;
+    if (download->received + length > download->capacity) {
+        return 0; // more than was asked for: the server ignored the range
+    }
+    memcpy(download->data + download->received, data, length);
+    download->received += length;
+    return length;
+}
+
+// Fetches [offset, offset + length) into download; 1 only for a complete 206 response.
+static int fetch_range(CURL *curl, const char *url, uint64_t offset, size_t length, Download *download) {
+    char range[64];
+    long status = 0;
+    snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, offset, offset + length - 1);
+    download->received = 0;
+    download->total_size = 0;
+    download->etag[0] = download->last_modified[0] = '\0';
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 15L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, download);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, download);
+    CURLcode result = curl_easy_perform(curl);
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status == 200) {
+        fprintf(stderr, "url_cache: %s does not support byte ranges\n", url);
+        return 0;
+    }
+    return result == CURLE_OK && status == 206 && download->received == length;
+}
+
+// Gets the size and validator with a one-byte range request.
+static int probe(const char *url, uint64_t *size, char *validator, size_t validator_size) {
+    uint8_t byte;
+    Download download = { &byte, 1, 0, 0, "", "" };
+    CURL *curl = curl_easy_init();
+    int ok = curl && fetch_range(curl, url, 0, 1, &download) && download.total_size > 0;
+    if (curl) curl_easy_cleanup(curl);
+    if (ok) {
+        *size = download.total_size;
+        snprintf(validator, validator_size, "%s", download_validator(&download));
+    }
+    return ok;
+}
+
+// Queues the chunks in the read-ahead window and drops queued ones left behind by a seek.
+// A chunk that failed is fetched again from scratch once a read asks for it.
+static void queue_window(UrlCache *cache, uint32_t index) {
+    if (cache->state[index] == CHUNK_FAILED) {
+        cache->state[index] = CHUNK_ABSENT;
+        cache->attempts[index] = 0;
+    }
+    uint32_t end = index + cache->prefetch < cache->chunk_count ? index + cache->prefetch : cache->chunk_count;
+    for (uint32_t i = 0; i < cache->chunk_count; i++) {
+        int inside = i >= index && i < end;
+        if (inside && cache->state[i] == CHUNK_ABSENT) {
+            cache->state[i] = CHUNK_QUEUED;
+        } else if (!inside && cache->state[i] == CHUNK_QUEUED) {
+            cache->state[i] = CHUNK_ABSENT;
+        }
+    }
+    pthread_cond_broadcast(&cache->work);
+}
+
+// Nearest queued chunk at or after the read position.
+static int64_t next_queued(const UrlCache *cache) {
+    for (uint32_t i = cache->playhead; i < cache->chunk_count; i++) {
+        if (cache->state[i] == CHUNK_QUEUED) return i;
+    }
+    for (uint32_t i = 0; i < cache->playhead; i++) {
+        if (cache->state[i] == CHUNK_QUEUED) return i;
+    }
+    return -1;
+}
+
+typedef struct _CachedFile {
+    char path[1024];
+    uint64_t size;
+    time_t mtime;
+} CachedFile;
+
+static int compare_mtime(const void *a, const void *b) {
+    time_t left = ((const CachedFile *)a)->mtime, right = ((const CachedFile *)b)->mtime;
+    return left < right ? -1 : left > right;
+}
+
+// Lists every chunk under root; the caller frees the array.
+static CachedFile *list_chunks(const char *root, size_t *count, uint64_t *total) {
+    size_t capacity = 256;
+    CachedFile *files = malloc(capacity * sizeof(CachedFile));
+    *count = 0;
+    *total = 0;
+    DIR *top = opendir(root);
+    if (!top) return files;
+    struct dirent *entry;
+    while ((entry = readdir(top))) {
+        if (entry->d_name[0] == '.') continue;
+        char sub[512];
+        snprintf(sub, sizeof(sub), "%s/%s", root, entry->d_name);
+        DIR *dir = opendir(sub);
+        if (!dir) continue;
+        struct dirent *chunk;
+        while ((chunk = readdir(dir))) {
+            size_t length = strlen(chunk->d_name);
+            struct stat info;
+            if (length < 6 || strcmp(chunk->d_name + length - 6, ".chunk") != 0) continue;
+            if (*count == capacity) {
+                capacity *= 2;
+                files = realloc(files, capacity * sizeof(CachedFile));
+            }
+            CachedFile *file = &files[*count];
+            snprintf(file->path, sizeof(file->path), "%s/%s", sub, chunk->d_name);
+            if (stat(file->path, &info) != 0) continue;
+            file->size = (uint64_t)info.st_size;
+            file->mtime = info.st_mtime;
+            *total += file->size;
+            (*count)++;
+        }
+        closedir(dir);
+    }
+    closedir(top);
+    return files;
+}
+
+// Deletes the least recently read chunks until the cache is back under 90% of its bound.
+static void evict(UrlCache *cache) {
+    size_t count;
+    uint64_t total;
+    size_t dir_length = strlen(cache->url_dir);
+
+    pthread_mutex_lock(&cache->evict_lock);
+    CachedFile *files = list_chunks(cache->root, &count, &total);
+    qsort(files, count, sizeof(CachedFile), compare_mtime);
+    uint64_t target = cache->max_bytes / 10 * 9;
+    uint64_t evicted = 0;
+    for (size_t i = 0; i < count && total > target; i++) {
+        if (strncmp(files[i].path, cache->url_dir, dir_length) == 0 && files[i].path[dir_length] == '/') {
+            uint64_t offset = strtoull(files[i].path + dir_length + 1, NULL, 10);
+            uint32_t index = (uint32_t)(offset / URL_CACHE_CHUNK);
+            pthread_mutex_lock(&cache->lock);
+            int keep = index >= cache->playhead && index < cache->playhead + cache->prefetch;
+            if (!keep && index < cache->chunk_count && cache->state[index] == CHUNK_PRESENT) cache->state[index] = CHUNK_ABSENT;
+            pthread_mutex_unlock(&cache->lock);
+            if (keep) continue;
+        }
+        if (unlink(files[i].path) == 0) {
+            total -= files[i].size;
+            evicted += files[i].size;
+        }
+    }
+    free(files);
+    pthread_mutex_lock(&cache->lock);
+    cache->disk_bytes = total;
+    cache->stats.evicted_bytes += evicted;
+    pthread_mutex_unlock(&cache->lock);
+    pthread_mutex_unlock(&cache->evict_lock);
+}
+
+static void *fetch_thread(void *data) {
+    UrlCache *cache = data;
+    CURL *curl = curl_easy_init();
+    Download download = { malloc(URL_CACHE_CHUNK), URL_CACHE_CHUNK, 0, 0, "", "" };
+    char path[1024];
+
+    pthread_mutex_lock(&cache->lock);
+    while (!cache->stopping) {
+        int64_t next = next_queued(cache);
+        if (next < 0 || !curl) {
+            pthread_cond_wait(&cache->work, &cache->lock);
+            continue;
+        }
+        uint32_t index = (uint32_t)next;
+        uint32_t length = chunk_length(cache, index);
+        cache->state[index] = CHUNK_FETCHING;
+        pthread_mutex_unlock(&cache->lock);
+
+        chunk_path(cache, index, path, sizeof(path));
+        int ok = fetch_range(curl, cache->url, (uint64_t)index * URL_CACHE_CHUNK, length, &download);
+        // A range of another version of the resource must not be mixed with the chunks already cached.
+        if (ok && cache->validator[0] && strcmp(download_validator(&download), cache->validator) != 0) {
+            fprintf(stderr, "url_cache: %s changed on the server during playback\n", cache->url);
+            ok = 0;
+        }
+        ok = ok && write_file(path, download.data, length);
+
+        pthread_mutex_lock(&cache->lock);
+        if (ok) {
+            cache->state[index] = CHUNK_PRESENT;
+            cache->stats.chunks_downloaded++;
+            cache->stats.bytes_downloaded += length;
+            cache->disk_bytes += length;
+        } else {
+            cache->stats.fetch_errors++;
+            cache->state[index] = ++cache->attempts[index] >= MAX_FETCH_ATTEMPTS ? CHUNK_FAILED : CHUNK_QUEUED;
+        }
+        pthread_cond_broadcast(&cache->ready);
+        if (!ok) {
+            // Back off before the retry, longer each time, so a network blip is ridden out.
+            uint32_t delay_ms = FETCH_BACKOFF_MS << (cache->attempts[index] - 1);
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += delay_ms / 1000;
+            until.tv_nsec += (long)(delay_ms % 1000) * 1000000;
+            if (until.tv_nsec >= 1000000000) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000;
+            }
+            while (!cache->stopping && pthread_cond_timedwait(&cache->work, &cache->lock, &until) != ETIMEDOUT) {
+            }
+        } else if (cache->disk_bytes > cache->max_bytes) {
+            pthread_mutex_unlock(&cache->lock);
+            evict(cache);
+            pthread_mutex_lock(&cache->lock);
+        }
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    free(download.data);
+    if (curl) curl_easy_cleanup(curl);
+    return NULL;
+}
+
+// Marks this URL's chunks found on disk; anything that does not fit the current size is removed,
+// and everything when the resource has changed since the chunks were stored.
+static void scan_url_dir(UrlCache *cache, int changed) {
+    DIR *dir = opendir(cache->url_dir);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        uint64_t offset;
+        unsigned length;
+        char path[1024];
+        size_t name_length = strlen(entry->d_name);
+        snprintf(path, sizeof(path), "%s/%s", cache->url_dir, entry->d_name);
+        if (name_length > 4 && strcmp(entry->d_name + name_length - 4, ".tmp") == 0) {
+            unlink(path);
+            continue;
+        }
+        if (sscanf(entry->d_name, "%" SCNu64 "-%u.chunk", &offset, &length) != 2) continue;
+        uint32_t index = (uint32_t)(offset / URL_CACHE_CHUNK);
+        struct stat info;
+        if (changed || offset % URL_CACHE_CHUNK != 0 || index >= cache->chunk_count ||
+            length != chunk_length(cache, index) || stat(path, &info) != 0 || (uint64_t)info.st_size != length) {
+            unlink(path);
+            continue;
+        }
+        cache->state[index] = CHUNK_PRESENT;
+        cache->stats.chunks_cached_at_open++;
+    }
+    closedir(dir);
+}
+
+UrlCache *url_cache_open(const char *dir, uint64_t max_bytes, const char *url, int prefetch_chunks, int threads) {
+    char path[1024], text[64], validator[VALIDATOR_LENGTH] = "", stored_validator[VALIDATOR_LENGTH] = "";
+    uint64_t probed = 0, stored = 0;
+    int changed = 0;
+
+    pthread_once(&curl_once, curl_init_once);
+    UrlCache *cache = calloc(1, sizeof(UrlCache));
+    cache->url = strdup(url);
+    cache->root = strdup(dir);
+    cache->prefetch = prefetch_chunks > 0 ? (uint32_t)prefetch_chunks : 1;
+    // The read-ahead window is never evicted, so the bound has to leave room beyond it.
+    cache->max_bytes = max_bytes > 2ull * cache->prefetch * URL_CACHE_CHUNK ? max_bytes : 2ull * cache->prefetch * URL_CACHE_CHUNK;
+    cache->read_fd = -1;
+    snprintf(path, sizeof(path), "%s/%016" PRIx64, dir, fnv1a64(url));
+    cache->url_dir = strdup(path);
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_mutex_init(&cache->evict_lock, NULL);
+    pthread_cond_init(&cache->work, NULL);
+    pthread_cond_init(&cache->ready, NULL);
+
+    if (!make_dirs(cache->url_dir)) {
+        fprintf(stderr, "url_cache: cannot create %s\n", cache->url_dir);
+        url_cache_close(cache);
+        return NULL;
+    }
+
+    // The size and validator from an earlier run let a fully cached URL play offline; if either
+    // has changed, the URL now names a different resource and none of its chunks are kept.
+    snprintf(path, sizeof(path), "%s/validator", cache->url_dir);
+    FILE *file = fopen(path, "r");
+    if (file) {
+        if (!fgets(stored_validator, sizeof(stored_validator), file)) stored_validator[0] = '\0';
+        fclose(file);
+    }
+    snprintf(path, sizeof(path), "%s/size", cache->url_dir);
+    file = fopen(path, "r");
+    if (file) {
+        if (fscanf(file, "%" SCNu64, &stored) != 1) stored = 0;
+        fclose(file);
+    }
+    if (probe(url, &probed, validator, sizeof(validator))) {
+        cache->size = probed;
+        snprintf(cache->validator, sizeof(cache->validator), "%s", validator);
+        if (probed != stored || strcmp(validator, stored_validator) != 0) {
+            changed = stored > 0;
+            snprintf(text, sizeof(text), "%" PRIu64 "\n", probed);
+            write_file(path, text, strlen(text));
+            snprintf(path, sizeof(path), "%s/validator", cache->url_dir);
+            write_file(path, validator, strlen(validator));
+            snprintf(path, sizeof(path), "%s/url", cache->url_dir);
+            write_file(path, url, strlen(url));
+        }
+    } else if (stored > 0) {
+        fprintf(stderr, "url_cache: %s unreachable, playing from cache only\n", url);
+        cache->size = stored;
+        snprintf(cache->validator, sizeof(cache->validator), "%s", stored_validator);
+    } else {
+        fprintf(stderr, "url_cache: cannot get the size of %s\n", url);
+        url_cache_close(cache);
+        return NULL;
+    }
+
+    cache->chunk_count = (uint32_t)((cache->size + URL_CACHE_CHUNK - 1) / URL_CACHE_CHUNK);
+    cache->state = calloc(cache->chunk_count, 1);
+    cache->attempts = calloc(cache->chunk_count, 1);
+    cache->touched = calloc(cache->chunk_count, 1);
+    scan_url_dir(cache, changed);
+
+    size_t count;
+    free(list_chunks(cache->root, &count, &cache->disk_bytes));
+
+    cache->thread_count = threads > 0 ? threads : 1;
+    cache->threads = calloc((size_t)cache->thread_count, sizeof(pthread_t));
+    for (int i = 0; i < cache->thread_count; i++) {
+        pthread_create(&cache->threads[i], NULL, fetch_thread, cache);
+    }
+    // Start on the first window straight away, before the first read asks for it.
+    pthread_mutex_lock(&cache->lock);
+    queue_window(cache, 0);
+    pthread_mutex_unlock(&cache->lock);
+    return cache;
+}
+
+void url_cache_close(UrlCache *cache) {
+    if (!cache) return;
+    pthread_mutex_lock(&cache->lock);
+    cache->stopping = 1;
+    pthread_cond_broadcast(&cache->work);
+    pthread_cond_broadcast(&cache->ready);
+    pthread_mutex_unlock(&cache->lock);
+    for (int i = 0; i < cache->thread_count; i++) {
+        pthread_join(cache->threads[i], NULL);
+    }
+    if (cache->read_fd >= 0) close(cache->read_fd);
+    pthread_mutex_destroy(&cache->lock);
+    pthread_mutex_destroy(&cache->evict_lock);
+    pthread_cond_destroy(&cache->work);
+    pthread_cond_destroy(&cache->ready);
+    free(cache->threads);
+    free(cache->state);
+    free(cache->attempts);
+    free(cache->touched);
+    free(cache->url_dir);
+    free(cache->root);
+    free(cache->url);
+    free(cache);
+}
+
+uint64_t url_cache_size(const UrlCache *cache) {
+    return cache->size;
+}
+
+ssize_t url_cache_read(UrlCache *cache, uint64_t offset, void *buffer, size_t length) {
+    if (offset >= cache->size) return 0;
+    uint32_t index = (uint32_t)(offset / URL_CACHE_CHUNK);
+    char path[1024];
+
+    for (;;) {
+        pthread_mutex_lock(&cache->lock);
+        cache->playhead = index;
+        queue_window(cache, index);
+        if (!cache->touched[index]) {
+            cache->touched[index] = 1;
+            cache->stats.chunks_read++;
+            if (cache->state[index] == CHUNK_PRESENT) cache->stats.chunks_hit++;
+        }
+        if (cache->state[index] != CHUNK_PRESENT && !cache->flushing) {
+            uint64_t start = now_ms();
+            cache->stats.stalls++;
+            while (!cache->stopping && !cache->flushing && cache->state[index] != CHUNK_PRESENT &&
+                   cache->state[index] != CHUNK_FAILED) {
+                pthread_cond_wait(&cache->ready, &cache->lock);
+            }
+            cache->stats.stall_ms += now_ms() - start;
+        }
+        int flushing = cache->flushing;
+        int present = cache->state[index] == CHUNK_PRESENT;
+        pthread_mutex_unlock(&cache->lock);
+        if (flushing) return URL_CACHE_FLUSHING;
+        if (!present) return -1;
+
+        if (cache->read_fd < 0 || cache->read_chunk != index) {
+            if (cache->read_fd >= 0) close(cache->read_fd);
+            chunk_path(cache, index, path, sizeof(path));
+            cache->read_fd = open(path, O_RDONLY);
+            if (cache->read_fd >= 0) {
+                cache->read_chunk = index;
+                futimens(cache->read_fd, NULL); // recently read chunks are evicted last
+            }
+        }
+        if (cache->read_fd >= 0) break;
+
+        // Evicted between the check and the open: fetch it again.
+        pthread_mutex_lock(&cache->lock);
+        if (cache->state[index] == CHUNK_PRESENT) cache->state[index] = CHUNK_ABSENT;
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    uint64_t chunk_offset = offset - (uint64_t)index * URL_CACHE_CHUNK;
+    size_t available = chunk_length(cache, index) - (size_t)chunk_offset;
+    ssize_t n = pread(cache->read_fd, buffer, length < available ? length : available, (off_t)chunk_offset);
+    if (n > 0) {
+        pthread_mutex_lock(&cache->lock);
+        cache->stats.bytes_read += (uint64_t)n;
+        pthread_mutex_unlock(&cache->lock);
+    }
+    return n;
+}
+
+void url_cache_set_flushing(UrlCache *cache, int flushing) {
+    pthread_mutex_lock(&cache->lock);
+    cache->flushing = flushing;
+    pthread_cond_broadcast(&cache->ready);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void url_cache_get_stats(UrlCache *cache, UrlCacheStats *stats) {
+    pthread_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,54 @@
+/*
+    Read-ahead disk cache for URL sources
+    1. A URL is fetched in URL_CACHE_CHUNK byte ranges (HTTP Range requests) by a few
+       worker threads, always nearest to the read position first, and each chunk is
+       stored as its own file under DIR/<url hash>/<offset>-<length>.chunk
+    2. Chunks survive the process: a repeat play reads straight from disk, and a URL
+       whose chunks are all cached plays without touching the network. They are kept only
+       while the size and the ETag (or Last-Modified) the server reports stay the same
+    3. The cache directory is bounded: once it grows past max_bytes the least recently
+       read chunks (of any URL) are deleted, never the ones around the read position
+    4. Plain C and pthreads, so it can be tested without GStreamer
+*/
+
+#ifndef URL_CACHE_H
+#define URL_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define URL_CACHE_CHUNK (1024 * 1024)
+#define URL_CACHE_FLUSHING (-2)
+
+typedef struct _UrlCache UrlCache;
+
+typedef struct _UrlCacheStats {
+    uint64_t chunks_cached_at_open;  // already on disk from an earlier run
+    uint64_t chunks_read;            // distinct chunks asked for
+    uint64_t chunks_hit;             // ready on disk when first asked for
+    uint64_t chunks_downloaded;
+    uint64_t bytes_downloaded;
+    uint64_t bytes_read;
+    uint64_t stalls;                 // reads that had to wait for the network
+    uint64_t stall_ms;
+    uint64_t fetch_errors;
+    uint64_t evicted_bytes;
+} UrlCacheStats;
+
+// Opens url through the cache in dir, probing the size with a one-byte range request
+// unless an earlier run stored it. prefetch_chunks are kept fetched ahead of the read
+// position by threads workers. Returns NULL if the size is unknown or ranges are not supported.
+UrlCache *url_cache_open(const char *dir, uint64_t max_bytes, const char *url, int prefetch_chunks, int threads);
+void url_cache_close(UrlCache *cache);
+
+uint64_t url_cache_size(const UrlCache *cache);
+
+// Blocks until the bytes are available; returns the number copied, 0 at the end, -1 on error,
+// or URL_CACHE_FLUSHING while flushing is set.
+ssize_t url_cache_read(UrlCache *cache, uint64_t offset, void *buffer, size_t length);
+// While set, blocked and new reads return URL_CACHE_FLUSHING at once; prefetching carries on.
+void url_cache_set_flushing(UrlCache *cache, int flushing);
+
+void url_cache_get_stats(UrlCache *cache, UrlCacheStats *stats);
+
+#endif // URL_CACHE_H
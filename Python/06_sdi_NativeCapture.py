@@ -0,0 +1,80 @@
+"""
+    1. Native DeckLink capture -> in-place numpy processing -> Native DeckLink output (no GStreamer, no copies)
+    2. Input[3]: 1080i5994 v210 -> Output[0] 1080i5994 v210, chroma removed (grayscale) like 04_sdi_AppLibrary.py
+    3. Build the pydecklink module first:
+        - cd DeckLink_SDK/build && cmake .. && make pydecklink
+        - PYTHONPATH=../bin/Linux64/<BuildType> python3 ../../Python/06_sdi_NativeCapture.py
+"""
+
+import time
+import logging
+import numpy as np
+
+import pydecklink
+
+logging.basicConfig(level=logging.INFO, format='%(asctime)s - %(levelname)s - %(message)s')
+logger = logging.getLogger(__name__)
+
+# v210 packs 6 pixels into 4 little-endian words of three 10-bit components:
+#   w0 = Cb0 | Y0 << 10 | Cr0 << 20    w1 = Y1  | Cb1 << 10 | Y2 << 20
+#   w2 = Cr1 | Y3 << 10 | Cb2 << 20    w3 = Y4  | Cr2 << 10 | Y5 << 20
+MIDDLE = np.uint32(0x3FF << 10)
+OUTER_NEUTRAL = np.uint32(512 | 512 << 20)
+MIDDLE_NEUTRAL = np.uint32(512 << 10)
+
+frame_count = 0
+fps_start_time = time.time()
+
+def process_frame(frame):
+    global frame_count, fps_start_time
+
+    if not frame.has_signal:
+        return frame
+
+    # Writable view straight over the capture buffer: (height, row_bytes / 4) uint32 v210 words
+    words = np.asarray(frame)
+
+    # Set every Cb/Cr sample to 512, leaving luma untouched
+    words[:, 0::4] &= MIDDLE
+    words[:, 0::4] |= OUTER_NEUTRAL
+    words[:, 2::4] &= MIDDLE
+    words[:, 2::4] |= OUTER_NEUTRAL
+    words[:, 1::4] &= ~MIDDLE
+    words[:, 1::4] |= MIDDLE_NEUTRAL
+    words[:, 3::4] &= ~MIDDLE
+    words[:, 3::4] |= MIDDLE_NEUTRAL
+
+    frame_count += 1
+    current_time = time.time()
+    if current_time - fps_start_time > 1:
+        fps = frame_count / (current_time - fps_start_time)
+        stats = pydecklink.stats()
+        print(f"Current FPS: {fps:.2f} | callback {stats['python.callback_us']} us"
+              f" | binding overhead {stats['python.overhead_us']} us (max {stats['python.overhead_max_us']})"
+              f" | GIL wait {stats['python.gil_wait_us']} us | overruns {stats['python.overruns']}"
+              f" | queue drops {stats['engine.queue_drops']}")
+        fps_start_time = current_time
+        frame_count = 0
+
+    # Returning the frame schedules the same buffer for output by reference
+    return frame
+
+def Native_Pipeline():
+    start_time = time.time()
+
+    engine = pydecklink.Engine(process_frame, input=3, output=0, mode='1080i5994', pixel_format='v210', audio=True)
+    try:
+        with engine:
+            logger.info(f"Capture running at {engine.frame_rate:.2f} fps, press Ctrl+C to stop")
+            engine.wait()
+    except KeyboardInterrupt:
+        logger.info("Interrupted by user")
+    finally:
+        engine.stop()
+
+    logger.info(f"Total runtime: {time.time() - start_time:.1f} s")
+    for name, value in sorted(pydecklink.stats().items()):
+        print(f"{name}: {value}")
+
+if __name__ == "__main__":
+    Native_Pipeline()